@@ -107,12 +107,15 @@
 
 #include <security/audit/audit.h>
 #include <kern/kalloc.h>
+#include <kern/btlog.h>
+#include <kern/clock.h>
 
 #include <mach/machine.h>
 #include <mach/mach_host.h>
 #include <mach/mach_types.h>
 #include <mach/vm_param.h>
 #include <kern/mach_param.h>
+#include <kern/ledger.h>
 #include <kern/task.h>
 #include <kern/thread.h>
 #include <kern/processor.h>
@@ -121,6 +124,7 @@
 #include <vm/vm_kern.h>
 #include <vm/vm_map.h>
 #include <mach/host_info.h>
+#include <mach_debug/zone_info.h>
 
 #include <sys/mount_internal.h>
 #include <sys/kdebug.h>
@@ -136,6 +140,11 @@
 #include <vm/vm_compressor_algorithms.h>
 #include <sys/imgsrc.h>
 #include <kern/timer_call.h>
+#include <kern/thread_call.h>
+#include <kern/cpu_number.h>
+#include <os/log.h>
+#include <libkern/OSAtomic.h>
+#include <libkern/OSDebug.h>
 
 #if defined(__i386__) || defined(__x86_64__)
 #include <i386/cpuid.h>
@@ -470,6 +479,134 @@ sysctl_sched_stats_enable(__unused struct sysctl_oid *oidp, __unused void *arg1,
 
 SYSCTL_PROC(_kern, OID_AUTO, sched_stats_enable, CTLFLAG_LOCKED | CTLFLAG_WR, 0, 0, sysctl_sched_stats_enable, "-", "");
 
+/*
+ * Per-processor run queue depth histograms, load averages and wait time
+ * percentiles, collected while kern.sched_stats_enable is set.
+ */
+STATIC int
+sysctl_sched_runq_stats(__unused struct sysctl_oid *oidp, __unused void *arg1, __unused int arg2, struct sysctl_req *req)
+{
+	host_basic_info_data_t hinfo;
+	kern_return_t kret;
+	uint32_t size;
+	mach_msg_type_number_t count = HOST_BASIC_INFO_COUNT;
+	struct _processor_runq_stats_np *buf;
+	int error;
+
+	kret = host_info((host_t)BSD_HOST, HOST_BASIC_INFO, (host_info_t)&hinfo, &count);
+	if (kret != KERN_SUCCESS) {
+		return EINVAL;
+	}
+
+	/* One per processor, and one per processor set, of which there are no more than processors */
+	size = sizeof(struct _processor_runq_stats_np) * (hinfo.logical_cpu_max * 2);
+
+	if (req->oldptr == USER_ADDR_NULL) {
+		req->oldidx = size;
+		return 0;
+	}
+
+	MALLOC(buf, struct _processor_runq_stats_np*, size, M_TEMP, M_ZERO | M_WAITOK);
+
+	kret = get_sched_runq_statistics(buf, &size);
+	if (kret != KERN_SUCCESS) {
+		error = EINVAL;
+		goto out;
+	}
+
+	error = SYSCTL_OUT(req, buf, size);
+out:
+	FREE(buf, M_TEMP);
+	return error;
+}
+
+SYSCTL_PROC(_kern, OID_AUTO, sched_runq_stats, CTLTYPE_STRUCT | CTLFLAG_RD | CTLFLAG_LOCKED, 0, 0, sysctl_sched_runq_stats, "S", "");
+
+/*
+ * Per-processor migration and cache-hot dispatch counts, collected while
+ * kern.sched_stats_enable is set.
+ */
+STATIC int
+sysctl_sched_cache_stats(__unused struct sysctl_oid *oidp, __unused void *arg1, __unused int arg2, struct sysctl_req *req)
+{
+	host_basic_info_data_t hinfo;
+	kern_return_t kret;
+	uint32_t size;
+	mach_msg_type_number_t count = HOST_BASIC_INFO_COUNT;
+	struct _processor_cache_stats_np *buf;
+	int error;
+
+	kret = host_info((host_t)BSD_HOST, HOST_BASIC_INFO, (host_info_t)&hinfo, &count);
+	if (kret != KERN_SUCCESS) {
+		return EINVAL;
+	}
+
+	size = sizeof(struct _processor_cache_stats_np) * hinfo.logical_cpu_max;
+
+	if (req->oldptr == USER_ADDR_NULL) {
+		req->oldidx = size;
+		return 0;
+	}
+
+	MALLOC(buf, struct _processor_cache_stats_np*, size, M_TEMP, M_ZERO | M_WAITOK);
+
+	kret = get_sched_cache_statistics(buf, &size);
+	if (kret != KERN_SUCCESS) {
+		error = EINVAL;
+		goto out;
+	}
+
+	error = SYSCTL_OUT(req, buf, size);
+out:
+	FREE(buf, M_TEMP);
+	return error;
+}
+
+SYSCTL_PROC(_kern, OID_AUTO, sched_cache_stats, CTLTYPE_STRUCT | CTLFLAG_RD | CTLFLAG_LOCKED, 0, 0, sysctl_sched_cache_stats, "S", "");
+
+extern uint32_t zsample_rate;
+extern unsigned int zsample_export_count(void);
+extern unsigned int zsample_export(zsample_site_info_t *sites, unsigned int max_sites);
+
+SYSCTL_UINT(_kern, OID_AUTO, zsample_rate, CTLFLAG_RD | CTLFLAG_LOCKED, &zsample_rate, 0, "");
+
+/*
+ * Live allocation sites of the sampling allocation profiler (zsample=1 boot-arg).
+ */
+static int
+sysctl_zsample_sites(__unused struct sysctl_oid *oidp, __unused void *arg1, __unused int arg2, struct sysctl_req *req)
+{
+	zsample_site_info_t *buf;
+	unsigned int count;
+	uint32_t size;
+	int error;
+
+	if (!kauth_cred_issuser(kauth_cred_get())) {
+		return EPERM;
+	}
+
+	count = zsample_export_count();
+	size = count * sizeof(zsample_site_info_t);
+
+	if (req->oldptr == USER_ADDR_NULL) {
+		req->oldidx = size;
+		return 0;
+	}
+	if (count == 0) {
+		return 0;
+	}
+
+	MALLOC(buf, zsample_site_info_t *, size, M_TEMP, M_ZERO | M_WAITOK);
+
+	count = zsample_export(buf, count);
+	error = SYSCTL_OUT(req, buf, count * sizeof(zsample_site_info_t));
+
+	FREE(buf, M_TEMP);
+	return error;
+}
+
+SYSCTL_PROC(_kern, OID_AUTO, zsample_sites, CTLTYPE_STRUCT | CTLFLAG_RD | CTLFLAG_LOCKED, 0, 0, sysctl_zsample_sites, "S", "");
+
 extern uint32_t sched_debug_flags;
 SYSCTL_INT(_debug, OID_AUTO, sched, CTLFLAG_RW | CTLFLAG_LOCKED, &sched_debug_flags, 0, "scheduler debug");
 
@@ -1770,6 +1907,46 @@ SYSCTL_INT(_kern, OID_AUTO, sched_smt_balance,
                &sched_smt_balance, 0, "");
 #endif
 
+/*
+ * Window, in microseconds, after a thread last ran during which the
+ * scheduler keeps it in its last processor set.  0 disables it.
+ */
+STATIC int
+sysctl_sched_cache_hot_us
+(__unused struct sysctl_oid *oidp, __unused void *arg1, __unused int arg2, struct sysctl_req *req)
+{
+	int new_value, changed;
+	int error = sysctl_io_number(req, sched_cache_hot_us, sizeof(int), &new_value, &changed);
+	if (changed) {
+		if (new_value >= 0 && (uint64_t)new_value <= USEC_PER_SEC) {
+			sched_cache_hot_us = new_value;
+			sched_cache_hot_window_init();
+		} else
+			error = EINVAL;
+	}
+	return(error);
+}
+
+SYSCTL_PROC(_kern, OID_AUTO, sched_cache_hot_us,
+		CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_LOCKED,
+		0, 0, sysctl_sched_cache_hot_us, "I", "");
+
+/*
+ * Nonzero admits THREAD_TIME_CONSTRAINT_POLICY requests only while the
+ * realtime threads' utilization fits on the available processors.
+ */
+SYSCTL_UINT(_kern, OID_AUTO, sched_rt_edf_admission,
+		CTLFLAG_RW | CTLFLAG_LOCKED,
+		&sched_rt_edf_admission, 0, "");
+
+/*
+ * Nonzero makes ulock_wake() and semaphore_signal() switch directly
+ * to the thread they wake.
+ */
+SYSCTL_UINT(_kern, OID_AUTO, sched_wake_handoff,
+		CTLFLAG_RW | CTLFLAG_LOCKED,
+		&sched_wake_handoff, 0, "");
+
 STATIC int
 sysctl_securelvl
 (__unused struct sysctl_oid *oidp, __unused void *arg1, __unused int arg2, struct sysctl_req *req)
@@ -2083,7 +2260,7 @@ SYSCTL_NODE(_kern_timer, OID_AUTO, longterm, CTLFLAG_RW | CTLFLAG_LOCKED, 0, "lo
 enum {
 	THRESHOLD, QCOUNT,
 	ENQUEUES, DEQUEUES, ESCALATES, SCANS, PREEMPTS,
-	LATENCY, LATENCY_MIN, LATENCY_MAX
+	LATENCY, LATENCY_MIN, LATENCY_MAX, CASCADES
 };
 extern uint64_t	timer_sysctl_get(int);
 extern int      timer_sysctl_set(int, uint64_t);
@@ -2136,6 +2313,9 @@ SYSCTL_PROC(_kern_timer_longterm, OID_AUTO, latency_min,
 SYSCTL_PROC(_kern_timer_longterm, OID_AUTO, latency_max,
 		CTLTYPE_QUAD | CTLFLAG_RD | CTLFLAG_LOCKED,
 		(void *) LATENCY_MAX, 0, sysctl_timer, "Q", "");
+SYSCTL_PROC(_kern_timer_longterm, OID_AUTO, cascades,
+		CTLTYPE_QUAD | CTLFLAG_RD | CTLFLAG_LOCKED,
+		(void *) CASCADES, 0, sysctl_timer, "Q", "");
 #endif /* DEBUG */
 
 STATIC int
@@ -2821,7 +3001,7 @@ extern uint32_t oslog_p_total_msgcount;
 extern uint32_t oslog_p_metadata_saved_msgcount;
 extern uint32_t oslog_p_metadata_dropped_msgcount;
 extern uint32_t oslog_p_error_count;
-extern uint32_t oslog_p_saved_msgcount;
+extern uint32_t oslog_p_saved_msgcount_read(void);
 extern uint32_t oslog_p_dropped_msgcount;
 extern uint32_t oslog_p_boot_dropped_msgcount;
 
@@ -2836,7 +3016,16 @@ SYSCTL_UINT(_debug, OID_AUTO, oslog_p_total_msgcount, CTLFLAG_ANYBODY | CTLFLAG_
 SYSCTL_UINT(_debug, OID_AUTO, oslog_p_metadata_saved_msgcount, CTLFLAG_ANYBODY | CTLFLAG_RD | CTLFLAG_LOCKED, &oslog_p_metadata_saved_msgcount, 0, "");
 SYSCTL_UINT(_debug, OID_AUTO, oslog_p_metadata_dropped_msgcount, CTLFLAG_ANYBODY | CTLFLAG_RD | CTLFLAG_LOCKED, &oslog_p_metadata_dropped_msgcount, 0, "");
 SYSCTL_UINT(_debug, OID_AUTO, oslog_p_error_count, CTLFLAG_ANYBODY | CTLFLAG_RD | CTLFLAG_LOCKED, &oslog_p_error_count, 0, "");
-SYSCTL_UINT(_debug, OID_AUTO, oslog_p_saved_msgcount, CTLFLAG_ANYBODY | CTLFLAG_RD | CTLFLAG_LOCKED, &oslog_p_saved_msgcount, 0, "");
+
+static int
+sysctl_oslog_p_saved_msgcount SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1, arg2)
+	uint32_t count = oslog_p_saved_msgcount_read();
+	return SYSCTL_OUT(req, &count, sizeof(count));
+}
+
+SYSCTL_PROC(_debug, OID_AUTO, oslog_p_saved_msgcount, CTLTYPE_INT | CTLFLAG_ANYBODY | CTLFLAG_RD | CTLFLAG_LOCKED, 0, 0, sysctl_oslog_p_saved_msgcount, "IU", "");
 SYSCTL_UINT(_debug, OID_AUTO, oslog_p_dropped_msgcount, CTLFLAG_ANYBODY | CTLFLAG_RD | CTLFLAG_LOCKED, &oslog_p_dropped_msgcount, 0, "");
 SYSCTL_UINT(_debug, OID_AUTO, oslog_p_boot_dropped_msgcount, CTLFLAG_ANYBODY | CTLFLAG_RD | CTLFLAG_LOCKED, &oslog_p_boot_dropped_msgcount, 0, "");
 
@@ -2846,9 +3035,477 @@ SYSCTL_UINT(_debug, OID_AUTO, oslog_s_error_count, CTLFLAG_ANYBODY | CTLFLAG_RD
 SYSCTL_UINT(_debug, OID_AUTO, oslog_s_streamed_msgcount, CTLFLAG_ANYBODY | CTLFLAG_RD | CTLFLAG_LOCKED, &oslog_s_streamed_msgcount, 0, "");
 SYSCTL_UINT(_debug, OID_AUTO, oslog_s_dropped_msgcount, CTLFLAG_ANYBODY | CTLFLAG_RD | CTLFLAG_LOCKED, &oslog_s_dropped_msgcount, 0, "");
 
+/*
+ * Emit the given number of os_log messages from the calling thread, so
+ * contention in the logging path can be measured from user space.
+ */
+static int
+sysctl_oslog_stress SYSCTL_HANDLER_ARGS
+{
+#pragma unused(arg1, arg2)
+	int count = 0;
+	int error = sysctl_handle_int(oidp, &count, 0, req);
+	if (error || !req->newptr) {
+		return error;
+	}
+	if (count < 0 || count > 100000) {
+		return EINVAL;
+	}
+
+	for (int i = 0; i < count; i++) {
+		os_log(OS_LOG_DEFAULT, "oslog stress %d of %d on cpu %d", i, count, cpu_number());
+	}
+	return 0;
+}
+
+SYSCTL_PROC(_debug, OID_AUTO, oslog_stress, CTLTYPE_INT | CTLFLAG_WR | CTLFLAG_LOCKED, 0, 0, sysctl_oslog_stress, "I", "");
+
+#define ZALLOC_STRESS_SIZE	64
+#define ZALLOC_STRESS_BATCH	32
+
+/*
+ * Allocate and free the given number of small kalloc elements, a batch at
+ * a time, so zone lock contention can be measured from user space.
+ */
+static int
+sysctl_zalloc_stress SYSCTL_HANDLER_ARGS
+{
+#pragma unused(arg1, arg2)
+	void *elems[ZALLOC_STRESS_BATCH];
+	int count = 0;
+	int error = sysctl_handle_int(oidp, &count, 0, req);
+	if (error || !req->newptr) {
+		return error;
+	}
+	if (count < 0 || count > 10000000) {
+		return EINVAL;
+	}
+
+	while (count > 0) {
+		int batch = MIN(count, ZALLOC_STRESS_BATCH);
+
+		for (int i = 0; i < batch; i++) {
+			elems[i] = kalloc(ZALLOC_STRESS_SIZE);
+		}
+		for (int i = 0; i < batch; i++) {
+			if (elems[i] != NULL) {
+				kfree(elems[i], ZALLOC_STRESS_SIZE);
+			}
+		}
+		count -= batch;
+	}
+	return 0;
+}
+
+SYSCTL_PROC(_debug, OID_AUTO, zalloc_stress, CTLTYPE_INT | CTLFLAG_WR | CTLFLAG_LOCKED, 0, 0, sysctl_zalloc_stress, "I", "");
+
+#define BTLOG_STRESS_RECORDS	4096
+#define BTLOG_STRESS_DEPTH	15
+#define BTLOG_STRESS_STACKS	64
+
+static btlog_t *btlog_stress_log;
+
+/*
+ * Log and remove the given number of allocations in a leaks-mode btlog,
+ * a batch of ZALLOC_STRESS_BATCH at a time, cycling through
+ * BTLOG_STRESS_STACKS distinct stacks, the way zone logging does.
+ */
+static int
+sysctl_btlog_stress SYSCTL_HANDLER_ARGS
+{
+#pragma unused(arg1, arg2)
+	void *bt[BTLOG_STRESS_DEPTH];
+	uintptr_t base = (uintptr_t)current_thread();
+	btlog_t *log;
+	size_t depth;
+	int count = 0;
+	int error = sysctl_handle_int(oidp, &count, 0, req);
+	if (error || !req->newptr) {
+		return error;
+	}
+	if (count < 0 || count > 10000000) {
+		return EINVAL;
+	}
+
+	log = btlog_stress_log;
+	if (log == NULL) {
+		log = btlog_create(BTLOG_STRESS_RECORDS, BTLOG_STRESS_DEPTH, TRUE);
+		if (log == NULL) {
+			return ENOMEM;
+		}
+		if (!OSCompareAndSwapPtr(NULL, log, (void * volatile *)&btlog_stress_log)) {
+			btlog_destroy(log);
+			log = btlog_stress_log;
+		}
+	}
+
+	depth = OSBacktrace(bt, BTLOG_STRESS_DEPTH);
+	if (depth == 0) {
+		return EINVAL;
+	}
+
+	for (int done = 0; done < count; ) {
+		int batch = MIN(count - done, ZALLOC_STRESS_BATCH);
+
+		for (int i = 0; i < batch; i++) {
+			bt[0] = (void *)(uintptr_t)((done + i) % BTLOG_STRESS_STACKS + 1);
+			btlog_add_entry(log, (void *)(base + i * sizeof(void *)), 1, bt, depth);
+		}
+		for (int i = 0; i < batch; i++) {
+			btlog_remove_entries_for_element(log, (void *)(base + i * sizeof(void *)));
+		}
+		done += batch;
+	}
+	return 0;
+}
+
+SYSCTL_PROC(_debug, OID_AUTO, btlog_stress, CTLTYPE_INT | CTLFLAG_WR | CTLFLAG_LOCKED, 0, 0, sysctl_btlog_stress, "I", "");
+
+/*
+ * Thundering herd benchmark: threads sleep on one event waiting for
+ * tokens, and a poster hands out tokens one at a time, waking either
+ * every sleeper or just one for each.
+ */
+static volatile UInt32 waitq_herd_tokens;
+
+#define WAITQ_HERD_TIMEOUT_NS	(1 * NSEC_PER_SEC)
+
+static int
+sysctl_waitq_herd_wait SYSCTL_HANDLER_ARGS
+{
+#pragma unused(arg1, arg2)
+	int count = 0;
+	int error = sysctl_handle_int(oidp, &count, 0, req);
+	if (error || !req->newptr) {
+		return error;
+	}
+	if (count < 0 || count > 10000000) {
+		return EINVAL;
+	}
+
+	while (count > 0) {
+		UInt32 tokens = waitq_herd_tokens;
+
+		if (tokens != 0) {
+			if (OSCompareAndSwap(tokens, tokens - 1, &waitq_herd_tokens)) {
+				count--;
+			}
+			continue;
+		}
+
+		assert_wait((event_t)&waitq_herd_tokens, THREAD_INTERRUPTIBLE);
+		if (waitq_herd_tokens != 0) {
+			clear_wait(current_thread(), THREAD_AWAKENED);
+			continue;
+		}
+		if (thread_block(THREAD_CONTINUE_NULL) == THREAD_INTERRUPTED) {
+			return EINTR;
+		}
+	}
+	return 0;
+}
+
+SYSCTL_PROC(_debug, OID_AUTO, waitq_herd_wait, CTLTYPE_INT | CTLFLAG_WR | CTLFLAG_LOCKED, 0, 0, sysctl_waitq_herd_wait, "I", "");
+
+static int
+sysctl_waitq_herd_wake SYSCTL_HANDLER_ARGS
+{
+#pragma unused(arg1)
+	boolean_t wake_one = (arg2 != 0);
+	uint64_t timeout;
+	int count = 0;
+	int error = sysctl_handle_int(oidp, &count, 0, req);
+	if (error || !req->newptr) {
+		return error;
+	}
+	if (count < 0 || count > 10000000) {
+		return EINVAL;
+	}
+
+	nanoseconds_to_absolutetime(WAITQ_HERD_TIMEOUT_NS, &timeout);
+
+	for (int i = 0; i < count; i++) {
+		uint64_t deadline = mach_absolute_time() + timeout;
+
+		OSIncrementAtomic((volatile SInt32 *)&waitq_herd_tokens);
+		if (wake_one) {
+			thread_wakeup_one((event_t)&waitq_herd_tokens);
+		} else {
+			thread_wakeup((event_t)&waitq_herd_tokens);
+		}
+
+		/* hand out the next token only once this one is taken */
+		while (waitq_herd_tokens != 0) {
+			if (mach_absolute_time() > deadline) {
+				waitq_herd_tokens = 0;
+				return ETIMEDOUT;
+			}
+			thread_yield_internal(1);
+		}
+	}
+	return 0;
+}
+
+SYSCTL_PROC(_debug, OID_AUTO, waitq_herd_wake_all, CTLTYPE_INT | CTLFLAG_WR | CTLFLAG_LOCKED, 0, 0, sysctl_waitq_herd_wake, "I", "");
+SYSCTL_PROC(_debug, OID_AUTO, waitq_herd_wake_one, CTLTYPE_INT | CTLFLAG_WR | CTLFLAG_LOCKED, 0, 1, sysctl_waitq_herd_wake, "I", "");
+
+/*
+ * Mutex contention benchmark: every caller takes one shared mutex 'count'
+ * times and holds it for lck_mtx_contend_hold_ns each time.
+ */
+static lck_mtx_t *lck_mtx_contend_mtx;
+static int lck_mtx_contend_hold_ns = 500;
+
+SYSCTL_INT(_debug, OID_AUTO, lck_mtx_contend_hold_ns, CTLFLAG_RW | CTLFLAG_LOCKED,
+	   &lck_mtx_contend_hold_ns, 0, "");
+
+static int
+sysctl_lck_mtx_contend SYSCTL_HANDLER_ARGS
+{
+#pragma unused(arg1, arg2)
+	lck_mtx_t *mtx;
+	uint64_t hold;
+	int count = 0;
+	int error = sysctl_handle_int(oidp, &count, 0, req);
+	if (error || !req->newptr) {
+		return error;
+	}
+	if (count < 0 || count > 10000000) {
+		return EINVAL;
+	}
+	if (lck_mtx_contend_hold_ns < 0 || lck_mtx_contend_hold_ns > 1000000) {
+		return EINVAL;
+	}
+
+	mtx = lck_mtx_contend_mtx;
+	if (mtx == NULL) {
+		lck_grp_t *grp = lck_grp_alloc_init("lck_mtx_contend", LCK_GRP_ATTR_NULL);
+
+		mtx = lck_mtx_alloc_init(grp, LCK_ATTR_NULL);
+		if (!OSCompareAndSwapPtr(NULL, mtx, (void * volatile *)&lck_mtx_contend_mtx)) {
+			lck_mtx_free(mtx, grp);
+			lck_grp_free(grp);
+			mtx = lck_mtx_contend_mtx;
+		}
+	}
+
+	nanoseconds_to_absolutetime((uint64_t)lck_mtx_contend_hold_ns, &hold);
+
+	for (int i = 0; i < count; i++) {
+		lck_mtx_lock(mtx);
+		if (hold != 0) {
+			uint64_t deadline = mach_absolute_time() + hold;
+
+			while (mach_absolute_time() < deadline) {
+				continue;
+			}
+		}
+		lck_mtx_unlock(mtx);
+	}
+	return 0;
+}
+
+SYSCTL_PROC(_debug, OID_AUTO, lck_mtx_contend, CTLTYPE_INT | CTLFLAG_WR | CTLFLAG_LOCKED, 0, 0, sysctl_lck_mtx_contend, "I", "");
+
+/*
+ * Timer churn benchmark: arm a pool of timer calls, then cancel and re-arm
+ * them at pseudo-random deadlines 'count' times. Short deadlines stay on
+ * the per-cpu queues; long ones go to the longterm queue.
+ */
+#define TIMER_CALL_CHURN_POOL	16384
+
+static timer_call_data_t *timer_call_churn_pool;
+static volatile UInt32 timer_call_churn_busy;
+static volatile SInt64 timer_call_churn_fired;
+
+static void
+timer_call_churn_fire(__unused timer_call_param_t p0, __unused timer_call_param_t p1)
+{
+	OSIncrementAtomic64(&timer_call_churn_fired);
+}
+
+static int
+sysctl_timer_call_churn SYSCTL_HANDLER_ARGS
+{
+#pragma unused(arg1)
+	boolean_t longterm = (arg2 != 0);
+	uint64_t min_ns = longterm ? 2 * NSEC_PER_SEC : 200 * NSEC_PER_MSEC;
+	uint64_t range_ns = longterm ? 3598 * NSEC_PER_SEC : 700 * NSEC_PER_MSEC;
+	uint32_t seed = 1;
+	int count = 0;
+	int error = sysctl_handle_int(oidp, &count, 0, req);
+	if (error || !req->newptr) {
+		return error;
+	}
+	if (count < 0 || count > 10000000) {
+		return EINVAL;
+	}
+	if (!OSCompareAndSwap(0, 1, &timer_call_churn_busy)) {
+		return EBUSY;
+	}
+
+	/* the pool is never freed: a cancelled timer may still be firing */
+	if (timer_call_churn_pool == NULL) {
+		timer_call_churn_pool = kalloc(TIMER_CALL_CHURN_POOL * sizeof(timer_call_data_t));
+		if (timer_call_churn_pool == NULL) {
+			timer_call_churn_busy = 0;
+			return ENOMEM;
+		}
+		for (int i = 0; i < TIMER_CALL_CHURN_POOL; i++) {
+			timer_call_setup(&timer_call_churn_pool[i], timer_call_churn_fire, NULL);
+		}
+	}
+
+	for (int i = 0; i < TIMER_CALL_CHURN_POOL + count; i++) {
+		timer_call_t call = &timer_call_churn_pool[i % TIMER_CALL_CHURN_POOL];
+		uint64_t interval;
+
+		seed = seed * 1103515245 + 12345;
+		nanoseconds_to_absolutetime(min_ns + range_ns * (seed >> 16) / 65536, &interval);
+		if (i >= TIMER_CALL_CHURN_POOL) {
+			timer_call_cancel(call);
+		}
+		timer_call_enter(call, mach_absolute_time() + interval, TIMER_CALL_SYS_NORMAL);
+	}
+
+	for (int i = 0; i < TIMER_CALL_CHURN_POOL; i++) {
+		timer_call_cancel(&timer_call_churn_pool[i]);
+	}
+
+	timer_call_churn_busy = 0;
+	return 0;
+}
+
+SYSCTL_PROC(_debug, OID_AUTO, timer_call_churn_short, CTLTYPE_INT | CTLFLAG_WR | CTLFLAG_LOCKED, 0, 0, sysctl_timer_call_churn, "I", "");
+SYSCTL_PROC(_debug, OID_AUTO, timer_call_churn_long, CTLTYPE_INT | CTLFLAG_WR | CTLFLAG_LOCKED, 0, 1, sysctl_timer_call_churn, "I", "");
+SYSCTL_QUAD(_debug, OID_AUTO, timer_call_churn_fired, CTLFLAG_RD | CTLFLAG_LOCKED,
+	    (uint64_t *)&timer_call_churn_fired, "");
+
+/*
+ * Thread call throughput benchmark: enter 'count' short thread calls of the
+ * priority given by arg2, spread over a small set of calls, then wait for
+ * the last of them to finish.
+ */
+#define THREAD_CALL_CHURN_CALLS	64
+
+static volatile SInt64 thread_call_churn_fired;
+
+static void
+thread_call_churn_fire(__unused thread_call_param_t p0, __unused thread_call_param_t p1)
+{
+	OSIncrementAtomic64(&thread_call_churn_fired);
+}
+
+static int
+sysctl_thread_call_churn SYSCTL_HANDLER_ARGS
+{
+#pragma unused(arg1)
+	thread_call_t calls[THREAD_CALL_CHURN_CALLS];
+	int count = 0;
+	int error = sysctl_handle_int(oidp, &count, 0, req);
+	if (error || !req->newptr) {
+		return error;
+	}
+	if (count < 0 || count > 10000000) {
+		return EINVAL;
+	}
+
+	for (int i = 0; i < THREAD_CALL_CHURN_CALLS; i++) {
+		calls[i] = thread_call_allocate_with_priority(thread_call_churn_fire, NULL,
+		    (thread_call_priority_t)arg2);
+	}
+
+	for (int i = 0; i < count; i++) {
+		thread_call_enter(calls[i % THREAD_CALL_CHURN_CALLS]);
+	}
+
+	for (int i = 0; i < THREAD_CALL_CHURN_CALLS; i++) {
+		while (thread_call_isactive(calls[i])) {
+			thread_yield_internal(1);
+		}
+		thread_call_free(calls[i]);
+	}
+	return 0;
+}
+
+SYSCTL_PROC(_debug, OID_AUTO, thread_call_churn_high, CTLTYPE_INT | CTLFLAG_WR | CTLFLAG_LOCKED,
+	    0, THREAD_CALL_PRIORITY_HIGH, sysctl_thread_call_churn, "I", "");
+SYSCTL_PROC(_debug, OID_AUTO, thread_call_churn_kernel, CTLTYPE_INT | CTLFLAG_WR | CTLFLAG_LOCKED,
+	    0, THREAD_CALL_PRIORITY_KERNEL, sysctl_thread_call_churn, "I", "");
+SYSCTL_PROC(_debug, OID_AUTO, thread_call_churn_user, CTLTYPE_INT | CTLFLAG_WR | CTLFLAG_LOCKED,
+	    0, THREAD_CALL_PRIORITY_USER, sysctl_thread_call_churn, "I", "");
+SYSCTL_QUAD(_debug, OID_AUTO, thread_call_churn_fired, CTLFLAG_RD | CTLFLAG_LOCKED,
+	    (uint64_t *)&thread_call_churn_fired, "");
+
+/*
+ * Ledger update benchmark: credit and debit one page to an entry of the
+ * caller's task ledger 'count' times.  arg2 selects the entry: phys_mem is
+ * updated through per-CPU deltas, wired_mem directly.
+ */
+static int
+sysctl_ledger_hammer SYSCTL_HANDLER_ARGS
+{
+#pragma unused(arg1)
+	ledger_t ledger = get_task_ledger(current_task());
+	int entry = arg2 ? task_ledgers.phys_mem : task_ledgers.wired_mem;
+	int count = 0;
+	int error = sysctl_handle_int(oidp, &count, 0, req);
+	if (error || !req->newptr) {
+		return error;
+	}
+	if (count < 0 || count > 10000000) {
+		return EINVAL;
+	}
+
+	for (int i = 0; i < count; i++) {
+		ledger_credit(ledger, entry, PAGE_SIZE);
+		ledger_debit(ledger, entry, PAGE_SIZE);
+	}
+	return 0;
+}
+
+SYSCTL_PROC(_debug, OID_AUTO, ledger_hammer_percpu, CTLTYPE_INT | CTLFLAG_WR | CTLFLAG_LOCKED,
+	    0, 1, sysctl_ledger_hammer, "I", "");
+SYSCTL_PROC(_debug, OID_AUTO, ledger_hammer_direct, CTLTYPE_INT | CTLFLAG_WR | CTLFLAG_LOCKED,
+	    0, 0, sysctl_ledger_hammer, "I", "");
+
 
 #endif /* DEVELOPMENT || DEBUG */
 
+/*
+ * Contended mutex spin outcomes; arg2 is the offset of the counter
+ * within struct lck_mtx_spin_stats.
+ */
+static int
+sysctl_lck_mtx_spin_stats SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1)
+	struct lck_mtx_spin_stats stats;
+	uint64_t value;
+
+	lck_mtx_spin_stats_get(&stats);
+	value = *(uint64_t *)((uintptr_t)&stats + arg2);
+
+	return SYSCTL_OUT(req, &value, sizeof(value));
+}
+
+SYSCTL_NODE(_kern, OID_AUTO, lck_mtx_spin, CTLFLAG_RD | CTLFLAG_LOCKED, 0, "contended mutex spinning");
+
+SYSCTL_PROC(_kern_lck_mtx_spin, OID_AUTO, spins, CTLTYPE_QUAD | CTLFLAG_RD | CTLFLAG_LOCKED,
+	    0, offsetof(struct lck_mtx_spin_stats, spins), sysctl_lck_mtx_spin_stats, "Q", "contended acquisitions that spun");
+SYSCTL_PROC(_kern_lck_mtx_spin, OID_AUTO, acquired, CTLTYPE_QUAD | CTLFLAG_RD | CTLFLAG_LOCKED,
+	    0, offsetof(struct lck_mtx_spin_stats, acquired), sysctl_lck_mtx_spin_stats, "Q", "spins that acquired the mutex");
+SYSCTL_PROC(_kern_lck_mtx_spin, OID_AUTO, timeouts, CTLTYPE_QUAD | CTLFLAG_RD | CTLFLAG_LOCKED,
+	    0, offsetof(struct lck_mtx_spin_stats, timeouts), sysctl_lck_mtx_spin_stats, "Q", "spins that ran out of budget");
+SYSCTL_PROC(_kern_lck_mtx_spin, OID_AUTO, owner_offcore, CTLTYPE_QUAD | CTLFLAG_RD | CTLFLAG_LOCKED,
+	    0, offsetof(struct lck_mtx_spin_stats, owner_offcore), sysctl_lck_mtx_spin_stats, "Q", "spins stopped because the owner was not running");
+SYSCTL_PROC(_kern_lck_mtx_spin, OID_AUTO, short_budget, CTLTYPE_QUAD | CTLFLAG_RD | CTLFLAG_LOCKED,
+	    0, offsetof(struct lck_mtx_spin_stats, short_budget), sysctl_lck_mtx_spin_stats, "Q", "spins given a reduced budget");
+SYSCTL_PROC(_kern_lck_mtx_spin, OID_AUTO, recovery_probes, CTLTYPE_QUAD | CTLFLAG_RD | CTLFLAG_LOCKED,
+	    0, offsetof(struct lck_mtx_spin_stats, recovery_probes), sysctl_lck_mtx_spin_stats, "Q", "spins on a demoted mutex given the full budget");
+SYSCTL_PROC(_kern_lck_mtx_spin, OID_AUTO, spin_time_ns, CTLTYPE_QUAD | CTLFLAG_RD | CTLFLAG_LOCKED,
+	    0, offsetof(struct lck_mtx_spin_stats, spin_time), sysctl_lck_mtx_spin_stats, "Q", "time spent spinning");
+
 /*
  * Enable tracing of voucher contents
  */
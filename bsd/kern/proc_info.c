@@ -57,7 +57,9 @@
 #include <mach/mach_types.h>
 #include <mach/vm_param.h>
 #include <kern/task.h>
+#include <kern/clock.h>
 #include <kern/kalloc.h>
+#include <kern/kern_cdata.h>
 #include <kern/assert.h>
 #include <kern/policy_internal.h>
 
@@ -103,6 +105,8 @@ uint64_t get_dispatchqueue_offset_from_proc(void *);
 uint64_t get_dispatchqueue_serialno_offset_from_proc(void *);
 int proc_info_internal(int callnum, int pid, int flavor, uint64_t arg, user_addr_t buffer, uint32_t buffersize, int32_t * retval);
 
+extern int threads_count;
+
 /*
  * TODO: Replace the noinline attribute below.  Currently, it serves
  * to avoid stack bloat caused by inlining multiple functions that
@@ -143,6 +147,7 @@ int __attribute__ ((noinline)) proc_pid_rusage(int pid, int flavor, user_addr_t
 int __attribute__ ((noinline)) proc_pidoriginatorinfo(int pid, int flavor, user_addr_t buffer, uint32_t buffersize, int32_t * retval);
 int __attribute__ ((noinline)) proc_listcoalitions(int flavor, int coaltype, user_addr_t buffer, uint32_t buffersize, int32_t *retval);
 int __attribute__ ((noinline)) proc_can_use_foreground_hw(int pid, user_addr_t reason, uint32_t resonsize, int32_t *retval);
+int __attribute__ ((noinline)) proc_bulkinfo(uint32_t type, uint32_t typeinfo, uint64_t flags, user_addr_t buffer, uint32_t buffersize, int32_t *retval);
 
 /* protos for procpidinfo calls */
 int __attribute__ ((noinline)) proc_pidfdlist(proc_t p, user_addr_t buffer, uint32_t buffersize, int32_t *retval);
@@ -257,6 +262,9 @@ proc_info_internal(int callnum, int pid, int flavor, uint64_t arg, user_addr_t b
 						   buffersize, retval);
 		case PROC_INFO_CALL_CANUSEFGHW:
 			return proc_can_use_foreground_hw(pid, buffer, buffersize, retval);
+		case PROC_INFO_CALL_BULKINFO:
+			/* pid contains type and flavor contains typeinfo */
+			return proc_bulkinfo(pid, flavor, arg, buffer, buffersize, retval);
 		default:
 				return(EINVAL);
 	}
@@ -265,6 +273,75 @@ proc_info_internal(int callnum, int pid, int flavor, uint64_t arg, user_addr_t b
 }
 
 /******************* proc_listpids routine ****************/
+
+/*
+ * Returns nonzero if p does not match the PROC_*_ONLY selection
+ * (type, typeinfo).  Called with the proc list lock held.
+ */
+static int
+proc_listpids_skip(proc_t p, uint32_t type, uint32_t typeinfo)
+{
+	struct tty * tp;
+	int skip;
+
+	skip = 0;
+	switch (type) {
+		case PROC_PGRP_ONLY:
+			if (p->p_pgrpid != (pid_t)typeinfo)
+				skip = 1;
+		  	break;
+		case PROC_PPID_ONLY:
+			if ((p->p_ppid != (pid_t)typeinfo) && (((p->p_lflag & P_LTRACED) == 0) || (p->p_oppid != (pid_t)typeinfo)))
+				skip = 1;
+		  	break;
+
+		case PROC_ALL_PIDS:
+			skip = 0;
+		  	break;
+		case PROC_TTY_ONLY:
+			/* racy but list lock is held */
+			if ((p->p_flag & P_CONTROLT) == 0 ||
+				(p->p_pgrp == NULL) || (p->p_pgrp->pg_session == NULL) ||
+		    	(tp = SESSION_TP(p->p_pgrp->pg_session)) == TTY_NULL ||
+		    	tp->t_dev != (dev_t)typeinfo)
+				skip = 1;
+		  	break;
+		case PROC_UID_ONLY:
+			if (p->p_ucred == NULL)
+				skip = 1;
+			else {
+				kauth_cred_t my_cred;
+				uid_t uid;
+		
+				my_cred = kauth_cred_proc_ref(p);
+				uid = kauth_cred_getuid(my_cred);
+				kauth_cred_unref(&my_cred);
+				if (uid != (uid_t)typeinfo)
+					skip = 1;
+			}
+		  	break;
+		case PROC_RUID_ONLY:
+			if (p->p_ucred == NULL)
+				skip = 1;
+			else {
+				kauth_cred_t my_cred;
+				uid_t uid;
+		
+				my_cred = kauth_cred_proc_ref(p);
+				uid = kauth_cred_getruid(my_cred);
+				kauth_cred_unref(&my_cred);
+				if (uid != (uid_t)typeinfo)
+					skip = 1;
+			}
+		  	break;
+		default:
+		  skip = 1;
+		  break;
+	};
+
+	return (skip);
+}
+
 int
 proc_listpids(uint32_t type, uint32_t typeinfo, user_addr_t buffer, uint32_t  buffersize, int32_t * retval)
 {
@@ -273,7 +350,6 @@ proc_listpids(uint32_t type, uint32_t typeinfo, user_addr_t buffer, uint32_t  bu
 	int * ptr;
 	int n, skip;
 	struct proc * p;
-	struct tty * tp;
 	int error = 0;
 	struct proclist *current_list;
 
@@ -308,60 +384,7 @@ proc_listpids(uint32_t type, uint32_t typeinfo, user_addr_t buffer, uint32_t  bu
 	current_list = &allproc;
 proc_loop:
 	LIST_FOREACH(p, current_list, p_list) {
-		skip = 0;
-		switch (type) {
-			case PROC_PGRP_ONLY:
-				if (p->p_pgrpid != (pid_t)typeinfo)
-					skip = 1;
-			  	break;
-			case PROC_PPID_ONLY:
-				if ((p->p_ppid != (pid_t)typeinfo) && (((p->p_lflag & P_LTRACED) == 0) || (p->p_oppid != (pid_t)typeinfo)))
-					skip = 1;
-			  	break;
-
-			case PROC_ALL_PIDS:
-				skip = 0;
-			  	break;
-			case PROC_TTY_ONLY:
-				/* racy but list lock is held */
-				if ((p->p_flag & P_CONTROLT) == 0 ||
-					(p->p_pgrp == NULL) || (p->p_pgrp->pg_session == NULL) ||
-			    	(tp = SESSION_TP(p->p_pgrp->pg_session)) == TTY_NULL ||
-			    	tp->t_dev != (dev_t)typeinfo)
-					skip = 1;
-			  	break;
-			case PROC_UID_ONLY:
-				if (p->p_ucred == NULL)
-					skip = 1;
-				else {
-					kauth_cred_t my_cred;
-					uid_t uid;
-			
-					my_cred = kauth_cred_proc_ref(p);
-					uid = kauth_cred_getuid(my_cred);
-					kauth_cred_unref(&my_cred);
-					if (uid != (uid_t)typeinfo)
-						skip = 1;
-				}
-			  	break;
-			case PROC_RUID_ONLY:
-				if (p->p_ucred == NULL)
-					skip = 1;
-				else {
-					kauth_cred_t my_cred;
-					uid_t uid;
-			
-					my_cred = kauth_cred_proc_ref(p);
-					uid = kauth_cred_getruid(my_cred);
-					kauth_cred_unref(&my_cred);
-					if (uid != (uid_t)typeinfo)
-						skip = 1;
-				}
-			  	break;
-			default:
-			  skip = 1;
-			  break;
-		};
+		skip = proc_listpids_skip(p, type, typeinfo);
 
 		if(skip == 0) {
 			*ptr++ = p->p_pid;
@@ -388,6 +411,193 @@ proc_loop:
 }
 
 
+/******************* proc_bulkinfo routine ****************/
+
+/*
+ * Worst-case kcdata size for the header, numprocs task containers and,
+ * with PROC_BULKINFO_THREADS, numthreads thread records.
+ */
+static uint32_t
+proc_bulkinfo_estimate(uint32_t numprocs, uint32_t numthreads, uint64_t flags)
+{
+	uint32_t items = 1 + (3 * numprocs);
+	uint32_t payload = sizeof(struct proc_bulkinfo_header) +
+	    numprocs * (2 * sizeof(uint64_t) + sizeof(struct proc_bulkinfo_task));
+
+	if (flags & PROC_BULKINFO_THREADS) {
+		items += numprocs;
+		payload += numthreads * sizeof(struct proc_bulkinfo_thread);
+	}
+
+	return kcdata_estimate_required_buffer_size(items, payload);
+}
+
+/*
+ * Report CPU time, memory and I/O counters for every process that
+ * proc_listpids would return for (type, typeinfo), as one kcdata buffer.
+ * This replaces a proc_pidinfo/proc_pid_rusage round trip per pid for
+ * monitoring agents: the process list is walked once, and each task is
+ * sampled under a single acquisition of its task lock.  Processes the
+ * caller is not allowed to inspect are left out.  If the buffer fills
+ * up, the last complete task is kept and PROC_BULKINFO_HDR_TRUNCATED is
+ * set in the header.
+ */
+int
+proc_bulkinfo(uint32_t type, uint32_t typeinfo, uint64_t flags, user_addr_t buffer, uint32_t buffersize, int32_t *retval)
+{
+	struct kcdata_descriptor kcd;
+	struct proc_bulkinfo_header header;
+	struct proc_bulkinfo_task pbt;
+	struct proc_bulkinfo_thread *threads = NULL;
+	mach_vm_address_t header_addr, out_addr, task_begin;
+	boolean_t check_same_user;
+	uint32_t kbufsize, used;
+	int thcount = 0, nthreads;
+	int numprocs, npids, i;
+	pid_t *pids = NULL;
+	char *kbuf = NULL;
+	proc_t p;
+	int error = 0;
+	kern_return_t kr;
+
+	if (flags & ~PROC_BULKINFO_FLAGS_MASK)
+		return (EINVAL);
+
+	/* Do we have permission to look into this? */
+	if ((error = proc_security_policy(PROC_NULL, PROC_INFO_CALL_BULKINFO, type, NO_CHECK_SAME_USER)))
+		return (error);
+
+	numprocs = nprocs + 20;
+	kbufsize = proc_bulkinfo_estimate(numprocs, threads_count + 20 * numprocs, flags);
+
+	/* if the buffer is null, return the size needed */
+	if (buffer == (user_addr_t)0) {
+		*retval = kbufsize;
+		return (0);
+	}
+
+	if (buffersize < kcdata_estimate_required_buffer_size(1, sizeof(header)))
+		return (ENOMEM);
+	if (kbufsize > buffersize)
+		kbufsize = buffersize;
+
+	/* the privilege check is the same for every target, so do it once */
+	check_same_user = CHECK_SAME_USER;
+	if (priv_check_cred(kauth_cred_get(), PRIV_GLOBAL_PROC_INFO, 0) == 0)
+		check_same_user = NO_CHECK_SAME_USER;
+
+	pids = (pid_t *)kalloc((vm_size_t)(numprocs * sizeof(pid_t)));
+	kbuf = (char *)kalloc((vm_size_t)kbufsize);
+	if (pids == NULL || kbuf == NULL) {
+		error = ENOMEM;
+		goto out;
+	}
+
+	bzero(&header, sizeof(header));
+	header.pbh_timestamp = mach_absolute_time();
+
+	/* zombies have no task left to report on */
+	npids = 0;
+	proc_list_lock();
+	LIST_FOREACH(p, &allproc, p_list) {
+		if (proc_listpids_skip(p, type, typeinfo) != 0)
+			continue;
+		if (npids >= numprocs) {
+			header.pbh_flags |= PROC_BULKINFO_HDR_TRUNCATED;
+			break;
+		}
+		pids[npids++] = p->p_pid;
+	}
+	proc_list_unlock();
+
+	kr = kcdata_memory_static_init(&kcd, (mach_vm_address_t)kbuf, KCDATA_BUFFER_BEGIN_PROC_BULKINFO,
+	    kbufsize, KCFLAG_USE_MEMCOPY);
+	if (kr == KERN_SUCCESS)
+		kr = kcdata_get_memory_addr(&kcd, PROC_BULKINFO_KCTYPE_HEADER, sizeof(header), &header_addr);
+	if (kr != KERN_SUCCESS) {
+		error = ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < npids; i++) {
+		if ((p = proc_find(pids[i])) == PROC_NULL)
+			continue;
+
+		if (p->task == TASK_NULL ||
+		    proc_security_policy(p, PROC_INFO_CALL_BULKINFO, type, check_same_user) != 0) {
+			proc_rele(p);
+			continue;
+		}
+
+		if (flags & PROC_BULKINFO_THREADS) {
+			int want = get_numthreads(p->task) + 8;
+
+			if (want > thcount) {
+				if (threads != NULL)
+					kfree(threads, thcount * sizeof(*threads));
+				thcount = 2 * want;
+				threads = (struct proc_bulkinfo_thread *)kalloc(thcount * sizeof(*threads));
+				if (threads == NULL) {
+					thcount = 0;
+					proc_rele(p);
+					error = ENOMEM;
+					goto out;
+				}
+			}
+		}
+
+		bzero(&pbt, sizeof(pbt));
+		pbt.pbt_pid = p->p_pid;
+		pbt.pbt_uniqueid = p->p_uniqueid;
+		nthreads = fill_taskbulkinfo(p->task, &pbt, threads, thcount);
+		proc_rele(p);
+
+		/* back out a partially written task if the buffer runs out */
+		task_begin = kcd.kcd_addr_end;
+		kr = kcdata_add_container_marker(&kcd, KCDATA_TYPE_CONTAINER_BEGIN,
+		    PROC_BULKINFO_KCCONTAINER_TASK, pbt.pbt_pid);
+		if (kr == KERN_SUCCESS)
+			kr = kcdata_get_memory_addr(&kcd, PROC_BULKINFO_KCTYPE_TASK, sizeof(pbt), &out_addr);
+		if (kr == KERN_SUCCESS)
+			kr = kcdata_memcpy(&kcd, out_addr, &pbt, sizeof(pbt));
+		if (kr == KERN_SUCCESS && nthreads > 0) {
+			kr = kcdata_get_memory_addr_for_array(&kcd, PROC_BULKINFO_KCTYPE_THREAD,
+			    sizeof(*threads), nthreads, &out_addr);
+			if (kr == KERN_SUCCESS)
+				kr = kcdata_memcpy(&kcd, out_addr, threads, nthreads * sizeof(*threads));
+		}
+		if (kr == KERN_SUCCESS)
+			kr = kcdata_add_container_marker(&kcd, KCDATA_TYPE_CONTAINER_END,
+			    PROC_BULKINFO_KCCONTAINER_TASK, pbt.pbt_pid);
+		if (kr != KERN_SUCCESS) {
+			kcd.kcd_addr_end = task_begin;
+			kcdata_write_buffer_end(&kcd);
+			header.pbh_flags |= PROC_BULKINFO_HDR_TRUNCATED;
+			break;
+		}
+
+		header.pbh_task_count++;
+	}
+
+	kcdata_memcpy(&kcd, header_addr, &header, sizeof(header));
+
+	used = (uint32_t)kcdata_memory_get_used_bytes(&kcd);
+	error = copyout(kbuf, buffer, used);
+	if (error == 0)
+		*retval = used;
+
+out:
+	if (threads != NULL)
+		kfree(threads, thcount * sizeof(*threads));
+	if (kbuf != NULL)
+		kfree(kbuf, (vm_size_t)kbufsize);
+	if (pids != NULL)
+		kfree(pids, (vm_size_t)(numprocs * sizeof(pid_t)));
+
+	return (error);
+}
+
+
 /********************************** proc_pidfdlist routines ********************************/
 
 int 
@@ -2659,9 +2869,10 @@ proc_security_policy(proc_t targetp, __unused int callnum, __unused int flavor,
 		return (error);
 #endif
 
-	/* The 'listpids' call doesn't have a target proc */
+	/* The 'listpids' and 'bulkinfo' calls don't have a target proc */
 	if (targetp == PROC_NULL) {
-		assert(callnum == PROC_INFO_CALL_LISTPIDS && check_same_user == NO_CHECK_SAME_USER);
+		assert((callnum == PROC_INFO_CALL_LISTPIDS || callnum == PROC_INFO_CALL_BULKINFO) &&
+		       check_same_user == NO_CHECK_SAME_USER);
 		return (0);
 	}
 
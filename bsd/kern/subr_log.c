@@ -98,6 +98,7 @@
 #include <vm/vm_kern.h>
 #include <kern/task.h>
 #include <kern/locks.h>
+#include <libkern/OSAtomic.h>
 
 /* XXX should be in a common header somewhere */
 extern void logwakeup(void);
@@ -153,6 +154,8 @@ static oslog_stream_buf_entry_t oslog_stream_buf_entries;
 
 int	oslog_open = 0;
 int	os_log_wakeup = 0;
+/* chunk pushes that arrived while logd still had a wakeup outstanding */
+static volatile UInt32 os_log_wakeups_coalesced = 0;
 int	oslog_stream_open = 0;
 int	oslog_stream_buf_size = OSLOG_STREAM_BUF_SIZE;
 int	oslog_stream_num_entries = OSLOG_NUM_STREAM_ENTRIES;
@@ -674,14 +677,29 @@ logwakeup(void)
 	LOG_UNLOCK();
 }
 
+/*
+ * Called for every firehose chunk pushed to logd.  While logd hasn't
+ * acknowledged the previous wakeup with LOGFLUSHED it is going to read the
+ * buffer anyway, so just count the push instead of taking the log lock; the
+ * LOGFLUSHED handler wakes logd again if anything was pushed meanwhile.
+ * The counter is bumped before os_log_wakeup is checked so the handler can't
+ * miss a push that saw the old wakeup.
+ */
 void
 oslogwakeup(void)
 {
+	(void)OSIncrementAtomic((volatile SInt32 *)&os_log_wakeups_coalesced);
+	if (os_log_wakeup) {
+		return;
+	}
+
 	LOG_LOCK();
 	if (!oslog_open) {
 		LOG_UNLOCK();
 		return;
 	}
+	/* this wakeup covers everything pushed so far */
+	(void)OSBitAndAtomic(0, &os_log_wakeups_coalesced);
 	selwakeup(&oslogsoftc.sc_selp);
 	os_log_wakeup = 1;
 	LOG_UNLOCK();
@@ -808,6 +826,11 @@ oslogioctl(__unused dev_t dev, u_long com, caddr_t data, __unused int flag, __un
 	case LOGFLUSHED:
 		LOG_LOCK();
 		os_log_wakeup = 0;
+		if (OSBitAndAtomic(0, &os_log_wakeups_coalesced) != 0) {
+			/* chunks were pushed after logd last looked */
+			selwakeup(&oslogsoftc.sc_selp);
+			os_log_wakeup = 1;
+		}
 		LOG_UNLOCK();
 		__firehose_merge_updates(*(firehose_push_reply_t *)(data));
 		break;
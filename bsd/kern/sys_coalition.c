@@ -3,6 +3,7 @@
 #include <mach/boolean.h>
 
 #include <kern/coalition.h>
+#include <kern/kalloc.h>
 
 #include <sys/coalition.h>
 #include <sys/errno.h>
@@ -280,6 +281,44 @@ bad:
 	return error;
 }
 
+/*
+ * Resource usage of every resource coalition in one call, as an array of
+ * struct procinfo_coalusage. Each entry is copied from the coalition's
+ * folded totals rather than summed over its tasks.
+ */
+static int sysctl_coalition_resource_usage SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1, arg2)
+	struct procinfo_coalusage *usage_list;
+	int ncoals, list_sz, error;
+	vm_size_t size;
+
+	ncoals = coalitions_get_resource_usage(NULL, 0);
+	if (req->oldptr == USER_ADDR_NULL) {
+		/* leave room for coalitions created before the next call */
+		req->oldidx = (ncoals + ncoals / 8 + 1) * sizeof(*usage_list);
+		return 0;
+	}
+
+	list_sz = (int)MIN((user_size_t)ncoals, req->oldlen / sizeof(*usage_list));
+	if (list_sz == 0)
+		return (ncoals == 0) ? 0 : ENOMEM;
+
+	size = list_sz * sizeof(*usage_list);
+	usage_list = kalloc(size);
+	if (usage_list == NULL)
+		return ENOMEM;
+
+	ncoals = coalitions_get_resource_usage(usage_list, list_sz);
+	error = SYSCTL_OUT(req, usage_list, MIN(ncoals, list_sz) * sizeof(*usage_list));
+	kfree(usage_list, size);
+
+	return error;
+}
+
+SYSCTL_PROC(_kern, OID_AUTO, coalition_resource_usage, CTLTYPE_STRUCT | CTLFLAG_RD | CTLFLAG_LOCKED,
+	    0, 0, sysctl_coalition_resource_usage, "S,procinfo_coalusage", "resource usage of all resource coalitions");
+
 #if defined(DEVELOPMENT) || defined(DEBUG)
 static int sysctl_coalition_get_ids SYSCTL_HANDLER_ARGS
 {
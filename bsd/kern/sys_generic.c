@@ -138,6 +138,7 @@
 /* for wait queue based select */
 #include <kern/waitq.h>
 #include <kern/kalloc.h>
+#include <kern/ltable.h>
 #include <sys/vnode_internal.h>
 
 /* XXX should be in a header file somewhere */
@@ -3670,3 +3671,67 @@ SYSCTL_PROC(_kern, OID_AUTO, wqset_clear_preposts, CTLTYPE_QUAD | CTLFLAG_RW | C
 
 #endif /* CONFIG_WAITQ_DEBUG */
 #endif /* defined(DEVELOPMENT) || defined(DEBUG) */
+
+/*
+ * Occupancy of the global wait queue table, and how often wakeups had
+ * to step over threads waiting on unrelated events hashed to the same
+ * bucket.
+ */
+static int sysctl_waitq_global_stats SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1)
+	struct wq_global_table_stats stats;
+	uint64_t value;
+
+	waitq_global_table_stats(&stats);
+	value = *(uint64_t *)((uintptr_t)&stats + arg2);
+
+	return SYSCTL_OUT(req, &value, sizeof(value));
+}
+
+SYSCTL_NODE(_kern, OID_AUTO, waitq_global, CTLFLAG_RD | CTLFLAG_LOCKED, 0, "global wait queue table");
+
+SYSCTL_PROC(_kern_waitq_global, OID_AUTO, buckets, CTLTYPE_QUAD | CTLFLAG_RD | CTLFLAG_LOCKED,
+	    0, offsetof(struct wq_global_table_stats, buckets), sysctl_waitq_global_stats, "Q", "number of buckets");
+SYSCTL_PROC(_kern_waitq_global, OID_AUTO, busy_buckets, CTLTYPE_QUAD | CTLFLAG_RD | CTLFLAG_LOCKED,
+	    0, offsetof(struct wq_global_table_stats, busy_buckets), sysctl_waitq_global_stats, "Q", "buckets with waiters");
+SYSCTL_PROC(_kern_waitq_global, OID_AUTO, scans, CTLTYPE_QUAD | CTLFLAG_RD | CTLFLAG_LOCKED,
+	    0, offsetof(struct wq_global_table_stats, scans), sysctl_waitq_global_stats, "Q", "wakeups that scanned a bucket");
+SYSCTL_PROC(_kern_waitq_global, OID_AUTO, collisions, CTLTYPE_QUAD | CTLFLAG_RD | CTLFLAG_LOCKED,
+	    0, offsetof(struct wq_global_table_stats, collisions), sysctl_waitq_global_stats, "Q", "waiters on other events passed over by wakeups");
+
+/*
+ * Link table allocation counters: arg1 selects the table's counter
+ * function, arg2 is the offset of the counter within struct ltable_counters.
+ */
+static int sysctl_waitq_table_counters SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp)
+	void (*get_counters)(struct ltable_counters *) = arg1;
+	struct ltable_counters counters;
+	uint64_t value;
+
+	get_counters(&counters);
+	value = *(uint64_t *)((uintptr_t)&counters + arg2);
+
+	return SYSCTL_OUT(req, &value, sizeof(value));
+}
+
+#define WAITQ_TABLE_COUNTER(table, fn, name, descr) \
+	SYSCTL_PROC(_kern_ ## table, OID_AUTO, name, CTLTYPE_QUAD | CTLFLAG_RD | CTLFLAG_LOCKED, \
+		    (void *)fn, offsetof(struct ltable_counters, name), sysctl_waitq_table_counters, "Q", descr)
+
+#define WAITQ_TABLE_COUNTERS(table, fn) \
+	WAITQ_TABLE_COUNTER(table, fn, grows, "slabs added to the table"); \
+	WAITQ_TABLE_COUNTER(table, fn, alloc_collisions, "contended free list allocations"); \
+	WAITQ_TABLE_COUNTER(table, fn, free_collisions, "contended free list returns"); \
+	WAITQ_TABLE_COUNTER(table, fn, cache_hits, "allocations from a per-CPU cache"); \
+	WAITQ_TABLE_COUNTER(table, fn, cache_misses, "allocations that missed the per-CPU cache"); \
+	WAITQ_TABLE_COUNTER(table, fn, cache_flushes, "batches returned from per-CPU caches"); \
+	WAITQ_TABLE_COUNTER(table, fn, cached_elems, "free elements held in per-CPU caches")
+
+SYSCTL_NODE(_kern, OID_AUTO, waitq_link_table, CTLFLAG_RD | CTLFLAG_LOCKED, 0, "waitq set link table");
+WAITQ_TABLE_COUNTERS(waitq_link_table, waitq_link_table_counters);
+
+SYSCTL_NODE(_kern, OID_AUTO, waitq_prepost_table, CTLFLAG_RD | CTLFLAG_LOCKED, 0, "waitq prepost table");
+WAITQ_TABLE_COUNTERS(waitq_prepost_table, waitq_prepost_table_counters);
@@ -58,6 +58,8 @@
 
 #include <pexpert/pexpert.h>
 
+#include <libkern/OSAtomic.h>
+
 #define XNU_TEST_BITMAP
 #include <kern/bits.h>
 
@@ -160,19 +162,53 @@ ull_dump(ull_t *ull)
 }
 #endif
 
-static int ull_hash_buckets;
-static queue_head_t *ull_bucket;
-static uint32_t ull_nzalloc = 0;
+/*
+ * The ulock hash table.  Each bucket has its own lock protecting its
+ * chain, and sits on its own cache line, so that waits and wakes on
+ * unrelated addresses neither contend nor share lines.
+ *
+ * The table doubles, up to ull_hash_max_buckets, when a lookup finds a
+ * chain longer than ULL_CHAIN_MAX.  The resize takes every bucket lock
+ * of the current table, rehashes the chains into the new table,
+ * publishes it and marks the old buckets moved; a lookup that locks a
+ * moved bucket retries against the published table, so lookups never
+ * take a table-wide lock.  Because such a lookup may still be about to
+ * lock a bucket of a replaced table, replaced tables are retired rather
+ * than freed; growth is bounded, so they at most double the footprint.
+ *
+ * ull_table_lock serializes resizes and hash dumps.
+ */
+#define ULL_CHAIN_MAX		8
+#define ULL_HASH_MAX_SHIFT	4	/* grow to at most 16x the boot size */
+
+typedef struct ull_bucket {
+	queue_head_t	ulb_head;
+	lck_mtx_t	ulb_lock;
+	uint32_t	ulb_count;	/* ull_t on this chain */
+	uint32_t	ulb_max_count;	/* longest this chain has been */
+	uint32_t	ulb_moved;	/* chain rehashed into a newer table */
+	uint64_t	ulb_lookups;	/* ull_get() calls on this bucket */
+	uint64_t	ulb_steps;	/* chain entries those calls examined */
+} __attribute__((aligned(64))) ull_bucket_t;
+
+typedef struct ull_table {
+	uint32_t	ult_nbuckets;	/* power of 2 */
+	ull_bucket_t	*ult_buckets;
+	struct ull_table *ult_retired;	/* the table this one replaced */
+} ull_table_t;
+
+static ull_table_t * volatile ull_table;
+static uint32_t ull_hash_max_buckets;
+static uint32_t ull_resizes = 0;
+#if DEVELOPMENT || DEBUG
+static int32_t ull_nzalloc = 0;
+#endif
 static zone_t ull_zone;
 
 static __inline__ uint32_t
 ull_hash_index(char *key, size_t length)
 {
-	uint32_t hash = jenkins_hash(key, length);
-
-	hash &= (ull_hash_buckets - 1);
-
-	return hash;
+	return jenkins_hash(key, length);
 }
 
 /* Ensure that the key structure is packed,
@@ -183,9 +219,114 @@ static_assert(sizeof(ulk_t) == sizeof(user_addr_t) + sizeof(pid_t));
 
 #define ULL_INDEX(keyp)	ull_hash_index((char *)keyp, sizeof *keyp)
 
+static ull_table_t *
+ull_table_alloc(uint32_t nbuckets)
+{
+	ull_table_t *table = (ull_table_t *)kalloc(sizeof(ull_table_t));
+	assert(table != NULL);
+
+	/*
+	 * A power of 2 sized kalloc is naturally aligned,
+	 * which keeps every bucket on its own cache line.
+	 */
+	table->ult_nbuckets = nbuckets;
+	table->ult_buckets = (ull_bucket_t *)kalloc(sizeof(ull_bucket_t) * nbuckets);
+	assert(table->ult_buckets != NULL);
+	table->ult_retired = NULL;
+
+	for (uint32_t i = 0; i < nbuckets; i++) {
+		ull_bucket_t *bucket = &table->ult_buckets[i];
+
+		queue_init(&bucket->ulb_head);
+		lck_mtx_init(&bucket->ulb_lock, ull_lck_grp, NULL);
+		bucket->ulb_count = 0;
+		bucket->ulb_max_count = 0;
+		bucket->ulb_moved = 0;
+		bucket->ulb_lookups = 0;
+		bucket->ulb_steps = 0;
+	}
+
+	return table;
+}
+
+/*
+ * Lock the bucket for a hash in the current table,
+ * following any resize that has moved its chain.
+ */
+static ull_bucket_t *
+ull_bucket_lock(uint32_t hash, ull_table_t **tablep)
+{
+	for (;;) {
+		ull_table_t *table = ull_table;
+		ull_bucket_t *bucket = &table->ult_buckets[hash & (table->ult_nbuckets - 1)];
+
+		lck_mtx_lock(&bucket->ulb_lock);
+		if (!bucket->ulb_moved) {
+			if (tablep != NULL) {
+				*tablep = table;
+			}
+			return bucket;
+		}
+		lck_mtx_unlock(&bucket->ulb_lock);
+	}
+}
+
+/*
+ * Double the table, unless it has already been replaced
+ * or is at its maximum size.  Called with no locks held.
+ */
+static void
+ull_table_grow(ull_table_t *table)
+{
+	ull_table_t *new_table;
+	uint32_t nbuckets = table->ult_nbuckets * 2;
+
+	ull_global_lock();
+
+	if (ull_table != table || nbuckets > ull_hash_max_buckets) {
+		ull_global_unlock();
+		return;
+	}
+
+	new_table = ull_table_alloc(nbuckets);
+
+	for (uint32_t i = 0; i < table->ult_nbuckets; i++) {
+		lck_mtx_lock(&table->ult_buckets[i].ulb_lock);
+	}
+
+	for (uint32_t i = 0; i < table->ult_nbuckets; i++) {
+		ull_bucket_t *bucket = &table->ult_buckets[i];
+
+		while (!queue_empty(&bucket->ulb_head)) {
+			ull_t *elem = qe_dequeue_head(&bucket->ulb_head, ull_t, ull_hash_link);
+			ull_bucket_t *new_bucket = &new_table->ult_buckets[ULL_INDEX(&elem->ull_saved_key) & (nbuckets - 1)];
+
+			enqueue(&new_bucket->ulb_head, &elem->ull_hash_link);
+			if (++new_bucket->ulb_count > new_bucket->ulb_max_count) {
+				new_bucket->ulb_max_count = new_bucket->ulb_count;
+			}
+		}
+		bucket->ulb_count = 0;
+		bucket->ulb_moved = 1;
+	}
+
+	new_table->ult_retired = table;
+	OSMemoryBarrier();
+	ull_table = new_table;
+	ull_resizes++;
+
+	for (uint32_t i = 0; i < table->ult_nbuckets; i++) {
+		lck_mtx_unlock(&table->ult_buckets[i].ulb_lock);
+	}
+
+	ull_global_unlock();
+}
+
 void
 ulock_initialize(void)
 {
+	int ull_hash_buckets;
+
 	ull_lck_grp = lck_grp_alloc_init("ulocks", NULL);
 	lck_mtx_init(&ull_table_lock, ull_lck_grp, NULL);
 
@@ -194,16 +335,12 @@ ulock_initialize(void)
 	 * Round up to nearest power of 2, then divide by 4
 	 */
 	ull_hash_buckets = (1 << (bit_ceiling(thread_max) - 2));
+	ull_hash_max_buckets = ull_hash_buckets << ULL_HASH_MAX_SHIFT;
 
 	kprintf("%s>thread_max=%d, ull_hash_buckets=%d\n", __FUNCTION__, thread_max, ull_hash_buckets);
 	assert(ull_hash_buckets >= thread_max/4);
 
-	ull_bucket = (queue_head_t *)kalloc(sizeof(queue_head_t) * ull_hash_buckets);
-	assert(ull_bucket != NULL);
-
-	for (int i = 0; i < ull_hash_buckets; i++) {
-		queue_init(&ull_bucket[i]);
-	}
+	ull_table = ull_table_alloc(ull_hash_buckets);
 
 	ull_zone = zinit(sizeof(ull_t),
 	                 thread_max * sizeof(ull_t),
@@ -221,30 +358,36 @@ ulock_initialize(void)
 
 #if DEVELOPMENT || DEBUG
 /* Count the number of hash entries for a given pid.
- * if pid==0, dump the whole table.
+ * if pid==0, dump the whole table and its per-bucket statistics.
  */
 static int
 ull_hash_dump(pid_t pid)
 {
 	int count = 0;
 	ull_global_lock();
+	ull_table_t *table = ull_table;
 	if (pid == 0) {
 		kprintf("%s>total number of ull_t allocated %d\n", __FUNCTION__, ull_nzalloc);
+		kprintf("%s>%d buckets, %d resizes\n", __FUNCTION__, table->ult_nbuckets, ull_resizes);
 		kprintf("%s>BEGIN\n", __FUNCTION__);
 	}
-	for (int i = 0; i < ull_hash_buckets; i++) {
-		if (!queue_empty(&ull_bucket[i])) {
+	for (uint32_t i = 0; i < table->ult_nbuckets; i++) {
+		ull_bucket_t *bucket = &table->ult_buckets[i];
+		lck_mtx_lock(&bucket->ulb_lock);
+		if (!queue_empty(&bucket->ulb_head)) {
 			ull_t *elem;
 			if (pid == 0) {
-				kprintf("%s>index %d:\n", __FUNCTION__, i);
+				kprintf("%s>index %d: %d entries, max %d, %llu lookups, %llu steps\n", __FUNCTION__, i,
+				        bucket->ulb_count, bucket->ulb_max_count, bucket->ulb_lookups, bucket->ulb_steps);
 			}
-			qe_foreach_element(elem, &ull_bucket[i], ull_hash_link) {
+			qe_foreach_element(elem, &bucket->ulb_head, ull_hash_link) {
 				if ((pid == 0) || (pid == elem->ull_key.ulk_pid)) {
 					ull_dump(elem);
 					count++;
 				}
 			}
 		}
+		lck_mtx_unlock(&bucket->ulb_lock);
 	}
 	if (pid == 0) {
 		kprintf("%s>END\n", __FUNCTION__);
@@ -273,7 +416,9 @@ ull_alloc(ulk_t *key)
 
 	lck_mtx_init(&ull->ull_lock, ull_lck_grp, NULL);
 
-	ull_nzalloc++;
+#if DEVELOPMENT || DEBUG
+	OSAddAtomic(1, &ull_nzalloc);
+#endif
 	return ull;
 }
 
@@ -292,17 +437,22 @@ ull_free(ull_t *ull)
 /* Finds an existing ulock structure (ull_t), or creates a new one.
  * If MUST_EXIST flag is set, returns NULL instead of creating a new one.
  * The ulock structure is returned with ull_lock locked
- *
- * TODO: Per-bucket lock to reduce contention on global lock
  */
 static ull_t *
 ull_get(ulk_t *key, uint32_t flags)
 {
 	ull_t *ull = NULL;
-	uint i = ULL_INDEX(key);
+	uint32_t hash = ULL_INDEX(key);
+	boolean_t grown = FALSE;
+	ull_bucket_t *bucket;
+	ull_table_t *table;
 	ull_t *elem;
-	ull_global_lock();
-	qe_foreach_element(elem, &ull_bucket[i], ull_hash_link) {
+
+again:
+	bucket = ull_bucket_lock(hash, &table);
+	bucket->ulb_lookups++;
+	qe_foreach_element(elem, &bucket->ulb_head, ull_hash_link) {
+		bucket->ulb_steps++;
 		ull_lock(elem);
 		if (ull_key_match(&elem->ull_key, key)) {
 			ull = elem;
@@ -314,11 +464,23 @@ ull_get(ulk_t *key, uint32_t flags)
 	if (ull == NULL) {
 		if (flags & ULL_MUST_EXIST) {
 			/* Must already exist (called from wake) */
-			ull_global_unlock();
+			lck_mtx_unlock(&bucket->ulb_lock);
 			return NULL;
 		}
 
-		/* NRG maybe drop the ull_global_lock before the kalloc,
+		if (bucket->ulb_count >= ULL_CHAIN_MAX && !grown) {
+			/*
+			 * Spread the chain out before adding to it.  The resize
+			 * takes every bucket lock, so it must be done with none
+			 * held, and the lookup repeated against the new table.
+			 */
+			lck_mtx_unlock(&bucket->ulb_lock);
+			ull_table_grow(table);
+			grown = TRUE;
+			goto again;
+		}
+
+		/* NRG maybe drop the bucket lock before the kalloc,
 		 * then take the lock and check again for a key match
 		 * and either use the new ull_t or free it.
 		 */
@@ -326,18 +488,21 @@ ull_get(ulk_t *key, uint32_t flags)
 		ull = ull_alloc(key);
 
 		if (ull == NULL) {
-			ull_global_unlock();
+			lck_mtx_unlock(&bucket->ulb_lock);
 			return NULL;
 		}
 
 		ull_lock(ull);
 
-		enqueue(&ull_bucket[i], &ull->ull_hash_link);
+		enqueue(&bucket->ulb_head, &ull->ull_hash_link);
+		if (++bucket->ulb_count > bucket->ulb_max_count) {
+			bucket->ulb_max_count = bucket->ulb_count;
+		}
 	}
 
 	ull->ull_refcount++;
 
-	ull_global_unlock();
+	lck_mtx_unlock(&bucket->ulb_lock);
 
 	return ull; /* still locked */
 }
@@ -357,9 +522,11 @@ ull_put(ull_t *ull)
 		return;
 	}
 
-	ull_global_lock();
+	/* The key has been cleared; the saved key still names the chain */
+	ull_bucket_t *bucket = ull_bucket_lock(ULL_INDEX(&ull->ull_saved_key), NULL);
 	remqueue(&ull->ull_hash_link);
-	ull_global_unlock();
+	bucket->ulb_count--;
+	lck_mtx_unlock(&bucket->ulb_lock);
 
 #if DEVELOPMENT || DEBUG
 	if (ull_debug) {
@@ -637,6 +804,7 @@ ulock_wake(struct proc *p, struct ulock_wake_args *args, __unused int32_t *retva
 	/* involved threads - each variable holds +1 ref if not null */
 	thread_t wake_thread    = THREAD_NULL;
 	thread_t old_owner      = THREAD_NULL;
+	thread_t handoff_thread = THREAD_NULL;
 
 	if (ull_debug) {
 		kprintf("[%d]%s>ENTER opcode %d addr %llx flags %x\n",
@@ -730,6 +898,9 @@ ulock_wake(struct proc *p, struct ulock_wake_args *args, __unused int32_t *retva
 			assert(kr == KERN_NOT_WAITING);
 			ret = EALREADY;
 		}
+	} else if (sched_wake_handoff) {
+		/* Switch to the woken thread once the ulock is released, below */
+		handoff_thread = thread_wakeup_identify(ULOCK_TO_EVENT(ull), WAITQ_SELECT_MAX_PRI);
 	} else {
 		/*
 		 * TODO: WAITQ_SELECT_MAX_PRI forces a linear scan of the (hashed) global waitq.
@@ -766,6 +937,10 @@ out_locked:
 		thread_deallocate(old_owner);
 	}
 
+	if (handoff_thread != THREAD_NULL) {
+		thread_handoff_woken(handoff_thread);
+	}
+
 munge_retval:
 	if ((flags & ULF_NO_ERRNO) && (ret != 0)) {
 		*retval = -ret;
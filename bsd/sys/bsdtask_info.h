@@ -116,6 +116,9 @@ extern int fill_procregioninfo_onlymappedvnodes(task_t t, uint64_t arg, struct p
 void fill_taskprocinfo(task_t task, struct proc_taskinfo_internal * ptinfo);
 int fill_taskthreadinfo(task_t task, uint64_t thaddr, int thuniqueid, struct proc_threadinfo_internal * ptinfo, void *, int *);
 int fill_taskthreadlist(task_t task, void * buffer, int thcount);
+struct proc_bulkinfo_task;
+struct proc_bulkinfo_thread;
+int fill_taskbulkinfo(task_t task, struct proc_bulkinfo_task *pbt, struct proc_bulkinfo_thread *threads, int thcount);
 int get_numthreads(task_t);
 boolean_t bsd_hasthreadname(void *uth);
 void bsd_getthreadname(void *uth, char* buffer);
@@ -83,6 +83,24 @@ uint64_t coalition_id(coalition_t coal);
 extern int coalitions_get_list(int type, struct procinfo_coalinfo *coal_list, int list_sz);
 
 
+/*
+ * coalitions_get_resource_usage:
+ * Get the resource usage of every resource coalition as procinfo_coalusage
+ * structures, each taken from the coalition's folded totals
+ *
+ * Parameters:
+ * 	usage_list : Pointer to an array of procinfo_coalusage structures
+ * 	             that will be filled with each coalition's id and usage
+ * 	             NOTE: This can be NULL to perform a simple query of
+ * 	             the total number of resource coalitions.
+ * 	list_sz    : The size (in number of structures) of 'usage_list'
+ *
+ * Returns: the number of resource coalitions. NOTE: This may be larger
+ *          than the 'usage_list' array.
+ */
+extern int coalitions_get_resource_usage(struct procinfo_coalusage *usage_list, int list_sz);
+
+
 /*
  * coalition_is_leader:
  * Determine if a task is a coalition leader.
@@ -199,6 +217,12 @@ static inline int coalitions_get_list(__unused int type,
 	return 0;
 }
 
+static inline int coalitions_get_resource_usage(__unused struct procinfo_coalusage *usage_list,
+						__unused int list_sz)
+{
+	return 0;
+}
+
 static inline boolean_t coalition_is_leader(__unused task_t task,
 					    __unused int coal_type,
 					    coalition_t *coal)
@@ -896,6 +896,16 @@ struct proc_fileportinfo {
 #define PROC_INFO_CALL_PIDORIGINATORINFO 0xa
 #define PROC_INFO_CALL_LISTCOALITIONS   0xb
 #define PROC_INFO_CALL_CANUSEFGHW       0xc
+#define PROC_INFO_CALL_BULKINFO         0xd
+
+/*
+ * Flags for PROC_INFO_CALL_BULKINFO.  The pid and flavor arguments
+ * select processes as type and typeinfo do for PROC_INFO_CALL_LISTPIDS;
+ * the result is a KCDATA_BUFFER_BEGIN_PROC_BULKINFO kcdata buffer
+ * holding one PROC_BULKINFO_KCCONTAINER_TASK per process.
+ */
+#define PROC_BULKINFO_THREADS           0x1 /* include a proc_bulkinfo_thread per thread */
+#define PROC_BULKINFO_FLAGS_MASK        (PROC_BULKINFO_THREADS)
 
 #endif /* PRIVATE */
 
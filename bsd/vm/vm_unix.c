@@ -1675,6 +1675,55 @@ extern unsigned int	vm_pageout_purged_objects;
 SYSCTL_INT(_vm, OID_AUTO, pageout_purged_objects, CTLFLAG_RD | CTLFLAG_LOCKED,
 	   &vm_pageout_purged_objects, 0, "System purged object count");
 
+extern uint64_t zone_reclaim_wakeups, zone_reclaim_batches, zone_reclaim_pages;
+extern uint64_t zone_reclaim_time_ns, zone_reclaim_max_batch_ns;
+SYSCTL_QUAD(_vm, OID_AUTO, zone_reclaim_wakeups, CTLFLAG_RD | CTLFLAG_LOCKED,
+	   &zone_reclaim_wakeups, "zone_reclaim thread passes");
+SYSCTL_QUAD(_vm, OID_AUTO, zone_reclaim_batches, CTLFLAG_RD | CTLFLAG_LOCKED,
+	   &zone_reclaim_batches, "Batches of free zone pages returned to the VM");
+SYSCTL_QUAD(_vm, OID_AUTO, zone_reclaim_pages, CTLFLAG_RD | CTLFLAG_LOCKED,
+	   &zone_reclaim_pages, "Free zone pages returned to the VM");
+SYSCTL_QUAD(_vm, OID_AUTO, zone_reclaim_time_ns, CTLFLAG_RD | CTLFLAG_LOCKED,
+	   &zone_reclaim_time_ns, "Time spent returning free zone pages");
+SYSCTL_QUAD(_vm, OID_AUTO, zone_reclaim_max_batch_ns, CTLFLAG_RD | CTLFLAG_LOCKED,
+	   &zone_reclaim_max_batch_ns, "Longest single batch");
+
+extern uint64_t zone_cache_depot_full_count(void);
+
+static int
+vm_ctl_zone_cache_depot_full SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1, arg2)
+	uint64_t depot_full;
+
+	depot_full = zone_cache_depot_full_count();
+	return SYSCTL_OUT(req, &depot_full, sizeof (depot_full));
+}
+SYSCTL_PROC(_vm, OID_AUTO, zone_cache_depot_full,
+	    CTLTYPE_QUAD | CTLFLAG_RD | CTLFLAG_LOCKED,
+	    0, 0, vm_ctl_zone_cache_depot_full, "Q", "Full magazines in the per-CPU zone cache depots");
+
+#if DEVELOPMENT || DEBUG
+extern void zone_reclaim_wakeup(boolean_t pressure);
+
+/* Wake the zone_reclaim thread as the pageout daemon does under memory pressure */
+static int
+sysctl_zone_reclaim_pressure SYSCTL_HANDLER_ARGS
+{
+#pragma unused(arg1, arg2)
+	int error, value = 0;
+
+	error = sysctl_handle_int(oidp, &value, 0, req);
+	if (error || !req->newptr)
+		return (error);
+
+	zone_reclaim_wakeup(TRUE);
+	return (0);
+}
+SYSCTL_PROC(_vm, OID_AUTO, zone_reclaim_pressure, CTLTYPE_INT | CTLFLAG_WR | CTLFLAG_LOCKED | CTLFLAG_MASKED,
+	    0, 0, &sysctl_zone_reclaim_pressure, "I", "");
+#endif /* DEVELOPMENT || DEBUG */
+
 extern int madvise_free_debug;
 SYSCTL_INT(_vm, OID_AUTO, madvise_free_debug, CTLFLAG_RW | CTLFLAG_LOCKED,
 	   &madvise_free_debug, 0, "zero-fill on madvise(MADV_FREE*)");
@@ -357,6 +357,9 @@ parseKCDataBuffer(void * dataBuffer, uint32_t size, NSError ** error)
 	case KCDATA_BUFFER_BEGIN_XNUPOST_CONFIG:
 		rootKey = @"xnupost_testconfig";
 		break;
+	case KCDATA_BUFFER_BEGIN_PROC_BULKINFO:
+		rootKey = @"kcdata_proc_bulkinfo";
+		break;
 	default: {
 		if (error)
 			*error = GEN_ERROR(KERN_INVALID_VALUE, "invalid magic number");
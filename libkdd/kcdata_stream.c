@@ -0,0 +1,241 @@
+/*
+ * Copyright (c) 2017 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include <kcdata.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include "kcdata_stream.h"
+
+#define KCDATA_INDEX_INITIAL_ENTRIES 256
+
+int
+kcdata_stream_init(kcdata_stream_t * stream, void * buffer, size_t size)
+{
+	kcdata_iter_t iter = kcdata_iter(buffer, size);
+
+	memset(stream, 0, sizeof(*stream));
+	stream->ks_buffer = buffer;
+	stream->ks_iter   = iter;
+
+	if (!kcdata_iter_valid(iter)) {
+		stream->ks_error = 1;
+		return -1;
+	}
+
+	/* a range handed out by kcdata_index_iter() has no begin/end markers of its own */
+	if (kcdata_iter_type(iter) == KCDATA_TYPE_CONTAINER_BEGIN)
+		stream->ks_lone_container = 1;
+
+	return 0;
+}
+
+int
+kcdata_stream_next(kcdata_stream_t * stream, kcdata_iter_t * item, uint32_t * depth)
+{
+	kcdata_iter_t iter;
+	uint32_t type;
+	uint32_t item_depth;
+
+	if (stream->ks_error)
+		return -1;
+	if (stream->ks_done)
+		return 0;
+
+	iter = stream->ks_iter;
+	if (!kcdata_iter_valid(iter))
+		goto malformed;
+
+	type       = kcdata_iter_type(iter);
+	item_depth = stream->ks_depth;
+
+	switch (type) {
+	case KCDATA_TYPE_BUFFER_END:
+		if (stream->ks_depth != 0 || stream->ks_lone_container)
+			goto malformed;
+		stream->ks_done = 1;
+		return 0;
+
+	case KCDATA_TYPE_CONTAINER_BEGIN:
+		if (!kcdata_iter_container_valid(iter) || stream->ks_depth >= KCDATA_STREAM_MAX_DEPTH)
+			goto malformed;
+		stream->ks_container_ids[stream->ks_depth++] = kcdata_iter_container_id(iter);
+		break;
+
+	case KCDATA_TYPE_CONTAINER_END:
+		if (stream->ks_depth == 0 ||
+		    stream->ks_container_ids[stream->ks_depth - 1] != kcdata_iter_container_id(iter))
+			goto malformed;
+		item_depth = --stream->ks_depth;
+		if (item_depth == 0 && stream->ks_lone_container)
+			stream->ks_done = 1;
+		break;
+
+	default:
+		break;
+	}
+
+	stream->ks_iter = kcdata_iter_next(iter);
+
+	*item = iter;
+	if (depth)
+		*depth = item_depth;
+	return 1;
+
+malformed:
+	stream->ks_error = 1;
+	return -1;
+}
+
+int
+kcdata_stream_skip_container(kcdata_stream_t * stream)
+{
+	kcdata_iter_t iter;
+	uint32_t target;
+
+	if (stream->ks_depth == 0)
+		return -1;
+
+	target = stream->ks_depth - 1;
+	while (stream->ks_depth > target) {
+		if (kcdata_stream_next(stream, &iter, NULL) != 1)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+kcdata_index_entry_compare(const void * a, const void * b)
+{
+	const kcdata_index_entry_t * ea = a;
+	const kcdata_index_entry_t * eb = b;
+
+	if (ea->kie_container_type != eb->kie_container_type)
+		return (ea->kie_container_type < eb->kie_container_type) ? -1 : 1;
+	if (ea->kie_container_id != eb->kie_container_id)
+		return (ea->kie_container_id < eb->kie_container_id) ? -1 : 1;
+	if (ea->kie_offset != eb->kie_offset)
+		return (ea->kie_offset < eb->kie_offset) ? -1 : 1;
+	return 0;
+}
+
+int
+kcdata_index_build(kcdata_index_t * index, void * buffer, size_t size)
+{
+	kcdata_stream_t stream;
+	kcdata_iter_t iter;
+	uint32_t depth;
+	uint32_t capacity = 0;
+	uint32_t open[KCDATA_STREAM_MAX_DEPTH];
+	int ret;
+
+	memset(index, 0, sizeof(*index));
+	index->ki_buffer = buffer;
+	index->ki_size   = size;
+
+	if (kcdata_stream_init(&stream, buffer, size) != 0)
+		return -1;
+
+	while ((ret = kcdata_stream_next(&stream, &iter, &depth)) == 1) {
+		uint32_t type = kcdata_iter_type(iter);
+
+		if (type == KCDATA_TYPE_CONTAINER_BEGIN) {
+			kcdata_index_entry_t * entry;
+
+			if (index->ki_count == capacity) {
+				uint32_t new_capacity = capacity ? capacity * 2 : KCDATA_INDEX_INITIAL_ENTRIES;
+				kcdata_index_entry_t * entries = realloc(index->ki_entries, new_capacity * sizeof(*entries));
+				if (entries == NULL)
+					goto fail;
+				index->ki_entries = entries;
+				capacity          = new_capacity;
+			}
+
+			entry                     = &index->ki_entries[index->ki_count];
+			entry->kie_container_type = kcdata_iter_container_type(iter);
+			entry->kie_depth          = depth;
+			entry->kie_container_id   = kcdata_iter_container_id(iter);
+			entry->kie_offset         = (uintptr_t)iter.item - (uintptr_t)buffer;
+			entry->kie_length         = 0;
+			open[depth]               = index->ki_count++;
+		} else if (type == KCDATA_TYPE_CONTAINER_END) {
+			kcdata_index_entry_t * entry = &index->ki_entries[open[depth]];
+			uintptr_t end = (uintptr_t)kcdata_iter_next(iter).item - (uintptr_t)buffer;
+
+			entry->kie_length = end - entry->kie_offset;
+		}
+	}
+
+	if (ret != 0)
+		goto fail;
+
+	qsort(index->ki_entries, index->ki_count, sizeof(index->ki_entries[0]), kcdata_index_entry_compare);
+	return 0;
+
+fail:
+	kcdata_index_free(index);
+	return -1;
+}
+
+const kcdata_index_entry_t *
+kcdata_index_find(const kcdata_index_t * index, uint32_t container_type, uint64_t container_id)
+{
+	uint32_t lo = 0;
+	uint32_t hi = index->ki_count;
+
+	/* lower bound, so duplicates come back in buffer order */
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		const kcdata_index_entry_t * entry = &index->ki_entries[mid];
+
+		if (entry->kie_container_type < container_type ||
+		    (entry->kie_container_type == container_type && entry->kie_container_id < container_id))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo < index->ki_count && index->ki_entries[lo].kie_container_type == container_type &&
+	    index->ki_entries[lo].kie_container_id == container_id)
+		return &index->ki_entries[lo];
+
+	return NULL;
+}
+
+kcdata_iter_t
+kcdata_index_iter(const kcdata_index_t * index, const kcdata_index_entry_t * entry)
+{
+	if (entry == NULL || entry->kie_offset + entry->kie_length > index->ki_size)
+		return kcdata_invalid_iter;
+
+	return kcdata_iter((void *)((uintptr_t)index->ki_buffer + entry->kie_offset), entry->kie_length);
+}
+
+void
+kcdata_index_free(kcdata_index_t * index)
+{
+	free(index->ki_entries);
+	index->ki_entries = NULL;
+	index->ki_count   = 0;
+}
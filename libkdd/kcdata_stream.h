@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2017 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef _KCDATA_STREAM_H_
+#define _KCDATA_STREAM_H_
+
+#include <kcdata.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Streaming access to kcdata buffers.
+ *
+ * parseKCDataBuffer() materializes the whole buffer as nested dictionaries
+ * before anything can be looked at.  The routines here walk the raw items in
+ * place instead, so a tool can pull one task out of a large stackshot or
+ * corpse without paying for the rest of it.  They are plain C and only depend
+ * on kcdata.h.
+ */
+
+#define KCDATA_STREAM_MAX_DEPTH 32
+
+typedef struct kcdata_stream {
+	kcdata_iter_t ks_iter;                               /* next item to return */
+	void *        ks_buffer;                             /* start of the buffer */
+	uint32_t      ks_depth;                              /* number of open containers */
+	int           ks_error;                              /* sticky; set on malformed data */
+	int           ks_done;                               /* reached the end of the data */
+	int           ks_lone_container;                     /* buffer holds a single container */
+	uint64_t      ks_container_ids[KCDATA_STREAM_MAX_DEPTH]; /* ids of open containers */
+} kcdata_stream_t;
+
+/*!
+ * @function kcdata_stream_init
+ *
+ * @abstract
+ * Prepare to stream the items of a kcdata buffer.
+ *
+ * @param stream
+ * Stream state to initialize.
+ *
+ * @param buffer
+ * Start of the kcdata. The first item must be one of the KCDATA_BUFFER_BEGIN_*
+ * magic numbers, or a KCDATA_TYPE_CONTAINER_BEGIN (e.g. the start of a range
+ * returned by kcdata_index_iter()).
+ *
+ * @param size
+ * Size of the buffer in bytes.
+ *
+ * @return
+ * 0 on success, -1 if the first item is not valid.
+ */
+int kcdata_stream_init(kcdata_stream_t * stream, void * buffer, size_t size);
+
+/*!
+ * @function kcdata_stream_next
+ *
+ * @abstract
+ * Return the next item in the buffer.
+ *
+ * @param stream
+ * Stream state.
+ *
+ * @param item
+ * Iterator positioned at the returned item.
+ *
+ * @param depth
+ * Optional. Container depth of the returned item. A CONTAINER_BEGIN and its
+ * matching CONTAINER_END are reported at the same depth as their parent's
+ * other items.
+ *
+ * @return
+ * 1 if an item was returned, 0 at KCDATA_TYPE_BUFFER_END (or at the end of a
+ * lone container), -1 if the buffer is malformed: an item overruns the
+ * buffer, container markers don't match, or the end is reached with
+ * containers still open.
+ */
+int kcdata_stream_next(kcdata_stream_t * stream, kcdata_iter_t * item, uint32_t * depth);
+
+/*!
+ * @function kcdata_stream_skip_container
+ *
+ * @abstract
+ * Skip the rest of the innermost open container, including its end marker.
+ *
+ * @discussion
+ * Call this right after kcdata_stream_next() returns a CONTAINER_BEGIN to
+ * step over everything inside it without looking at it.
+ *
+ * @return
+ * 0 on success, -1 if no container is open or the buffer is malformed.
+ */
+int kcdata_stream_skip_container(kcdata_stream_t * stream);
+
+typedef struct kcdata_index_entry {
+	uint32_t kie_container_type; /* e.g. STACKSHOT_KCCONTAINER_TASK */
+	uint32_t kie_depth;          /* depth of the CONTAINER_BEGIN */
+	uint64_t kie_container_id;
+	uint64_t kie_offset;         /* offset of the CONTAINER_BEGIN from the buffer start */
+	uint64_t kie_length;         /* bytes up to and including the CONTAINER_END */
+} kcdata_index_entry_t;
+
+typedef struct kcdata_index {
+	void *                 ki_buffer;
+	size_t                 ki_size;
+	uint32_t               ki_count;
+	kcdata_index_entry_t * ki_entries; /* sorted by type, id, then offset */
+} kcdata_index_t;
+
+/*!
+ * @function kcdata_index_build
+ *
+ * @abstract
+ * Record the location of every container in a buffer in a single pass.
+ *
+ * @return
+ * 0 on success, -1 if the buffer is malformed or memory couldn't be
+ * allocated. On failure the index is left empty.
+ *
+ * @discussion
+ * The buffer must stay mapped for as long as the index is used. Release the
+ * index with kcdata_index_free().
+ */
+int kcdata_index_build(kcdata_index_t * index, void * buffer, size_t size);
+
+/*!
+ * @function kcdata_index_find
+ *
+ * @abstract
+ * Look up a container by type and id.
+ *
+ * @return
+ * The first matching entry in buffer order, or NULL. Container ids are only
+ * unique among siblings, so later entries with the same type and id (if any)
+ * immediately follow the returned one.
+ */
+const kcdata_index_entry_t * kcdata_index_find(const kcdata_index_t * index, uint32_t container_type, uint64_t container_id);
+
+/*!
+ * @function kcdata_index_iter
+ *
+ * @abstract
+ * Return an iterator bounded to a single indexed container. The result can
+ * be passed to kcdata_stream_init() or parseKCDataContainer().
+ */
+kcdata_iter_t kcdata_index_iter(const kcdata_index_t * index, const kcdata_index_entry_t * entry);
+
+void kcdata_index_free(kcdata_index_t * index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _KCDATA_STREAM_H_ */
@@ -738,6 +738,51 @@ kcdata_get_typedescription(unsigned type_id, uint8_t * buffer, uint32_t buffer_s
 
 	}
 
+	case PROC_BULKINFO_KCTYPE_HEADER: {
+		i = 0;
+		_SUBTYPE(KC_ST_UINT64, struct proc_bulkinfo_header, pbh_timestamp);
+		_SUBTYPE(KC_ST_UINT32, struct proc_bulkinfo_header, pbh_task_count);
+		_SUBTYPE(KC_ST_UINT32, struct proc_bulkinfo_header, pbh_flags);
+		setup_type_definition(retval, type_id, i, "proc_bulkinfo_header");
+		break;
+	}
+
+	case PROC_BULKINFO_KCCONTAINER_TASK:
+		setup_type_definition(retval, type_id, 0, "task_bulkinfo");
+		break;
+
+	case PROC_BULKINFO_KCTYPE_TASK: {
+		i = 0;
+		_SUBTYPE(KC_ST_UINT64, struct proc_bulkinfo_task, pbt_uniqueid);
+		_SUBTYPE(KC_ST_INT32, struct proc_bulkinfo_task, pbt_pid);
+		_SUBTYPE(KC_ST_UINT32, struct proc_bulkinfo_task, pbt_threadnum);
+		_SUBTYPE(KC_ST_UINT64, struct proc_bulkinfo_task, pbt_user_time);
+		_SUBTYPE(KC_ST_UINT64, struct proc_bulkinfo_task, pbt_system_time);
+		_SUBTYPE(KC_ST_UINT64, struct proc_bulkinfo_task, pbt_phys_footprint);
+		_SUBTYPE(KC_ST_UINT64, struct proc_bulkinfo_task, pbt_resident_size);
+		_SUBTYPE(KC_ST_UINT64, struct proc_bulkinfo_task, pbt_diskio_bytesread);
+		_SUBTYPE(KC_ST_UINT64, struct proc_bulkinfo_task, pbt_diskio_byteswritten);
+		_SUBTYPE(KC_ST_UINT64, struct proc_bulkinfo_task, pbt_pageins);
+		_SUBTYPE(KC_ST_UINT64, struct proc_bulkinfo_task, pbt_faults);
+		_SUBTYPE(KC_ST_UINT64, struct proc_bulkinfo_task, pbt_csw);
+		_SUBTYPE(KC_ST_UINT64, struct proc_bulkinfo_task, pbt_interrupt_wkups);
+		setup_type_definition(retval, type_id, i, "proc_bulkinfo_task");
+		break;
+	}
+
+	case PROC_BULKINFO_KCTYPE_THREAD: {
+		i = 0;
+		_SUBTYPE(KC_ST_UINT64, struct proc_bulkinfo_thread, pbth_thread_id);
+		_SUBTYPE(KC_ST_UINT64, struct proc_bulkinfo_thread, pbth_user_time);
+		_SUBTYPE(KC_ST_UINT64, struct proc_bulkinfo_thread, pbth_system_time);
+		_SUBTYPE(KC_ST_UINT32, struct proc_bulkinfo_thread, pbth_csw);
+		_SUBTYPE(KC_ST_INT16, struct proc_bulkinfo_thread, pbth_sched_pri);
+		_SUBTYPE(KC_ST_INT16, struct proc_bulkinfo_thread, pbth_base_pri);
+		_SUBTYPE(KC_ST_UINT32, struct proc_bulkinfo_thread, pbth_state);
+		setup_type_definition(retval, type_id, i, "proc_bulkinfo_thread");
+		break;
+	}
+
 	default:
 		retval = NULL;
 		break;
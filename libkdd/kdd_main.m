@@ -10,23 +10,223 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <zlib.h>
+#include <mach/mach_time.h>
 #import "kdd.h"
+#include "kcdata_stream.h"
 
 void usage(char *const* argv) {
     fprintf(stderr, "usage: %s [-p] FILE\n", argv[0]);
+    fprintf(stderr, "       %s -s FILE           stream an outline of the items\n", argv[0]);
+    fprintf(stderr, "       %s [-p] -t ID FILE   print only the task container with this id\n", argv[0]);
+    fprintf(stderr, "       %s -b FILE           time full parse against streaming and indexing\n", argv[0]);
     exit(1);
 }
 
+static BOOL hasKCDataMagic(NSData *data) {
+    if (data.length < sizeof(struct kcdata_item)) {
+        return NO;
+    }
+    switch (((struct kcdata_item *)data.bytes)->type) {
+    case KCDATA_BUFFER_BEGIN_CRASHINFO:
+    case KCDATA_BUFFER_BEGIN_STACKSHOT:
+    case KCDATA_BUFFER_BEGIN_DELTA_STACKSHOT:
+    case KCDATA_BUFFER_BEGIN_OS_REASON:
+    case KCDATA_BUFFER_BEGIN_XNUPOST_CONFIG:
+    case KCDATA_BUFFER_BEGIN_PROC_BULKINFO:
+        return YES;
+    default:
+        return NO;
+    }
+}
+
+static NSData *inflateGzip(NSData *data) {
+    uint8_t buffer[100];
+    z_stream stream;
+    bzero(&stream, sizeof(stream));
+    stream.next_in = (void*) data.bytes;
+    stream.avail_in = data.length;
+    stream.next_out = buffer;
+    stream.avail_out = sizeof(buffer);
+    inflateInit2(&stream, 16+MAX_WBITS);
+    NSMutableData *inflated = [[NSMutableData alloc] init];
+    while (1) {
+        int z = inflate(&stream, Z_NO_FLUSH);
+        if (z == Z_OK || z == Z_STREAM_END) {
+            [inflated appendBytes:buffer length:sizeof(buffer) - stream.avail_out];
+            stream.avail_out = sizeof(buffer);
+            stream.next_out = buffer;
+            if (z == Z_STREAM_END) {
+                break;
+            }
+        } else {
+            inflated = nil;
+            break;
+        }
+    }
+    inflateEnd(&stream);
+    return inflated;
+}
+
+/* Undo the gzip or base64 wrapping kcdata files are often stored with. */
+static NSData *rawKCData(NSData *data) {
+    if (hasKCDataMagic(data)) {
+        return data;
+    }
+    NSData *inflated = inflateGzip(data);
+    if (hasKCDataMagic(inflated)) {
+        return inflated;
+    }
+    NSData *decoded = [[NSData alloc] initWithBase64EncodedData:data options:NSDataBase64DecodingIgnoreUnknownCharacters];
+    if (hasKCDataMagic(decoded)) {
+        return decoded;
+    }
+    return data;
+}
+
+static int printOutline(NSData *data) {
+    kcdata_stream_t stream;
+    kcdata_iter_t iter;
+    uint32_t depth;
+    int ret;
+
+    if (kcdata_stream_init(&stream, (void *)data.bytes, data.length) != 0) {
+        NSLog(@"invalid kcdata buffer");
+        return 1;
+    }
+
+    while ((ret = kcdata_stream_next(&stream, &iter, &depth)) == 1) {
+        uint32_t type = kcdata_iter_type(iter);
+        if (type == KCDATA_TYPE_CONTAINER_END) {
+            continue;
+        }
+        if (type == KCDATA_TYPE_CONTAINER_BEGIN) {
+            printf("%*s%s[%llu]\n", (int)depth * 2, "",
+                   [KCDataTypeNameForID(kcdata_iter_container_type(iter)) UTF8String], kcdata_iter_container_id(iter));
+        } else if (type == KCDATA_TYPE_ARRAY) {
+            printf("%*s%s x %u\n", (int)depth * 2, "",
+                   [KCDataTypeNameForID(kcdata_iter_array_elem_type(iter)) UTF8String], kcdata_iter_array_elem_count(iter));
+        } else {
+            printf("%*s%s (%u bytes)\n", (int)depth * 2, "",
+                   [KCDataTypeNameForID(type) UTF8String], kcdata_iter_size(iter));
+        }
+    }
+
+    if (ret != 0) {
+        NSLog(@"malformed kcdata at offset 0x%lx",
+              (unsigned long)((uintptr_t)stream.ks_iter.item - (uintptr_t)data.bytes));
+        return 1;
+    }
+    return 0;
+}
+
+static NSDictionary *parseTask(NSData *data, uint64_t taskID, NSError **error) {
+    kcdata_index_t index;
+
+    if (kcdata_index_build(&index, (void *)data.bytes, data.length) != 0) {
+        *error = [NSError errorWithDomain:@"kdd" code:KERN_INVALID_OBJECT
+                                 userInfo:@{NSLocalizedDescriptionKey : @"malformed kcdata"}];
+        return nil;
+    }
+
+    NSDictionary *dict = nil;
+    const kcdata_index_entry_t *entry = kcdata_index_find(&index, STACKSHOT_KCCONTAINER_TASK, taskID);
+    if (entry) {
+        kcdata_iter_t iter = kcdata_index_iter(&index, entry);
+        dict = parseKCDataContainer(&iter, error);
+    } else {
+        *error = [NSError errorWithDomain:@"kdd" code:KERN_NOT_FOUND
+                                 userInfo:@{NSLocalizedDescriptionKey : @"no such task"}];
+    }
+
+    kcdata_index_free(&index);
+    return dict;
+}
+
+static double elapsedMS(uint64_t start) {
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0) {
+        mach_timebase_info(&timebase);
+    }
+    return (double)(mach_absolute_time() - start) * timebase.numer / timebase.denom / 1e6;
+}
+
+static int runBenchmark(NSData *data) {
+    const int iterations = 10;
+    NSError *error = nil;
+    uint64_t start;
+    double parse = 0, stream = 0, index = 0;
+    uint64_t items = 0;
+    uint32_t containers = 0;
+
+    for (int i = 0; i < iterations; i++) {
+        @autoreleasepool {
+            start = mach_absolute_time();
+            NSDictionary *dict = parseKCDataBuffer((void*)data.bytes, (uint32_t)data.length, &error);
+            parse += elapsedMS(start);
+            if (!dict || error) {
+                NSLog(@"error parsing kcdata: %@", error);
+                return 1;
+            }
+        }
+
+        kcdata_stream_t s;
+        kcdata_iter_t iter;
+        int ret;
+        items = 0;
+        start = mach_absolute_time();
+        kcdata_stream_init(&s, (void *)data.bytes, data.length);
+        while ((ret = kcdata_stream_next(&s, &iter, NULL)) == 1) {
+            items++;
+        }
+        stream += elapsedMS(start);
+        if (ret != 0) {
+            NSLog(@"malformed kcdata");
+            return 1;
+        }
+
+        kcdata_index_t idx;
+        start = mach_absolute_time();
+        if (kcdata_index_build(&idx, (void *)data.bytes, data.length) != 0) {
+            NSLog(@"malformed kcdata");
+            return 1;
+        }
+        index += elapsedMS(start);
+        containers = idx.ki_count;
+        kcdata_index_free(&idx);
+    }
+
+    printf("%lu bytes, %llu items, %u containers, %d iterations\n",
+           (unsigned long)data.length, items, containers, iterations);
+    printf("parseKCDataBuffer: %10.3f ms\n", parse / iterations);
+    printf("kcdata_stream:     %10.3f ms\n", stream / iterations);
+    printf("kcdata_index:      %10.3f ms\n", index / iterations);
+    return 0;
+}
+
 int main(int argc, char *const*argv) {
 
     int c ;
     int plist = 0;
+    int outline = 0;
+    int benchmark = 0;
+    int haveTaskID = 0;
+    uint64_t taskID = 0;
 
-    while ((c = getopt(argc, argv, "p")) != EOF) {
+    while ((c = getopt(argc, argv, "pst:b")) != EOF) {
         switch(c) {
         case 'p':
             plist = TRUE;
             break;
+        case 's':
+            outline = TRUE;
+            break;
+        case 't':
+            haveTaskID = TRUE;
+            taskID = strtoull(optarg, NULL, 0);
+            break;
+        case 'b':
+            benchmark = TRUE;
+            break;
         case '?':
         case 'h':
         default:
@@ -55,49 +255,26 @@ int main(int argc, char *const*argv) {
         return 1;
     }
 
+    data = rawKCData(data);
+
     if (data.length > UINT32_MAX) {
         NSLog(@"data too big");
         return 1;
     }
 
-    NSDictionary *dict = parseKCDataBuffer((void*)data.bytes, (uint32_t)data.length, &error);
-
-    if (error && error.code == KERN_INVALID_VALUE) {
-        uint8_t buffer[100];
-        z_stream stream;
-        bzero(&stream, sizeof(stream));
-        stream.next_in = (void*) data.bytes;
-        stream.avail_in = data.length;
-        stream.next_out = buffer;
-        stream.avail_out = sizeof(buffer);
-        inflateInit2(&stream, 16+MAX_WBITS);
-        NSMutableData *inflated = [[NSMutableData alloc] init];
-        while (1) {
-            int z = inflate(&stream, Z_NO_FLUSH);
-            if (z == Z_OK || z == Z_STREAM_END) {
-                [inflated appendBytes:buffer length:sizeof(buffer) - stream.avail_out];
-                stream.avail_out = sizeof(buffer);
-                stream.next_out = buffer;
-                if (z == Z_STREAM_END) {
-                    break;
-                }
-            } else {
-                inflated = nil;
-                break;
-            }
-        }
-        if (inflated) {
-            error = nil;
-            dict = parseKCDataBuffer((void*)inflated.bytes, (uint32_t)inflated.length, &error);
-        }
+    if (outline) {
+        return printOutline(data);
     }
 
-    if (error && error.code == KERN_INVALID_VALUE) {
-        NSData *decoded = [[NSData alloc] initWithBase64EncodedData:data options:NSDataBase64DecodingIgnoreUnknownCharacters];
-        if (decoded) {
-            error = nil;
-            dict = parseKCDataBuffer((void*)decoded.bytes, (uint32_t)decoded.length, &error);
-        }
+    if (benchmark) {
+        return runBenchmark(data);
+    }
+
+    NSDictionary *dict;
+    if (haveTaskID) {
+        dict = parseTask(data, taskID, &error);
+    } else {
+        dict = parseKCDataBuffer((void*)data.bytes, (uint32_t)data.length, &error);
     }
 
     if (!dict || error) {
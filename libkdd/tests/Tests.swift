@@ -1335,6 +1335,125 @@ class Tests: XCTestCase {
         self.testSampleStackshot("stackshot-with-waitinfo")
     }
 
+    func appendContainerMarker(buffer : NSMutableData, type : UInt32, id : UInt64) {
+        var item = kcdata_item()
+        item.type = type
+        item.flags = id
+        item.size = UInt32(sizeof(UInt32))
+        buffer.appendBytes(&item, length: sizeof(kcdata_item))
+        var payload32 = UInt32(STACKSHOT_KCCONTAINER_TASK)
+        buffer.appendBytes(&payload32, length:sizeof(UInt32))
+    }
+
+    func testStreamContainers() {
+        let buffer = NSMutableData(capacity:1000)!
+
+        var item = kcdata_item()
+        var payload64 : UInt64
+
+        item.type = KCDATA_BUFFER_BEGIN_CRASHINFO
+        item.flags = 0
+        item.size = 0
+        buffer.appendBytes(&item, length: sizeof(kcdata_item))
+
+        for id in [UInt64(1), UInt64(2)] {
+            appendContainerMarker(buffer, type: UInt32(KCDATA_TYPE_CONTAINER_BEGIN), id: id)
+
+            item.type = UInt32(TASK_CRASHINFO_CRASHED_THREADID)
+            item.flags = 0
+            item.size = UInt32(sizeof(UInt64))
+            buffer.appendBytes(&item, length: sizeof(kcdata_item))
+            payload64 = 41 + id
+            buffer.appendBytes(&payload64, length:sizeof(UInt64))
+
+            appendContainerMarker(buffer, type: UInt32(KCDATA_TYPE_CONTAINER_END), id: id)
+        }
+
+        item.type = KCDATA_TYPE_BUFFER_END
+        item.flags = 0
+        item.size = 0
+        buffer.appendBytes(&item, length: sizeof(kcdata_item))
+
+        // skipping the first container should only show the second one's contents
+        var stream = kcdata_stream_t()
+        var iter = kcdata_iter_t()
+        var depth : UInt32 = 0
+        var items = 0
+        XCTAssert(kcdata_stream_init(&stream, UnsafeMutablePointer(buffer.bytes), buffer.length) == 0)
+        while kcdata_stream_next(&stream, &iter, &depth) == 1 {
+            items += 1
+            if kcdata_iter_type(iter) == UInt32(KCDATA_TYPE_CONTAINER_BEGIN) && kcdata_iter_container_id(iter) == 1 {
+                XCTAssert(kcdata_stream_skip_container(&stream) == 0)
+            }
+        }
+        XCTAssert(stream.ks_error == 0)
+        XCTAssert(items == 5)
+
+        var index = kcdata_index_t()
+        XCTAssert(kcdata_index_build(&index, UnsafeMutablePointer(buffer.bytes), buffer.length) == 0)
+        XCTAssert(index.ki_count == 2)
+
+        let entry = kcdata_index_find(&index, UInt32(STACKSHOT_KCCONTAINER_TASK), 2)
+        XCTAssert(entry != nil)
+        XCTAssert(kcdata_index_find(&index, UInt32(STACKSHOT_KCCONTAINER_TASK), 3) == nil)
+
+        iter = kcdata_index_iter(&index, entry)
+        var error : NSError?
+        guard let dict = parseKCDataContainer(&iter, &error)
+            else { XCTFail(); return; }
+        XCTAssert(dict["task_snapshots"]?["crashed_threadid"] == 43)
+
+        kcdata_index_free(&index)
+    }
+
+    func testStreamMismatchedContainer() {
+        let buffer = NSMutableData(capacity:1000)!
+
+        var item = kcdata_item()
+
+        item.type = KCDATA_BUFFER_BEGIN_CRASHINFO
+        item.flags = 0
+        item.size = 0
+        buffer.appendBytes(&item, length: sizeof(kcdata_item))
+
+        appendContainerMarker(buffer, type: UInt32(KCDATA_TYPE_CONTAINER_BEGIN), id: 1)
+        appendContainerMarker(buffer, type: UInt32(KCDATA_TYPE_CONTAINER_END), id: 2)
+
+        item.type = KCDATA_TYPE_BUFFER_END
+        item.flags = 0
+        item.size = 0
+        buffer.appendBytes(&item, length: sizeof(kcdata_item))
+
+        var index = kcdata_index_t()
+        XCTAssert(kcdata_index_build(&index, UnsafeMutablePointer(buffer.bytes), buffer.length) == -1)
+        XCTAssert(index.ki_count == 0)
+    }
+
+    func testIndexSampleStackshot() {
+        // every indexed container should stream cleanly on its own
+        guard let sampledata = self.dataWithResource("stackshot-with-waitinfo")
+            else { XCTFail(); return }
+
+        var index = kcdata_index_t()
+        XCTAssert(kcdata_index_build(&index, UnsafeMutablePointer(sampledata.bytes), sampledata.length) == 0)
+        XCTAssert(index.ki_count > 0)
+
+        for i in 0..<Int(index.ki_count) {
+            let entry = index.ki_entries + i
+            XCTAssert(kcdata_index_find(&index, entry.memory.kie_container_type, entry.memory.kie_container_id) != nil)
+
+            let iter = kcdata_index_iter(&index, entry)
+            var stream = kcdata_stream_t()
+            var item = kcdata_iter_t()
+            XCTAssert(kcdata_stream_init(&stream, UnsafeMutablePointer(iter.item), Int(entry.memory.kie_length)) == 0)
+            while kcdata_stream_next(&stream, &item, nil) == 1 {
+            }
+            XCTAssert(stream.ks_error == 0)
+        }
+
+        kcdata_index_free(&index)
+    }
+
     func testTrivial() {
     }
 }
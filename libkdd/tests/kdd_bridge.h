@@ -11,6 +11,7 @@
 
 #import "kdd.h"
 #include "kcdata.h"
+#include "kcdata_stream.h"
 #include <zlib.h>
 
 #endif /* kdd_bridge_h */
@@ -62,10 +62,38 @@ uint32_t oslog_p_total_msgcount = 0;
 uint32_t oslog_p_metadata_saved_msgcount = 0;
 uint32_t oslog_p_metadata_dropped_msgcount = 0;
 uint32_t oslog_p_error_count = 0;
-uint32_t oslog_p_saved_msgcount = 0;
 uint32_t oslog_p_dropped_msgcount = 0;
 uint32_t oslog_p_boot_dropped_msgcount = 0;
 
+/*
+ * Every message that makes it into the persistence buffer bumps the saved
+ * count, so a single shared counter bounces between all the CPUs that are
+ * logging.  Spread it over cache-line sized stripes picked by CPU number and
+ * sum them when it's read.
+ */
+#define OSLOG_COUNTER_STRIPES 16 /* must be a power of 2 */
+
+static struct {
+	uint32_t count;
+} __attribute__((aligned(64))) oslog_p_saved_msgcount_stripes[OSLOG_COUNTER_STRIPES];
+
+static inline void
+oslog_p_saved_msgcount_inc(void)
+{
+	unsigned int stripe = cpu_number() & (OSLOG_COUNTER_STRIPES - 1);
+	(void)hw_atomic_add(&oslog_p_saved_msgcount_stripes[stripe].count, 1);
+}
+
+uint32_t
+oslog_p_saved_msgcount_read(void)
+{
+	uint32_t total = 0;
+	for (int i = 0; i < OSLOG_COUNTER_STRIPES; i++) {
+		total += oslog_p_saved_msgcount_stripes[i].count;
+	}
+	return total;
+}
+
 /* Counters for streaming mode */
 uint32_t oslog_s_total_msgcount = 0;
 uint32_t oslog_s_error_count = 0;
@@ -440,7 +468,7 @@ out:
 				thread_tid(current_thread()), offset);
 		memcpy(ft->ft_data, pubdata, publen);
 		firehose_chunk_tracepoint_end(fbc, ft, ftid);
-		(void)hw_atomic_add(&oslog_p_saved_msgcount, 1);
+		oslog_p_saved_msgcount_inc();
 		return ftid.ftid_value;
 	}
 	if (!oslog_boot_done) {
@@ -453,7 +481,7 @@ out:
 		(void)hw_atomic_add(&oslog_p_metadata_saved_msgcount, 1);
 	}
 	else {
-		(void)hw_atomic_add(&oslog_p_saved_msgcount, 1);
+		oslog_p_saved_msgcount_inc();
 	}
 	return ftid.ftid_value;
 }
@@ -126,6 +126,12 @@ proc_listcoalitions(int flavor, int coaltype, void *buffer, int buffersize)
 	return retval;
 }
 
+int
+proc_list_bulkinfo(int type, uint32_t typeinfo, uint32_t flags, void *buffer, int buffersize)
+{
+	return (__proc_info(PROC_INFO_CALL_BULKINFO, type, typeinfo, flags, buffer, buffersize));
+}
+
 int
 proc_pid_rusage(int pid, int flavor, rusage_info_t *buffer)
 {
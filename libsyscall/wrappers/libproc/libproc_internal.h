@@ -111,6 +111,13 @@ int proc_pidoriginatorinfo(int flavor,  void *buffer, int buffersize) __OSX_AVAI
 
 int proc_listcoalitions(int flavor, int coaltype, void *buffer, int buffersize) __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_8_3);
 
+/*
+ * Returns a KCDATA_BUFFER_BEGIN_PROC_BULKINFO kcdata buffer describing every
+ * process proc_listpids(type, typeinfo) would list.  With a NULL buffer,
+ * returns the buffer size needed.  flags takes PROC_BULKINFO_THREADS.
+ */
+int proc_list_bulkinfo(int type, uint32_t typeinfo, uint32_t flags, void *buffer, int buffersize);
+
 #if !TARGET_IPHONE_SIMULATOR
 
 #define PROC_SUPPRESS_SUCCESS                (0)
@@ -103,6 +103,18 @@ typedef struct _lck_mtx_ {
 
 /* Adaptive spin before blocking */
 extern uint64_t 	MutexSpin;
+extern boolean_t	MutexSpinAdaptive;
+
+struct lck_mtx_spin_cpu_stats {
+	uint64_t	spins;
+	uint64_t	acquired;
+	uint64_t	timeouts;
+	uint64_t	owner_offcore;
+	uint64_t	short_budget;
+	uint64_t	recovery_probes;
+	uint64_t	spin_time;		/* absolute time units */
+	uint64_t	demoted;		/* spins on locks above MutexSpin */
+} __attribute__((aligned(64)));
 extern int		lck_mtx_lock_spinwait_x86(lck_mtx_t *mutex);
 extern void		lck_mtx_lock_wait_x86(lck_mtx_t *mutex);
 extern void		lck_mtx_lock_acquire_x86(lck_mtx_t *mutex);
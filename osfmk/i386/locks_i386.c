@@ -65,6 +65,7 @@
 
 #include <kern/locks.h>
 #include <kern/kalloc.h>
+#include <kern/clock.h>
 #include <kern/misc_protos.h>
 #include <kern/thread.h>
 #include <kern/processor.h>
@@ -1980,12 +1981,129 @@ lck_mtx_interlock_unlock(lck_mtx_t *mutex, boolean_t istate)
 }
 
 
+/*
+ * Adaptive mutex spinning
+ *
+ * The spin budget of a contended mutex is derived from how long recent
+ * contenders on the same lock had to wait for it to be released. Indirect
+ * mutexes (statistics or debug attributes) keep that history in their lock
+ * group; direct mutexes have no room for it, so theirs lives in a small
+ * table hashed by lock address (collisions only blur the estimate).
+ *
+ * Locks that are normally released quickly are given twice their average
+ * wait, up to MutexSpin. Locks whose recent spins timed out are only probed
+ * for a fraction of MutexSpin before the contender blocks; such a probe that
+ * times out records only the time it spun, so the estimate decays back below
+ * MutexSpin unless full-budget spins keep timing out. Every
+ * LCK_MTX_SPIN_RECOVER_PERIOD-th probe of a demoted lock on a processor is
+ * given the full budget anyway, so a lock that got cheaper is re-measured.
+ */
+#define LCK_MTX_SPIN_HIST_SIZE		512
+#define LCK_MTX_SPIN_EWMA_SHIFT		3	/* each sample weighs 1/8 */
+#define LCK_MTX_SPIN_PROBE_DIV		8
+#define LCK_MTX_SPIN_RECOVER_PERIOD	16
+
+static uint32_t lck_mtx_spin_hist[LCK_MTX_SPIN_HIST_SIZE];
+static struct lck_mtx_spin_cpu_stats lck_mtx_spin_stats[MAX_CPUS];
+
+static inline volatile uint64_t *
+lck_mtx_spin_grp_hist(lck_mtx_t *mutex)
+{
+	lck_grp_t *grp = ((lck_mtx_ext_t *)mutex)->lck_mtx_grp;
+
+	return &grp->lck_grp_stat.lck_grp_mtx_stat.lck_grp_mtx_spin_avg;
+}
+
+static inline uint32_t *
+lck_mtx_spin_lck_hist(lck_mtx_t *mutex)
+{
+	uint32_t h = (uint32_t)((uintptr_t)mutex >> 4);
+
+	return &lck_mtx_spin_hist[(h * 0x9E3779B1u) >> 23];
+}
+
+static uint64_t
+lck_mtx_spin_budget(lck_mtx_t *mutex)
+{
+	uint64_t avg;
+
+	if (!MutexSpinAdaptive)
+		return MutexSpin;
+
+	if (mutex->lck_mtx_is_ext)
+		avg = *lck_mtx_spin_grp_hist(mutex);
+	else
+		avg = *lck_mtx_spin_lck_hist(mutex);
+
+	if (avg == 0)
+		return MutexSpin;
+	if (avg > MutexSpin) {
+		struct lck_mtx_spin_cpu_stats *cs;
+		boolean_t recover;
+
+		disable_preemption();
+		cs = &lck_mtx_spin_stats[cpu_number()];
+		recover = (++cs->demoted % LCK_MTX_SPIN_RECOVER_PERIOD) == 0;
+		if (recover)
+			cs->recovery_probes++;
+		enable_preemption();
+
+		return recover ? MutexSpin : MutexSpin / LCK_MTX_SPIN_PROBE_DIV;
+	}
+	return MAX(MIN(2 * avg, MutexSpin), MutexSpin / LCK_MTX_SPIN_PROBE_DIV);
+}
+
+/*
+ * Fold one observed wait into the lock's history. Updates are unlocked:
+ * a lost update only delays the estimate by one sample.
+ */
+static void
+lck_mtx_spin_record(lck_mtx_t *mutex, uint64_t sample)
+{
+	if (!MutexSpinAdaptive)
+		return;
+
+	if (mutex->lck_mtx_is_ext) {
+		volatile uint64_t *hist = lck_mtx_spin_grp_hist(mutex);
+		uint64_t avg = *hist;
+
+		*hist = avg - (avg >> LCK_MTX_SPIN_EWMA_SHIFT) + (sample >> LCK_MTX_SPIN_EWMA_SHIFT);
+	} else {
+		uint32_t *hist = lck_mtx_spin_lck_hist(mutex);
+		uint64_t avg = *hist;
+
+		avg = avg - (avg >> LCK_MTX_SPIN_EWMA_SHIFT) + (sample >> LCK_MTX_SPIN_EWMA_SHIFT);
+		*hist = (uint32_t)MIN(avg, UINT32_MAX);
+	}
+}
+
+void
+lck_mtx_spin_stats_get(struct lck_mtx_spin_stats *stats)
+{
+	bzero(stats, sizeof(*stats));
+
+	for (int i = 0; i < MAX_CPUS; i++) {
+		struct lck_mtx_spin_cpu_stats *cs = &lck_mtx_spin_stats[i];
+
+		stats->spins += cs->spins;
+		stats->acquired += cs->acquired;
+		stats->timeouts += cs->timeouts;
+		stats->owner_offcore += cs->owner_offcore;
+		stats->short_budget += cs->short_budget;
+		stats->recovery_probes += cs->recovery_probes;
+		stats->spin_time += cs->spin_time;
+	}
+	absolutetime_to_nanoseconds(stats->spin_time, &stats->spin_time);
+}
+
+
 /*
  * Routine: 	lck_mtx_lock_spinwait_x86
  *
  * Invoked trying to acquire a mutex when there is contention but
- * the holder is running on another processor. We spin for up to a maximum
- * time waiting for the lock to be released.
+ * the holder is running on another processor. We spin for up to an
+ * adaptive budget (see lck_mtx_spin_budget) waiting for the lock to be
+ * released, and stop early if the holder leaves its processor.
  *
  * Called with the interlock unlocked.
  * returns 0 if mutex acquired
@@ -1998,17 +2116,22 @@ lck_mtx_lock_spinwait_x86(
 {
 	__kdebug_only uintptr_t	trace_lck = VM_KERNEL_UNSLIDE_OR_PERM(mutex);
 	thread_t	holder;
+	struct lck_mtx_spin_cpu_stats *cs;
+	uint64_t	spin_budget;
+	uint64_t	start_time;
 	uint64_t	overall_deadline;
 	uint64_t	check_owner_deadline;
 	uint64_t	cur_time;
 	int		retval = 1;
 	int		loopcount = 0;
+	boolean_t	offcore = FALSE;
 
 	KERNEL_DEBUG(MACHDBG_CODE(DBG_MACH_LOCKS, LCK_MTX_LCK_SPIN_CODE) | DBG_FUNC_START,
 		     trace_lck, VM_KERNEL_UNSLIDE_OR_PERM(mutex->lck_mtx_owner), mutex->lck_mtx_waiters, 0, 0);
 
-	cur_time = mach_absolute_time();
-	overall_deadline = cur_time + MutexSpin;
+	spin_budget = lck_mtx_spin_budget(mutex);
+	start_time = cur_time = mach_absolute_time();
+	overall_deadline = cur_time + spin_budget;
 	check_owner_deadline = cur_time;
 
 	/*
@@ -2041,6 +2164,7 @@ lck_mtx_lock_spinwait_x86(
 
 						lck_mtx_interlock_unlock(mutex, istate);
 
+						offcore = TRUE;
 						if (loopcount == 0)
 							retval = 2;
 						break;
@@ -2048,7 +2172,7 @@ lck_mtx_lock_spinwait_x86(
 				}
 				lck_mtx_interlock_unlock(mutex, istate);
 
-				check_owner_deadline = cur_time + (MutexSpin / 4);
+				check_owner_deadline = cur_time + (spin_budget / 4);
 			}
 		}
 		cpu_pause();
@@ -2057,10 +2181,39 @@ lck_mtx_lock_spinwait_x86(
 
 	} while (TRUE);
 
+	cur_time = mach_absolute_time();
+	if (retval == 0) {
+		lck_mtx_spin_record(mutex, cur_time - start_time);
+	} else if (!offcore) {
+		/*
+		 * The holder kept the lock, while running, past our budget.
+		 * Only a full budget shows that spinning does not pay; a
+		 * short probe just records how long it waited.
+		 */
+		if (spin_budget >= MutexSpin)
+			lck_mtx_spin_record(mutex, 2 * MutexSpin);
+		else
+			lck_mtx_spin_record(mutex, cur_time - start_time);
+	}
+
+	disable_preemption();
+	cs = &lck_mtx_spin_stats[cpu_number()];
+	cs->spins++;
+	cs->spin_time += cur_time - start_time;
+	if (retval == 0)
+		cs->acquired++;
+	else if (offcore)
+		cs->owner_offcore++;
+	else
+		cs->timeouts++;
+	if (spin_budget < MutexSpin)
+		cs->short_budget++;
+	enable_preemption();
+
 #if	CONFIG_DTRACE
 	/*
-	 * We've already kept a count via overall_deadline of how long we spun.
-	 * If dtrace is active, then we compute backwards to decide how
+	 * We've already kept a count via start_time of how long we spun.
+	 * If dtrace is active, then we compute forward from it to decide how
 	 * long we spun.
 	 *
 	 * Note that we record a different probe id depending on whether
@@ -2070,10 +2223,10 @@ lck_mtx_lock_spinwait_x86(
 	 */
 	if (__probable(mutex->lck_mtx_is_ext == 0)) {
 		LOCKSTAT_RECORD(LS_LCK_MTX_LOCK_SPIN, mutex,
-			mach_absolute_time() - (overall_deadline - MutexSpin));
+			mach_absolute_time() - start_time);
 	} else {
 		LOCKSTAT_RECORD(LS_LCK_MTX_EXT_LOCK_SPIN, mutex,
-			mach_absolute_time() - (overall_deadline - MutexSpin));
+			mach_absolute_time() - start_time);
 	}
 	/* The lockstat acquire event is recorded by the assembly code beneath us. */
 #endif
@@ -74,6 +74,7 @@ uint64_t	TLBTimeOut;
 uint64_t	LockTimeOutTSC;
 uint32_t	LockTimeOutUsec;
 uint64_t	MutexSpin;
+boolean_t	MutexSpinAdaptive = TRUE;
 uint64_t	LastDebuggerEntryAllowance;
 uint64_t	delay_spin_threshold;
 
@@ -673,6 +674,9 @@ ml_init_lock_timeout(void)
 	}
 	MutexSpin = (unsigned int)abstime;
 
+	if (PE_parse_boot_argn("mtxspin_adaptive", &mtxspin, sizeof (mtxspin)))
+		MutexSpinAdaptive = (mtxspin != 0);
+
 	nanoseconds_to_absolutetime(4ULL * NSEC_PER_SEC, &LastDebuggerEntryAllowance);
 	if (PE_parse_boot_argn("panic_restart_timeout", &prt, sizeof (prt)))
 		nanoseconds_to_absolutetime(prt * NSEC_PER_SEC, &panic_restart_timeout);
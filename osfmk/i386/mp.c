@@ -156,6 +156,23 @@ static struct _kdp_xcpu_call_func {
 	.cpu  = KDP_XCPU_NONE
 };
 
+/*
+ * The broadcast state packs the generation (upper 32 bits), a closed flag
+ * and the number of cpus that joined the generation. Cpus join with a
+ * compare-and-swap, so once the debugger cpu closes a generation the
+ * count can't change under it.
+ */
+#define KDP_XCPU_BC_CLOSED	0x80000000ULL
+#define KDP_XCPU_BC_COUNT_MASK	0x7fffffffULL
+#define KDP_XCPU_BC_GEN(state)	((uint32_t)((state) >> 32))
+
+static struct _kdp_xcpu_broadcast_func {
+	kdp_x86_xcpu_func_t func;
+	void     *arg0, *arg1;
+	volatile uint64_t state;
+	volatile long     done;
+} kdp_xcpu_broadcast_func;
+
 #endif
 
 /* Variables needed for MP broadcast. */
@@ -1675,9 +1692,86 @@ kdp_x86_xcpu_poll(void)
 	}
 }
 
+/*
+ * Number of cpus held in the debugger, including the debugger cpu itself.
+ * Only meaningful from the debugger cpu while mp_kdp_trap is set.
+ */
+unsigned int
+kdp_x86_xcpu_count(void)
+{
+	return (unsigned int) mp_kdp_ncpus;
+}
+
+/*
+ * Run func on every cpu held in mp_kdp_wait() and on the calling
+ * (debugger) cpu, returning once all of them have completed it.
+ * Only cpus that join the broadcast before the debugger cpu is done with
+ * func run it; a cpu that shows up later skips this generation.
+ * Returns the number of cpus that ran func.
+ */
+long
+kdp_x86_xcpu_broadcast(kdp_x86_xcpu_func_t func, void *arg0, void *arg1)
+{
+	uint32_t generation;
+	uint64_t state;
+	long joined;
+
+	if (func == NULL)
+		return -1;
+
+	generation = KDP_XCPU_BC_GEN(kdp_xcpu_broadcast_func.state) + 1;
+	kdp_xcpu_broadcast_func.func = func;
+	kdp_xcpu_broadcast_func.arg0 = arg0;
+	kdp_xcpu_broadcast_func.arg1 = arg1;
+	kdp_xcpu_broadcast_func.done = 0;
+	mfence();
+	kdp_xcpu_broadcast_func.state = (uint64_t)generation << 32;
+
+	DBG("Broadcasting function %p to %ld CPUs\n", func, (long)mp_kdp_ncpus);
+	(void) func(arg0, arg1, (uint16_t)cpu_number());
+
+	/* stop counting cpus, then wait for the ones that joined */
+	do {
+		state = kdp_xcpu_broadcast_func.state;
+	} while (!__sync_bool_compare_and_swap(&kdp_xcpu_broadcast_func.state, state, state | KDP_XCPU_BC_CLOSED));
+	joined = (long)(state & KDP_XCPU_BC_COUNT_MASK);
+
+	while (kdp_xcpu_broadcast_func.done < joined)
+		cpu_pause();
+
+	kdp_xcpu_broadcast_func.func = NULL;
+	return joined + 1;
+}
+
+static void
+kdp_x86_xcpu_broadcast_poll(uint32_t *generation)
+{
+	uint64_t state = kdp_xcpu_broadcast_func.state;
+	uint32_t state_generation = KDP_XCPU_BC_GEN(state);
+
+	if (*generation == state_generation)
+		return;
+
+	*generation = state_generation;
+	for (;;) {
+		if (KDP_XCPU_BC_GEN(state) != state_generation || (state & KDP_XCPU_BC_CLOSED))
+			return;
+		if (__sync_bool_compare_and_swap(&kdp_xcpu_broadcast_func.state, state, state + 1))
+			break;
+		state = kdp_xcpu_broadcast_func.state;
+	}
+
+	(void) kdp_xcpu_broadcast_func.func(kdp_xcpu_broadcast_func.arg0,
+					    kdp_xcpu_broadcast_func.arg1,
+					    cpu_number());
+	atomic_incl((volatile long *)&kdp_xcpu_broadcast_func.done, 1);
+}
+
 static void
 mp_kdp_wait(boolean_t flush, boolean_t isNMI)
 {
+	uint32_t broadcast_generation = KDP_XCPU_BC_GEN(kdp_xcpu_broadcast_func.state);
+
 	DBG("mp_kdp_wait()\n");
 
 	current_cpu_datap()->debugger_ipi_time = mach_absolute_time();
@@ -1698,6 +1792,7 @@ mp_kdp_wait(boolean_t flush, boolean_t isNMI)
 			handle_pending_TLB_flushes();
 
 		kdp_x86_xcpu_poll();
+		kdp_x86_xcpu_broadcast_poll(&broadcast_generation);
 		cpu_pause();
 	}
 
@@ -145,6 +145,9 @@ typedef long (*kdp_x86_xcpu_func_t) (void *arg0, void *arg1, uint16_t lcpu);
 extern  long kdp_x86_xcpu_invoke(const uint16_t lcpu, 
                                  kdp_x86_xcpu_func_t func, 
                                  void *arg0, void *arg1);
+extern  long kdp_x86_xcpu_broadcast(kdp_x86_xcpu_func_t func,
+                                    void *arg0, void *arg1);
+extern  unsigned int kdp_x86_xcpu_count(void);
 typedef enum	{KDP_XCPU_NONE = 0xffff, KDP_CURRENT_LCPU = 0xfffe} kdp_cpu_t;
 #endif
 
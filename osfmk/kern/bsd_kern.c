@@ -30,6 +30,7 @@
 #include <mach/task.h>
 
 #include <kern/kern_types.h>
+#include <kern/kcdata.h>
 #include <kern/ledger.h>
 #include <kern/processor.h>
 #include <kern/thread.h>
@@ -931,6 +932,87 @@ out:
 	
 }
 
+/*
+ * Collect the proc_bulkinfo_task summary of a task and, if threads is
+ * non-NULL, up to thcount proc_bulkinfo_thread records in the same pass
+ * under a single acquisition of the task lock.  Returns the number of
+ * thread records filled in.
+ */
+int
+fill_taskbulkinfo(task_t task, struct proc_bulkinfo_task *pbt, struct proc_bulkinfo_thread *threads, int thcount)
+{
+	thread_t thread;
+	ledger_amount_t credit, debit;
+	uint32_t cswitch = 0;
+	int numthr = 0;
+
+	task_lock(task);
+
+	pbt->pbt_threadnum = task->thread_count;
+	pbt->pbt_user_time = task->total_user_time;
+	pbt->pbt_system_time = task->total_system_time;
+
+	queue_iterate(&task->threads, thread, thread_t, task_threads) {
+		uint64_t user, system;
+		spl_t x;
+
+		if (thread->options & TH_OPT_IDLE_THREAD)
+			continue;
+
+		x = splsched();
+		thread_lock(thread);
+
+		user = timer_grab(&thread->user_timer);
+		system = timer_grab(&thread->system_timer);
+		if (!thread->precise_user_kernel_time) {
+			/* system_timer may represent either sys or user */
+			user += system;
+			system = 0;
+		}
+		cswitch += thread->c_switch;
+
+		if (threads != NULL && numthr < thcount) {
+			struct proc_bulkinfo_thread *pbth = &threads[numthr++];
+
+			pbth->pbth_thread_id = thread->thread_id;
+			pbth->pbth_user_time = user;
+			pbth->pbth_system_time = system;
+			pbth->pbth_csw = thread->c_switch;
+			pbth->pbth_sched_pri = thread->sched_pri;
+			pbth->pbth_base_pri = thread->base_pri;
+			pbth->pbth_state = thread->state;
+		}
+
+		thread_unlock(thread);
+		splx(x);
+
+		pbt->pbt_user_time += user;
+		pbt->pbt_system_time += system;
+	}
+
+	pbt->pbt_csw = task->c_switch + cswitch;
+	pbt->pbt_pageins = task->pageins;
+	pbt->pbt_faults = task->faults;
+
+	ledger_get_balance(task->ledger, task_ledgers.phys_footprint, &credit);
+	pbt->pbt_phys_footprint = credit;
+	ledger_get_balance(task->ledger, task_ledgers.phys_mem, &credit);
+	pbt->pbt_resident_size = credit;
+	ledger_get_entries(task->ledger, task_ledgers.interrupt_wakeups, &credit, &debit);
+	pbt->pbt_interrupt_wkups = credit;
+
+	if (task->task_io_stats) {
+		pbt->pbt_diskio_bytesread = task->task_io_stats->disk_reads.size;
+		pbt->pbt_diskio_byteswritten = (task->task_io_stats->total_io.size - task->task_io_stats->disk_reads.size);
+	} else {
+		pbt->pbt_diskio_bytesread = 0;
+		pbt->pbt_diskio_byteswritten = 0;
+	}
+
+	task_unlock(task);
+	return (numthr);
+}
+
 int
 get_numthreads(task_t task)
 {
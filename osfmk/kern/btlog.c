@@ -33,6 +33,7 @@
 #include <vm/vm_map.h>
 #include <vm/pmap.h>
 #include <mach/vm_param.h>
+#include <os/base.h>
 #define _SYS_TYPES_H_
 #include <libkern/crypto/md5.h>
 #include <libkern/crypto/crypto_internal.h>
@@ -63,6 +64,20 @@
 #define ELEMENT_HASH_BUCKET_COUNT (256)
 #define BTLOG_HASHELEMINDEX_NONE BTLOG_RECORDINDEX_NONE
 
+/*
+ * Records are also hashed by the md5 of their stack, so that finding the
+ * record for an incoming stack doesn't walk the whole active list.
+ */
+#define BTLOG_RECORD_HASH_COUNT (512)
+
+/*
+ * A btlog is split into shards, chosen by element address, each with its
+ * own lock.  Only logs big enough to give every shard a useful number of
+ * records are split.
+ */
+#define BTLOG_MAX_SHARDS		(8)
+#define BTLOG_MIN_RECORDS_PER_SHARD	(512)
+
 #define ZELEMS_DEFAULT	(8000)
 size_t	zelems_count = 0;
 
@@ -85,6 +100,8 @@ typedef struct btlog_record {
     			operation:8;
     uint32_t		ref_count;
     uint32_t		bthash;
+    btlog_recordindex_t	hash_next;	/* next record in the same record hash bucket */
+    volatile uint32_t	gen;		/* bumped when the record is freed or reused, odd while it's rewritten */
     struct _element_record_queue	element_record_queue;
     void		*bt[]; /* variable sized, based on btlog_t params */
 } btlog_record_t;
@@ -103,19 +120,21 @@ typedef struct btlog_element {
 						       */
 } btlog_element_t;
 
-struct btlog {
-    vm_address_t    btlog_buffer;       /* all memory for this btlog_t */
-    vm_size_t       btlog_buffersize;
-
-    uintptr_t       btrecords;      /* use btlog_recordindex_t to lookup */
-    size_t          btrecord_btdepth; /* BT entries per record */
-    size_t          btrecord_size;
+/*
+ * Everything that used to be protected by the btlog lock lives in a shard.
+ * A shard owns a contiguous range of the record array and a share of the
+ * log elements; all the entries for a given element land in the same
+ * shard, so an element's history is still kept in order.
+ */
+typedef struct btlog_shard {
+    decl_simple_lock_data(,btlog_lock);
 
     btlog_recordindex_t head; /* active record list */
     btlog_recordindex_t tail;
     btlog_recordindex_t activerecord;
     btlog_recordindex_t	freelist_records;
 
+    size_t              record_count;
     size_t              active_record_count;
     size_t          	active_element_count;
     btlog_element_t 	*freelist_elements;
@@ -124,11 +143,29 @@ struct btlog {
 		struct _element_hash_queue	*element_hash_queue; /* CORRUPTION mode: We use a single hash bucket i.e. queue */
     } elem_linkage_un;
 
-    decl_simple_lock_data(,btlog_lock);
+    btlog_recordindex_t	record_hashtbl[BTLOG_RECORD_HASH_COUNT]; /* read without the lock */
+} __attribute__((aligned(64))) btlog_shard_t;
+
+struct btlog {
+    vm_address_t    btlog_buffer;       /* all records for this btlog_t */
+    vm_size_t       btlog_buffersize;
+    vm_address_t    btlog_elem_buffer;
+    vm_size_t       btlog_elem_buffersize;
+    vm_address_t    btlog_hash_buffer;
+    vm_size_t       btlog_hash_buffersize;
+    boolean_t       btlog_stolen;       /* allocated with pmap_steal_memory, can't be freed */
+
+    uintptr_t       btrecords;      /* use btlog_recordindex_t to lookup */
+    size_t          btrecord_count;
+    size_t          btrecord_btdepth; /* BT entries per record */
+    size_t          btrecord_size;
+
     boolean_t	caller_will_remove_entries_for_element; /* If TRUE, this means that the caller is interested in keeping track of abandoned / leaked elements.
 							 * And so they want to be in charge of explicitly removing elements. Depending on this variable we
 							 * will choose what kind of data structure to use for the elem_linkage_un union above.
 							 */
+    uint32_t        shard_count;    /* power of 2 */
+    btlog_shard_t   shards[];
 };
 
 extern boolean_t vm_kernel_ready;
@@ -138,69 +175,85 @@ extern boolean_t kmem_alloc_ready;
 	((btlog_record_t *)(btlog->btrecords + index * btlog->btrecord_size))
 
 uint32_t calculate_hashidx_for_element(uintptr_t elem, btlog_t *btlog);
-uint32_t lookup_btrecord_byhash(btlog_t *btlog, uint32_t md5_hash, void *bt[], size_t btcount);
+uint32_t lookup_btrecord_byhash(btlog_t *btlog, btlog_shard_t *shard, uint32_t md5_hash, void *bt[], size_t btcount, uint32_t *genp);
+
+void btlog_add_elem_to_freelist(btlog_shard_t *shard, btlog_element_t *hash_elem);
+btlog_element_t* btlog_get_elem_from_freelist(btlog_t *btlog, btlog_shard_t *shard);
+
+static inline btlog_shard_t *
+btlog_shard_for_element(btlog_t *btlog, uintptr_t elem)
+{
+	uint32_t hash = (uint32_t)(elem >> 4) * 0x9E3779B1U;
 
-void btlog_add_elem_to_freelist(btlog_t *btlog, btlog_element_t *hash_elem);
-btlog_element_t* btlog_get_elem_from_freelist(btlog_t *btlog);
+	return &btlog->shards[(hash >> 16) & (btlog->shard_count - 1)];
+}
+
+static boolean_t
+btrecord_matches_stack(btlog_t *btlog, btlog_record_t *record, void *bt[], size_t btcount)
+{
+	size_t i;
+
+	/*
+	 * Make sure that the incoming stack actually matches the
+	 * stack in this record. Since we only save off a
+	 * part of the md5 hash there can be collisions sometimes.
+	 * This comparison isn't costly because, in case of collisions,
+	 * usually the first few frames are different.
+	 */
+
+	if (btcount < btlog->btrecord_btdepth) {
+		if (record->bt[btcount] != NULL) {
+			/*
+			 * If the stack depth passed in is smaller than
+			 * the recorded stack and we have a valid pointer
+			 * in the recorded stack at that depth, then we
+			 * don't need to do any further checks.
+			 */
+			return FALSE;
+		}
+	}
 
+	for (i=0; i < MIN(btcount, btlog->btrecord_btdepth); i++) {
+		if (record->bt[i] != bt[i]) {
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/*
+ * Safe to call without the shard lock: the generation returned in *genp
+ * tells the caller whether the record was reused before it took the lock.
+ * Chains can change under an unlocked walk, so the walk is bounded.
+ */
 uint32_t
-lookup_btrecord_byhash(btlog_t *btlog, uint32_t md5_hash, void *bt[], size_t btcount)
+lookup_btrecord_byhash(btlog_t *btlog, btlog_shard_t *shard, uint32_t md5_hash, void *bt[], size_t btcount, uint32_t *genp)
 {
 	btlog_recordindex_t	recindex = BTLOG_RECORDINDEX_NONE;
 	btlog_record_t		*record = NULL;
-	size_t			i = 0;
-	boolean_t		stack_matched = TRUE;
+	size_t			steps = 0;
+	uint32_t		gen = 0;
 
 	assert(btcount);
 	assert(bt);
 
-	recindex = btlog->head;
-	record = lookup_btrecord(btlog, recindex);
-	while (recindex != BTLOG_RECORDINDEX_NONE) {
-		assert(record->bthash);
-		assert(! TAILQ_EMPTY(&record->element_record_queue));
-		if (record->bthash == md5_hash) {
-
-			/*
-			 * Make sure that the incoming stack actually matches the
-			 * stack in this record. Since we only save off a
-			 * part of the md5 hash there can be collisions sometimes.
-			 * This comparison isn't costly because, in case of collisions,
-			 * usually the first few frames are different.
-			 */
+	recindex = shard->record_hashtbl[md5_hash & (BTLOG_RECORD_HASH_COUNT - 1)];
+	while (recindex != BTLOG_RECORDINDEX_NONE && steps++ < shard->record_count) {
+		record = lookup_btrecord(btlog, recindex);
 
-			stack_matched = TRUE;
+		gen = record->gen;
+		os_compiler_barrier();
 
-			if (btcount < btlog->btrecord_btdepth) {
-				if (record->bt[btcount] != NULL) {
-					/*
-					 * If the stack depth passed in is smaller than
-					 * the recorded stack and we have a valid pointer
-					 * in the recorded stack at that depth, then we
-					 * don't need to do any further checks.
-					 */
-					stack_matched = FALSE;
-					goto next;
-				}
-			}
-
-			for (i=0; i < MIN(btcount, btlog->btrecord_btdepth); i++) {
-				if (record->bt[i] != bt[i]) {
-					stack_matched = FALSE;
-					goto next;
-				}
-			}
-
-			if (stack_matched == TRUE) {
-				break;
-			}
+		if ((gen & 1) == 0 && record->bthash == md5_hash &&
+		    btrecord_matches_stack(btlog, record, bt, btcount)) {
+			*genp = gen;
+			return recindex;
 		}
-next:
-		recindex = record->next;
-		record = lookup_btrecord(btlog, recindex);
+		recindex = record->hash_next;
 	}
 
-	return recindex;
+	return BTLOG_RECORDINDEX_NONE;
 }
 
 uint32_t
@@ -218,14 +271,14 @@ calculate_hashidx_for_element(uintptr_t elem, btlog_t *btlog)
 }
 
 static void
-btlog_lock(btlog_t *btlog)
+btlog_lock(btlog_shard_t *shard)
 {
-	simple_lock(&btlog->btlog_lock);
+	simple_lock(&shard->btlog_lock);
 }
 static void
-btlog_unlock(btlog_t *btlog)
+btlog_unlock(btlog_shard_t *shard)
 {
-	simple_unlock(&btlog->btlog_lock);
+	simple_unlock(&shard->btlog_lock);
 }
 
 btlog_t *
@@ -234,11 +287,13 @@ btlog_create(size_t numrecords,
 	     boolean_t caller_will_remove_entries_for_element)
 {
 	btlog_t *btlog;
-	vm_size_t buffersize_needed = 0, elemsize_needed = 0;
+	vm_size_t buffersize_needed = 0, elemsize_needed = 0, hashsize_needed = 0, header_size = 0;
 	vm_address_t buffer = 0, elem_buffer = 0, elem_hash_buffer = 0;
-	size_t i = 0;
+	size_t i = 0, s = 0;
 	kern_return_t ret;
 	size_t btrecord_size = 0;
+	size_t records_per_shard = 0, elems_per_shard = 0;
+	uint32_t shard_count = 1;
 	uintptr_t free_elem = 0, next_free_elem = 0;
 
 	if (vm_kernel_ready && !kmem_alloc_ready)
@@ -253,11 +308,16 @@ btlog_create(size_t numrecords,
 	if (record_btdepth > BTLOG_MAX_DEPTH)
 		return NULL;
 
+	while (shard_count < BTLOG_MAX_SHARDS &&
+	       numrecords / (shard_count * 2) >= BTLOG_MIN_RECORDS_PER_SHARD)
+		shard_count *= 2;
+
 	/* btlog_record_t is variable-sized, calculate needs now */
 	btrecord_size = sizeof(btlog_record_t)
 		+ sizeof(void *) * record_btdepth;
 
-	buffersize_needed = sizeof(btlog_t) + numrecords * btrecord_size;
+	header_size = sizeof(btlog_t) + shard_count * sizeof(btlog_shard_t);
+	buffersize_needed = header_size + numrecords * btrecord_size;
 	buffersize_needed = round_page(buffersize_needed);
 		    
 	if (zelems_count == 0) {
@@ -271,12 +331,21 @@ btlog_create(size_t numrecords,
 			printf("Set number of log elements per btlog to: %ld\n", zelems_count);
 		}
 	}
+	if (zelems_count < shard_count)
+		shard_count = 1;
 	elemsize_needed = sizeof(btlog_element_t) * zelems_count;
 	elemsize_needed = round_page(elemsize_needed);
 
+	if (caller_will_remove_entries_for_element == TRUE) {
+		hashsize_needed = shard_count * ELEMENT_HASH_BUCKET_COUNT * sizeof(btlog_element_t*);
+	} else {
+		hashsize_needed = shard_count * sizeof(struct _element_hash_queue);
+	}
+
 	/* since rounding to a page size might hold more, recalculate */
+	header_size = sizeof(btlog_t) + shard_count * sizeof(btlog_shard_t);
 	numrecords = MIN(BTLOG_MAX_RECORDS,
-					 (buffersize_needed - sizeof(btlog_t))/btrecord_size);
+					 (buffersize_needed - header_size)/btrecord_size);
 
 	if (kmem_alloc_ready) {
 		ret = kmem_alloc(kernel_map, &buffer, buffersize_needed, VM_KERN_MEMORY_DIAG);
@@ -290,11 +359,7 @@ btlog_create(size_t numrecords,
 			return NULL;
 		}
 
-		if (caller_will_remove_entries_for_element == TRUE) {
-			ret = kmem_alloc(kernel_map, &elem_hash_buffer, ELEMENT_HASH_BUCKET_COUNT * sizeof(btlog_element_t*), VM_KERN_MEMORY_DIAG);
-		} else {
-			ret = kmem_alloc(kernel_map, &elem_hash_buffer, 2 * sizeof(btlog_element_t*), VM_KERN_MEMORY_DIAG);
-		}
+		ret = kmem_alloc(kernel_map, &elem_hash_buffer, hashsize_needed, VM_KERN_MEMORY_DIAG);
 
 		if (ret != KERN_SUCCESS) {
 			kmem_free(kernel_map, buffer, buffersize_needed);
@@ -308,70 +373,102 @@ btlog_create(size_t numrecords,
 	} else {
 		buffer = (vm_address_t)pmap_steal_memory(buffersize_needed);
 		elem_buffer = (vm_address_t)pmap_steal_memory(elemsize_needed);
-		if (caller_will_remove_entries_for_element == TRUE) {
-			elem_hash_buffer = (vm_address_t)pmap_steal_memory(ELEMENT_HASH_BUCKET_COUNT * sizeof(btlog_element_t*));
-		} else {
-			elem_hash_buffer = (vm_address_t)pmap_steal_memory(2 * sizeof(btlog_element_t*));
-		}
+		elem_hash_buffer = (vm_address_t)pmap_steal_memory(hashsize_needed);
 		ret = KERN_SUCCESS;
 	}
 
 	btlog = (btlog_t *)buffer;
 	btlog->btlog_buffer = buffer;
 	btlog->btlog_buffersize = buffersize_needed;
-	btlog->freelist_elements = (btlog_element_t *)elem_buffer;
-
-	simple_lock_init(&btlog->btlog_lock, 0);
+	btlog->btlog_elem_buffer = elem_buffer;
+	btlog->btlog_elem_buffersize = elemsize_needed;
+	btlog->btlog_hash_buffer = elem_hash_buffer;
+	btlog->btlog_hash_buffersize = hashsize_needed;
+	btlog->btlog_stolen = !kmem_alloc_ready;
 
 	btlog->caller_will_remove_entries_for_element = caller_will_remove_entries_for_element;
 
-	if (caller_will_remove_entries_for_element == TRUE) {
-		btlog->elem_linkage_un.elem_recindex_hashtbl = (btlog_element_t **)elem_hash_buffer;
-	} else {
-		btlog->elem_linkage_un.element_hash_queue = (struct _element_hash_queue*) elem_hash_buffer;
-		TAILQ_INIT(btlog->elem_linkage_un.element_hash_queue);
-	}
-
-	btlog->btrecords = (uintptr_t)(buffer + sizeof(btlog_t));
+	btlog->btrecords = (uintptr_t)(buffer + header_size);
+	btlog->btrecord_count = numrecords;
 	btlog->btrecord_btdepth = record_btdepth;
 	btlog->btrecord_size = btrecord_size;
+	btlog->shard_count = shard_count;
 
-	btlog->head = BTLOG_RECORDINDEX_NONE;
-	btlog->tail = BTLOG_RECORDINDEX_NONE;
-	btlog->active_record_count = 0;
-	btlog->activerecord = BTLOG_RECORDINDEX_NONE;
+	records_per_shard = numrecords / shard_count;
+	elems_per_shard = zelems_count / shard_count;
 
-	for (i=0; i < ELEMENT_HASH_BUCKET_COUNT; i++) {
-		btlog->elem_linkage_un.elem_recindex_hashtbl[i]=0;
-	}
+	for (s = 0; s < shard_count; s++) {
+		btlog_shard_t *shard = &btlog->shards[s];
+		size_t first_record = s * records_per_shard;
+		size_t last_record = (s == shard_count - 1) ? numrecords - 1 : first_record + records_per_shard - 1;
+		size_t nelems = (s == shard_count - 1) ? zelems_count - s * elems_per_shard : elems_per_shard;
 
-	/* populate freelist_records with all records in order */
-	btlog->freelist_records = 0;
-	for (i=0; i < (numrecords - 1); i++) {
-		btlog_record_t *rec = lookup_btrecord(btlog, i);
-		rec->next = (btlog_recordindex_t)(i + 1);
-	}
-	lookup_btrecord(btlog, i)->next = BTLOG_RECORDINDEX_NONE; /* terminate */
+		simple_lock_init(&shard->btlog_lock, 0);
 
-	/* populate freelist_elements with all elements in order */
-	free_elem = (uintptr_t)btlog->freelist_elements;
+		if (caller_will_remove_entries_for_element == TRUE) {
+			shard->elem_linkage_un.elem_recindex_hashtbl =
+			    (btlog_element_t **)elem_hash_buffer + s * ELEMENT_HASH_BUCKET_COUNT;
+			for (i=0; i < ELEMENT_HASH_BUCKET_COUNT; i++) {
+				shard->elem_linkage_un.elem_recindex_hashtbl[i]=0;
+			}
+		} else {
+			shard->elem_linkage_un.element_hash_queue = (struct _element_hash_queue *)elem_hash_buffer + s;
+			TAILQ_INIT(shard->elem_linkage_un.element_hash_queue);
+		}
 
-	for (i=0; i < (zelems_count - 1); i++) {
+		shard->head = BTLOG_RECORDINDEX_NONE;
+		shard->tail = BTLOG_RECORDINDEX_NONE;
+		shard->active_record_count = 0;
+		shard->active_element_count = 0;
+		shard->activerecord = BTLOG_RECORDINDEX_NONE;
+		shard->record_count = last_record - first_record + 1;
 
-		next_free_elem = free_elem + sizeof(btlog_element_t);
-		*(uintptr_t*)free_elem = next_free_elem;
-		free_elem = next_free_elem;
+		for (i=0; i < BTLOG_RECORD_HASH_COUNT; i++) {
+			shard->record_hashtbl[i] = BTLOG_RECORDINDEX_NONE;
+		}
+
+		/* populate freelist_records with this shard's records in order */
+		shard->freelist_records = (btlog_recordindex_t)first_record;
+		for (i=first_record; i <= last_record; i++) {
+			btlog_record_t *rec = lookup_btrecord(btlog, i);
+			rec->next = (i == last_record) ? BTLOG_RECORDINDEX_NONE : (btlog_recordindex_t)(i + 1);
+			rec->hash_next = BTLOG_RECORDINDEX_NONE;
+			rec->bthash = 0;
+			rec->gen = 0;
+		}
+
+		/* populate freelist_elements with this shard's elements in order */
+		shard->freelist_elements = (btlog_element_t *)elem_buffer + s * elems_per_shard;
+		free_elem = next_free_elem = (uintptr_t)shard->freelist_elements;
+
+		for (i=0; i < (nelems - 1); i++) {
+
+			next_free_elem = free_elem + sizeof(btlog_element_t);
+			*(uintptr_t*)free_elem = next_free_elem;
+			free_elem = next_free_elem;
+		}
+		*(uintptr_t*)next_free_elem = BTLOG_HASHELEMINDEX_NONE;
 	}
-	*(uintptr_t*)next_free_elem = BTLOG_HASHELEMINDEX_NONE;
 
 	return btlog;
 }
 
-/* Assumes btlog is already locked */
+void
+btlog_destroy(btlog_t *btlog)
+{
+	if (btlog->btlog_stolen)
+		panic("btlog_destroy: btlog %p was created before kmem was ready\n", btlog);
+
+	kmem_free(kernel_map, btlog->btlog_hash_buffer, btlog->btlog_hash_buffersize);
+	kmem_free(kernel_map, btlog->btlog_elem_buffer, btlog->btlog_elem_buffersize);
+	kmem_free(kernel_map, btlog->btlog_buffer, btlog->btlog_buffersize);
+}
+
+/* Assumes shard is already locked */
 static btlog_recordindex_t
-btlog_get_record_from_freelist(btlog_t *btlog)
+btlog_get_record_from_freelist(btlog_t *btlog, btlog_shard_t *shard)
 {
-	btlog_recordindex_t	recindex = btlog->freelist_records;
+	btlog_recordindex_t	recindex = shard->freelist_records;
 
 	if (recindex == BTLOG_RECORDINDEX_NONE) {
 		/* nothing on freelist */
@@ -379,13 +476,34 @@ btlog_get_record_from_freelist(btlog_t *btlog)
 	} else {
 		/* remove the head of the freelist_records */
 		btlog_record_t *record = lookup_btrecord(btlog, recindex);
-		btlog->freelist_records = record->next;
+		shard->freelist_records = record->next;
 		return recindex;
 	}
 }
 
+/* Assumes shard is already locked */
+static void
+btlog_remove_record_from_hashtbl(btlog_t *btlog, btlog_shard_t *shard, btlog_recordindex_t recindex)
+{
+	btlog_record_t *record = lookup_btrecord(btlog, recindex);
+	btlog_recordindex_t *linkp = &shard->record_hashtbl[record->bthash & (BTLOG_RECORD_HASH_COUNT - 1)];
+
+	/*
+	 * Unlocked lookups may still be walking through this record, so its
+	 * own hash_next is left alone until it is reused.
+	 */
+	while (*linkp != BTLOG_RECORDINDEX_NONE) {
+		if (*linkp == recindex) {
+			*linkp = record->hash_next;
+			return;
+		}
+		linkp = &lookup_btrecord(btlog, *linkp)->hash_next;
+	}
+	panic("BTLog: record %u missing from its hash chain\n", recindex);
+}
+
 static void
-btlog_add_record_to_freelist(btlog_t *btlog, btlog_recordindex_t recindex)
+btlog_add_record_to_freelist(btlog_t *btlog, btlog_shard_t *shard, btlog_recordindex_t recindex)
 {
 	btlog_recordindex_t precindex = BTLOG_RECORDINDEX_NONE;
 	btlog_record_t *precord = NULL, *record = NULL;
@@ -394,34 +512,36 @@ btlog_add_record_to_freelist(btlog_t *btlog, btlog_recordindex_t recindex)
 
 	assert(TAILQ_EMPTY(&record->element_record_queue));
 
+	btlog_remove_record_from_hashtbl(btlog, shard, recindex);
+	record->gen += 2;
 	record->bthash = 0;
 
-	precindex = btlog->head;
+	precindex = shard->head;
 	precord = lookup_btrecord(btlog, precindex);
 
 	if (precindex == recindex) {
-		btlog->head = precord->next;
-		btlog->active_record_count--;
+		shard->head = precord->next;
+		shard->active_record_count--;
 
-		record->next = btlog->freelist_records;
-		btlog->freelist_records = recindex;
+		record->next = shard->freelist_records;
+		shard->freelist_records = recindex;
 	
-		if (btlog->head == BTLOG_RECORDINDEX_NONE) {
+		if (shard->head == BTLOG_RECORDINDEX_NONE) {
 			/* active list is now empty, update tail */
-			btlog->tail = BTLOG_RECORDINDEX_NONE;
-			assert(btlog->active_record_count == 0);
+			shard->tail = BTLOG_RECORDINDEX_NONE;
+			assert(shard->active_record_count == 0);
 		}
 	} else {
 		while (precindex != BTLOG_RECORDINDEX_NONE) {
 			if (precord->next == recindex) {
 				precord->next = record->next;
-				btlog->active_record_count--;
+				shard->active_record_count--;
 
-				record->next = btlog->freelist_records;
-				btlog->freelist_records = recindex;
+				record->next = shard->freelist_records;
+				shard->freelist_records = recindex;
 
-				if (btlog->tail == recindex) {
-					btlog->tail = precindex;
+				if (shard->tail == recindex) {
+					shard->tail = precindex;
 				}
 				break;
 			} else {
@@ -433,11 +553,11 @@ btlog_add_record_to_freelist(btlog_t *btlog, btlog_recordindex_t recindex)
 }
 
 
-/* Assumes btlog is already locked */
+/* Assumes shard is already locked */
 static void
-btlog_evict_elements_from_record(btlog_t *btlog, int num_elements_to_evict)
+btlog_evict_elements_from_record(btlog_t *btlog, btlog_shard_t *shard, int num_elements_to_evict)
 {
-	btlog_recordindex_t	recindex = btlog->head;
+	btlog_recordindex_t	recindex = shard->head;
 	btlog_record_t		*record = NULL;
 	btlog_element_t		*recelem = NULL;
 
@@ -456,14 +576,14 @@ btlog_evict_elements_from_record(btlog_t *btlog, int num_elements_to_evict)
 				uint32_t		max_refs_threshold = UINT32_MAX;
 				btlog_recordindex_t	precindex = 0, prev_evictindex = 0, evict_index = 0;
 
-				prev_evictindex = evict_index = btlog->head;
-				precindex = recindex = btlog->head;	
+				prev_evictindex = evict_index = shard->head;
+				precindex = recindex = shard->head;	
 
 				while (recindex != BTLOG_RECORDINDEX_NONE) {
 
 					record	= lookup_btrecord(btlog, recindex);
 
-					if (btlog->activerecord == recindex || record->ref_count > max_refs_threshold) {
+					if (shard->activerecord == recindex || record->ref_count > max_refs_threshold) {
 							/* skip this record */
 					} else {
 						prev_evictindex = precindex;
@@ -485,7 +605,7 @@ btlog_evict_elements_from_record(btlog_t *btlog, int num_elements_to_evict)
 				recelem = TAILQ_LAST(&record->element_record_queue, _element_record_queue);
 			} else {
 
-				recelem = TAILQ_LAST(btlog->elem_linkage_un.element_hash_queue, _element_hash_queue);
+				recelem = TAILQ_LAST(shard->elem_linkage_un.element_hash_queue, _element_hash_queue);
 				recindex = recelem->recindex;
 				record = lookup_btrecord(btlog, recindex);
 			}
@@ -505,7 +625,7 @@ btlog_evict_elements_from_record(btlog_t *btlog, int num_elements_to_evict)
 					
 					hashidx = calculate_hashidx_for_element(~recelem->elem, btlog);
 
-					prev_hashelem = hashelem = btlog->elem_linkage_un.elem_recindex_hashtbl[hashidx];
+					prev_hashelem = hashelem = shard->elem_linkage_un.elem_recindex_hashtbl[hashidx];
 					while (hashelem != NULL) {
 						if (hashelem == recelem)
 							break;
@@ -522,15 +642,15 @@ btlog_evict_elements_from_record(btlog_t *btlog, int num_elements_to_evict)
 					if (prev_hashelem != hashelem) {
 						TAILQ_NEXT(prev_hashelem, element_hash_link) = TAILQ_NEXT(hashelem, element_hash_link);
 					} else {
-						btlog->elem_linkage_un.elem_recindex_hashtbl[hashidx] = TAILQ_NEXT(hashelem, element_hash_link);
+						shard->elem_linkage_un.elem_recindex_hashtbl[hashidx] = TAILQ_NEXT(hashelem, element_hash_link);
 					}
 				} else {
 				
-					TAILQ_REMOVE(btlog->elem_linkage_un.element_hash_queue, recelem, element_hash_link);
+					TAILQ_REMOVE(shard->elem_linkage_un.element_hash_queue, recelem, element_hash_link);
 				}
 
-				btlog_add_elem_to_freelist(btlog, recelem);
-				btlog->active_element_count--;
+				btlog_add_elem_to_freelist(shard, recelem);
+				shard->active_element_count--;
 
 				num_elements_to_evict--;
 
@@ -540,7 +660,7 @@ btlog_evict_elements_from_record(btlog_t *btlog, int num_elements_to_evict)
 
 				if (record->ref_count == 0) {
 
-					btlog_add_record_to_freelist(btlog, recindex);
+					btlog_add_record_to_freelist(btlog, shard, recindex);
 				
 					/*
 					 * LEAKS: All done with this record. Need the next least popular record.
@@ -556,7 +676,7 @@ btlog_evict_elements_from_record(btlog_t *btlog, int num_elements_to_evict)
 					recelem = TAILQ_LAST(&record->element_record_queue, _element_record_queue);
 				} else {
 
-					recelem = TAILQ_LAST(btlog->elem_linkage_un.element_hash_queue, _element_hash_queue);
+					recelem = TAILQ_LAST(shard->elem_linkage_un.element_hash_queue, _element_hash_queue);
 					recindex = recelem->recindex;
 					record = lookup_btrecord(btlog, recindex);
 				}
@@ -565,54 +685,54 @@ btlog_evict_elements_from_record(btlog_t *btlog, int num_elements_to_evict)
 	}
 }
 
-/* Assumes btlog is already locked */
+/* Assumes shard is already locked */
 static void
-btlog_append_record_to_activelist(btlog_t *btlog, btlog_recordindex_t recindex)
+btlog_append_record_to_activelist(btlog_t *btlog, btlog_shard_t *shard, btlog_recordindex_t recindex)
 {
 	
 	assert(recindex != BTLOG_RECORDINDEX_NONE);
 
-	if (btlog->head == BTLOG_RECORDINDEX_NONE) {
+	if (shard->head == BTLOG_RECORDINDEX_NONE) {
 		/* empty active list, update both head and tail */
-		btlog->head = btlog->tail = recindex;
+		shard->head = shard->tail = recindex;
 	} else {
-		btlog_record_t *record = lookup_btrecord(btlog, btlog->tail);
+		btlog_record_t *record = lookup_btrecord(btlog, shard->tail);
 		record->next = recindex;
-		btlog->tail = recindex;
+		shard->tail = recindex;
 	}
-	btlog->active_record_count++;
+	shard->active_record_count++;
 }
 
 btlog_element_t*
-btlog_get_elem_from_freelist(btlog_t *btlog)
+btlog_get_elem_from_freelist(btlog_t *btlog, btlog_shard_t *shard)
 {
 	btlog_element_t *free_elem = NULL;
 
 retry:
-	free_elem = btlog->freelist_elements;
+	free_elem = shard->freelist_elements;
 
 	if ((uintptr_t)free_elem == BTLOG_HASHELEMINDEX_NONE) {
 		/* nothing on freelist */
-		btlog_evict_elements_from_record(btlog, 1);
+		btlog_evict_elements_from_record(btlog, shard, 1);
 		goto retry;
 	} else {
 		/* remove the head of the freelist */
 		uintptr_t next_elem = *(uintptr_t*)free_elem;
-		btlog->freelist_elements = (btlog_element_t *)next_elem;
+		shard->freelist_elements = (btlog_element_t *)next_elem;
 		return free_elem;
 	}
 }
 
 void
-btlog_add_elem_to_freelist(btlog_t *btlog, btlog_element_t *elem)
+btlog_add_elem_to_freelist(btlog_shard_t *shard, btlog_element_t *elem)
 {
-	btlog_element_t *free_elem = btlog->freelist_elements;
+	btlog_element_t *free_elem = shard->freelist_elements;
 
 	TAILQ_NEXT(elem, element_hash_link) = (btlog_element_t *) BTLOG_HASHELEMINDEX_NONE;
 	TAILQ_NEXT(elem, element_record_link) = (btlog_element_t *) BTLOG_HASHELEMINDEX_NONE;
 
 	*(uintptr_t*)elem = (uintptr_t)free_elem;
-	btlog->freelist_elements = elem;
+	shard->freelist_elements = elem;
 }
 
 void
@@ -624,25 +744,39 @@ btlog_add_entry(btlog_t *btlog,
 {
 	btlog_recordindex_t	recindex = 0;
 	btlog_record_t		*record = NULL;
+	btlog_shard_t		*shard = NULL;
 	size_t			i;
 	u_int32_t		md5_buffer[4];
 	MD5_CTX			btlog_ctx;
 	uint32_t		hashidx = 0;
+	uint32_t		gen = 0;
 
 	btlog_element_t	*hashelem = NULL;
 
 	if (g_crypto_funcs == NULL)
 		return;
 
-	btlog_lock(btlog);
-
+	/* hashing the stack and finding its record don't need the lock */
 	MD5Init(&btlog_ctx);
 	for (i=0; i < MIN(btcount, btlog->btrecord_btdepth); i++) {
 		MD5Update(&btlog_ctx, (u_char *) &bt[i], sizeof(bt[i]));
 	}
 	MD5Final((u_char *) &md5_buffer, &btlog_ctx);
 
-	recindex = lookup_btrecord_byhash(btlog, md5_buffer[0], bt, btcount);
+	shard = btlog_shard_for_element(btlog, (uintptr_t)element);
+	recindex = lookup_btrecord_byhash(btlog, shard, md5_buffer[0], bt, btcount, &gen);
+
+	btlog_lock(shard);
+
+	if (recindex != BTLOG_RECORDINDEX_NONE &&
+	    lookup_btrecord(btlog, recindex)->gen != gen) {
+		/* the record was recycled before we got the lock */
+		recindex = BTLOG_RECORDINDEX_NONE;
+	}
+	if (recindex == BTLOG_RECORDINDEX_NONE) {
+		/* look again so racing threads don't create the same record twice */
+		recindex = lookup_btrecord_byhash(btlog, shard, md5_buffer[0], bt, btcount, &gen);
+	}
 
 	if (recindex != BTLOG_RECORDINDEX_NONE) {
 		
@@ -650,17 +784,22 @@ btlog_add_entry(btlog_t *btlog,
 		record->ref_count++;
 		assert(record->operation == operation);
 	} else {
+		uint32_t bucket = md5_buffer[0] & (BTLOG_RECORD_HASH_COUNT - 1);
 retry:
 		/* If there's a free record, use it */
-		recindex = btlog_get_record_from_freelist(btlog);
+		recindex = btlog_get_record_from_freelist(btlog, shard);
 		if (recindex == BTLOG_RECORDINDEX_NONE) {
 			/* Use the first active record (FIFO age-out) */
-			btlog_evict_elements_from_record(btlog, ((2 * sizeof(btlog_record_t))/sizeof(btlog_element_t)));
+			btlog_evict_elements_from_record(btlog, shard, ((2 * sizeof(btlog_record_t))/sizeof(btlog_element_t)));
 			goto retry;
 		}
 
 		record = lookup_btrecord(btlog, recindex);
 
+		/* unlocked lookups ignore the record while its generation is odd */
+		record->gen++;
+		os_compiler_barrier();
+
 		/* we always add to the tail, so there is no next pointer */
 		record->next = BTLOG_RECORDINDEX_NONE;
 		record->operation = operation;
@@ -676,13 +815,18 @@ retry:
 			record->bt[i] = NULL;
 		}
 
-		btlog_append_record_to_activelist(btlog, recindex);
+		record->hash_next = shard->record_hashtbl[bucket];
+		os_compiler_barrier();
+		record->gen++;
+		shard->record_hashtbl[bucket] = recindex;
+
+		btlog_append_record_to_activelist(btlog, shard, recindex);
 	}
 
-	btlog->activerecord = recindex;
+	shard->activerecord = recindex;
 
 	hashidx = calculate_hashidx_for_element((uintptr_t)element, btlog);
-	hashelem = btlog_get_elem_from_freelist(btlog);
+	hashelem = btlog_get_elem_from_freelist(btlog, shard);
 
 	assert(record->bthash);
 
@@ -693,18 +837,18 @@ retry:
 	TAILQ_INSERT_HEAD(&record->element_record_queue, hashelem, element_record_link);
 
 	if (btlog->caller_will_remove_entries_for_element) {
-		TAILQ_NEXT(hashelem, element_hash_link) = btlog->elem_linkage_un.elem_recindex_hashtbl[hashidx];
-		btlog->elem_linkage_un.elem_recindex_hashtbl[hashidx] = hashelem;
+		TAILQ_NEXT(hashelem, element_hash_link) = shard->elem_linkage_un.elem_recindex_hashtbl[hashidx];
+		shard->elem_linkage_un.elem_recindex_hashtbl[hashidx] = hashelem;
 
 	} else {
-		TAILQ_INSERT_HEAD(btlog->elem_linkage_un.element_hash_queue, hashelem, element_hash_link);
+		TAILQ_INSERT_HEAD(shard->elem_linkage_un.element_hash_queue, hashelem, element_hash_link);
 	}
 
-	btlog->active_element_count++;
+	shard->active_element_count++;
 
-	btlog->activerecord = BTLOG_RECORDINDEX_NONE;
+	shard->activerecord = BTLOG_RECORDINDEX_NONE;
 
-	btlog_unlock(btlog);
+	btlog_unlock(shard);
 }
 
 void
@@ -713,6 +857,7 @@ btlog_remove_entries_for_element(btlog_t *btlog,
 {
 	btlog_recordindex_t	recindex = BTLOG_RECORDINDEX_NONE;
 	btlog_record_t		*record = NULL;
+	btlog_shard_t		*shard = NULL;
 	uint32_t		hashidx = 0;
 	
 	btlog_element_t	*prev_hashelem = NULL, *hashelem = NULL;
@@ -724,10 +869,12 @@ btlog_remove_entries_for_element(btlog_t *btlog,
 	if (g_crypto_funcs == NULL)
 		return;
 
-	btlog_lock(btlog);
+	shard = btlog_shard_for_element(btlog, (uintptr_t)element);
+
+	btlog_lock(shard);
 
 	hashidx = calculate_hashidx_for_element((uintptr_t) element, btlog);
-	prev_hashelem = hashelem = btlog->elem_linkage_un.elem_recindex_hashtbl[hashidx];
+	prev_hashelem = hashelem = shard->elem_linkage_un.elem_recindex_hashtbl[hashidx];
 
 	while (hashelem != NULL) {
 		if (~hashelem->elem == (uintptr_t)element)
@@ -746,7 +893,7 @@ btlog_remove_entries_for_element(btlog_t *btlog,
 			TAILQ_NEXT(prev_hashelem, element_hash_link) = TAILQ_NEXT(hashelem, element_hash_link);
 		} else {
 		
-			btlog->elem_linkage_un.elem_recindex_hashtbl[hashidx] = TAILQ_NEXT(hashelem, element_hash_link);
+			shard->elem_linkage_un.elem_recindex_hashtbl[hashidx] = TAILQ_NEXT(hashelem, element_hash_link);
 		}
 
 		recindex = hashelem->recindex;
@@ -755,19 +902,19 @@ btlog_remove_entries_for_element(btlog_t *btlog,
 		recelem = hashelem;
 		TAILQ_REMOVE(&record->element_record_queue, recelem, element_record_link);
 
-		btlog_add_elem_to_freelist(btlog, hashelem);
-		btlog->active_element_count--;
+		btlog_add_elem_to_freelist(shard, hashelem);
+		shard->active_element_count--;
 
 		assert(record->ref_count);
 
 		record->ref_count--;
 
 		if (record->ref_count == 0) {
-			btlog_add_record_to_freelist(btlog, recindex);
+			btlog_add_record_to_freelist(btlog, shard, recindex);
 		}
 	}
 
-	btlog_unlock(btlog);
+	btlog_unlock(shard);
 }
 
 #if DEBUG || DEVELOPMENT
@@ -783,11 +930,14 @@ btlog_copy_backtraces_for_elements(btlog_t      * btlog,
 	btlog_recordindex_t	  recindex;
 	btlog_record_t		* record;
 	btlog_element_t	    * hashelem;
-	uint32_t		      hashidx, idx, dups, numSites, siteCount;
+	btlog_shard_t	    * shard;
+	uint32_t		      hashidx, idx, dups, numSites, siteCount, s;
 	uintptr_t             element, site;
     uint32_t              count;
 
-	btlog_lock(btlog);
+    /* records are handed to proc, so hold every shard for the duration */
+    for (s = 0; s < btlog->shard_count; s++)
+        btlog_lock(&btlog->shards[s]);
 
     count = *countp;
     for (numSites = 0, idx = 0; idx < count; idx++)
@@ -798,8 +948,9 @@ btlog_copy_backtraces_for_elements(btlog_t      * btlog,
         element = INSTANCE_PUT(element) & ~kInstanceFlags;
 
         site = 0;
+        shard = btlog_shard_for_element(btlog, element);
         hashidx = calculate_hashidx_for_element(element, btlog);
-        hashelem = btlog->elem_linkage_un.elem_recindex_hashtbl[hashidx];
+        hashelem = shard->elem_linkage_un.elem_recindex_hashtbl[hashidx];
         while (hashelem != NULL)
         {
             if (~hashelem->elem == element) break;
@@ -834,7 +985,8 @@ btlog_copy_backtraces_for_elements(btlog_t      * btlog,
 
     *countp = numSites;
 
-	btlog_unlock(btlog);
+    for (s = btlog->shard_count; s > 0; s--)
+        btlog_unlock(&btlog->shards[s - 1]);
 }
 
 #endif  /* DEBUG || DEVELOPMENT */
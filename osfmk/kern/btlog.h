@@ -49,6 +49,10 @@
  * When the event buffer fills, records are reused in FIFO
  * order.
  *
+ * Large btlogs are split into shards by element address, each
+ * with its own lock, so logging unrelated elements from several
+ * CPUs doesn't serialize.  Ordering is kept per element only.
+ *
  * When a btlog_t is created, callbacks can be provided
  * to ensure proper locking of the datastructures. If these
  * are not provided, the caller is responsible for
@@ -71,6 +75,8 @@ extern btlog_t *btlog_create(size_t numrecords,
                              size_t record_btdepth,
 			     boolean_t caller_will_remove_entries_for_element);
 
+extern void btlog_destroy(btlog_t *btlog);
+
 extern void btlog_add_entry(btlog_t *btlog,
                             void *element,
                             uint8_t operation,
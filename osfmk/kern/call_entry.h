@@ -111,10 +111,27 @@ call_entry_enqueue_deadline(
 	call_entry_t	current;
 
 	if (old_queue != queue || entry->deadline < deadline) {
-		if (old_queue == NULL) {
-			current = CE(queue_first(queue));
-		} else if (old_queue != queue) {
-			(void)remque(qe(entry));
+		if (old_queue != queue) {
+			if (old_queue != NULL)
+				(void)remque(qe(entry));
+
+			/*
+			 * New arrivals mostly land near the far end of the
+			 * queue: when the deadline is in its later half, search
+			 * back from the tail instead, which appends in constant
+			 * time. Equal deadlines stay in arrival order either way.
+			 */
+			current = CE(queue_last(queue));
+			if (!queue_end(queue, qe(current)) &&
+			    deadline >= CE(queue_first(queue))->deadline +
+			    ((current->deadline - CE(queue_first(queue))->deadline) >> 1)) {
+				while (!queue_end(queue, qe(current)) &&
+				    deadline < current->deadline)
+					current = CE(queue_prev(qe(current)));
+
+				insque(qe(entry), qe(current));
+				goto done;
+			}
 			current = CE(queue_first(queue));
 		} else {
 			current = CE(queue_next(qe(entry)));
@@ -147,6 +164,7 @@ call_entry_enqueue_deadline(
 		}
 		insque(qe(entry), qe(current));
 	}
+done:
 	entry->queue = queue;
 	entry->deadline = deadline;
 
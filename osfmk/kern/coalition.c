@@ -36,6 +36,7 @@
 #include <kern/ledger.h>
 #include <kern/mach_param.h> /* for TASK_CHUNK */
 #include <kern/task.h>
+#include <kern/thread_call.h>
 #include <kern/zalloc.h>
 
 #include <libkern/OSAtomic.h>
@@ -50,6 +51,7 @@
  * BSD interface functions
  */
 int coalitions_get_list(int type, struct procinfo_coalinfo *coal_list, int list_sz);
+int coalitions_get_resource_usage(struct procinfo_coalusage *usage_list, int list_sz);
 boolean_t coalition_is_leader(task_t task, int coal_type, coalition_t *coal);
 task_t coalition_get_leader(coalition_t coal);
 int coalition_get_task_count(coalition_t coal);
@@ -79,6 +81,22 @@ static uint64_t coalition_count;
 static uint64_t coalition_next_id = 1;
 static queue_head_t coalitions_q;
 
+/*
+ * Resource coalition usage is folded into running totals: a task's final
+ * usage when it exits, and its usage so far by a periodic fold of every
+ * coalition, so that a snapshot is a copy of the totals.  The periodic fold
+ * runs while anyone takes snapshots and stops after
+ * COALITION_FOLD_IDLE_PERIODS periods without one; a snapshot of a
+ * coalition not folded within the last period folds it first.
+ */
+#define COALITION_FOLD_INTERVAL_MS	1000
+#define COALITION_FOLD_IDLE_PERIODS	10
+
+static uint64_t coalition_fold_interval;	/* abstime */
+static volatile uint64_t coalition_fold_last_read;
+static volatile UInt32 coalition_fold_armed;
+static thread_call_t coalition_fold_call;
+
 coalition_t init_coalition[COALITION_NUM_TYPES];
 coalition_t corpse_coalition[COALITION_NUM_TYPES];
 
@@ -167,14 +185,14 @@ static void          i_coal_resource_iterate_tasks(coalition_t coal, void *ctx,
 
 struct i_resource_coalition {
 	ledger_t ledger;
-	uint64_t bytesread;
-	uint64_t byteswritten;
 	uint64_t energy;
-	uint64_t gpu_time;
-	uint64_t logical_immediate_writes;
-	uint64_t logical_deferred_writes;
-	uint64_t logical_invalidated_writes;
-	uint64_t logical_metadata_writes;
+
+	/*
+	 * Usage of the dead tasks, plus that of the live tasks as of their
+	 * last fold (see task->coalition_folded_usage).
+	 */
+	struct coalition_resource_usage usage;
+	uint64_t last_fold_time;
 
 	uint64_t task_count;      /* tasks that have started in this coalition */
 	uint64_t dead_task_count; /* tasks that have exited in this coalition;
@@ -307,6 +325,207 @@ coalition_notify_user(uint64_t id, uint32_t flags)
  * COALITION_TYPE_RESOURCE
  *
  */
+
+/*
+ * Gather a member task's usage so far.  An exiting task's billed CPU time
+ * comes from its ledger; a live task's from its bank linkages, since its
+ * ledger doesn't yet have the time for active ones.  Exec copy and exec'd
+ * tasks count for nothing, as rolling them up would double count.
+ */
+static void
+i_coal_resource_task_usage(task_t task, boolean_t exiting,
+			   struct coalition_resource_usage *cru)
+{
+	ledger_amount_t credit, debit, billed;
+
+	bzero(cru, sizeof(*cru));
+
+	if (task_is_exec_copy(task) || task_did_exec(task))
+		return;
+
+	if (ledger_get_entries(task->ledger, task_ledgers.cpu_time, &credit, &debit) == KERN_SUCCESS)
+		cru->cpu_time = credit;
+	if (ledger_get_entries(task->ledger, task_ledgers.interrupt_wakeups, &credit, &debit) == KERN_SUCCESS)
+		cru->interrupt_wakeups = credit;
+	if (ledger_get_entries(task->ledger, task_ledgers.platform_idle_wakeups, &credit, &debit) == KERN_SUCCESS)
+		cru->platform_idle_wakeups = credit;
+
+	cru->bytesread = task->task_io_stats->disk_reads.size;
+	cru->byteswritten = task->task_io_stats->total_io.size - task->task_io_stats->disk_reads.size;
+	cru->gpu_time = task_gpu_utilisation(task);
+	cru->logical_immediate_writes = task->task_immediate_writes;
+	cru->logical_deferred_writes = task->task_deferred_writes;
+	cru->logical_invalidated_writes = task->task_invalidated_writes;
+	cru->logical_metadata_writes = task->task_metadata_writes;
+
+	if (exiting) {
+		if (ledger_get_balance(task->ledger, task_ledgers.cpu_time_billed_to_me, &billed) == KERN_SUCCESS &&
+		    billed > 0)
+			cru->cpu_time_billed_to_me = (uint64_t)billed;
+		if (ledger_get_balance(task->ledger, task_ledgers.cpu_time_billed_to_others, &billed) == KERN_SUCCESS &&
+		    billed > 0)
+			cru->cpu_time_billed_to_others = (uint64_t)billed;
+	} else {
+		cru->cpu_time_billed_to_me = bank_billed_time_safe(task);
+		cru->cpu_time_billed_to_others = bank_serviced_time_safe(task);
+	}
+}
+
+/*
+ * Add what a member task has used since its last fold to the coalition's
+ * totals.  The differences are unsigned, so a counter that went backwards
+ * (an exec, or billed time moving from bank to ledger) still sums right.
+ * pre-condition: coalition locked
+ */
+static void
+i_coal_resource_fold_task(coalition_t coal, task_t task, boolean_t exiting)
+{
+	struct coalition_resource_usage cru;
+	struct coalition_resource_usage *total = &coal->r.usage;
+	struct coalition_resource_usage *folded = &task->coalition_folded_usage;
+
+	i_coal_resource_task_usage(task, exiting, &cru);
+
+#define FOLD(field) (total->field += cru.field - folded->field)
+	FOLD(cpu_time);
+	FOLD(interrupt_wakeups);
+	FOLD(platform_idle_wakeups);
+	FOLD(bytesread);
+	FOLD(byteswritten);
+	FOLD(gpu_time);
+	FOLD(cpu_time_billed_to_me);
+	FOLD(cpu_time_billed_to_others);
+	FOLD(logical_immediate_writes);
+	FOLD(logical_deferred_writes);
+	FOLD(logical_invalidated_writes);
+	FOLD(logical_metadata_writes);
+#undef FOLD
+
+	*folded = cru;
+}
+
+/*
+ * pre-condition: coalition locked
+ */
+static void
+i_coal_resource_fold(coalition_t coal, uint64_t now)
+{
+	task_t task;
+
+	qe_foreach_element(task, &coal->r.tasks, task_coalition[COALITION_TYPE_RESOURCE]) {
+		i_coal_resource_fold_task(coal, task, FALSE);
+	}
+	coal->r.last_fold_time = now;
+}
+
+/*
+ * Take a reference on every live resource coalition but the corpse one, so
+ * that they can be folded without holding coalitions_list_lock.  Returns
+ * the number of coalitions referenced; release them, and free *coalsp,
+ * with coalition_resource_refs_release().
+ * Condition: coalitions_list_lock must be UNLOCKED.
+ */
+static int
+coalition_resource_refs_get(coalition_t **coalsp, vm_size_t *sizep)
+{
+	coalition_t *coals;
+	coalition_t coal;
+	vm_size_t size;
+	uint64_t max;
+	int n = 0;
+
+	for (;;) {
+		lck_mtx_lock(&coalitions_list_lock);
+		max = coalition_count;
+		lck_mtx_unlock(&coalitions_list_lock);
+
+		if (max == 0)
+			return 0;
+		size = (vm_size_t)max * sizeof(coalition_t);
+		coals = (coalition_t *)kalloc(size);
+		if (coals == NULL)
+			return 0;
+
+		lck_mtx_lock(&coalitions_list_lock);
+		if (coalition_count <= max)
+			break;
+		lck_mtx_unlock(&coalitions_list_lock);
+		kfree(coals, size);
+	}
+
+	qe_foreach_element(coal, &coalitions_q, coalitions) {
+		if (coal->type != COALITION_TYPE_RESOURCE ||
+		    coal == corpse_coalition[COALITION_TYPE_RESOURCE])
+			continue;
+		coalition_lock(coal);
+		if (!coal->reaped) {
+			coal->ref_count++;
+			coals[n++] = coal;
+		}
+		coalition_unlock(coal);
+	}
+	lck_mtx_unlock(&coalitions_list_lock);
+
+	*coalsp = coals;
+	*sizep = size;
+	return n;
+}
+
+static void
+coalition_resource_refs_release(coalition_t *coals, vm_size_t size, int n)
+{
+	int i;
+
+	if (coals == NULL)
+		return;
+	for (i = 0; i < n; i++)
+		coalition_release(coals[i]);
+	kfree(coals, size);
+}
+
+static void
+coalition_fold_periodic(__unused thread_call_param_t p0, __unused thread_call_param_t p1)
+{
+	coalition_t *coals = NULL;
+	vm_size_t size = 0;
+	uint64_t now;
+	int i, n;
+
+	n = coalition_resource_refs_get(&coals, &size);
+	for (i = 0; i < n; i++) {
+		coalition_lock(coals[i]);
+		if (!coals[i]->reaped)
+			i_coal_resource_fold(coals[i], mach_absolute_time());
+		coalition_unlock(coals[i]);
+	}
+	coalition_resource_refs_release(coals, size, n);
+
+	now = mach_absolute_time();
+	if (coalition_fold_last_read + COALITION_FOLD_IDLE_PERIODS * coalition_fold_interval > now) {
+		thread_call_enter_delayed(coalition_fold_call, now + coalition_fold_interval);
+	} else {
+		coalition_fold_armed = 0;
+	}
+}
+
+/*
+ * Note a snapshot, starting the periodic fold if it isn't running.
+ */
+static void
+coalition_fold_arm(void)
+{
+	uint64_t now = mach_absolute_time();
+
+	coalition_fold_last_read = now;
+	if (coalition_fold_armed || !OSCompareAndSwap(0, 1, &coalition_fold_armed))
+		return;
+
+	/* Only the thread that armed the fold gets here, so this is race-free */
+	if (coalition_fold_call == NULL)
+		coalition_fold_call = thread_call_allocate(coalition_fold_periodic, NULL);
+	thread_call_enter_delayed(coalition_fold_call, now + coalition_fold_interval);
+}
+
 static kern_return_t
 i_coal_resource_init(coalition_t coal, boolean_t privileged)
 {
@@ -353,6 +572,7 @@ i_coal_resource_adopt_task(coalition_t coal, task_t task)
 
 	/* put the task on the coalition's list of tasks */
 	enqueue_tail(&cr->tasks, &task->task_coalition[COALITION_TYPE_RESOURCE]);
+	bzero(&task->coalition_folded_usage, sizeof(task->coalition_folded_usage));
 
 	coal_dbg("Added PID:%d to id:%llu, task_count:%llu, dead_count:%llu, nonempty_time:%llu",
 		 task_pid(task), coal->id, cr->task_count, cr->dead_task_count,
@@ -392,14 +612,8 @@ i_coal_resource_remove_task(coalition_t coal, task_t task)
 	/* Do not roll up for exec'd task or exec copy task */
 	if (!task_is_exec_copy(task) && !task_did_exec(task)) {
 		ledger_rollup(cr->ledger, task->ledger);
-		cr->bytesread += task->task_io_stats->disk_reads.size;
-		cr->byteswritten += task->task_io_stats->total_io.size - task->task_io_stats->disk_reads.size;
-		cr->gpu_time += task_gpu_utilisation(task);
-		cr->logical_immediate_writes += task->task_immediate_writes;
-		cr->logical_deferred_writes += task->task_deferred_writes;
-		cr->logical_invalidated_writes += task->task_invalidated_writes;
-		cr->logical_metadata_writes += task->task_metadata_writes;
 	}
+	i_coal_resource_fold_task(coal, task, TRUE);
 
 	/* remove the task from the coalition's list */
 	remqueue(&task->task_coalition[COALITION_TYPE_RESOURCE]);
@@ -443,11 +657,36 @@ i_coal_resource_iterate_tasks(coalition_t coal, void *ctx, void (*callback)(coal
 		callback(coal, ctx, t);
 }
 
+/*
+ * Snapshot a resource coalition's usage from its folded totals.
+ * pre-condition: coalition locked
+ */
+static void
+i_coal_resource_get_usage(coalition_t coal, struct coalition_resource_usage *cru_out)
+{
+	struct i_resource_coalition *cr = &coal->r;
+	uint64_t now = mach_absolute_time();
+	uint64_t time_nonempty;
+
+	if (now - cr->last_fold_time >= coalition_fold_interval) {
+		i_coal_resource_fold(coal, now);
+	}
+
+	*cru_out = cr->usage;
+	cru_out->tasks_started = cr->task_count;
+	cru_out->tasks_exited = cr->dead_task_count;
+	cru_out->energy = cr->energy;
+
+	time_nonempty = cr->time_nonempty;
+	if (cr->last_became_nonempty_time) {
+		time_nonempty += now - cr->last_became_nonempty_time;
+	}
+	absolutetime_to_nanoseconds(time_nonempty, &cru_out->time_nonempty);
+}
+
 kern_return_t
 coalition_resource_usage_internal(coalition_t coal, struct coalition_resource_usage *cru_out)
 {
-	kern_return_t kr;
-	ledger_amount_t credit, debit;
 	int i;
 
 	if (coal->type != COALITION_TYPE_RESOURCE)
@@ -460,122 +699,12 @@ coalition_resource_usage_internal(coalition_t coal, struct coalition_resource_us
 		}
 	}
 
-	ledger_t sum_ledger = ledger_instantiate(task_ledger_template, LEDGER_CREATE_ACTIVE_ENTRIES);
-	if (sum_ledger == LEDGER_NULL)
-		return KERN_RESOURCE_SHORTAGE;
+	coalition_fold_arm();
 
 	coalition_lock(coal);
-
-	/*
-	 * Start with the coalition's ledger, which holds the totals from all
-	 * the dead tasks.
-	 */
-	ledger_rollup(sum_ledger, coal->r.ledger);
-	uint64_t bytesread = coal->r.bytesread;
-	uint64_t byteswritten = coal->r.byteswritten;
-	uint64_t gpu_time = coal->r.gpu_time;
-	uint64_t energy = coal->r.energy;
-	uint64_t logical_immediate_writes = coal->r.logical_immediate_writes;
-	uint64_t logical_deferred_writes = coal->r.logical_deferred_writes;
-	uint64_t logical_invalidated_writes = coal->r.logical_invalidated_writes;
-	uint64_t logical_metadata_writes = coal->r.logical_metadata_writes;
-	int64_t cpu_time_billed_to_me = 0;
-	int64_t cpu_time_billed_to_others = 0;
-
-	kr = ledger_get_balance(sum_ledger, task_ledgers.cpu_time_billed_to_me, (int64_t *)&cpu_time_billed_to_me);
-	if (kr != KERN_SUCCESS || cpu_time_billed_to_me < 0) {
-#if DEVELOPMENT || DEBUG
-		printf("ledger_get_balance failed or ledger negative in coalition_resource_usage_internal: %lld\n", cpu_time_billed_to_me);
-#endif /* DEVELOPMENT || DEBUG */
-		cpu_time_billed_to_me = 0;
-	}
-
-	kr = ledger_get_balance(sum_ledger, task_ledgers.cpu_time_billed_to_others, (int64_t *)&cpu_time_billed_to_others);
-	if (kr != KERN_SUCCESS || cpu_time_billed_to_others < 0) {
-#if DEVELOPMENT || DEBUG
-		printf("ledger_get_balance failed or ledger negative in coalition_resource_usage_internal: %lld\n", cpu_time_billed_to_others);
-#endif /* DEVELOPMENT || DEBUG */
-		cpu_time_billed_to_others = 0;
-	}
-
-	/*
-	 * Add to that all the active tasks' ledgers. Tasks cannot deallocate
-	 * out from under us, since we hold the coalition lock.
-	 * Do not use the on-behalf of cpu time from ledger for live tasks, since
-	 * it will not have cpu time for active linkages between tasks.
-	 */
-	task_t task;
-	qe_foreach_element(task, &coal->r.tasks, task_coalition[COALITION_TYPE_RESOURCE]) {
-		/*
-		 * Rolling up stats for exec copy task or exec'd task will lead to double accounting.
-		 * Cannot take task lock after taking coaliton lock
-		 */
-		if (task_is_exec_copy(task) || task_did_exec(task)) {
-			continue;
-		}
-
-		ledger_rollup(sum_ledger, task->ledger);
-		bytesread += task->task_io_stats->disk_reads.size;
-		byteswritten += task->task_io_stats->total_io.size - task->task_io_stats->disk_reads.size;
-		gpu_time += task_gpu_utilisation(task);
-		logical_immediate_writes += task->task_immediate_writes;
-		logical_deferred_writes += task->task_deferred_writes;
-		logical_invalidated_writes += task->task_invalidated_writes;
-		logical_metadata_writes += task->task_metadata_writes;
-		cpu_time_billed_to_me += (int64_t)bank_billed_time_safe(task);
-		cpu_time_billed_to_others += (int64_t)bank_serviced_time_safe(task);
-	}
-
-	/* collect information from the coalition itself */
-	cru_out->tasks_started = coal->r.task_count;
-	cru_out->tasks_exited = coal->r.dead_task_count;
-
-	uint64_t time_nonempty = coal->r.time_nonempty;
-	uint64_t last_became_nonempty_time = coal->r.last_became_nonempty_time;
-
+	i_coal_resource_get_usage(coal, cru_out);
 	coalition_unlock(coal);
 
-	/* Copy the totals out of sum_ledger */
-	kr = ledger_get_entries(sum_ledger, task_ledgers.cpu_time,
-			&credit, &debit);
-	if (kr != KERN_SUCCESS) {
-		credit = 0;
-	}
-	cru_out->cpu_time = credit;
-	cru_out->cpu_time_billed_to_me = (uint64_t)cpu_time_billed_to_me;
-	cru_out->cpu_time_billed_to_others = (uint64_t)cpu_time_billed_to_others;
-
-	kr = ledger_get_entries(sum_ledger, task_ledgers.interrupt_wakeups,
-			&credit, &debit);
-	if (kr != KERN_SUCCESS) {
-		credit = 0;
-	}
-	cru_out->interrupt_wakeups = credit;
-
-	kr = ledger_get_entries(sum_ledger, task_ledgers.platform_idle_wakeups,
-			&credit, &debit);
-	if (kr != KERN_SUCCESS) {
-		credit = 0;
-	}
-	cru_out->platform_idle_wakeups = credit;
-
-	cru_out->bytesread = bytesread;
-	cru_out->byteswritten = byteswritten;
-	cru_out->gpu_time = gpu_time;
-	cru_out->energy = energy;
-	cru_out->logical_immediate_writes = logical_immediate_writes;
-	cru_out->logical_deferred_writes = logical_deferred_writes;
-	cru_out->logical_invalidated_writes = logical_invalidated_writes;
-	cru_out->logical_metadata_writes = logical_metadata_writes;
-
-	ledger_dereference(sum_ledger);
-	sum_ledger = LEDGER_NULL;
-
-	if (last_became_nonempty_time) {
-		time_nonempty += mach_absolute_time() - last_became_nonempty_time;
-	}
-	absolutetime_to_nanoseconds(time_nonempty, &cru_out->time_nonempty);
-
 	return KERN_SUCCESS;
 }
 
@@ -1533,6 +1662,10 @@ coalitions_init(void)
 		unrestrict_coalition_syscalls = 0;
 	}
 
+	uint32_t fold_ms = COALITION_FOLD_INTERVAL_MS;
+	(void)PE_parse_boot_argn("coalition_fold_ms", &fold_ms, sizeof (fold_ms));
+	nanoseconds_to_absolutetime((uint64_t)fold_ms * NSEC_PER_MSEC, &coalition_fold_interval);
+
 	lck_grp_attr_setdefault(&coalitions_lck_grp_attr);
 	lck_grp_init(&coalitions_lck_grp, "coalition", &coalitions_lck_grp_attr);
 	lck_attr_setdefault(&coalitions_lck_attr);
@@ -1596,6 +1729,44 @@ int coalitions_get_list(int type, struct procinfo_coalinfo *coal_list, int list_
 	return ncoals;
 }
 
+int coalitions_get_resource_usage(struct procinfo_coalusage *usage_list, int list_sz)
+{
+	int ncoals = 0;
+	struct coalition *coal;
+	coalition_t *coals = NULL;
+	vm_size_t size = 0;
+	int i, n;
+
+	if (usage_list == NULL) {
+		lck_mtx_lock(&coalitions_list_lock);
+		qe_foreach_element(coal, &coalitions_q, coalitions) {
+			if (!coal->reaped && coal->type == COALITION_TYPE_RESOURCE &&
+			    coal != corpse_coalition[COALITION_TYPE_RESOURCE])
+				++ncoals;
+		}
+		lck_mtx_unlock(&coalitions_list_lock);
+		return ncoals;
+	}
+
+	coalition_fold_arm();
+
+	/* getting the usage may fold every member task; don't do it under the list lock */
+	n = coalition_resource_refs_get(&coals, &size);
+	for (i = 0; i < n; i++) {
+		coal = coals[i];
+		if (ncoals < list_sz) {
+			usage_list[ncoals].coalition_id = coal->id;
+			coalition_lock(coal);
+			i_coal_resource_get_usage(coal, &usage_list[ncoals].coalition_usage);
+			coalition_unlock(coal);
+		}
+		++ncoals;
+	}
+	coalition_resource_refs_release(coals, size, n);
+
+	return ncoals;
+}
+
 /*
  * Jetsam coalition interface
  *
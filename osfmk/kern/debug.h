@@ -238,6 +238,8 @@ enum {
 	STACKSHOT_NO_IO_STATS                      = 0x800000,
 	/* Report owners of and pointers to kernel objects that threads are blocked on */
 	STACKSHOT_THREAD_WAITINFO                  = 0x1000000,
+	/* Walk all tasks on the debugger CPU only, even if other CPUs could help */
+	STACKSHOT_NO_PARALLEL                      = 0x2000000,
 };
 
 #define STACKSHOT_THREAD_SNAPSHOT_MAGIC 	0xfeedface
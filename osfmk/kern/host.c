@@ -663,6 +663,7 @@ kern_return_t
 get_sched_statistics(struct _processor_statistics_np * out, uint32_t * count)
 {
 	processor_t processor;
+	processor_set_t pset;
 
 	if (!sched_stats_active) {
 		return (KERN_FAILURE);
@@ -700,16 +701,164 @@ get_sched_statistics(struct _processor_statistics_np * out, uint32_t * count)
 
 	simple_unlock(&processor_list_lock);
 
-	/* And include RT Queue information */
+	/* And include RT Queue information, summed over the psets */
 	bzero(out, sizeof(*out));
 	out->ps_cpuid = (-1);
-	out->ps_runq_count_sum = rt_runq.runq_stats.count_sum;
+	pset = &pset0;
+	do {
+		out->ps_runq_count_sum += pset->rt_runq.runq_stats.count_sum;
+	} while ((pset = next_pset(pset)) != &pset0);
 	out++;
 	*count += (uint32_t)sizeof(struct _processor_statistics_np);
 
 	return (KERN_SUCCESS);
 }
 
+static uint64_t
+sched_stats_wait_percentile(uint64_t *hist, uint64_t total, uint32_t percent)
+{
+	uint64_t threshold = (total * percent + 99) / 100;
+	uint64_t seen = 0;
+	int i;
+
+	if (total == 0)
+		return 0;
+
+	for (i = 0; i < SCHED_STATS_WAIT_BUCKETS - 1; i++) {
+		seen += hist[i];
+		if (seen >= threshold)
+			break;
+	}
+
+	/* the last bucket is open ended; report its lower bound */
+	if (i == SCHED_STATS_WAIT_BUCKETS - 1)
+		return 1ULL << (SCHED_STATS_WAIT_SHIFT + i - 1);
+
+	return 1ULL << (SCHED_STATS_WAIT_SHIFT + i);
+}
+
+static void
+sched_stats_fill_runq_depth(struct _processor_runq_stats_np *out, uint64_t *depth_time)
+{
+	for (int i = 0; i < RUNQ_STATS_DEPTH_BUCKETS; i++)
+		absolutetime_to_nanoseconds(depth_time[i], &out->prs_depth_ns[i]);
+}
+
+kern_return_t
+get_sched_runq_statistics(struct _processor_runq_stats_np * out, uint32_t * count)
+{
+	processor_t processor;
+	processor_set_t pset;
+	uint32_t npsets = 0;
+	uint32_t size;
+
+	static_assert(_PROCESSOR_RUNQ_DEPTH_BUCKETS == RUNQ_STATS_DEPTH_BUCKETS);
+	static_assert(_PROCESSOR_WAIT_BUCKETS == SCHED_STATS_WAIT_BUCKETS);
+
+	if (!sched_stats_active) {
+		return (KERN_FAILURE);
+	}
+
+	pset = &pset0;
+	do {
+		npsets++;
+	} while ((pset = next_pset(pset)) != &pset0);
+
+	simple_lock(&processor_list_lock);
+
+	size = (processor_count + npsets) * (uint32_t)sizeof(struct _processor_runq_stats_np);
+	if (*count < size) {
+		simple_unlock(&processor_list_lock);
+		return (KERN_FAILURE);
+	}
+
+	processor = processor_list;
+	while (processor) {
+		struct processor_sched_statistics * stats = &processor->processor_data.sched_stats;
+		uint64_t depth_time[RUNQ_STATS_DEPTH_BUCKETS] = { 0 };
+		uint64_t total = 0;
+
+		bzero(out, sizeof(*out));
+		out->prs_cpuid = processor->cpu_id;
+		out->prs_pset_cpu = processor->processor_set->cpu_set_low;
+		out->prs_runq_count = SCHED(processor_runq_count)(processor);
+		for (int i = 0; i < 3; i++)
+			out->prs_load_average[i] = stats->runq_load_average[i];
+
+		SCHED(processor_runq_stats_depth)(processor, depth_time);
+		sched_stats_fill_runq_depth(out, depth_time);
+
+		sched_stats_decayed_hist(stats->wait_hist, SCHED_STATS_WAIT_BUCKETS,
+		    stats->wait_decay_deadline, out->prs_wait_count);
+		for (int i = 0; i < SCHED_STATS_WAIT_BUCKETS; i++)
+			total += out->prs_wait_count[i];
+		out->prs_wait_p50_ns = sched_stats_wait_percentile(out->prs_wait_count, total, 50);
+		out->prs_wait_p90_ns = sched_stats_wait_percentile(out->prs_wait_count, total, 90);
+		out->prs_wait_p99_ns = sched_stats_wait_percentile(out->prs_wait_count, total, 99);
+
+		out++;
+		processor = processor->processor_list;
+	}
+
+	simple_unlock(&processor_list_lock);
+
+	/* And one entry for each pset's RT queue */
+	pset = &pset0;
+	do {
+		uint64_t depth_time[RUNQ_STATS_DEPTH_BUCKETS] = { 0 };
+
+		bzero(out, sizeof(*out));
+		out->prs_cpuid = (-1);
+		out->prs_pset_cpu = pset->cpu_set_low;
+		out->prs_runq_count = pset->rt_runq.count;
+		sched_stats_runq_depth(&pset->rt_runq.runq_stats, depth_time);
+		sched_stats_fill_runq_depth(out, depth_time);
+		out++;
+	} while ((pset = next_pset(pset)) != &pset0);
+
+	*count = size;
+
+	return (KERN_SUCCESS);
+}
+
+kern_return_t
+get_sched_cache_statistics(struct _processor_cache_stats_np * out, uint32_t * count)
+{
+	processor_t processor;
+
+	if (!sched_stats_active) {
+		return (KERN_FAILURE);
+	}
+
+	simple_lock(&processor_list_lock);
+
+	if (*count < processor_count * sizeof(struct _processor_cache_stats_np)) {
+		simple_unlock(&processor_list_lock);
+		return (KERN_FAILURE);
+	}
+
+	processor = processor_list;
+	while (processor) {
+		struct processor_sched_statistics * stats = &processor->processor_data.sched_stats;
+
+		out->pcs_cpuid = processor->cpu_id;
+		out->pcs_pset_cpu = processor->processor_set->cpu_set_low;
+		out->pcs_migration_count = stats->migration_count;
+		out->pcs_pset_migration_count = stats->pset_migration_count;
+		out->pcs_cache_hot_count = stats->cache_hot_count;
+		out->pcs_cache_hot_migration_count = stats->cache_hot_migration_count;
+
+		out++;
+		processor = processor->processor_list;
+	}
+
+	*count = (uint32_t)(processor_count * sizeof(struct _processor_cache_stats_np));
+
+	simple_unlock(&processor_list_lock);
+
+	return (KERN_SUCCESS);
+}
+
 kern_return_t
 host_page_size(host_t host, vm_size_t * out_page_size)
 {
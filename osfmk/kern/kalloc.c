@@ -72,6 +72,7 @@
 #include <kern/misc_protos.h>
 #include <kern/zalloc.h>
 #include <kern/kalloc.h>
+#include <kern/zsample.h>
 #include <kern/ledger.h>
 #include <vm/vm_kern.h>
 #include <vm/vm_object.h>
@@ -144,42 +145,31 @@ KALLOC_ZINFO_SFREE(vm_size_t bytes)
 
 #if KALLOC_MINSIZE == 16 && KALLOC_LOG2_MINALIGN == 4
 
+/*
+ * Every multiple of the minimum alignment up to 128 bytes, then four
+ * classes per power of two, so no request above 128 bytes wastes more
+ * than a fifth of its element.  288, 576 and 1152 are kept for the
+ * structures they were added for.
+ */
 #define K_ZONE_SIZES			\
-	16,				\
-	32,				\
-	48,				\
-/* 3 */	64,				\
-	80,				\
-	96,				\
-/* 6 */	128,				\
-	160, 192,				\
-	256,				\
-/* 9 */	288,				\
-	512, 576,				\
-	1024, 1152,				\
-/* C */	1280,				\
-	2048,				\
-	4096
+	16,	32,	48,	64,		\
+	80,	96,	112,	128,		\
+/* 8 */	160,	192,	224,	256,	288,	\
+	320,	384,	448,	512,	576,	\
+/* 18 */	640,	768,	896,	1024,	1152,	\
+	1280,	1536,	1792,	2048,		\
+/* 27 */	2560,	3072,	3584,	4096,		\
+	5120,	6144,	7168
 
 #define K_ZONE_NAMES			\
-	"kalloc.16",			\
-	"kalloc.32",			\
-	"kalloc.48",			\
-/* 3 */	"kalloc.64",			\
-	"kalloc.80",			\
-	"kalloc.96",			\
-/* 6 */	"kalloc.128",			\
-	"kalloc.160",			\
-	"kalloc.192",			\
-	"kalloc.256",			\
-/* 9 */	"kalloc.288",			\
-	"kalloc.512",			\
-	"kalloc.576",			\
-	"kalloc.1024",			\
-	"kalloc.1152", 			\
-/* C */	"kalloc.1280",			\
-	"kalloc.2048",			\
-	"kalloc.4096"
+	"kalloc.16",	"kalloc.32",	"kalloc.48",	"kalloc.64",	\
+	"kalloc.80",	"kalloc.96",	"kalloc.112",	"kalloc.128",	\
+/* 8 */	"kalloc.160",	"kalloc.192",	"kalloc.224",	"kalloc.256",	"kalloc.288",	\
+	"kalloc.320",	"kalloc.384",	"kalloc.448",	"kalloc.512",	"kalloc.576",	\
+/* 18 */	"kalloc.640",	"kalloc.768",	"kalloc.896",	"kalloc.1024",	"kalloc.1152",	\
+	"kalloc.1280",	"kalloc.1536",	"kalloc.1792",	"kalloc.2048",	\
+/* 27 */	"kalloc.2560",	"kalloc.3072",	"kalloc.3584",	"kalloc.4096",	\
+	"kalloc.5120",	"kalloc.6144",	"kalloc.7168"
 
 #elif KALLOC_MINSIZE == 8 && KALLOC_LOG2_MINALIGN == 3
 
@@ -236,27 +226,33 @@ static const char *k_zone_name[MAX_K_ZONE] = {
 
 
 /*
- * Many kalloc() allocations are for small structures containing a few
- * pointers and longs - the k_zone_dlut[] direct lookup table, indexed by
- * size normalized to the minimum alignment, finds the right zone index
- * for them in one dereference.
+ * The k_zone_dlut[] direct lookup table, indexed by size normalized to
+ * the minimum alignment, finds the right zone index for any zone-backed
+ * size in one dereference.  Zone-backed sizes are at most kalloc_max / 2,
+ * and kalloc_max is at most 64K.
  */
 
 #define INDEX_ZDLUT(size)	\
 			(((size) + KALLOC_MINALIGN - 1) / KALLOC_MINALIGN)
-#define N_K_ZDLUT	(2048 / KALLOC_MINALIGN)
-				/* covers sizes [0 .. 2048 - KALLOC_MINALIGN] */
-#define MAX_SIZE_ZDLUT	((N_K_ZDLUT - 1) * KALLOC_MINALIGN)
+#define N_K_ZDLUT	(KiB(32) / KALLOC_MINALIGN + 1)
+				/* covers sizes [0 .. 32K] */
 
-static int8_t k_zone_dlut[N_K_ZDLUT];	/* table of indices into k_zone[] */
-
-/*
- * If there's no hit in the DLUT, then start searching from k_zindex_start.
- */
-static int k_zindex_start;
+static uint8_t k_zone_dlut[N_K_ZDLUT];	/* table of indices into k_zone[] */
 
 static zone_t k_zone[MAX_K_ZONE];
 
+struct kalloc_large_entry {
+	struct kalloc_large_entry	*kle_next;
+	vm_offset_t			kle_addr;
+	vm_size_t			kle_size;	/* size passed to kalloc */
+};
+
+#define KALLOC_LARGE_HASH_SIZE	1024	/* must be a power of 2 */
+#define KALLOC_LARGE_HASH(addr)	(((addr) >> PAGE_SHIFT) & (KALLOC_LARGE_HASH_SIZE - 1))
+
+static struct kalloc_large_entry *kalloc_large_hash[KALLOC_LARGE_HASH_SIZE];
+static zone_t kalloc_large_entry_zone;
+
 /* #define KALLOC_DEBUG		1 */
 
 /* forward declarations */
@@ -351,61 +347,40 @@ kalloc_init(
 	}
 
 	/*
-	 * Build the Direct LookUp Table for small allocations
+	 * Build the Direct LookUp Table for every zone-backed size
 	 */
-	for (i = 0, size = 0; i <= N_K_ZDLUT; i++, size += KALLOC_MINALIGN) {
+	for (i = 0, size = 0; i < (int)N_K_ZDLUT && size < kalloc_max_prerounded; i++, size += KALLOC_MINALIGN) {
 		int zindex = 0;
 
 		while ((vm_size_t)k_zone_size[zindex] < size)
 			zindex++;
 
-		if (i == N_K_ZDLUT) {
-			k_zindex_start = zindex;
-			break;
-		}
-		k_zone_dlut[i] = (int8_t)zindex;
+		assert(k_zone[zindex] != ZONE_NULL);
+		k_zone_dlut[i] = (uint8_t)zindex;
 	}
 
 #ifdef KALLOC_DEBUG
-	printf("kalloc_init: k_zindex_start %d\n", k_zindex_start);
-
 	/*
-	 * Do a quick synthesis to see how well/badly we can
-	 * find-a-zone for a given size.
+	 * Report the internal fragmentation of the size classes.  The worst
+	 * case for each zone is a request one byte over the previous class.
 	 * Useful when debugging/tweaking the array of zone sizes.
-	 * Cache misses probably more critical than compare-branches!
 	 */
-	for (i = 0; i < (int)MAX_K_ZONE; i++) {
-		vm_size_t testsize = (vm_size_t)k_zone_size[i] - 1;
-		int compare = 0;
-		int zindex;
-
-		if (testsize < MAX_SIZE_ZDLUT) {
-			compare += 1;	/* 'if' (T) */
-
-			long dindex = INDEX_ZDLUT(testsize);
-			zindex = (int)k_zone_dlut[dindex];
-
-		} else if (testsize < kalloc_max_prerounded) {
-
-			compare += 2;	/* 'if' (F), 'if' (T) */
-
-			zindex = k_zindex_start;
-			while ((vm_size_t)k_zone_size[zindex] < testsize) {
-				zindex++;
-				compare++;	/* 'while' (T) */
-			}
-			compare++;	/* 'while' (F) */
-		} else
-			break;	/* not zone-backed */
-
-		zone_t z = k_zone[zindex];
-		printf("kalloc_init: req size %4lu: %11s took %d compare%s\n",
-		    (unsigned long)testsize, z->zone_name, compare,
-		    compare == 1 ? "" : "s");
+	for (i = 0, size = 0; i < (int)MAX_K_ZONE && k_zone[i] != ZONE_NULL; i++) {
+		vm_size_t elem_size = k_zone[i]->elem_size;
+		vm_size_t waste = elem_size - (size + 1);
+
+		printf("kalloc_init: %12s wastes up to %4lu bytes (%lu%%) for %lu byte requests\n",
+		    k_zone[i]->zone_name, (unsigned long)waste,
+		    (unsigned long)(waste * 100 / elem_size), (unsigned long)(size + 1));
+		size = elem_size;
 	}
 #endif
 
+	kalloc_large_entry_zone = zinit(sizeof(struct kalloc_large_entry),
+	    KALLOC_LARGE_HASH_SIZE * 64 * sizeof(struct kalloc_large_entry),
+	    PAGE_SIZE, "kalloc.large entries");
+	zone_change(kalloc_large_entry_zone, Z_CALLERACCT, FALSE);
+
 	lck_grp_init(&kalloc_lck_grp, "kalloc.large", LCK_GRP_ATTR_NULL);
 	lck_mtx_init(&kalloc_lock, &kalloc_lck_grp, LCK_ATTR_NULL);
 	OSMalloc_init();
@@ -415,31 +390,61 @@ kalloc_init(
 }
 
 /*
- * Given an allocation size, return the kalloc zone it belongs to.
- * Direct LookUp Table variant.
+ * Given an allocation size below kalloc_max_prerounded, return the kalloc
+ * zone it belongs to.
  */
 static __inline zone_t
 get_zone_dlut(vm_size_t size)
 {
 	long dindex = INDEX_ZDLUT(size);
 	int zindex = (int)k_zone_dlut[dindex];
+
+	assert(size < kalloc_max_prerounded);
 	return (k_zone[zindex]);
 }
 
-/* As above, but linear search k_zone_size[] for the next zone that fits. */
+/*
+ * Large allocation table: the address and size of every live kmem-backed
+ * kalloc allocation, hashed by address, so kfree_addr() and kalloc_size()
+ * don't have to look the address up in the VM map.  Protected by
+ * kalloc_lock.
+ */
+static void
+kalloc_large_insert(struct kalloc_large_entry *entry, vm_offset_t addr, vm_size_t size)
+{
+	struct kalloc_large_entry **bucket = &kalloc_large_hash[KALLOC_LARGE_HASH(addr)];
+
+	entry->kle_addr = addr;
+	entry->kle_size = size;
+	entry->kle_next = *bucket;
+	*bucket = entry;
+}
 
-static __inline zone_t
-get_zone_search(vm_size_t size, int zindex)
+static struct kalloc_large_entry *
+kalloc_large_remove(vm_offset_t addr)
 {
-	assert(size < kalloc_max_prerounded);
+	struct kalloc_large_entry **prevp = &kalloc_large_hash[KALLOC_LARGE_HASH(addr)];
+	struct kalloc_large_entry *entry;
 
-	while ((vm_size_t)k_zone_size[zindex] < size)
-		zindex++;
+	for (entry = *prevp; entry != NULL; prevp = &entry->kle_next, entry = entry->kle_next) {
+		if (entry->kle_addr == addr) {
+			*prevp = entry->kle_next;
+			return entry;
+		}
+	}
+	return NULL;
+}
 
-	assert((unsigned)zindex < MAX_K_ZONE &&
-	    (vm_size_t)k_zone_size[zindex] < kalloc_max);
+static vm_size_t
+kalloc_large_lookup(vm_offset_t addr)
+{
+	struct kalloc_large_entry *entry;
 
-	return (k_zone[zindex]);
+	for (entry = kalloc_large_hash[KALLOC_LARGE_HASH(addr)]; entry != NULL; entry = entry->kle_next) {
+		if (entry->kle_addr == addr)
+			return entry->kle_size;
+	}
+	return 0;
 }
 
 static vm_size_t
@@ -482,6 +487,14 @@ kalloc_size(
 	} else {
 		map = kernel_map;
 	}
+
+	kalloc_spin_lock();
+	size = kalloc_large_lookup((vm_offset_t)addr);
+	kalloc_unlock();
+	if (size) {
+		return vm_map_round_page(size, VM_MAP_PAGE_MASK(map));
+	}
+
 	vm_map_lock_read(map);
 	size = vm_map_lookup_kalloc_entry_locked(map, addr);
 	vm_map_unlock_read(map);
@@ -495,13 +508,8 @@ kalloc_bucket_size(
 	zone_t 		z;
 	vm_map_t 	map;
 	
-	if (size < MAX_SIZE_ZDLUT) {
-		z = get_zone_dlut(size);
-		return z->elem_size;
-	} 
-	
 	if (size < kalloc_max_prerounded) {
-		z = get_zone_search(size, k_zindex_start);
+		z = get_zone_dlut(size);
 		return z->elem_size;
 	}
 
@@ -521,6 +529,7 @@ kfree_addr(
 	vm_size_t       size = 0;
 	kern_return_t 	ret;
 	zone_t 			z;
+	struct kalloc_large_entry *entry;
 
 	size = zone_element_size(addr, &z);
 	if (size) {
@@ -537,6 +546,25 @@ kfree_addr(
 		panic("kfree on an address not in the kernel & kext address range! addr: %p\n", addr);
 	}
 
+	if (__improbable(zsample_active))
+		zsample_free((vm_offset_t)addr);
+
+	kalloc_spin_lock();
+	entry = kalloc_large_remove((vm_offset_t)addr);
+	if (entry != NULL) {
+		size = entry->kle_size;
+		kalloc_large_total -= size;
+		kalloc_large_inuse--;
+	}
+	kalloc_unlock();
+
+	if (entry != NULL) {
+		zfree(kalloc_large_entry_zone, entry);
+		kmem_free(map, (vm_offset_t)addr, size);
+		KALLOC_ZINFO_SFREE(size);
+		return vm_map_round_page(size, VM_MAP_PAGE_MASK(map));
+	}
+
 	vm_map_lock(map);
 	size = vm_map_lookup_kalloc_entry_locked(map, addr);
 	ret = vm_map_remove_locked(map,
@@ -571,10 +599,8 @@ kalloc_canblock(
 
 	size = *psize;
 
-	if (size < MAX_SIZE_ZDLUT)
+	if (size < kalloc_max_prerounded)
 		z = get_zone_dlut(size);
-	else if (size < kalloc_max_prerounded)
-		z = get_zone_search(size, k_zindex_start);
 	else {
 		/*
 		 * If size is too large for a zone, then use kmem_alloc.
@@ -583,6 +609,7 @@ kalloc_canblock(
 		 */
 		vm_map_t alloc_map;
 		void *addr;
+		struct kalloc_large_entry *entry = NULL;
 
 		/* kmem_alloc could block so we return if noblock */
 		if (!canblock) {
@@ -610,7 +637,11 @@ kalloc_canblock(
 		}
 
 		if (addr != NULL) {
+			entry = zalloc(kalloc_large_entry_zone);
+
 			kalloc_spin_lock();
+			if (entry != NULL)
+				kalloc_large_insert(entry, (vm_offset_t)addr, size);
 			/*
 			 * Thread-safe version of the workaround for 4740071
 			 * (a double FREE())
@@ -627,6 +658,9 @@ kalloc_canblock(
 
 			kalloc_unlock();
 
+			if (__improbable(zsample_active))
+				zsample_alloc(ZSAMPLE_SITE_KALLOC, (vm_offset_t)addr, size);
+
 			KALLOC_ZINFO_SALLOC(size);
 		}
 		*psize = round_page(size);
@@ -662,14 +696,13 @@ kfree(
 {
 	zone_t z;
 
-	if (size < MAX_SIZE_ZDLUT)
+	if (size < kalloc_max_prerounded)
 		z = get_zone_dlut(size);
-	else if (size < kalloc_max_prerounded)
-		z = get_zone_search(size, k_zindex_start);
 	else {
 		/* if size was too large for a zone, then use kmem_free */
 
 		vm_map_t alloc_map = kernel_map;
+		struct kalloc_large_entry *entry;
 
 		if ((((vm_offset_t) data) >= kalloc_map_min) && (((vm_offset_t) data) <= kalloc_map_max))
 			alloc_map = kalloc_map;
@@ -697,14 +730,22 @@ kfree(
 				OSAddAtomic(1, &kfree_nop_count);
 			        return;
 		}
-		kmem_free(alloc_map, (vm_offset_t)data, size);
+		if (__improbable(zsample_active))
+			zsample_free((vm_offset_t)data);
+
+		/* forget the address before it can be handed out again */
 		kalloc_spin_lock();
 
+		entry = kalloc_large_remove((vm_offset_t)data);
 		kalloc_large_total -= size;
 		kalloc_large_inuse--;
 
 		kalloc_unlock();
 
+		if (entry != NULL)
+			zfree(kalloc_large_entry_zone, entry);
+		kmem_free(alloc_map, (vm_offset_t)data, size);
+
 		KALLOC_ZINFO_SFREE(size);
 		return;
 	}
@@ -724,10 +765,8 @@ zone_t
 kalloc_zone(
 	vm_size_t       size)
 {
-	if (size < MAX_SIZE_ZDLUT)
+	if (size < kalloc_max_prerounded)
 		return (get_zone_dlut(size));
-	if (size <= kalloc_max)
-		return (get_zone_search(size, k_zindex_start));
 	return (ZONE_NULL);
 }
 #endif
@@ -420,8 +420,10 @@ struct kcdata_type_definition {
                                                         /* type-range: 0x1000-0x103f */
 #define KCDATA_BUFFER_BEGIN_XNUPOST_CONFIG 0x1e21c09fu  /* owner: osfmk/tests/kernel_tests.c */
                                                         /* type-range: 0x1040-0x105f */
+#define KCDATA_BUFFER_BEGIN_PROC_BULKINFO 0xB01C1F05u   /* owner: sys/proc_info.h */
+                                                        /* type-range: 0x1060-0x107f */
 
-/* next type range number available 0x1060 */
+/* next type range number available 0x1080 */
 /**************** definitions for XNUPOST *********************/
 #define XNUPOST_KCTYPE_TESTCONFIG		0x1040
 
@@ -808,6 +810,54 @@ struct codesigning_exit_reason_info {
 
 #define EXIT_REASON_USER_DESC_MAX_LEN   1024
 #define EXIT_REASON_PAYLOAD_MAX_LEN     2048
+
+/**************** definitions for proc bulkinfo *********************/
+
+/*
+ * NOTE: Please update kcdata/libkdd/kcdtypes.c if you make any changes
+ * in PROC_BULKINFO_KCTYPE_* types.
+ */
+#define PROC_BULKINFO_KCTYPE_HEADER      0x1060u /* struct proc_bulkinfo_header */
+#define PROC_BULKINFO_KCCONTAINER_TASK   0x1061u /* container identifier is the pid */
+#define PROC_BULKINFO_KCTYPE_TASK        0x1062u /* struct proc_bulkinfo_task */
+#define PROC_BULKINFO_KCTYPE_THREAD      0x1063u /* struct proc_bulkinfo_thread[] */
+
+/* proc_bulkinfo_header pbh_flags */
+#define PROC_BULKINFO_HDR_TRUNCATED      0x1 /* buffer filled before every matching process was reported */
+
+struct proc_bulkinfo_header {
+	uint64_t pbh_timestamp;         /* mach_absolute_time() when the walk started */
+	uint32_t pbh_task_count;        /* number of task containers that follow */
+	uint32_t pbh_flags;
+} __attribute__((packed));
+
+/* All times are in mach absolute time units, all sizes in bytes */
+struct proc_bulkinfo_task {
+	uint64_t pbt_uniqueid;
+	int32_t  pbt_pid;
+	uint32_t pbt_threadnum;
+	uint64_t pbt_user_time;         /* live and terminated threads */
+	uint64_t pbt_system_time;
+	uint64_t pbt_phys_footprint;
+	uint64_t pbt_resident_size;
+	uint64_t pbt_diskio_bytesread;
+	uint64_t pbt_diskio_byteswritten;
+	uint64_t pbt_pageins;
+	uint64_t pbt_faults;
+	uint64_t pbt_csw;
+	uint64_t pbt_interrupt_wkups;
+} __attribute__((packed));
+
+struct proc_bulkinfo_thread {
+	uint64_t pbth_thread_id;
+	uint64_t pbth_user_time;
+	uint64_t pbth_system_time;
+	uint32_t pbth_csw;
+	int16_t  pbth_sched_pri;
+	int16_t  pbth_base_pri;
+	uint32_t pbth_state;            /* TH_* state bits */
+} __attribute__((packed));
+
 /**************** safe iterators *********************/
 
 typedef struct kcdata_iter {
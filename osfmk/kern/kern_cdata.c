@@ -100,6 +100,74 @@ kern_return_t kcdata_memory_static_init(kcdata_descriptor_t data, mach_vm_addres
 	return kcdata_get_memory_addr(data, data_type, 0, &user_addr);
 }
 
+/*
+ * Routine: kcdata_memory_sub_init
+ * Desc: Initialize a descriptor for a sub-buffer that lives in the unused space
+ *       of a parent buffer. No BEGIN header is written; the items added to the
+ *       sub-buffer are later moved into the parent with kcdata_memory_append_sub().
+ * params:  sub - descriptor to initialize
+ *          parent - descriptor of the enclosing buffer
+ *          buffer_addr_p - start of the sub-buffer, must be past the parent's end
+ *          size - size of the sub-buffer in bytes
+ */
+kern_return_t kcdata_memory_sub_init(kcdata_descriptor_t sub, kcdata_descriptor_t parent, mach_vm_address_t buffer_addr_p, unsigned size)
+{
+	if (sub == NULL || parent == NULL) {
+		return KERN_INVALID_ARGUMENT;
+	}
+
+	if ((parent->kcd_flags & KCFLAG_USE_COPYOUT) ||
+	    (buffer_addr_p < parent->kcd_addr_end) ||
+	    (buffer_addr_p + size > parent->kcd_addr_begin + parent->kcd_length) ||
+	    (kcdata_calc_padding((uint32_t)(buffer_addr_p - parent->kcd_addr_begin)) != 0)) {
+		return KERN_INVALID_ARGUMENT;
+	}
+
+	bzero(sub, sizeof(struct kcdata_descriptor));
+	sub->kcd_addr_begin = buffer_addr_p;
+	sub->kcd_addr_end = buffer_addr_p;
+	sub->kcd_flags = KCFLAG_USE_MEMCOPY | KCFLAG_NO_AUTO_ENDBUFFER;
+	sub->kcd_length = size;
+
+	return KERN_SUCCESS;
+}
+
+/*
+ * Routine: kcdata_memory_append_sub
+ * Desc: Move the items recorded in a sub-buffer to the end of the parent buffer.
+ *       Sub-buffers must be appended in address order, since the move may
+ *       overwrite the space of sub-buffers that were already appended.
+ * params:  data - descriptor of the parent buffer
+ *          sub - descriptor initialized with kcdata_memory_sub_init()
+ */
+kern_return_t kcdata_memory_append_sub(kcdata_descriptor_t data, kcdata_descriptor_t sub)
+{
+	uint64_t size;
+
+	if (data == NULL || sub == NULL || (data->kcd_flags & KCFLAG_USE_COPYOUT)) {
+		return KERN_INVALID_ARGUMENT;
+	}
+
+	assert(sub->kcd_addr_begin >= data->kcd_addr_end);
+	size = sub->kcd_addr_end - sub->kcd_addr_begin;
+
+	/* check available memory, including trailer size for KCDATA_TYPE_BUFFER_END */
+	if (data->kcd_length < ((data->kcd_addr_end - data->kcd_addr_begin) + size + sizeof(struct kcdata_item))) {
+		return KERN_RESOURCE_SHORTAGE;
+	}
+
+	if (size != 0 && sub->kcd_addr_begin != data->kcd_addr_end) {
+		memmove((void *)data->kcd_addr_end, (void *)sub->kcd_addr_begin, (size_t)size);
+	}
+	data->kcd_addr_end += size;
+
+	if (!(data->kcd_flags & KCFLAG_NO_AUTO_ENDBUFFER)) {
+		return kcdata_write_buffer_end(data);
+	} else {
+		return KERN_SUCCESS;
+	}
+}
+
 uint64_t kcdata_memory_get_used_bytes(kcdata_descriptor_t kcd)
 {
 	assert(kcd != NULL);
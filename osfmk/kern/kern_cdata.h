@@ -91,6 +91,9 @@ kern_return_t kcdata_undo_add_container_begin(kcdata_descriptor_t data);
 
 kern_return_t kcdata_write_buffer_end(kcdata_descriptor_t data);
 
+kern_return_t kcdata_memory_sub_init(kcdata_descriptor_t sub, kcdata_descriptor_t parent, mach_vm_address_t buffer_addr_p, unsigned size);
+kern_return_t kcdata_memory_append_sub(kcdata_descriptor_t data, kcdata_descriptor_t sub);
+
 #else /* XNU_KERNEL_PRIVATE */
 
 typedef void * kcdata_descriptor_t;
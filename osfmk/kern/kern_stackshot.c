@@ -60,9 +60,10 @@
 #include <vm/vm_fault.h>
 #include <vm/vm_shared_region.h>
 #include <libkern/OSKextLibPrivate.h>
-
-#if (defined(__arm64__) || defined(NAND_PANIC_DEVICE)) && !defined(LEGACY_PANIC_LOGS)
 #include <pexpert/pexpert.h> /* For gPanicBase/gPanicBase */
+
+#if defined(__x86_64__)
+#include <i386/mp.h>
 #endif
 
 extern unsigned int not_in_kdp;
@@ -177,6 +178,13 @@ static void stackshot_memcpy(void *dst, const void *src, size_t len);
  */
 void machine_trace_thread_clear_validation_cache(void);
 
+#define UNIQUEIDSPERFLUSH 12
+
+struct saved_uniqueids {
+	uint64_t ids[UNIQUEIDSPERFLUSH];
+	unsigned count;
+};
+
 #define MAX_FRAMES 1000
 #define MAX_LOADINFOS 500
 #define TASK_IMP_WALK_LIMIT 20
@@ -189,11 +197,54 @@ extern kdp_send_t    kdp_en_send_pkt;
 #endif 
 
 /*
- * Globals to support machine_trace_thread_get_kva.
+ * Per-cpu state to support machine_trace_thread_get_kva. Parallel
+ * stackshots walk threads on several cpus at once, so the translation
+ * cache can't be shared.
  */
-static vm_offset_t prev_target_page = 0;
-static vm_offset_t prev_target_kva = 0;
-static boolean_t validate_next_addr = TRUE;
+static struct stackshot_kva_cache {
+	vm_offset_t prev_target_page;
+	vm_offset_t prev_target_kva;
+	boolean_t validate_next_addr;
+} __attribute__((aligned(64))) stackshot_kva_cache[MAX_CPUS];
+
+/*
+ * Parallel stackshot support. The debugger cpu records the global items and
+ * lists the tasks, then every cpu held in the debugger claims tasks from the
+ * list and records them into chunks of the unused buffer space, handed out
+ * on demand. The chunks are compacted behind the global items once all cpus
+ * are done.
+ */
+#define STACKSHOT_PARALLEL_MIN_TASKS   64          /* Below this, fanning out isn't worth it */
+#define STACKSHOT_PARALLEL_MAX_UNITS   1024        /* Chunks are handed out in multiples of a unit */
+#define STACKSHOT_PARALLEL_UNIT_MIN    (8 * 1024)
+
+#if defined(__x86_64__)
+struct stackshot_worker {
+	kcdata_descriptor_t      sw_kcdata;        /* chunk being filled, if any */
+	uint32_t                 sw_units;         /* size of that chunk in units */
+	struct saved_uniqueids   sw_saved_uniqueids;
+} __attribute__((aligned(64)));
+
+static struct stackshot_parallel_state {
+	int                              sps_pid;
+	uint32_t                         sps_trace_flags;
+	uint32_t                         sps_nworkers;
+	struct dyld_uuid_info_64_v2     *sps_sys_shared_cache_loadinfo;
+	task_t                          *sps_tasks;
+	uint32_t                         sps_ntasks;
+	mach_vm_address_t                sps_units_base;
+	uint32_t                         sps_unit_size;
+	uint32_t                         sps_nunits;
+	volatile uint32_t                sps_next_unit;
+	volatile uint32_t                sps_next_worker;
+	volatile uint32_t                sps_next_task;
+	volatile kern_return_t           sps_error;
+	struct stackshot_worker          sps_workers[MAX_CPUS];
+	struct kcdata_descriptor         sps_chunks[STACKSHOT_PARALLEL_MAX_UNITS]; /* indexed by first unit */
+} stackshot_parallel;
+#endif /* __x86_64__ */
+
+static int stackshot_parallel_enabled = 1;
 
 /*
  * Stackshot locking and other defines.
@@ -227,6 +278,7 @@ __private_extern__ void
 stackshot_init( void )
 {
 	mach_timebase_info_data_t timebase;
+	int i;
 
 	stackshot_subsys_lck_grp_attr = lck_grp_attr_alloc_init();
 
@@ -238,6 +290,12 @@ stackshot_init( void )
 
 	clock_timebase_info(&timebase);
 	fault_stats.sfs_system_max_fault_time = ((KDP_FAULT_PATH_MAX_TIME_PER_STACKSHOT_NSECS * timebase.denom)/ timebase.numer);
+
+	for (i = 0; i < MAX_CPUS; i++) {
+		stackshot_kva_cache[i].validate_next_addr = TRUE;
+	}
+
+	PE_parse_boot_argn("stackshot_parallel", &stackshot_parallel_enabled, sizeof(stackshot_parallel_enabled));
 }
 
 /* 
@@ -1397,20 +1455,13 @@ kcdata_record_thread_delta_snapshot(struct thread_delta_snapshot_v2 * cur_thread
  * the stack and having large kcdata item overheads for recording nonrunable
  * tasks.
  */
-#define UNIQUEIDSPERFLUSH 12
-
-struct saved_uniqueids {
-	uint64_t ids[UNIQUEIDSPERFLUSH];
-	unsigned count;
-};
-
 static kern_return_t
-flush_nonrunnable_tasks(struct saved_uniqueids * ids)
+flush_nonrunnable_tasks(kcdata_descriptor_t kcd, struct saved_uniqueids * ids)
 {
 	if (ids->count == 0)
 		return KERN_SUCCESS;
 	mach_vm_address_t out_addr = 0;
-	kern_return_t ret = kcdata_get_memory_addr_for_array(stackshot_kcdata_p, STACKSHOT_KCTYPE_NONRUNNABLE_TASKS, sizeof(uint64_t),
+	kern_return_t ret = kcdata_get_memory_addr_for_array(kcd, STACKSHOT_KCTYPE_NONRUNNABLE_TASKS, sizeof(uint64_t),
 	                                                     ids->count, &out_addr);
 	if (ret != KERN_SUCCESS) {
 		return ret;
@@ -1421,14 +1472,14 @@ flush_nonrunnable_tasks(struct saved_uniqueids * ids)
 }
 
 static kern_return_t
-handle_nonrunnable_task(struct saved_uniqueids * ids, uint64_t pid)
+handle_nonrunnable_task(kcdata_descriptor_t kcd, struct saved_uniqueids * ids, uint64_t pid)
 {
 	kern_return_t ret    = KERN_SUCCESS;
 	ids->ids[ids->count] = pid;
 	ids->count++;
 	assert(ids->count <= UNIQUEIDSPERFLUSH);
 	if (ids->count == UNIQUEIDSPERFLUSH)
-		ret = flush_nonrunnable_tasks(ids);
+		ret = flush_nonrunnable_tasks(kcd, ids);
 	return ret;
 }
 
@@ -1464,6 +1515,489 @@ classify_thread(thread_t thread, boolean_t * thread_on_core_p, uint32_t trace_fl
 	}
 }
 
+/*
+ * Record a single task, and the threads it contains, into kcd.
+ */
+static kern_return_t
+kdp_stackshot_record_task(kcdata_descriptor_t kcd, task_t task, int pid, uint32_t trace_flags,
+                          struct dyld_uuid_info_64_v2 *sys_shared_cache_loadinfo, struct saved_uniqueids *saved_uniqueids)
+{
+	kern_return_t error        = KERN_SUCCESS;
+	mach_vm_address_t out_addr = 0;
+	int saved_count = 0;
+	thread_t thread = THREAD_NULL;
+
+	boolean_t active_kthreads_only_p  = ((trace_flags & STACKSHOT_ACTIVE_KERNEL_THREADS_ONLY) != 0);
+	boolean_t save_donating_pids_p    = ((trace_flags & STACKSHOT_SAVE_IMP_DONATION_PIDS) != 0);
+	boolean_t collect_delta_stackshot = ((trace_flags & STACKSHOT_COLLECT_DELTA_SNAPSHOT) != 0);
+	boolean_t minimize_nonrunnables   = ((trace_flags & STACKSHOT_TAILSPIN) != 0);
+	boolean_t save_owner_info         = ((trace_flags & STACKSHOT_THREAD_WAITINFO) != 0);
+
+	int task_pid                   = 0;
+	uint64_t task_uniqueid         = 0;
+	int num_delta_thread_snapshots = 0;
+	int num_nonrunnable_threads    = 0;
+	int num_waitinfo_threads       = 0;
+	uint64_t task_start_abstime    = 0;
+	boolean_t task_delta_stackshot = FALSE;
+	boolean_t task64 = FALSE, have_map = FALSE, have_pmap = FALSE;
+	boolean_t some_thread_ran = FALSE;
+	unaligned_u64 *task_snap_ss_flags = NULL;
+
+	if ((task == NULL) || !ml_validate_nofault((vm_offset_t)task, sizeof(struct task))) {
+		error = KERN_FAILURE;
+		goto error_exit;
+	}
+
+	have_map = (task->map != NULL) && (ml_validate_nofault((vm_offset_t)(task->map), sizeof(struct _vm_map)));
+	have_pmap = have_map && (task->map->pmap != NULL) && (ml_validate_nofault((vm_offset_t)(task->map->pmap), sizeof(struct pmap)));
+
+	task_pid = pid_from_task(task);
+	task_uniqueid = get_task_uniqueid(task);
+	task64 = task_has_64BitAddr(task);
+
+	if (!task->active || task_is_a_corpse(task)) {
+		/*
+		 * Not interested in terminated tasks without threads, and
+		 * at the moment, stackshot can't handle a task  without a name.
+		 */
+		if (queue_empty(&task->threads) || task_pid == -1) {
+			return KERN_SUCCESS;
+		}
+	}
+
+	if (collect_delta_stackshot) {
+		proc_starttime_kdp(task->bsd_info, NULL, NULL, &task_start_abstime);
+	}
+
+	/* Trace everything, unless a process was specified */
+	if ((pid == -1) || (pid == task_pid)) {
+#if DEBUG || DEVELOPMENT
+		/* we might want to call kcdata_undo_add_container_begin(), which is
+		 * only safe if we call it after kcdata_add_container_marker() but
+		 * before adding any other kcdata items.  In development kernels,
+		 * we'll remember where the buffer end was and confirm after calling
+		 * kcdata_undo_add_container_begin() that it's in exactly the same
+		 * place.*/
+		mach_vm_address_t revert_addr = kcd->kcd_addr_end;
+#endif
+
+		/* add task snapshot marker */
+		kcd_exit_on_error(kcdata_add_container_marker(kcd, KCDATA_TYPE_CONTAINER_BEGIN,
+		                                              STACKSHOT_KCCONTAINER_TASK, task_uniqueid));
+
+		if (!collect_delta_stackshot || (task_start_abstime == 0) ||
+		    (task_start_abstime > stack_snapshot_delta_since_timestamp)) {
+			kcd_exit_on_error(kcdata_record_task_snapshot(kcd, task, trace_flags, have_pmap, &task_snap_ss_flags));
+		} else {
+			task_delta_stackshot = TRUE;
+			if (minimize_nonrunnables) {
+				// delay taking the task snapshot.  If there are no runnable threads we'll skip it.
+			} else {
+				kcd_exit_on_error(kcdata_record_task_delta_snapshot(kcd, task, have_pmap, &task_snap_ss_flags));
+			}
+		}
+
+		/* Iterate over task threads */
+		queue_iterate(&task->threads, thread, thread_t, task_threads)
+		{
+			uint64_t thread_uniqueid;
+
+			if ((thread == NULL) || !ml_validate_nofault((vm_offset_t)thread, sizeof(struct thread))) {
+				error = KERN_FAILURE;
+				goto error_exit;
+			}
+
+			if (active_kthreads_only_p && thread->kernel_stack == 0)
+				continue;
+
+			thread_uniqueid = thread_tid(thread);
+
+			boolean_t thread_on_core;
+			enum thread_classification thread_classification = classify_thread(thread, &thread_on_core, trace_flags);
+
+			switch (thread_classification) {
+			case tc_full_snapshot:
+				/* add thread marker */
+				kcd_exit_on_error(kcdata_add_container_marker(kcd, KCDATA_TYPE_CONTAINER_BEGIN,
+				                                              STACKSHOT_KCCONTAINER_THREAD, thread_uniqueid));
+				kcd_exit_on_error(
+				    kcdata_record_thread_snapshot(kcd, thread, task, trace_flags, have_pmap, thread_on_core));
+
+				/* mark end of thread snapshot data */
+				kcd_exit_on_error(kcdata_add_container_marker(kcd, KCDATA_TYPE_CONTAINER_END,
+				                                              STACKSHOT_KCCONTAINER_THREAD, thread_uniqueid));
+
+				some_thread_ran = TRUE;
+				break;
+
+			case tc_delta_snapshot:
+				num_delta_thread_snapshots++;
+				break;
+
+			case tc_nonrunnable:
+				num_nonrunnable_threads++;
+				break;
+			}
+
+			/* We want to report owner information regardless of whether a thread
+			 * has changed since the last delta, whether it's a normal stackshot,
+			 * or whether it's nonrunnable */
+			if (save_owner_info && stackshot_thread_has_valid_waitinfo(thread))
+				num_waitinfo_threads++;
+		}
+
+		if (task_delta_stackshot && minimize_nonrunnables) {
+			if (some_thread_ran || num_delta_thread_snapshots > 0) {
+				kcd_exit_on_error(kcdata_record_task_delta_snapshot(kcd, task, have_pmap, &task_snap_ss_flags));
+			} else {
+				kcd_exit_on_error(kcdata_undo_add_container_begin(kcd));
+
+#if DEBUG || DEVELOPMENT
+				mach_vm_address_t undo_addr = kcd->kcd_addr_end;
+				if (revert_addr != undo_addr) {
+					panic("tried to revert a container begin but we already moved past it. revert=%p undo=%p",
+					      (void *)revert_addr, (void *)undo_addr);
+				}
+#endif
+				kcd_exit_on_error(handle_nonrunnable_task(kcd, saved_uniqueids, task_uniqueid));
+				return KERN_SUCCESS;
+			}
+		}
+
+		struct thread_delta_snapshot_v2 * delta_snapshots = NULL;
+		int current_delta_snapshot_index                  = 0;
+
+		if (num_delta_thread_snapshots > 0) {
+			kcd_exit_on_error(kcdata_get_memory_addr_for_array(kcd, STACKSHOT_KCTYPE_THREAD_DELTA_SNAPSHOT,
+			                                                   sizeof(struct thread_delta_snapshot_v2),
+			                                                   num_delta_thread_snapshots, &out_addr));
+			delta_snapshots = (struct thread_delta_snapshot_v2 *)out_addr;
+		}
+
+		uint64_t * nonrunnable_tids   = NULL;
+		int current_nonrunnable_index = 0;
+
+		if (num_nonrunnable_threads > 0) {
+			kcd_exit_on_error(kcdata_get_memory_addr_for_array(kcd, STACKSHOT_KCTYPE_NONRUNNABLE_TIDS,
+			                                                   sizeof(uint64_t), num_nonrunnable_threads, &out_addr));
+			nonrunnable_tids = (uint64_t *)out_addr;
+		}
+
+		thread_waitinfo_t *thread_waitinfo = NULL;
+		int current_waitinfo_index         = 0;
+
+		if (num_waitinfo_threads > 0) {
+			kcd_exit_on_error(kcdata_get_memory_addr_for_array(kcd, STACKSHOT_KCTYPE_THREAD_WAITINFO,
+								   sizeof(thread_waitinfo_t), num_waitinfo_threads, &out_addr));
+			thread_waitinfo = (thread_waitinfo_t *)out_addr;
+		}
+
+		if (num_delta_thread_snapshots > 0 || num_nonrunnable_threads > 0 || num_waitinfo_threads > 0) {
+			queue_iterate(&task->threads, thread, thread_t, task_threads)
+			{
+				if (active_kthreads_only_p && thread->kernel_stack == 0)
+					continue;
+
+				/* If we want owner info, we should capture it regardless of its classification */
+				if (save_owner_info && stackshot_thread_has_valid_waitinfo(thread)) {
+					stackshot_thread_wait_owner_info(
+							thread,
+							&thread_waitinfo[current_waitinfo_index++]);
+				}
+
+				boolean_t thread_on_core;
+				enum thread_classification thread_classification = classify_thread(thread, &thread_on_core, trace_flags);
+
+				switch (thread_classification) {
+				case tc_full_snapshot:
+					/* full thread snapshot captured above */
+					continue;
+
+				case tc_delta_snapshot:
+					kcd_exit_on_error(kcdata_record_thread_delta_snapshot(&delta_snapshots[current_delta_snapshot_index++],
+					                                                      thread, thread_on_core));
+					break;
+
+				case tc_nonrunnable:
+					nonrunnable_tids[current_nonrunnable_index++] = thread_tid(thread);
+					continue;
+				}
+			}
+
+#if DEBUG || DEVELOPMENT
+			if (current_delta_snapshot_index != num_delta_thread_snapshots) {
+				panic("delta thread snapshot count mismatch while capturing snapshots for task %p. expected %d, found %d", task,
+				      num_delta_thread_snapshots, current_delta_snapshot_index);
+			}
+			if (current_nonrunnable_index != num_nonrunnable_threads) {
+				panic("nonrunnable thread count mismatch while capturing snapshots for task %p. expected %d, found %d", task,
+				      num_nonrunnable_threads, current_nonrunnable_index);
+			}
+			if (current_waitinfo_index != num_waitinfo_threads) {
+				panic("thread wait info count mismatch while capturing snapshots for task %p. expected %d, found %d", task,
+				      num_waitinfo_threads, current_waitinfo_index);
+			}
+#endif
+		}
+
+#if IMPORTANCE_INHERITANCE
+		if (save_donating_pids_p) {
+			kcd_exit_on_error(
+			    ((((mach_vm_address_t)kcd_end_address(kcd) + (TASK_IMP_WALK_LIMIT * sizeof(int32_t))) <
+			      (mach_vm_address_t)kcd_max_address(kcd))
+			         ? KERN_SUCCESS
+			         : KERN_RESOURCE_SHORTAGE));
+			saved_count = task_importance_list_pids(task, TASK_IMP_LIST_DONATING_PIDS,
+			                                        (void *)kcd_end_address(kcd), TASK_IMP_WALK_LIMIT);
+			if (saved_count > 0)
+				kcd_exit_on_error(kcdata_get_memory_addr_for_array(kcd, STACKSHOT_KCTYPE_DONATING_PIDS,
+				                                                   sizeof(int32_t), saved_count, &out_addr));
+		}
+#endif
+
+		if (!collect_delta_stackshot || (num_delta_thread_snapshots != task->thread_count) || !task_delta_stackshot) {
+			/*
+			 * Collect shared cache info and UUID info in these scenarios
+			 * 1) a full stackshot
+			 * 2) a delta stackshot where the task started after the previous full stackshot OR
+			 *    any thread from the task has run since the previous full stackshot
+			 */
+
+			kcd_exit_on_error(kcdata_record_shared_cache_info(kcd, task, sys_shared_cache_loadinfo, trace_flags, task_snap_ss_flags));
+			kcd_exit_on_error(kcdata_record_uuid_info(kcd, task, trace_flags, have_pmap, task_snap_ss_flags));
+		}
+		/* mark end of task snapshot data */
+		kcd_exit_on_error(kcdata_add_container_marker(kcd, KCDATA_TYPE_CONTAINER_END, STACKSHOT_KCCONTAINER_TASK,
+		                                              task_uniqueid));
+	}
+
+error_exit:
+	return error;
+}
+
+/*
+ * Parallel walks are only used for full, system-wide stackshots taken
+ * through the debugger trap. Panic stackshots can't rely on the other cpus,
+ * and the fault path keeps a global time budget.
+ */
+static boolean_t
+stackshot_parallel_allowed(int pid, uint32_t trace_flags)
+{
+#if defined(__x86_64__)
+	if (!stackshot_parallel_enabled || panic_stackshot || pid != -1)
+		return FALSE;
+
+	if (trace_flags & (STACKSHOT_NO_PARALLEL | STACKSHOT_ENABLE_BT_FAULTING | STACKSHOT_ENABLE_UUID_FAULTING))
+		return FALSE;
+
+	if (kdp_x86_xcpu_count() < 2 || tasks_count < STACKSHOT_PARALLEL_MIN_TASKS)
+		return FALSE;
+
+	return TRUE;
+#else
+#pragma unused(pid, trace_flags)
+	return FALSE;
+#endif
+}
+
+#if defined(__x86_64__)
+/*
+ * Hand out a chunk of nunits units of the free buffer space. Chunks are
+ * carved in address order, so the compaction can move them down one after
+ * the other.
+ */
+static kcdata_descriptor_t
+stackshot_parallel_chunk_alloc(struct stackshot_parallel_state *sps, kcdata_descriptor_t kcd, uint32_t nunits)
+{
+	uint32_t first;
+
+	if (nunits > sps->sps_nunits)
+		return NULL;
+
+	first = hw_atomic_add(&sps->sps_next_unit, nunits) - nunits;
+	if (first > sps->sps_nunits - nunits)
+		return NULL;
+
+	if (kcdata_memory_sub_init(&sps->sps_chunks[first], kcd, sps->sps_units_base + (mach_vm_address_t)first * sps->sps_unit_size,
+	                           nunits * sps->sps_unit_size) != KERN_SUCCESS)
+		return NULL;
+
+	return &sps->sps_chunks[first];
+}
+
+/*
+ * Record a task into the worker's chunk, or flush its nonrunnable task ids
+ * when task is TASK_NULL. A record that doesn't fit is dropped and redone
+ * in a new chunk, twice the size of the last one if that was empty.
+ * KERN_RESOURCE_SHORTAGE means the buffer itself ran out.
+ */
+static kern_return_t
+stackshot_parallel_record(struct stackshot_parallel_state *sps, struct stackshot_worker *sw, kcdata_descriptor_t kcd, task_t task)
+{
+	struct saved_uniqueids saved_uniqueids = sw->sw_saved_uniqueids;
+	mach_vm_address_t record_begin;
+	kern_return_t error;
+	uint32_t nunits = 1;
+
+	for (;;) {
+		if (sw->sw_kcdata != NULL) {
+			record_begin = sw->sw_kcdata->kcd_addr_end;
+			if (task == TASK_NULL) {
+				error = flush_nonrunnable_tasks(sw->sw_kcdata, &sw->sw_saved_uniqueids);
+			} else {
+				error = kdp_stackshot_record_task(sw->sw_kcdata, task, sps->sps_pid, sps->sps_trace_flags,
+				                                  sps->sps_sys_shared_cache_loadinfo, &sw->sw_saved_uniqueids);
+			}
+			if (error != KERN_RESOURCE_SHORTAGE)
+				return error;
+
+			sw->sw_kcdata->kcd_addr_end = record_begin;
+			sw->sw_saved_uniqueids = saved_uniqueids;
+			nunits = (record_begin == sw->sw_kcdata->kcd_addr_begin) ? 2 * sw->sw_units : 1;
+		}
+
+		sw->sw_kcdata = stackshot_parallel_chunk_alloc(sps, kcd, nunits);
+		if (sw->sw_kcdata == NULL)
+			return KERN_RESOURCE_SHORTAGE;
+		sw->sw_units = nunits;
+	}
+}
+
+/*
+ * Runs on every cpu held in the debugger. Each cpu takes a worker slot and
+ * claims tasks by index until the task list is exhausted, so a few large
+ * tasks don't leave the other cpus idle.
+ */
+static long
+stackshot_parallel_worker(void *arg0, void *arg1, __unused uint16_t lcpu)
+{
+	struct stackshot_parallel_state *sps = (struct stackshot_parallel_state *)arg0;
+	kcdata_descriptor_t kcd = (kcdata_descriptor_t)arg1;
+	struct stackshot_worker *sw = NULL;
+	kern_return_t error = KERN_SUCCESS;
+	uint32_t worker, claimed;
+
+	worker = hw_atomic_add(&sps->sps_next_worker, 1) - 1;
+	if (worker >= sps->sps_nworkers)
+		return KERN_SUCCESS;
+
+	sw = &sps->sps_workers[worker];
+
+	while (sps->sps_error == KERN_SUCCESS) {
+		claimed = hw_atomic_add(&sps->sps_next_task, 1) - 1;
+		if (claimed >= sps->sps_ntasks)
+			break;
+
+		kcd_exit_on_error(stackshot_parallel_record(sps, sw, kcd, sps->sps_tasks[claimed]));
+	}
+
+	if ((sps->sps_trace_flags & STACKSHOT_TAILSPIN) && sw->sw_saved_uniqueids.count != 0) {
+		kcd_exit_on_error(stackshot_parallel_record(sps, sw, kcd, TASK_NULL));
+	}
+
+error_exit:
+	if (error != KERN_SUCCESS) {
+		sps->sps_error = error;
+	}
+	return error;
+}
+
+/*
+ * Record all tasks using every cpu held in the debugger, appending the
+ * result to kcd. Returns KERN_RESOURCE_SHORTAGE, with nothing appended,
+ * if the free buffer space runs out; *ncpus is set to the number of cpus
+ * that took part.
+ */
+static kern_return_t
+kdp_stackshot_parallel_tasks(kcdata_descriptor_t kcd, int pid, uint32_t trace_flags,
+                             struct dyld_uuid_info_64_v2 *sys_shared_cache_loadinfo, uint32_t *ncpus)
+{
+	struct stackshot_parallel_state *sps = &stackshot_parallel;
+	kern_return_t error = KERN_SUCCESS;
+	mach_vm_address_t tasks_addr;
+	uint64_t avail, list_size;
+	uint32_t ntasks = 0, i;
+	task_t task = TASK_NULL, launchd = TASK_NULL;
+
+	/*
+	 * List the tasks once, validating each, so workers can claim them by
+	 * index. Other tasks compare their shared cache against launchd's, so
+	 * that gets filled in before any worker starts.
+	 */
+	queue_iterate(&tasks, task, task_t, tasks) {
+		if ((task == NULL) || !ml_validate_nofault((vm_offset_t)task, sizeof(struct task))) {
+			error = KERN_FAILURE;
+			goto error_exit;
+		}
+		if (pid_from_task(task) == 1)
+			launchd = task;
+		ntasks++;
+	}
+
+	if (sys_shared_cache_loadinfo != NULL && launchd != TASK_NULL) {
+		uint64_t ss_flags = 0;
+		kcd_exit_on_error(kcdata_record_shared_cache_info(kcd, launchd, sys_shared_cache_loadinfo,
+		                                                  trace_flags, (unaligned_u64 *)&ss_flags));
+	}
+
+	/* the list lives at the top of the free space, leaving room for the trailer */
+	list_size = (uint64_t)ntasks * sizeof(task_t);
+	avail = (kcd->kcd_addr_begin + kcd->kcd_length) - kcd->kcd_addr_end;
+	if (avail <= list_size + sizeof(struct kcdata_item) + STACKSHOT_PARALLEL_UNIT_MIN) {
+		return KERN_RESOURCE_SHORTAGE;
+	}
+	tasks_addr = (kcd->kcd_addr_begin + kcd->kcd_length - list_size) & ~((mach_vm_address_t)sizeof(task_t) - 1);
+	avail = tasks_addr - kcd->kcd_addr_end - sizeof(struct kcdata_item);
+
+	sps->sps_tasks = (task_t *)tasks_addr;
+	sps->sps_ntasks = 0;
+	queue_iterate(&tasks, task, task_t, tasks) {
+		sps->sps_tasks[sps->sps_ntasks++] = task;
+	}
+
+	sps->sps_nunits = (uint32_t)MIN(avail / STACKSHOT_PARALLEL_UNIT_MIN, STACKSHOT_PARALLEL_MAX_UNITS);
+	if (sps->sps_nunits == 0) {
+		return KERN_RESOURCE_SHORTAGE;
+	}
+	sps->sps_unit_size = (uint32_t)((avail / sps->sps_nunits) & ~((uint64_t)KCDATA_ALIGNMENT_SIZE - 1));
+	sps->sps_units_base = kcd->kcd_addr_end;
+	sps->sps_next_unit = 0;
+	for (i = 0; i < sps->sps_nunits; i++) {
+		sps->sps_chunks[i].kcd_length = 0;
+	}
+
+	sps->sps_pid = pid;
+	sps->sps_trace_flags = trace_flags;
+	sps->sps_nworkers = MIN(kdp_x86_xcpu_count(), MAX_CPUS);
+	sps->sps_sys_shared_cache_loadinfo = sys_shared_cache_loadinfo;
+	sps->sps_next_worker = 0;
+	sps->sps_next_task = 0;
+	sps->sps_error = KERN_SUCCESS;
+
+	for (i = 0; i < sps->sps_nworkers; i++) {
+		sps->sps_workers[i].sw_kcdata = NULL;
+		sps->sps_workers[i].sw_units = 0;
+		sps->sps_workers[i].sw_saved_uniqueids.count = 0;
+	}
+
+	*ncpus = (uint32_t)kdp_x86_xcpu_broadcast(stackshot_parallel_worker, sps, kcd);
+
+	/* nothing has been appended to kcd yet, so the caller can still walk serially */
+	kcd_exit_on_error(sps->sps_error);
+
+	/* stitch the chunks back together, in address order */
+	for (i = 0; i < sps->sps_nunits; i++) {
+		if (sps->sps_chunks[i].kcd_length != 0) {
+			kcd_exit_on_error(kcdata_memory_append_sub(kcd, &sps->sps_chunks[i]));
+		}
+	}
+
+error_exit:
+	return error;
+}
+#endif /* __x86_64__ */
+
 static kern_return_t
 kdp_stackshot_kcdata_format(int pid, uint32_t trace_flags, uint32_t * pBytesTraced)
 {
@@ -1472,9 +2006,7 @@ kdp_stackshot_kcdata_format(int pid, uint32_t trace_flags, uint32_t * pBytesTrac
 	uint64_t abs_time = 0, abs_time_end = 0;
 	uint64_t *abs_time_addr = NULL;
 	uint64_t system_state_flags = 0;
-	int saved_count = 0;
 	task_t task = TASK_NULL;
-	thread_t thread = THREAD_NULL;
 	mach_timebase_info_data_t timebase = {0, 0};
 	uint32_t length_to_copy = 0, tmp32 = 0;
 
@@ -1485,12 +2017,9 @@ kdp_stackshot_kcdata_format(int pid, uint32_t trace_flags, uint32_t * pBytesTrac
 #endif
 
 	/* process the flags */
-	boolean_t active_kthreads_only_p  = ((trace_flags & STACKSHOT_ACTIVE_KERNEL_THREADS_ONLY) != 0);
-	boolean_t save_donating_pids_p    = ((trace_flags & STACKSHOT_SAVE_IMP_DONATION_PIDS) != 0);
 	boolean_t collect_delta_stackshot = ((trace_flags & STACKSHOT_COLLECT_DELTA_SNAPSHOT) != 0);
 	boolean_t minimize_nonrunnables   = ((trace_flags & STACKSHOT_TAILSPIN) != 0);
 	boolean_t use_fault_path          = ((trace_flags & (STACKSHOT_ENABLE_UUID_FAULTING | STACKSHOT_ENABLE_BT_FAULTING)) != 0);
-	boolean_t save_owner_info         = ((trace_flags & STACKSHOT_THREAD_WAITINFO) != 0);
 
 	stack_enable_faulting = (trace_flags & (STACKSHOT_ENABLE_BT_FAULTING));
 
@@ -1570,250 +2099,36 @@ kdp_stackshot_kcdata_format(int pid, uint32_t trace_flags, uint32_t * pBytesTrac
 	}
 
 	/* Iterate over tasks */
-	queue_head_t *task_list = &tasks;
-	queue_iterate(task_list, task, task_t, tasks) {
-		int task_pid                   = 0;
-		uint64_t task_uniqueid         = 0;
-		int num_delta_thread_snapshots = 0;
-		int num_nonrunnable_threads    = 0;
-		int num_waitinfo_threads       = 0;
-		uint64_t task_start_abstime    = 0;
-		boolean_t task_delta_stackshot = FALSE;
-		boolean_t task64 = FALSE, have_map = FALSE, have_pmap = FALSE;
-		boolean_t some_thread_ran = FALSE;
-		unaligned_u64 *task_snap_ss_flags = NULL;
-
-		if ((task == NULL) || !ml_validate_nofault((vm_offset_t)task, sizeof(struct task))) {
-			error = KERN_FAILURE;
-			goto error_exit;
-		}
-
-		have_map = (task->map != NULL) && (ml_validate_nofault((vm_offset_t)(task->map), sizeof(struct _vm_map)));
-		have_pmap = have_map && (task->map->pmap != NULL) && (ml_validate_nofault((vm_offset_t)(task->map->pmap), sizeof(struct pmap)));
+	boolean_t walk_serially = TRUE;
+#if defined(__x86_64__)
+	if (stackshot_parallel_allowed(pid, trace_flags)) {
+		uint32_t parallel_cpus = 0;
 
-		task_pid = pid_from_task(task);
-		task_uniqueid = get_task_uniqueid(task);
-		task64 = task_has_64BitAddr(task);
-
-		if (!task->active || task_is_a_corpse(task)) {
-			/*
-			 * Not interested in terminated tasks without threads, and
-			 * at the moment, stackshot can't handle a task  without a name.
-			 */
-			if (queue_empty(&task->threads) || task_pid == -1) {
-				continue;
-			}
-		}
-
-		if (collect_delta_stackshot) {
-			proc_starttime_kdp(task->bsd_info, NULL, NULL, &task_start_abstime);
+		/*
+		 * KERN_RESOURCE_SHORTAGE means the parallel walk ran out of buffer,
+		 * having wasted some of it on partly filled chunks. Let the serial
+		 * walk try; it fails on its own if the buffer really is too small.
+		 */
+		error = kdp_stackshot_parallel_tasks(stackshot_kcdata_p, pid, trace_flags, sys_shared_cache_loadinfo,
+		                                     &parallel_cpus);
+		if (error != KERN_RESOURCE_SHORTAGE) {
+			kcd_exit_on_error(error);
+			kcd_exit_on_error(kcdata_add_uint32_with_description(stackshot_kcdata_p, parallel_cpus,
+			                                                     "stackshot_parallel_cpus"));
+			walk_serially = FALSE;
 		}
-
-		/* Trace everything, unless a process was specified */
-		if ((pid == -1) || (pid == task_pid)) {
-#if DEBUG || DEVELOPMENT
-			/* we might want to call kcdata_undo_add_container_begin(), which is
-			 * only safe if we call it after kcdata_add_container_marker() but
-			 * before adding any other kcdata items.  In development kernels,
-			 * we'll remember where the buffer end was and confirm after calling
-			 * kcdata_undo_add_container_begin() that it's in exactly the same
-			 * place.*/
-			mach_vm_address_t revert_addr = stackshot_kcdata_p->kcd_addr_end;
-#endif
-
-			/* add task snapshot marker */
-			kcd_exit_on_error(kcdata_add_container_marker(stackshot_kcdata_p, KCDATA_TYPE_CONTAINER_BEGIN,
-			                                              STACKSHOT_KCCONTAINER_TASK, task_uniqueid));
-
-			if (!collect_delta_stackshot || (task_start_abstime == 0) ||
-			    (task_start_abstime > stack_snapshot_delta_since_timestamp)) {
-				kcd_exit_on_error(kcdata_record_task_snapshot(stackshot_kcdata_p, task, trace_flags, have_pmap, &task_snap_ss_flags));
-			} else {
-				task_delta_stackshot = TRUE;
-				if (minimize_nonrunnables) {
-					// delay taking the task snapshot.  If there are no runnable threads we'll skip it.
-				} else {
-					kcd_exit_on_error(kcdata_record_task_delta_snapshot(stackshot_kcdata_p, task, have_pmap, &task_snap_ss_flags));
-				}
-			}
-
-			/* Iterate over task threads */
-			queue_iterate(&task->threads, thread, thread_t, task_threads)
-			{
-				uint64_t thread_uniqueid;
-
-				if ((thread == NULL) || !ml_validate_nofault((vm_offset_t)thread, sizeof(struct thread))) {
-					error = KERN_FAILURE;
-					goto error_exit;
-				}
-
-				if (active_kthreads_only_p && thread->kernel_stack == 0)
-					continue;
-
-				thread_uniqueid = thread_tid(thread);
-
-				boolean_t thread_on_core;
-				enum thread_classification thread_classification = classify_thread(thread, &thread_on_core, trace_flags);
-
-				switch (thread_classification) {
-				case tc_full_snapshot:
-					/* add thread marker */
-					kcd_exit_on_error(kcdata_add_container_marker(stackshot_kcdata_p, KCDATA_TYPE_CONTAINER_BEGIN,
-					                                              STACKSHOT_KCCONTAINER_THREAD, thread_uniqueid));
-					kcd_exit_on_error(
-					    kcdata_record_thread_snapshot(stackshot_kcdata_p, thread, task, trace_flags, have_pmap, thread_on_core));
-
-					/* mark end of thread snapshot data */
-					kcd_exit_on_error(kcdata_add_container_marker(stackshot_kcdata_p, KCDATA_TYPE_CONTAINER_END,
-					                                              STACKSHOT_KCCONTAINER_THREAD, thread_uniqueid));
-
-					some_thread_ran = TRUE;
-					break;
-
-				case tc_delta_snapshot:
-					num_delta_thread_snapshots++;
-					break;
-
-				case tc_nonrunnable:
-					num_nonrunnable_threads++;
-					break;
-				}
-
-				/* We want to report owner information regardless of whether a thread
-				 * has changed since the last delta, whether it's a normal stackshot,
-				 * or whether it's nonrunnable */
-				if (save_owner_info && stackshot_thread_has_valid_waitinfo(thread))
-					num_waitinfo_threads++;
-			}
-
-			if (task_delta_stackshot && minimize_nonrunnables) {
-				if (some_thread_ran || num_delta_thread_snapshots > 0) {
-					kcd_exit_on_error(kcdata_record_task_delta_snapshot(stackshot_kcdata_p, task, have_pmap, &task_snap_ss_flags));
-				} else {
-					kcd_exit_on_error(kcdata_undo_add_container_begin(stackshot_kcdata_p));
-
-#if DEBUG || DEVELOPMENT
-					mach_vm_address_t undo_addr = stackshot_kcdata_p->kcd_addr_end;
-					if (revert_addr != undo_addr) {
-						panic("tried to revert a container begin but we already moved past it. revert=%p undo=%p",
-						      (void *)revert_addr, (void *)undo_addr);
-					}
-#endif
-					kcd_exit_on_error(handle_nonrunnable_task(&saved_uniqueids, task_uniqueid));
-					continue;
-				}
-			}
-
-			struct thread_delta_snapshot_v2 * delta_snapshots = NULL;
-			int current_delta_snapshot_index                  = 0;
-
-			if (num_delta_thread_snapshots > 0) {
-				kcd_exit_on_error(kcdata_get_memory_addr_for_array(stackshot_kcdata_p, STACKSHOT_KCTYPE_THREAD_DELTA_SNAPSHOT,
-				                                                   sizeof(struct thread_delta_snapshot_v2),
-				                                                   num_delta_thread_snapshots, &out_addr));
-				delta_snapshots = (struct thread_delta_snapshot_v2 *)out_addr;
-			}
-
-			uint64_t * nonrunnable_tids   = NULL;
-			int current_nonrunnable_index = 0;
-
-			if (num_nonrunnable_threads > 0) {
-				kcd_exit_on_error(kcdata_get_memory_addr_for_array(stackshot_kcdata_p, STACKSHOT_KCTYPE_NONRUNNABLE_TIDS,
-				                                                   sizeof(uint64_t), num_nonrunnable_threads, &out_addr));
-				nonrunnable_tids = (uint64_t *)out_addr;
-			}
-
-			thread_waitinfo_t *thread_waitinfo = NULL;
-			int current_waitinfo_index         = 0;
-
-			if (num_waitinfo_threads > 0) {
-				kcd_exit_on_error(kcdata_get_memory_addr_for_array(stackshot_kcdata_p, STACKSHOT_KCTYPE_THREAD_WAITINFO,
-									   sizeof(thread_waitinfo_t), num_waitinfo_threads, &out_addr));
-				thread_waitinfo = (thread_waitinfo_t *)out_addr;
-			}
-
-			if (num_delta_thread_snapshots > 0 || num_nonrunnable_threads > 0 || num_waitinfo_threads > 0) {
-				queue_iterate(&task->threads, thread, thread_t, task_threads)
-				{
-					if (active_kthreads_only_p && thread->kernel_stack == 0)
-						continue;
-
-					/* If we want owner info, we should capture it regardless of its classification */
-					if (save_owner_info && stackshot_thread_has_valid_waitinfo(thread)) {
-						stackshot_thread_wait_owner_info(
-								thread,
-								&thread_waitinfo[current_waitinfo_index++]);
-					}
-
-					boolean_t thread_on_core;
-					enum thread_classification thread_classification = classify_thread(thread, &thread_on_core, trace_flags);
-
-					switch (thread_classification) {
-					case tc_full_snapshot:
-						/* full thread snapshot captured above */
-						continue;
-
-					case tc_delta_snapshot:
-						kcd_exit_on_error(kcdata_record_thread_delta_snapshot(&delta_snapshots[current_delta_snapshot_index++],
-						                                                      thread, thread_on_core));
-						break;
-
-					case tc_nonrunnable:
-						nonrunnable_tids[current_nonrunnable_index++] = thread_tid(thread);
-						continue;
-					}
-				}
-
-#if DEBUG || DEVELOPMENT
-				if (current_delta_snapshot_index != num_delta_thread_snapshots) {
-					panic("delta thread snapshot count mismatch while capturing snapshots for task %p. expected %d, found %d", task,
-					      num_delta_thread_snapshots, current_delta_snapshot_index);
-				}
-				if (current_nonrunnable_index != num_nonrunnable_threads) {
-					panic("nonrunnable thread count mismatch while capturing snapshots for task %p. expected %d, found %d", task,
-					      num_nonrunnable_threads, current_nonrunnable_index);
-				}
-				if (current_waitinfo_index != num_waitinfo_threads) {
-					panic("thread wait info count mismatch while capturing snapshots for task %p. expected %d, found %d", task,
-					      num_waitinfo_threads, current_waitinfo_index);
-				}
-#endif
-			}
-
-#if IMPORTANCE_INHERITANCE
-			if (save_donating_pids_p) {
-				kcd_exit_on_error(
-				    ((((mach_vm_address_t)kcd_end_address(stackshot_kcdata_p) + (TASK_IMP_WALK_LIMIT * sizeof(int32_t))) <
-				      (mach_vm_address_t)kcd_max_address(stackshot_kcdata_p))
-				         ? KERN_SUCCESS
-				         : KERN_RESOURCE_SHORTAGE));
-				saved_count = task_importance_list_pids(task, TASK_IMP_LIST_DONATING_PIDS,
-				                                        (void *)kcd_end_address(stackshot_kcdata_p), TASK_IMP_WALK_LIMIT);
-				if (saved_count > 0)
-					kcd_exit_on_error(kcdata_get_memory_addr_for_array(stackshot_kcdata_p, STACKSHOT_KCTYPE_DONATING_PIDS,
-					                                                   sizeof(int32_t), saved_count, &out_addr));
-			}
-#endif
-
-			if (!collect_delta_stackshot || (num_delta_thread_snapshots != task->thread_count) || !task_delta_stackshot) {
-				/*
-				 * Collect shared cache info and UUID info in these scenarios
-				 * 1) a full stackshot
-				 * 2) a delta stackshot where the task started after the previous full stackshot OR
-				 *    any thread from the task has run since the previous full stackshot
-				 */
-
-				kcd_exit_on_error(kcdata_record_shared_cache_info(stackshot_kcdata_p, task, sys_shared_cache_loadinfo, trace_flags, task_snap_ss_flags));
-				kcd_exit_on_error(kcdata_record_uuid_info(stackshot_kcdata_p, task, trace_flags, have_pmap, task_snap_ss_flags));
-			}
-			/* mark end of task snapshot data */
-			kcd_exit_on_error(kcdata_add_container_marker(stackshot_kcdata_p, KCDATA_TYPE_CONTAINER_END, STACKSHOT_KCCONTAINER_TASK,
-			                                              task_uniqueid));
+		error = KERN_SUCCESS;
+	}
+#endif /* __x86_64__ */
+	if (walk_serially) {
+		queue_iterate(&tasks, task, task_t, tasks) {
+			kcd_exit_on_error(kdp_stackshot_record_task(stackshot_kcdata_p, task, pid, trace_flags,
+			                                            sys_shared_cache_loadinfo, &saved_uniqueids));
 		}
 	}
 
 	if (minimize_nonrunnables) {
-		flush_nonrunnable_tasks(&saved_uniqueids);
+		flush_nonrunnable_tasks(stackshot_kcdata_p, &saved_uniqueids);
 	}
 
 	if (use_fault_path) {
@@ -2084,7 +2399,7 @@ do_stackshot(void *context)
  * same page.  It turns out this is exactly the workflow
  * machine_trace_thread and its relatives tend to throw at us.
  *
- * Please zero the nasty global this uses after a bulk lookup;
+ * Please zero the nasty per-cpu cache this uses after a bulk lookup;
  * this isn't safe across a switch of the map or changes
  * to a pmap.
  *
@@ -2100,9 +2415,11 @@ machine_trace_thread_get_kva(vm_offset_t cur_target_addr, vm_map_t map, uint32_t
 	vm_offset_t kern_virt_target_addr;
 	uint32_t kdp_fault_results = 0;
 
+	struct stackshot_kva_cache *cache = &stackshot_kva_cache[cpu_number()];
+
 	cur_target_page = atop(cur_target_addr);
 
-	if ((cur_target_page != prev_target_page) || validate_next_addr) {
+	if ((cur_target_page != cache->prev_target_page) || cache->validate_next_addr) {
 
 		/*
 		 * Alright; it wasn't our previous page.  So
@@ -2135,13 +2452,13 @@ machine_trace_thread_get_kva(vm_offset_t cur_target_addr, vm_map_t map, uint32_t
 #else
 #error Oh come on... we should really unify the physical -> kernel virtual interface
 #endif
-		prev_target_page = cur_target_page;
-		prev_target_kva = (kern_virt_target_addr & ~PAGE_MASK);
-		validate_next_addr = FALSE;
+		cache->prev_target_page = cur_target_page;
+		cache->prev_target_kva = (kern_virt_target_addr & ~PAGE_MASK);
+		cache->validate_next_addr = FALSE;
 		return kern_virt_target_addr;
 	} else {
 		/* We found a translation, so stash this page */
-		kern_virt_target_addr = prev_target_kva + (cur_target_addr & PAGE_MASK);
+		kern_virt_target_addr = cache->prev_target_kva + (cur_target_addr & PAGE_MASK);
 		return kern_virt_target_addr;
 	}
 }
@@ -2149,7 +2466,7 @@ machine_trace_thread_get_kva(vm_offset_t cur_target_addr, vm_map_t map, uint32_t
 void
 machine_trace_thread_clear_validation_cache(void)
 {
-	validate_next_addr = TRUE;
+	stackshot_kva_cache[cpu_number()].validate_next_addr = TRUE;
 }
 
 boolean_t
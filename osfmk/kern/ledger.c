@@ -30,6 +30,8 @@
  */
 
 #include <kern/kern_types.h>
+#include <kern/cpu_data.h>
+#include <kern/cpu_number.h>
 #include <kern/ledger.h>
 #include <kern/kalloc.h>
 #include <kern/task.h>
@@ -46,6 +48,10 @@
 #include <mach/mach_types.h>
 #include <os/overflow.h>
 
+#if defined(__x86_64__)
+#include <i386/mp.h>
+#endif
+
 /*
  * Ledger entry flags. Bits in second nibble (masked by 0xF0) are used for
  * ledger actions (LEDGER_ACTION_BLOCK, etc).
@@ -60,6 +66,12 @@
 #define	LF_TRACKING_MAX		0x4000	/* track max balance over user-specfied time */
 #define LF_PANIC_ON_NEGATIVE	0x8000	/* panic if it goes negative */
 #define LF_TRACK_CREDIT_ONLY	0x10000	/* only update "credit" */
+#define LF_PERCPU		0x20000	/* updates accumulate in per-CPU deltas */
+#define LF_PERCPU_DIRTY		0x40000	/* a CPU may hold an unfolded delta */
+#define LF_PERCPU_SLOT_SHIFT	19	/* 2 bits: slot in struct ledger_percpu */
+
+#define LF_PERCPU_SLOT(flags)	\
+	(((flags) >> LF_PERCPU_SLOT_SHIFT) & (LEDGER_PERCPU_ENTRIES - 1))
 
 /* Determine whether a ledger entry exists and has been initialized and active */
 #define	ENTRY_VALID(l, e)					\
@@ -110,6 +122,7 @@ struct ledger_template {
 	int			lt_refs;
 	int			lt_cnt;
 	int			lt_table_size;
+	int			lt_percpu_cnt;
 	volatile uint32_t	lt_inuse;
 	lck_mtx_t		lt_lock;
 	struct entry_template	*lt_entries;
@@ -159,11 +172,36 @@ struct ledger_entry {
 	} _le;
 } __attribute__((aligned(8)));
 
+/*
+ * Per-CPU deltas for hot entries.  Updates to an entry marked with
+ * ledger_track_percpu() go to this CPU's slot of the ledger's l_percpu
+ * array, so that the common case dirties only a local cache line.  A CPU
+ * folds its slot into the entry once either delta reaches LEDGER_PERCPU_FOLD,
+ * and readers fold every CPU's slot first, so balances read back exact.
+ *
+ * The array has a slot for each CPU the machine had when the ledger was
+ * instantiated; a CPU registered later updates the entry directly.
+ *
+ * At most LEDGER_PERCPU_SLACK() can be outstanding.  An entry whose balance
+ * is within that of its limit or warning level, or which refills or tracks
+ * its maximum, is updated directly so that those checks stay precise.
+ */
+#define LEDGER_PERCPU_ENTRIES	4		/* must be a power of 2 */
+#define LEDGER_PERCPU_FOLD	(64 * 1024)
+#define LEDGER_PERCPU_SLACK(l)	((ledger_amount_t)LEDGER_PERCPU_FOLD * (l)->l_percpu_ncpus)
+
+struct ledger_percpu {
+	volatile ledger_amount_t	lp_credit[LEDGER_PERCPU_ENTRIES];
+	volatile ledger_amount_t	lp_debit[LEDGER_PERCPU_ENTRIES];
+} __attribute__((aligned(64)));
+
 struct ledger {
 	uint64_t		l_id;
 	int32_t			l_refs;
 	int32_t			l_size;
 	struct ledger_template	*l_template;
+	struct ledger_percpu	*l_percpu;	/* per-CPU slots, if any LF_PERCPU entries */
+	uint32_t		l_percpu_ncpus;	/* slots in l_percpu */
 	struct ledger_entry	l_entries[0] __attribute__((aligned(8)));
 };
 
@@ -225,6 +263,7 @@ ledger_template_create(const char *name)
 	template->lt_refs = 1;
 	template->lt_cnt = 0;
 	template->lt_table_size = 1;
+	template->lt_percpu_cnt = 0;
 	template->lt_inuse = 0;
 	lck_mtx_init(&template->lt_lock, &ledger_lck_grp, LCK_ATTR_NULL);
 
@@ -359,11 +398,13 @@ ledger_instantiate(ledger_template_t template, int entry_type)
 {
 	ledger_t ledger;
 	size_t cnt, sz;
-	int i;
+	int i, percpu_cnt;
+	uint32_t ncpus;
 
 	template_lock(template);
 	template->lt_refs++;
 	cnt = template->lt_cnt;
+	percpu_cnt = template->lt_percpu_cnt;
 	template_unlock(template);
 
 	sz = sizeof(*ledger) + (cnt * sizeof(struct ledger_entry));
@@ -374,6 +415,26 @@ ledger_instantiate(ledger_template_t template, int entry_type)
 		return LEDGER_NULL;
 	}
 
+	ledger->l_percpu = NULL;
+	ledger->l_percpu_ncpus = 0;
+	if (percpu_cnt != 0) {
+		/* CPUs are still being registered early in boot */
+		ncpus = (uint32_t)machine_info.logical_cpu_max;
+		if (ncpus == 0)
+			ncpus = 1;
+		else if (ncpus > MAX_CPUS)
+			ncpus = MAX_CPUS;
+
+		ledger->l_percpu = kalloc(ncpus * sizeof(struct ledger_percpu));
+		if (ledger->l_percpu == NULL) {
+			kfree(ledger, sz);
+			ledger_template_dereference(template);
+			return LEDGER_NULL;
+		}
+		bzero(ledger->l_percpu, ncpus * sizeof(struct ledger_percpu));
+		ledger->l_percpu_ncpus = ncpus;
+	}
+
 	ledger->l_template = template;
 	ledger->l_id = ledger_cnt++;
 	ledger->l_refs = 1;
@@ -457,6 +518,9 @@ ledger_dereference(ledger_t ledger)
 
 	/* Just released the last reference.  Free it. */
 	if (v == 1) {
+		if (ledger->l_percpu != NULL)
+			kfree(ledger->l_percpu,
+			      ledger->l_percpu_ncpus * sizeof(struct ledger_percpu));
 		kfree(ledger,
 		      sizeof(*ledger) + ledger->l_size * sizeof(struct ledger_entry));
 	}
@@ -511,6 +575,130 @@ limit_exceeded(struct ledger_entry *le)
 	return (0);
 }
 
+/*
+ * Can this update go to a per-CPU delta?  See LEDGER_PERCPU_SLACK().
+ */
+static inline boolean_t
+ledger_percpu_usable(ledger_t ledger, struct ledger_entry *le)
+{
+	ledger_amount_t balance;
+	uint32_t flags = le->le_flags;
+
+	if ((flags & (LF_PERCPU | LF_TRACKING_MAX | LF_REFILL_SCHEDULED |
+	    LF_WAKE_NEEDED)) != LF_PERCPU)
+		return (FALSE);
+
+	if ((le->le_limit == LEDGER_LIMIT_INFINITY) &&
+	    (le->le_warn_level == LEDGER_LIMIT_INFINITY))
+		return (TRUE);
+
+	balance = le->le_credit - le->le_debit;
+	if ((le->le_limit != LEDGER_LIMIT_INFINITY) &&
+	    ((le->le_limit <= 0) || (balance > le->le_limit - LEDGER_PERCPU_SLACK(ledger))))
+		return (FALSE);
+	if ((le->le_warn_level != LEDGER_LIMIT_INFINITY) &&
+	    (balance > le->le_warn_level - LEDGER_PERCPU_SLACK(ledger)))
+		return (FALSE);
+	return (TRUE);
+}
+
+/*
+ * Atomically take a CPU's delta, leaving zero behind.
+ */
+static inline ledger_amount_t
+ledger_percpu_take(volatile ledger_amount_t *delta)
+{
+	ledger_amount_t old;
+
+	do {
+		old = *delta;
+	} while ((old != 0) && !OSCompareAndSwap64(old, 0, delta));
+
+	return (old);
+}
+
+/*
+ * Move the deltas taken from one or more CPUs into the entry.  The credit
+ * goes first, so that a debit it covers never shows as a negative balance.
+ */
+static inline void
+ledger_percpu_apply(struct ledger_entry *le, ledger_amount_t credit,
+    ledger_amount_t debit)
+{
+	if (credit != 0)
+		OSAddAtomic64(credit, &le->le_credit);
+	if (debit != 0)
+		OSAddAtomic64(debit, &le->le_debit);
+}
+
+/*
+ * Fold every CPU's delta for this entry into it.  Updaters set
+ * LF_PERCPU_DIRTY after adding to their delta, so clearing it before the
+ * sweep can't lose one.
+ */
+static void
+ledger_percpu_fold(ledger_t ledger, struct ledger_entry *le)
+{
+	ledger_amount_t credit = 0, debit = 0;
+	uint32_t cpu;
+	int slot;
+
+	if ((le->le_flags & LF_PERCPU_DIRTY) == 0)
+		return;
+
+	flag_clear(&le->le_flags, LF_PERCPU_DIRTY);
+	slot = LF_PERCPU_SLOT(le->le_flags);
+	for (cpu = 0; cpu < ledger->l_percpu_ncpus; cpu++) {
+		credit += ledger_percpu_take(&ledger->l_percpu[cpu].lp_credit[slot]);
+		debit += ledger_percpu_take(&ledger->l_percpu[cpu].lp_debit[slot]);
+	}
+	ledger_percpu_apply(le, credit, debit);
+}
+
+/*
+ * Add amount to this CPU's credit or debit delta for the entry, folding the
+ * delta once it grows past LEDGER_PERCPU_FOLD.  Returns FALSE, having done
+ * nothing, if the entry must be updated directly.
+ */
+static boolean_t
+ledger_percpu_add(ledger_t ledger, int entry, struct ledger_entry *le,
+    ledger_amount_t amount, boolean_t debit)
+{
+	struct ledger_percpu *lp;
+	ledger_amount_t delta;
+	uint32_t cpu;
+	int slot;
+
+	if (!ledger_percpu_usable(ledger, le))
+		return (FALSE);
+
+	slot = LF_PERCPU_SLOT(le->le_flags);
+
+	disable_preemption();
+	cpu = (uint32_t)cpu_number();
+	if (cpu >= ledger->l_percpu_ncpus) {
+		enable_preemption();
+		return (FALSE);
+	}
+	lp = &ledger->l_percpu[cpu];
+	if (debit)
+		delta = OSAddAtomic64(amount, &lp->lp_debit[slot]) + amount;
+	else
+		delta = OSAddAtomic64(amount, &lp->lp_credit[slot]) + amount;
+	enable_preemption();
+
+	if ((le->le_flags & LF_PERCPU_DIRTY) == 0)
+		flag_set(&le->le_flags, LF_PERCPU_DIRTY);
+
+	if ((delta >= LEDGER_PERCPU_FOLD) || (delta <= -LEDGER_PERCPU_FOLD)) {
+		ledger_percpu_apply(le, ledger_percpu_take(&lp->lp_credit[slot]),
+		    ledger_percpu_take(&lp->lp_debit[slot]));
+		ledger_entry_check_new_balance(ledger, entry, le);
+	}
+
+	return (TRUE);
+}
+
 static inline struct ledger_callback *
 entry_get_callback(ledger_t ledger, int entry)
 {
@@ -774,6 +962,12 @@ ledger_entry_check_new_balance(ledger_t ledger, int entry, struct ledger_entry *
 
 	credit = le->le_credit;
 	debit = le->le_debit;
+	if ((le->le_flags & LF_PERCPU) && (credit < debit)) {
+		/* The credits covering this debit may still be on another CPU */
+		ledger_percpu_fold(ledger, le);
+		credit = le->le_credit;
+		debit = le->le_debit;
+	}
 	if ((le->le_flags & LF_PANIC_ON_NEGATIVE) &&
 	    ((credit < debit) ||
 	     (le->le_credit < le->le_debit))) {
@@ -812,6 +1006,12 @@ ledger_credit(ledger_t ledger, int entry, ledger_amount_t amount)
 
 	le = &ledger->l_entries[entry];
 
+	if (le->le_flags & LF_PERCPU) {
+		if (ledger_percpu_add(ledger, entry, le, amount, FALSE))
+			return (KERN_SUCCESS);
+		ledger_percpu_fold(ledger, le);
+	}
+
 	old = OSAddAtomic64(amount, &le->le_credit);
 	new = old + amount;
 	lprintf(("%p Credit %lld->%lld\n", current_thread(), old, new));
@@ -856,6 +1056,8 @@ ledger_rollup_entry(ledger_t to_ledger, ledger_t from_ledger, int entry)
 	if (ENTRY_VALID(from_ledger, entry) && ENTRY_VALID(to_ledger, entry)) {
 		from_le = &from_ledger->l_entries[entry];
 		to_le   =   &to_ledger->l_entries[entry];
+		if (from_le->le_flags & LF_PERCPU)
+			ledger_percpu_fold(from_ledger, from_le);
 		OSAddAtomic64(from_le->le_credit, &to_le->le_credit);
 		OSAddAtomic64(from_le->le_debit,  &to_le->le_debit);
 	}
@@ -879,6 +1081,9 @@ ledger_zero_balance(ledger_t ledger, int entry)
 
 	le = &ledger->l_entries[entry];
 
+	if (le->le_flags & LF_PERCPU)
+		ledger_percpu_fold(ledger, le);
+
 top:
 	debit = le->le_debit;
 	credit = le->le_credit;
@@ -947,6 +1152,10 @@ ledger_set_limit(ledger_t ledger, int entry, ledger_amount_t limit,
 		ledger_disable_refill(ledger, entry);
 	}
 
+	/* Later updates check against the new limit with the exact balance */
+	if (le->le_flags & LF_PERCPU)
+		ledger_percpu_fold(ledger, le);
+
 	le->le_limit = limit;
 	le->_le.le_refill.le_last_refill = 0;
 	flag_clear(&le->le_flags, LF_CALLED_BACK);
@@ -1055,6 +1264,38 @@ ledger_track_credit_only(ledger_template_t template, int entry)
 	return (KERN_SUCCESS);
 }
 
+/*
+ * Accumulate updates to this entry in per-CPU deltas.  Meant for entries
+ * that many threads of one task update at once; at most
+ * LEDGER_PERCPU_ENTRIES entries of a template can use this.
+ */
+kern_return_t
+ledger_track_percpu(ledger_template_t template, int entry)
+{
+	struct entry_template *et;
+
+	template_lock(template);
+
+	if ((entry < 0) || (entry >= template->lt_cnt)) {
+		template_unlock(template);
+		return (KERN_INVALID_VALUE);
+	}
+
+	et = &template->lt_entries[entry];
+	if ((et->et_flags & LF_PERCPU) == 0) {
+		if (template->lt_percpu_cnt == LEDGER_PERCPU_ENTRIES) {
+			template_unlock(template);
+			return (KERN_RESOURCE_SHORTAGE);
+		}
+		et->et_flags |= LF_PERCPU |
+		    ((uint32_t)template->lt_percpu_cnt++ << LF_PERCPU_SLOT_SHIFT);
+	}
+
+	template_unlock(template);
+
+	return (KERN_SUCCESS);
+}
+
 /*
  * Add a callback to be executed when the resource goes into deficit.
  */
@@ -1247,6 +1488,16 @@ ledger_debit(ledger_t ledger, int entry, ledger_amount_t amount)
 
 	le = &ledger->l_entries[entry];
 
+	if (le->le_flags & LF_PERCPU) {
+		if (le->le_flags & LF_TRACK_CREDIT_ONLY) {
+			if (ledger_percpu_add(ledger, entry, le, -amount, FALSE))
+				return (KERN_SUCCESS);
+		} else if (ledger_percpu_add(ledger, entry, le, amount, TRUE)) {
+			return (KERN_SUCCESS);
+		}
+		ledger_percpu_fold(ledger, le);
+	}
+
 	if (le->le_flags & LF_TRACK_CREDIT_ONLY) {
 		assert(le->le_debit == 0);
 		old = OSAddAtomic64(-amount, &le->le_credit);
@@ -1488,6 +1739,9 @@ ledger_get_entries(ledger_t ledger, int entry, ledger_amount_t *credit,
 
 	le = &ledger->l_entries[entry];
 
+	if (le->le_flags & LF_PERCPU)
+		ledger_percpu_fold(ledger, le);
+
 	*credit = le->le_credit;
 	*debit = le->le_debit;
 
@@ -1534,6 +1788,9 @@ ledger_get_balance(ledger_t ledger, int entry, ledger_amount_t *balance)
 
 	le = &ledger->l_entries[entry];
 
+	if (le->le_flags & LF_PERCPU)
+		ledger_percpu_fold(ledger, le);
+
 	if (le->le_flags & LF_TRACK_CREDIT_ONLY) {
 		assert(le->le_debit == 0);
 	} else {
@@ -1585,7 +1842,8 @@ ledger_template_info(void **buf, int *len)
 }
 
 static void
-ledger_fill_entry_info(struct ledger_entry      *le,
+ledger_fill_entry_info(ledger_t                  ledger,
+                       struct ledger_entry      *le,
                        struct ledger_entry_info *lei,
                        uint64_t                  now)
 {
@@ -1594,6 +1852,9 @@ ledger_fill_entry_info(struct ledger_entry      *le,
 
 	memset(lei, 0, sizeof (*lei));
 
+	if (le->le_flags & LF_PERCPU)
+		ledger_percpu_fold(ledger, le);
+
 	lei->lei_limit         = le->le_limit;
 	lei->lei_credit        = le->le_credit;
 	lei->lei_debit         = le->le_debit;
@@ -1625,7 +1886,7 @@ ledger_get_task_entry_info_multiple(task_t task, void **buf, int *len)
 	le = l->l_entries;
 
 	for (i = 0; i < *len; i++) {
-		ledger_fill_entry_info(le, lei, now);
+		ledger_fill_entry_info(l, le, lei, now);
 		le++;
 		lei++;
 	}
@@ -1645,7 +1906,7 @@ ledger_get_entry_info(ledger_t                  ledger,
 
 	if (entry >= 0 && entry < ledger->l_size) {
 		struct ledger_entry *le = &ledger->l_entries[entry];
-		ledger_fill_entry_info(le, lei, now);
+		ledger_fill_entry_info(ledger, le, lei, now);
 	}
 }
 
@@ -104,6 +104,8 @@ extern kern_return_t ledger_panic_on_negative(ledger_template_t template,
 					      int entry);
 extern kern_return_t ledger_track_credit_only(ledger_template_t template,
 					      int entry);
+extern kern_return_t ledger_track_percpu(ledger_template_t template,
+					 int entry);
 extern int ledger_key_lookup(ledger_template_t template, const char *key);
 
 /* value of entry type */
@@ -83,6 +83,8 @@ typedef struct {
 	uint64_t			lck_grp_mtx_held_cum;
 	uint64_t			lck_grp_mtx_wait_max;
 	uint64_t			lck_grp_mtx_wait_cum;
+	/* On x86, recent wait for release seen by spinning contenders */
+	uint64_t			lck_grp_mtx_spin_avg;
 } lck_grp_mtx_stat_t;
 
 typedef struct {
@@ -398,6 +400,24 @@ extern boolean_t		lck_mtx_ilk_try_lock(
 
 #endif
 
+#ifdef	XNU_KERNEL_PRIVATE
+/* Contended mutex spin outcomes, summed over all processors */
+struct lck_mtx_spin_stats {
+	uint64_t	spins;		/* contended acquisitions that tried spinning */
+	uint64_t	acquired;	/* ... and got the mutex while spinning */
+	uint64_t	timeouts;	/* ... and ran out of spin budget */
+	uint64_t	owner_offcore;	/* ... and stopped as the owner left its processor */
+	uint64_t	short_budget;	/* ... with less than the full MutexSpin budget */
+	uint64_t	recovery_probes;	/* ... with the full budget on a demoted lock */
+	uint64_t	spin_time;	/* nanoseconds spent spinning */
+};
+
+__BEGIN_DECLS
+extern void				lck_mtx_spin_stats_get(
+									struct lck_mtx_spin_stats *stats);
+__END_DECLS
+#endif
+
 #define decl_lck_rw_data(class,name)     class lck_rw_t name;
 
 typedef unsigned int	 lck_rw_type_t;
@@ -26,14 +26,19 @@
  * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
  */
 #include <kern/cpu_data.h>
+#include <kern/cpu_number.h>
 #include <kern/kern_types.h>
 #include <kern/locks.h>
 #include <kern/ltable.h>
+#include <kern/misc_protos.h>
 #include <kern/zalloc.h>
 #include <libkern/OSAtomic.h>
 #include <pexpert/pexpert.h>
 #include <vm/vm_kern.h>
 
+#if defined(__x86_64__)
+#include <i386/mp.h>
+#endif
 
 #define	P2ROUNDUP(x, align) (-(-((uint32_t)(x)) & -(align)))
 #define ROUNDDOWN(x,y)	(((x)/(y))*(y))
@@ -47,6 +52,9 @@
 vm_size_t         g_lt_max_tbl_size;
 static lck_grp_t  g_lt_lck_grp;
 
+/* per-CPU free element cache depth (0 disables the caches) */
+static uint32_t   g_lt_cpu_cache_max = LT_CPU_CACHE_MAX;
+
 /* default VA space for link tables (zone allocated) */
 #define DEFAULT_MAX_TABLE_SIZE  P2ROUNDUP(8 * 1024 * 1024, PAGE_SIZE)
 
@@ -144,6 +152,111 @@ static void lt_elem_set_type(struct lt_elem *elem, int type)
 }
 
 
+/**
+ * lt_free_list_push: return a list of free elements to the table's free list
+ *
+ * 'head' through 'tail' must already be linked through lt_next_idx. The whole
+ * list is published with a single compare-and-swap of the free list head.
+ */
+static void lt_free_list_push(struct link_table *table,
+			      struct lt_elem *head, struct lt_elem *tail)
+{
+	struct ltable_id free_id;
+
+again:
+	free_id = table->free_list;
+	if (free_id.idx >= table->nelem)
+		tail->lt_next_idx = LT_IDX_MAX;
+	else
+		tail->lt_next_idx = free_id.idx;
+
+	/* store barrier */
+	OSMemoryBarrier();
+	if (OSCompareAndSwap64(free_id.id, head->lt_id.id,
+			       &table->free_list.id) == FALSE) {
+		OSIncrementAtomic64((volatile SInt64 *)&table->nfree_collisions);
+		goto again;
+	}
+}
+
+
+/**
+ * lt_cpu_cache_alloc: take a free element from the current CPU's cache
+ *
+ * Returns NULL if the cache is empty. The returned element is still counted
+ * in 'used_elem' (it was never returned to the free list).
+ */
+static struct lt_elem *lt_cpu_cache_alloc(struct link_table *table)
+{
+	struct lt_cpu_cache *cache;
+	struct lt_elem *elem = NULL;
+
+	disable_preemption();
+	cache = &table->cpu_cache[cpu_number()];
+	if (cache->avail > 0) {
+		elem = lt_elem_idx(table, cache->head);
+		cache->head = elem->lt_next_idx;
+		cache->avail--;
+		cache->hits++;
+	} else {
+		cache->misses++;
+	}
+	enable_preemption();
+
+	return elem;
+}
+
+
+/**
+ * lt_cpu_cache_free: stash a free element in the current CPU's cache
+ *
+ * When the cache overflows, its older half is handed back to the table's
+ * free list in one batch. Returns FALSE if per-CPU caching is disabled.
+ */
+static boolean_t lt_cpu_cache_free(struct link_table *table,
+				   struct lt_elem *elem)
+{
+	struct lt_cpu_cache *cache;
+	struct lt_elem *first = NULL, *last = NULL;
+	uint32_t nflush = 0;
+
+	if (g_lt_cpu_cache_max == 0)
+		return FALSE;
+
+	disable_preemption();
+	cache = &table->cpu_cache[cpu_number()];
+	elem->lt_next_idx = (cache->avail > 0) ? cache->head : LT_IDX_MAX;
+	cache->head = elem->lt_id.idx;
+	cache->avail++;
+
+	if (cache->avail > g_lt_cpu_cache_max) {
+		/* keep the most recently freed (cache-hot) half */
+		uint32_t nkeep = cache->avail - (cache->avail / 2);
+
+		last = elem;
+		for (uint32_t i = 1; i < nkeep; i++)
+			last = lt_elem_idx(table, last->lt_next_idx);
+		first = lt_elem_idx(table, last->lt_next_idx);
+		last->lt_next_idx = LT_IDX_MAX;
+
+		nflush = cache->avail - nkeep;
+		cache->avail = nkeep;
+		cache->flushes++;
+	}
+	enable_preemption();
+
+	if (first != NULL) {
+		/* the oldest cached element terminates the detached list */
+		for (last = first; last->lt_next_idx != LT_IDX_MAX; )
+			last = lt_elem_idx(table, last->lt_next_idx);
+		OSAddAtomic(-(int)nflush, &table->used_elem);
+		lt_free_list_push(table, first, last);
+	}
+
+	return TRUE;
+}
+
+
 /**
  * ltable_bootstrap: bootstrap a link table
  *
@@ -163,6 +276,9 @@ void ltable_bootstrap(void)
 	if (PE_parse_boot_argn("lt_tbl_size", &tmp32, sizeof(tmp32)) == TRUE)
 		g_lt_max_tbl_size = (vm_size_t)P2ROUNDUP(tmp32, PAGE_SIZE);
 
+	if (PE_parse_boot_argn("lt_cpu_cache", &tmp32, sizeof(tmp32)) == TRUE)
+		g_lt_cpu_cache_max = MIN(tmp32, 1024);
+
 	lck_grp_init(&g_lt_lck_grp, "link_table_locks", LCK_GRP_ATTR_NULL);
 }
 
@@ -178,7 +294,9 @@ void ltable_init(struct link_table *table, const char *name,
 	uint32_t slab_sz, slab_shift, slab_msk, slab_elem;
 	zone_t slab_zone;
 	size_t max_tbl_sz;
+	vm_size_t cache_sz;
 	struct lt_elem *e, **base;
+	struct lt_cpu_cache *cpu_cache;
 
 #ifndef CONFIG_LTABLE_STATS
 	/* the element size _must_ be a power of two! */
@@ -198,6 +316,17 @@ void ltable_init(struct link_table *table, const char *name,
 		      "kernel_memory_allocate failed:%d\n", name, kr);
 	memset(base, 0, PAGE_SIZE);
 
+	/* per-CPU free element caches, one cache line each */
+	cache_sz = round_page(MAX_CPUS * sizeof(struct lt_cpu_cache));
+	kr = kernel_memory_allocate(kernel_map, (vm_offset_t *)&cpu_cache,
+				    cache_sz, 0, KMA_NOPAGEWAIT, VM_KERN_MEMORY_LTABLE);
+	if (kr != KERN_SUCCESS)
+		panic("Cannot initialize %s table: "
+		      "kernel_memory_allocate failed:%d\n", name, kr);
+	memset(cpu_cache, 0, cache_sz);
+	for (unsigned c = 0; c < MAX_CPUS; c++)
+		cpu_cache[c].head = LT_IDX_MAX;
+
 	/*
 	 * Based on the maximum table size, calculate the slab size:
 	 * we allocate 1 page of slab pointers for the table, and we need to
@@ -278,6 +407,12 @@ void ltable_init(struct link_table *table, const char *name,
 	table->next_free_slab = &base[1];
 	table->free_list.id = base[0]->lt_id.id;
 
+	table->cpu_cache = cpu_cache;
+	table->ncpu_cache = MAX_CPUS;
+	table->ngrows = 0;
+	table->nalloc_collisions = 0;
+	table->nfree_collisions = 0;
+
 #if CONFIG_LTABLE_STATS
 	table->nslabs = 1;
 	table->nallocs = 0;
@@ -379,6 +514,7 @@ void ltable_grow(struct link_table *table, uint32_t min_free)
 		table->nelem = LT_IDX_MAX - 1;
 	else
 		table->nelem += table->slab_elem;
+	table->ngrows += 1;
 
 #if CONFIG_LTABLE_STATS
 	table->nslabs += 1;
@@ -406,6 +542,31 @@ void ltable_grow(struct link_table *table, uint32_t min_free)
 }
 
 
+/**
+ * ltable_get_counters: snapshot the allocation and contention counters of 'table'
+ */
+void ltable_get_counters(struct link_table *table,
+			 struct ltable_counters *counters)
+{
+	counters->grows = table->ngrows;
+	counters->alloc_collisions = table->nalloc_collisions;
+	counters->free_collisions = table->nfree_collisions;
+	counters->cache_hits = 0;
+	counters->cache_misses = 0;
+	counters->cache_flushes = 0;
+	counters->cached_elems = 0;
+
+	for (uint32_t c = 0; c < table->ncpu_cache; c++) {
+		struct lt_cpu_cache *cache = &table->cpu_cache[c];
+
+		counters->cache_hits += cache->hits;
+		counters->cache_misses += cache->misses;
+		counters->cache_flushes += cache->flushes;
+		counters->cached_elems += cache->avail;
+	}
+}
+
+
 /**
  * ltable_alloc_elem: allocate one or more elements from a given table
  *
@@ -435,6 +596,15 @@ struct lt_elem *ltable_alloc_elem(struct link_table *table, int type,
 
 	assert(nelem > 0);
 
+	if (nelem == 1 && g_lt_cpu_cache_max > 0) {
+		elem = lt_cpu_cache_alloc(table);
+		if (elem != NULL) {
+			elem->lt_next_idx = LT_IDX_MAX;
+			nalloc = 1;
+			goto init_elems;
+		}
+	}
+
 	/*
 	 * If the callers only wants to try a certain number of times, make it
 	 * look like we've already made (MAX - nattempts) tries at allocation
@@ -524,8 +694,10 @@ try_again:
 	/* 'elem' points to the last element being allocated */
 
 	if (OSCompareAndSwap64(free_id.id, next_id.id,
-			       &table->free_list.id) == FALSE)
+			       &table->free_list.id) == FALSE) {
+		OSIncrementAtomic64((volatile SInt64 *)&table->nalloc_collisions);
 		goto try_again;
+	}
 
 	/* load barrier */
 	OSMemoryBarrier();
@@ -542,6 +714,7 @@ try_again:
 	/* reset 'elem' to point to the first allocated element */
 	elem = lt_elem_idx(table, free_id.idx);
 
+init_elems:
 	/*
 	 * Update the generation count, and return the element(s)
 	 * with a single reference (and no valid bit). If the
@@ -634,14 +807,10 @@ void ltable_realloc_elem(struct link_table *table, struct lt_elem *elem, int typ
  */
 static void ltable_free_elem(struct link_table *table, struct lt_elem *elem)
 {
-	struct ltable_id next_id;
-
 	assert(lt_elem_in_range(elem, table) &&
 	       !lt_bits_valid(elem->lt_bits) &&
 	       (lt_bits_refcnt(elem->lt_bits) == 0));
 
-	OSDecrementAtomic(&table->used_elem);
-
 #if CONFIG_LTABLE_STATS
 	table->avg_used = (table->avg_used + table->used_elem) / 2;
 	if (lt_bits_type(elem->lt_bits) == LT_RESERVED)
@@ -654,18 +823,11 @@ static void ltable_free_elem(struct link_table *table, struct lt_elem *elem)
 	if (table->poison)
 		(table->poison)(table, elem);
 
-again:
-	next_id = table->free_list;
-	if (next_id.idx >= table->nelem)
-		elem->lt_next_idx = LT_IDX_MAX;
-	else
-		elem->lt_next_idx = next_id.idx;
+	if (lt_cpu_cache_free(table, elem))
+		return;
 
-	/* store barrier */
-	OSMemoryBarrier();
-	if (OSCompareAndSwap64(next_id.id, elem->lt_id.id,
-			       &table->free_list.id) == FALSE)
-		goto again;
+	OSDecrementAtomic(&table->used_elem);
+	lt_free_list_push(table, elem, elem);
 }
 
 
@@ -952,7 +1114,6 @@ int lt_elem_list_release(struct link_table *table, struct lt_elem *head,
                          int __assert_only type)
 {
 	struct lt_elem *elem;
-	struct ltable_id free_id;
 	int nelem = 0;
 
 	if (!head)
@@ -980,19 +1141,7 @@ int lt_elem_list_release(struct link_table *table, struct lt_elem *head,
 	 * the 'head' and ensure that 'elem' points to the previous free list
 	 * head.
 	 */
-
-again:
-	free_id = table->free_list;
-	if (free_id.idx >= table->nelem)
-		elem->lt_next_idx = LT_IDX_MAX;
-	else
-		elem->lt_next_idx = free_id.idx;
-
-	/* store barrier */
-	OSMemoryBarrier();
-	if (OSCompareAndSwap64(free_id.id, head->lt_id.id,
-			       &table->free_list.id) == FALSE)
-		goto again;
+	lt_free_list_push(table, head, elem);
 
 	OSAddAtomic(-nelem, &table->used_elem);
 	return nelem;
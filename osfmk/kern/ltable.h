@@ -116,6 +116,35 @@ enum lt_elem_type {
 struct link_table;
 typedef void (*ltable_poison_func)(struct link_table *, struct lt_elem *);
 
+/*
+ * Per-CPU cache of free table elements
+ *
+ * Single element allocations and frees are satisfied from a small LIFO of
+ * free elements private to each CPU (accessed with preemption disabled).
+ * When a cache overflows, half of it is returned to the table's shared free
+ * list with a single compare-and-swap. Cached elements are counted in the
+ * table's 'used_elem' until they are returned.
+ */
+#define LT_CPU_CACHE_MAX	32
+
+struct lt_cpu_cache {
+	uint32_t         head;     /* index of the most recently freed element */
+	uint32_t         avail;
+	uint64_t         hits;
+	uint64_t         misses;
+	uint64_t         flushes;
+} __attribute__((aligned(64)));
+
+struct ltable_counters {
+	uint64_t         grows;            /* slabs added by ltable_grow */
+	uint64_t         alloc_collisions; /* failed free list CAS on allocation */
+	uint64_t         free_collisions;  /* failed free list CAS on free */
+	uint64_t         cache_hits;
+	uint64_t         cache_misses;
+	uint64_t         cache_flushes;    /* batches returned to the free list */
+	uint64_t         cached_elems;
+};
+
 /*
  * link_table structure
  *
@@ -146,6 +175,13 @@ struct link_table {
 	lck_mtx_t        lock;
 	uint32_t         state;
 
+	struct lt_cpu_cache *cpu_cache; /* one per possible CPU */
+	uint32_t         ncpu_cache;
+
+	uint64_t         ngrows;
+	uint64_t         nalloc_collisions;
+	uint64_t         nfree_collisions;
+
 #if CONFIG_LTABLE_STATS
 	uint32_t         nslabs;
 
@@ -208,6 +244,16 @@ struct lt_elem *ltable_alloc_elem(struct link_table *table, int type,
 	                          int nelem, int nattempts);
 
 
+/**
+ * ltable_get_counters: snapshot the allocation and contention counters of 'table'
+ *
+ * The counters are not read atomically with respect to each other: they
+ * are meant to be informative, not perfectly accurate.
+ */
+extern void ltable_get_counters(struct link_table *table,
+				struct ltable_counters *counters);
+
+
 /**
  * ltable_realloc_elem: convert a reserved element to a particular type
  *
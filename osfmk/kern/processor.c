@@ -95,6 +95,7 @@ queue_head_t			terminated_tasks;	/* To be used ONLY for stackshot. */
 queue_head_t			corpse_tasks;
 int						tasks_count;
 int						terminated_tasks_count;
+uint32_t				tasks_generation;	/* bumped whenever the tasks queue changes */
 queue_head_t			threads;
 int						threads_count;
 decl_lck_mtx_data(,tasks_threads_lock)
@@ -264,6 +265,7 @@ pset_init(
 	if (pset != &pset0) {
 		/* Scheduler state deferred until sched_init() */
 		SCHED(pset_init)(pset);
+		sched_realtime_pset_init(pset);
 	}
 
 	queue_init(&pset->active_queue);
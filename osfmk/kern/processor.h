@@ -97,6 +97,11 @@ struct processor_set {
 	decl_simple_lock_data(,sched_lock)	/* lock for above */
 #endif
 
+	struct rt_queue		rt_runq;		/* realtime runq for this processor set */
+#if __SMP__
+	decl_simple_lock_data(,rt_lock)		/* lock for rt_runq */
+#endif
+
 #if defined(CONFIG_SCHED_TRADITIONAL) || defined(CONFIG_SCHED_MULTIQ)
 	struct run_queue	pset_runq;      /* runq for this processor set */
 #endif
@@ -145,6 +150,7 @@ extern struct pset_node	pset_node0;
 
 extern queue_head_t		tasks, terminated_tasks, threads, corpse_tasks; /* Terminated tasks are ONLY for stackshot */
 extern int				tasks_count, terminated_tasks_count, threads_count;
+extern uint32_t			tasks_generation;
 decl_lck_mtx_data(extern,tasks_threads_lock)
 decl_lck_mtx_data(extern,tasks_corpse_lock)
 
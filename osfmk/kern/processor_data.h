@@ -41,6 +41,9 @@
 #include <ipc/ipc_kmsg.h>
 #include <kern/timer.h>
 
+#define SCHED_STATS_WAIT_BUCKETS	16
+#define SCHED_STATS_WAIT_SHIFT		10	/* first bucket is below 1 << 10 ns */
+
 struct processor_sched_statistics {
 	uint32_t		csw_count;
 	uint32_t		preempt_count;
@@ -52,6 +55,22 @@ struct processor_sched_statistics {
 	uint32_t		timer_pop_count;
 	uint32_t		idle_transitions;
 	uint32_t		quantum_timer_expirations;
+	uint32_t		migration_count;		/* switched in away from its last processor */
+	uint32_t		pset_migration_count;		/* ... and away from its last processor set */
+	uint32_t		cache_hot_count;		/* cache-hot thread dispatched within its last processor set */
+	uint32_t		cache_hot_migration_count;	/* cache-hot thread moved to another processor set */
+
+	/* Run queue depth averages, see compute_averages() */
+	uint32_t		runq_load_average[3];		/* 5s, 30s and 1m averages, scaled by LOAD_SCALE */
+	uint64_t		runq_load_count_sum;		/* count_sum at the last update */
+	uint64_t		runq_load_timestamp;
+
+	/*
+	 * Dispatches by time spent runnable: < 1us, then doubling up to the last
+	 * bucket, decayed like the run queue depth histogram.
+	 */
+	uint64_t		wait_decay_deadline;
+	uint64_t		wait_hist[SCHED_STATS_WAIT_BUCKETS];
 };
 
 struct processor_data {
@@ -135,6 +154,13 @@ MACRO_BEGIN											\
 	}											\
 MACRO_END
 
+#define SCHED_STATS_WAIT(p, latency)							\
+MACRO_BEGIN											\
+	if (__builtin_expect(sched_stats_active, 0)) { 					\
+		sched_stats_handle_wait((p), (latency));					\
+	}											\
+MACRO_END
+
 #define SCHED_STATS_QUANTUM_TIMER_EXPIRATION(p)								\
 MACRO_BEGIN											\
 	if (__builtin_expect(sched_stats_active, 0)) { 					\
@@ -189,9 +189,20 @@ typedef enum {
  */
 #define invalid_pri(pri) ((pri) < MINPRI || (pri) > MAXPRI)
 
+/*
+ * Besides the depth integral, the run queue statistics keep the time
+ * spent at each depth in log2 buckets (0, 1, 2-3, 4-7, ... 64 and up).
+ * The histogram is halved every RUNQ_STATS_DECAY_SECS seconds so that
+ * it reflects recent load rather than everything since boot.
+ */
+#define RUNQ_STATS_DEPTH_BUCKETS	8
+#define RUNQ_STATS_DECAY_SECS		5
+
 struct runq_stats {
 	uint64_t				count_sum;
 	uint64_t				last_change_timestamp;
+	uint64_t				decay_deadline;
+	uint64_t				depth_time[RUNQ_STATS_DEPTH_BUCKETS];
 };
 
 #if defined(CONFIG_SCHED_TIMESHARE_CORE) || defined(CONFIG_SCHED_PROTO)
@@ -224,7 +235,8 @@ rq_bitmap_clear(bitmap_t *map, u_int n)
 
 struct rt_queue {
 	int					count;				/* # of threads total */
-	queue_head_t		queue;				/* all runnable RT threads */
+	uint64_t			earliest_deadline;	/* deadline of the queue head, for stealing */
+	queue_head_t		queue;				/* all runnable RT threads, in deadline order */
 
 	struct runq_stats	runq_stats;
 };
@@ -275,8 +287,6 @@ struct grrr_run_queue {
 
 #endif /* defined(CONFIG_SCHED_GRRR_CORE) */
 
-extern struct rt_queue		rt_runq;
-
 #if defined(CONFIG_SCHED_MULTIQ)
 sched_group_t   sched_group_create(void);
 void            sched_group_destroy(sched_group_t sched_group);
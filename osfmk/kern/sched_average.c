@@ -121,6 +121,45 @@ static struct sched_average {
 
 typedef struct sched_average	*sched_average_t;
 
+/*
+ * Per-processor run queue depth averages, from the count_sum integral the
+ * run queues keep while sched_stats_active is set.  The integral only
+ * advances when a queue changes, so time a queue spends parked at one
+ * depth is counted when it next changes.
+ */
+static void
+compute_processor_load_averages(uint64_t stdelta)
+{
+	uint64_t abstime = mach_absolute_time();
+	processor_t processor;
+
+	simple_lock(&processor_list_lock);
+
+	for (processor = processor_list; processor != PROCESSOR_NULL; processor = processor->processor_list) {
+		struct processor_sched_statistics *stats = &processor->processor_data.sched_stats;
+		uint64_t count_sum = SCHED(processor_runq_stats_count_sum)(processor);
+		uint32_t depth_now = 0;
+
+		if (stats->runq_load_timestamp != 0 && abstime > stats->runq_load_timestamp &&
+		    count_sum >= stats->runq_load_count_sum) {
+			depth_now = (uint32_t)(((count_sum - stats->runq_load_count_sum) * LOAD_SCALE) /
+			    (abstime - stats->runq_load_timestamp));
+		}
+
+		stats->runq_load_count_sum = count_sum;
+		stats->runq_load_timestamp = abstime;
+
+		for (uint32_t index = 0; index < stdelta; index++) {
+			for (uint32_t i = 0; i < 3; i++) {
+				stats->runq_load_average[i] = ((stats->runq_load_average[i] * fract[i]) +
+							(depth_now * (LOAD_SCALE - fract[i]))) / LOAD_SCALE;
+			}
+		}
+	}
+
+	simple_unlock(&processor_list_lock);
+}
+
 uint32_t load_now[TH_BUCKET_MAX];
 
 /* The "stdelta" parameter represents the number of scheduler maintenance
@@ -255,6 +294,12 @@ compute_averages(uint64_t stdelta)
 		}
 	}
 
+	/*
+	 * Per-processor run queue depth averages, for the sched stats tool.
+	 */
+	if (sched_stats_active)
+		compute_processor_load_averages(stdelta);
+
 	/*
 	 * Compute averages in other components.
 	 */
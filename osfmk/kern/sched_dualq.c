@@ -76,6 +76,9 @@ sched_dualq_processor_queue_empty(processor_t processor);
 static uint64_t
 sched_dualq_runq_stats_count_sum(processor_t processor);
 
+static void
+sched_dualq_runq_stats_depth(processor_t processor, uint64_t *depth_time);
+
 static int
 sched_dualq_processor_bound_count(processor_t processor);
 
@@ -121,6 +124,7 @@ const struct sched_dispatch_table sched_dualq_dispatch = {
 	.quantum_expire                                 = sched_default_quantum_expire,
 	.processor_runq_count                           = sched_dualq_runq_count,
 	.processor_runq_stats_count_sum                 = sched_dualq_runq_stats_count_sum,
+	.processor_runq_stats_depth                     = sched_dualq_runq_stats_depth,
 	.processor_bound_count                          = sched_dualq_processor_bound_count,
 	.thread_update_scan                             = sched_dualq_thread_update_scan,
 	.direct_dispatch_to_idle_processors             = FALSE,
@@ -298,6 +302,15 @@ sched_dualq_runq_stats_count_sum(processor_t processor)
 	else
 		return bound_sum;
 }
+
+static void
+sched_dualq_runq_stats_depth(processor_t processor, uint64_t *depth_time)
+{
+	sched_stats_runq_depth(&dualq_bound_runq(processor)->runq_stats, depth_time);
+
+	if (processor->cpu_id == processor->processor_set->cpu_set_low)
+		sched_stats_runq_depth(&dualq_main_runq(processor)->runq_stats, depth_time);
+}
 static int
 sched_dualq_processor_bound_count(processor_t processor)
 {
@@ -184,6 +184,9 @@ sched_grrr_processor_runq_count(processor_t	processor);
 static uint64_t
 sched_grrr_processor_runq_stats_count_sum(processor_t   processor);
 
+static void
+sched_grrr_processor_runq_stats_depth(processor_t   processor, uint64_t *depth_time);
+
 static int
 sched_grrr_processor_bound_count(processor_t	processor);
 
@@ -217,6 +220,7 @@ const struct sched_dispatch_table sched_grrr_dispatch = {
 	.quantum_expire                                 = sched_default_quantum_expire,
 	.processor_runq_count                           = sched_grrr_processor_runq_count,
 	.processor_runq_stats_count_sum                 = sched_grrr_processor_runq_stats_count_sum,
+	.processor_runq_stats_depth                     = sched_grrr_processor_runq_stats_depth,
 	.processor_bound_count                          = sched_grrr_processor_bound_count,
 	.thread_update_scan                             = sched_grrr_thread_update_scan,
 	.direct_dispatch_to_idle_processors             = TRUE,
@@ -511,6 +515,12 @@ sched_grrr_processor_runq_stats_count_sum(processor_t	processor)
 	return processor->grrr_runq.runq_stats.count_sum;
 }
 
+static void
+sched_grrr_processor_runq_stats_depth(processor_t	processor, uint64_t *depth_time)
+{
+	sched_stats_runq_depth(&processor->grrr_runq.runq_stats, depth_time);
+}
+
 static int
 sched_grrr_processor_bound_count(__unused processor_t	processor)
 {
@@ -269,6 +269,9 @@ sched_multiq_processor_queue_empty(processor_t processor);
 static uint64_t
 sched_multiq_runq_stats_count_sum(processor_t processor);
 
+static void
+sched_multiq_runq_stats_depth(processor_t processor, uint64_t *depth_time);
+
 static int
 sched_multiq_processor_bound_count(processor_t processor);
 
@@ -314,6 +317,7 @@ const struct sched_dispatch_table sched_multiq_dispatch = {
 	.quantum_expire                                 = sched_multiq_quantum_expire,
 	.processor_runq_count                           = sched_multiq_runq_count,
 	.processor_runq_stats_count_sum                 = sched_multiq_runq_stats_count_sum,
+	.processor_runq_stats_depth                     = sched_multiq_runq_stats_depth,
 	.processor_bound_count                          = sched_multiq_processor_bound_count,
 	.thread_update_scan                             = sched_multiq_thread_update_scan,
 	.direct_dispatch_to_idle_processors             = FALSE,
@@ -1260,6 +1264,15 @@ sched_multiq_runq_stats_count_sum(processor_t processor)
 		return bound_sum;
 }
 
+static void
+sched_multiq_runq_stats_depth(processor_t processor, uint64_t *depth_time)
+{
+	sched_stats_runq_depth(&multiq_bound_runq(processor)->runq_stats, depth_time);
+
+	if (processor->cpu_id == processor->processor_set->cpu_set_low)
+		sched_stats_runq_depth(&multiq_main_entryq(processor)->runq_stats, depth_time);
+}
+
 static int
 sched_multiq_processor_bound_count(processor_t processor)
 {
@@ -1357,8 +1370,9 @@ sched_multiq_steal_thread(processor_set_t pset)
  * Scan the global queue for candidate groups, and scan those groups for
  * candidate threads.
  *
- * TODO: This iterates every group runq in its entirety for each entry it has in the runq, which is O(N^2)
- *       Instead, iterate only the queue in the group runq matching the priority of the entry.
+ * Each entry stands for exactly one non-empty priority level of its group,
+ * so only the group runq queue at the entry's priority is scanned, and
+ * every enqueued thread is visited once.
  *
  * Returns TRUE if retry is needed.
  */
@@ -1382,10 +1396,9 @@ group_scan(entry_queue_t runq, sched_update_scan_context_t scan_context) {
 			assert(count > 0);
 
 			sched_group_t group = group_for_entry(entry);
-			if (group->runq.count > 0) {
-				if (runq_scan(&group->runq, scan_context))
-					return (TRUE);
-			}
+			assert(entry->sched_pri == queue_index);
+			if (runq_scan_queue(&group->runq.queues[queue_index], scan_context))
+				return (TRUE);
 			count--;
 		}
 	}
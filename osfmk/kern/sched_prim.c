@@ -117,22 +117,37 @@
 
 #include <kern/pms.h>
 
-struct rt_queue	rt_runq;
-
-uintptr_t sched_thread_on_rt_queue = (uintptr_t)0xDEAFBEE0;
-
-/* Lock RT runq, must be done with interrupts disabled (under splsched()) */
+/*
+ * Lock a pset's RT runq, must be done with interrupts disabled (under splsched()).
+ * The RT lock is a leaf: it may be taken with any pset lock held, but
+ * never with another pset's RT lock held.
+ */
 #if __SMP__
-decl_simple_lock_data(static,rt_lock);
-#define rt_lock_init()		simple_lock_init(&rt_lock, 0)
-#define rt_lock_lock()		simple_lock(&rt_lock)
-#define rt_lock_unlock()	simple_unlock(&rt_lock)
+#define rt_lock_init(p)		simple_lock_init(&(p)->rt_lock, 0)
+#define rt_lock_lock(p)		simple_lock(&(p)->rt_lock)
+#define rt_lock_unlock(p)	simple_unlock(&(p)->rt_lock)
 #else
-#define rt_lock_init()		do { } while(0)
-#define rt_lock_lock()		do { } while(0)
-#define rt_lock_unlock()	do { } while(0)
+#define rt_lock_init(p)		do { (void)p; } while(0)
+#define rt_lock_lock(p)		do { (void)p; } while(0)
+#define rt_lock_unlock(p)	do { (void)p; } while(0)
 #endif
 
+/*
+ * When set, THREAD_TIME_CONSTRAINT_POLICY requests are admitted only while
+ * the summed computation/period utilization of the realtime threads in the
+ * system fits on the available processors, so that earliest-deadline-first
+ * dispatch from the RT queues can meet every admitted constraint.
+ */
+uint32_t	sched_rt_edf_admission = 0;
+
+/*
+ * When set, ulock_wake() and semaphore_signal() from user space switch
+ * straight to the one thread they woke, rather than leaving it for the
+ * scheduler to place, saving a context switch and a cold-cache dispatch
+ * in producer/consumer handoffs.
+ */
+uint32_t	sched_wake_handoff = 0;
+
 #define		DEFAULT_PREEMPTION_RATE		100		/* (1/s) */
 int			default_preemption_rate = DEFAULT_PREEMPTION_RATE;
 
@@ -201,6 +216,17 @@ thread_t sched_maintenance_thread;
 
 uint64_t	sched_one_second_interval;
 
+/*
+ * A thread that last ran within sched_cache_hot_us is assumed to still
+ * have its working set in the caches shared by its last processor set.
+ * choose_processor() keeps such a timeshare thread on an idle last
+ * processor, and queues it within that set when it cannot preempt
+ * any processor.
+ */
+#define SCHED_CACHE_HOT_US_DEFAULT	500
+uint32_t	sched_cache_hot_us = SCHED_CACHE_HOT_US_DEFAULT;
+uint64_t	sched_cache_hot_window;
+
 /* Forwards */
 
 #if defined(CONFIG_SCHED_TIMESHARE_CORE)
@@ -235,8 +261,13 @@ static void processor_setrun(
 				 thread_t			thread,
 				 integer_t			options);
 
-static void
-sched_realtime_init(void);
+static thread_t
+rt_runq_dequeue(processor_set_t pset);
+
+#if __SMP__
+static thread_t
+sched_rt_steal_thread(processor_set_t pset);
+#endif
 
 static void
 sched_realtime_timebase_init(void);
@@ -370,9 +401,21 @@ sched_init(void)
 	if (PE_parse_boot_argn("sched_debug", &sched_debug_flags, sizeof(sched_debug_flags))) {
 		kprintf("Scheduler: Debug flags 0x%08x\n", sched_debug_flags);
 	}
+
+	if (PE_parse_boot_argn("sched_cache_hot_us", &sched_cache_hot_us, sizeof(sched_cache_hot_us))) {
+		kprintf("Scheduler: Cache hot window %u us\n", sched_cache_hot_us);
+	}
 	
+	if (PE_parse_boot_argn("sched_rt_edf_admission", &sched_rt_edf_admission, sizeof(sched_rt_edf_admission))) {
+		kprintf("Scheduler: Realtime EDF admission %s\n", sched_rt_edf_admission ? "enabled" : "disabled");
+	}
+
+	if (PE_parse_boot_argn("sched_wake_handoff", &sched_wake_handoff, sizeof(sched_wake_handoff))) {
+		kprintf("Scheduler: Wake handoff %s\n", sched_wake_handoff ? "enabled" : "disabled");
+	}
+
 	SCHED(init)();
-	sched_realtime_init();
+	sched_realtime_pset_init(&pset0);
 	ast_init();
 	sched_timer_deadline_tracking_init();
 
@@ -388,10 +431,33 @@ sched_timebase_init(void)
 	clock_interval_to_absolutetime_interval(1, NSEC_PER_SEC, &abstime);
 	sched_one_second_interval = abstime;
 	
+	sched_cache_hot_window_init();
+
 	SCHED(timebase_init)();
 	sched_realtime_timebase_init();
 }
 
+/*
+ * Recompute the cache hot window from sched_cache_hot_us, which
+ * may be changed at runtime via sysctl.
+ */
+void
+sched_cache_hot_window_init(void)
+{
+	uint64_t	abstime;
+
+	clock_interval_to_absolutetime_interval(sched_cache_hot_us, NSEC_PER_USEC, &abstime);
+	sched_cache_hot_window = abstime;
+}
+
+static inline boolean_t
+sched_thread_cache_hot(
+	thread_t	thread,
+	uint64_t	now)
+{
+	return (thread->last_run_time + sched_cache_hot_window > now);
+}
+
 #if defined(CONFIG_SCHED_TIMESHARE_CORE)
 
 void
@@ -471,13 +537,93 @@ sched_timeshare_timebase_init(void)
 
 #endif /* CONFIG_SCHED_TIMESHARE_CORE */
 
-static void
-sched_realtime_init(void)
+/*
+ *	sched_realtime_pset_init:
+ *
+ *	Initialize the realtime run queue of a processor set.
+ */
+void
+sched_realtime_pset_init(processor_set_t pset)
 {
-	rt_lock_init();
+	rt_lock_init(pset);
+
+	pset->rt_runq.count = 0;
+	pset->rt_runq.earliest_deadline = UINT64_MAX;
+	queue_init(&pset->rt_runq.queue);
+}
+
+/* Realtime utilization is measured in parts per million of one processor */
+#define SCHED_RT_UTIL_SCALE	1000000ULL
+
+static uint64_t
+sched_rt_utilization(
+	uint32_t	period,
+	uint32_t	computation,
+	uint32_t	constraint)
+{
+	/* Aperiodic threads must fit their computation within the constraint */
+	uint32_t	interval = (period != 0) ? period : constraint;
+
+	return (((uint64_t)computation * SCHED_RT_UTIL_SCALE) / interval);
+}
+
+/*
+ *	sched_rt_admit:
+ *
+ *	Decide whether a thread may run with the given time
+ *	constraint parameters.  Under sched_rt_edf_admission the
+ *	utilization of every other realtime thread plus the new
+ *	request must not exceed the available processors, which
+ *	is the bound within which EDF meets all deadlines; otherwise
+ *	every request is admitted.
+ *
+ *	The check is made against the threads at the time of the
+ *	call, so two requests racing each other may both be admitted.
+ *
+ *	Called with no locks held.
+ */
+boolean_t
+sched_rt_admit(
+	thread_t	thread,
+	uint32_t	period,
+	uint32_t	computation,
+	uint32_t	constraint)
+{
+	uint64_t	utilization, capacity;
+	thread_t	iter;
+	spl_t		s;
+
+	if (!sched_rt_edf_admission)
+		return (TRUE);
 
-	rt_runq.count = 0;
-	queue_init(&rt_runq.queue);
+	utilization = sched_rt_utilization(period, computation, constraint);
+	capacity = (uint64_t)processor_avail_count * SCHED_RT_UTIL_SCALE;
+
+	lck_mtx_lock(&tasks_threads_lock);
+
+	queue_iterate(&threads, iter, thread_t, threads) {
+		if (iter == thread)
+			continue;
+
+		s = splsched();
+		thread_lock(iter);
+
+		if (iter->sched_mode == TH_MODE_REALTIME || iter->saved_mode == TH_MODE_REALTIME) {
+			utilization += sched_rt_utilization(iter->realtime.period,
+			                                    iter->realtime.computation,
+			                                    iter->realtime.constraint);
+		}
+
+		thread_unlock(iter);
+		splx(s);
+
+		if (utilization > capacity)
+			break;
+	}
+
+	lck_mtx_unlock(&tasks_threads_lock);
+
+	return (utilization <= capacity);
 }
 
 static void
@@ -1775,12 +1921,12 @@ thread_select(
 			 * An exception is that bound threads are dispatched to a processor without going through
 			 * choose_processor(), so in those cases we should continue trying to dequeue work.
 			 */
-			if (!SCHED(processor_bound_count)(processor) && !queue_empty(&pset->idle_queue) && !rt_runq.count) {
+			if (!SCHED(processor_bound_count)(processor) && !queue_empty(&pset->idle_queue) && !pset->rt_runq.count) {
 				goto idle;
 			}
 		}
 
-		rt_lock_lock();
+		rt_lock_lock(pset);
 
 		/*
 		 *	Test to see if the current thread should continue
@@ -1802,10 +1948,10 @@ thread_select(
 			 * unless there's a valid RT thread with an earlier deadline.
 			 */
 			if (thread->sched_pri >= BASEPRI_RTQUEUES && processor->first_timeslice) {
-				if (rt_runq.count > 0) {
-					thread_t next_rt = qe_queue_first(&rt_runq.queue, struct thread, runq_links);
+				if (pset->rt_runq.count > 0) {
+					thread_t next_rt = qe_queue_first(&pset->rt_runq.queue, struct thread, runq_links);
 
-					assert(next_rt->runq == THREAD_ON_RT_RUNQ);
+					assert(next_rt->runq != PROCESSOR_NULL && next_rt->runq->processor_set == pset);
 
 					if (next_rt->realtime.deadline < processor->deadline &&
 					    (next_rt->bound_processor == PROCESSOR_NULL ||
@@ -1818,18 +1964,18 @@ thread_select(
 				/* This is still the best RT thread to run. */
 				processor->deadline = thread->realtime.deadline;
 
-				rt_lock_unlock();
+				rt_lock_unlock(pset);
 				pset_unlock(pset);
 
 				return (thread);
 			}
 
-			if ((rt_runq.count == 0) &&
+			if ((pset->rt_runq.count == 0) &&
 			    SCHED(processor_queue_has_priority)(processor, thread->sched_pri, TRUE) == FALSE) {
 				/* This thread is still the highest priority runnable (non-idle) thread */
 				processor->deadline = UINT64_MAX;
 
-				rt_lock_unlock();
+				rt_lock_unlock(pset);
 				pset_unlock(pset);
 
 				return (thread);
@@ -1837,31 +1983,43 @@ thread_select(
 		}
 
 		/* OK, so we're not going to run the current thread. Look at the RT queue. */
-		if (rt_runq.count > 0) {
-			thread_t next_rt = qe_queue_first(&rt_runq.queue, struct thread, runq_links);
+		if (pset->rt_runq.count > 0) {
+			thread_t next_rt = qe_queue_first(&pset->rt_runq.queue, struct thread, runq_links);
 
-			assert(next_rt->runq == THREAD_ON_RT_RUNQ);
+			assert(next_rt->runq != PROCESSOR_NULL && next_rt->runq->processor_set == pset);
 
 			if (__probable((next_rt->bound_processor == PROCESSOR_NULL ||
 			               (next_rt->bound_processor == processor)))) {
 pick_new_rt_thread:
-				new_thread = qe_dequeue_head(&rt_runq.queue, struct thread, runq_links);
-
-				new_thread->runq = PROCESSOR_NULL;
-				SCHED_STATS_RUNQ_CHANGE(&rt_runq.runq_stats, rt_runq.count);
-				rt_runq.count--;
+				new_thread = rt_runq_dequeue(pset);
 
 				processor->deadline = new_thread->realtime.deadline;
 
-				rt_lock_unlock();
+				rt_lock_unlock(pset);
 				pset_unlock(pset);
 
 				return (new_thread);
 			}
 		}
 
+		rt_lock_unlock(pset);
+
+#if __SMP__
+		/*
+		 * Nothing runnable on our own RT queue; run the earliest
+		 * deadline queued on another processor set before falling
+		 * back to the regular threads.
+		 */
+		if ((new_thread = sched_rt_steal_thread(pset)) != THREAD_NULL) {
+			processor->deadline = new_thread->realtime.deadline;
+
+			pset_unlock(pset);
+
+			return (new_thread);
+		}
+#endif
+
 		processor->deadline = UINT64_MAX;
-		rt_lock_unlock();
 
 		/* No RT threads, so let's look at the regular threads. */
 		if ((new_thread = SCHED(choose_thread)(processor, MINPRI, reason)) != THREAD_NULL) {
@@ -1884,7 +2042,7 @@ pick_new_rt_thread:
 			 * If other threads have appeared, shortcut
 			 * around again.
 			 */
-			if (!SCHED(processor_queue_empty)(processor) || rt_runq.count > 0)
+			if (!SCHED(processor_queue_empty)(processor) || pset->rt_runq.count > 0)
 				continue;
 
 			pset_lock(pset);
@@ -2070,6 +2228,7 @@ thread_invoke(
 	thread_continue_t       continuation = self->continuation;
 	void                    *parameter   = self->parameter;
 	processor_t             processor;
+	processor_t             last_processor;
 
 	uint64_t                ctime = mach_absolute_time();
 
@@ -2124,6 +2283,7 @@ thread_invoke(
 			processor->current_pri = thread->sched_pri;
 			processor->current_thmode = thread->sched_mode;
 			processor->current_sfi_class = thread->sfi_class;
+			last_processor = thread->last_processor;
 			if (thread->last_processor != processor && thread->last_processor != NULL) {
 				if (thread->last_processor->processor_set != processor->processor_set)
 					thread->ps_switch++;
@@ -2163,7 +2323,7 @@ thread_invoke(
 
 			DTRACE_SCHED2(off__cpu, struct thread *, thread, struct proc *, thread->task->bsd_info);
 
-			SCHED_STATS_CSW(processor, self->reason, self->sched_pri, thread->sched_pri);
+			SCHED_STATS_CSW(processor, self->reason, self->sched_pri, thread, last_processor);
 
 			TLOG(1, "thread_invoke: calling stack_handoff\n");
 			stack_handoff(self, thread);
@@ -2244,6 +2404,7 @@ need_stack:
 	processor->current_pri = thread->sched_pri;
 	processor->current_thmode = thread->sched_mode;
 	processor->current_sfi_class = thread->sfi_class;
+	last_processor = thread->last_processor;
 	if (thread->last_processor != processor && thread->last_processor != NULL) {
 		if (thread->last_processor->processor_set != processor->processor_set)
 			thread->ps_switch++;
@@ -2285,7 +2446,7 @@ need_stack:
 
 	DTRACE_SCHED2(off__cpu, struct thread *, thread, struct proc *, thread->task->bsd_info);
 
-	SCHED_STATS_CSW(processor, self->reason, self->sched_pri, thread->sched_pri);
+	SCHED_STATS_CSW(processor, self->reason, self->sched_pri, thread, last_processor);
 
 	/*
 	 * This is where we actually switch register context,
@@ -2682,6 +2843,8 @@ thread_dispatch(
 		thread_tell_urgency(urgency, arg1, arg2, latency, self);
 
 		machine_thread_going_on_core(self, urgency, latency, processor->last_dispatch);
+
+		SCHED_STATS_WAIT(processor, latency);
 		
 		/*
 		 *	Get a new quantum if none remaining.
@@ -3027,40 +3190,123 @@ run_queue_remove(
 	thread->runq = PROCESSOR_NULL;
 }
 
-/* Assumes RT lock is not held, and acquires splsched/rt_lock itself */
+/* Assumes RT locks are not held, and acquires splsched/rt_lock itself */
 void
 rt_runq_scan(sched_update_scan_context_t scan_context)
 {
 	spl_t		s;
 	thread_t	thread;
+	processor_set_t	pset = &pset0;
 
 	s = splsched();
-	rt_lock_lock();
+	do {
+		rt_lock_lock(pset);
 
-	qe_foreach_element_safe(thread, &rt_runq.queue, runq_links) {
-		if (thread->last_made_runnable_time < scan_context->earliest_rt_make_runnable_time) {
-			scan_context->earliest_rt_make_runnable_time = thread->last_made_runnable_time;
+		qe_foreach_element_safe(thread, &pset->rt_runq.queue, runq_links) {
+			if (thread->last_made_runnable_time < scan_context->earliest_rt_make_runnable_time) {
+				scan_context->earliest_rt_make_runnable_time = thread->last_made_runnable_time;
+			}
 		}
-	}
 
-	rt_lock_unlock();
+		rt_lock_unlock(pset);
+	} while ((pset = next_pset(pset)) != &pset0);
 	splx(s);
 }
 
+/*
+ * Recompute the deadline advertised to processors looking to
+ * steal from this RT runq.  RT lock must be held.
+ */
+static void
+rt_runq_update_deadline(processor_set_t pset)
+{
+	if (pset->rt_runq.count > 0) {
+		thread_t next_rt = qe_queue_first(&pset->rt_runq.queue, struct thread, runq_links);
+
+		pset->rt_runq.earliest_deadline = next_rt->realtime.deadline;
+	} else {
+		pset->rt_runq.earliest_deadline = UINT64_MAX;
+	}
+}
+
+/*
+ *	rt_runq_dequeue:
+ *
+ *	Remove the earliest-deadline thread from a pset's RT runq.
+ *	RT lock must be held and the runq must not be empty.
+ */
+static thread_t
+rt_runq_dequeue(processor_set_t pset)
+{
+	thread_t thread = qe_dequeue_head(&pset->rt_runq.queue, struct thread, runq_links);
+
+	thread->runq = PROCESSOR_NULL;
+	SCHED_STATS_RUNQ_CHANGE(&pset->rt_runq.runq_stats, pset->rt_runq.count);
+	pset->rt_runq.count--;
+	rt_runq_update_deadline(pset);
+
+	return (thread);
+}
+
+#if __SMP__
+/*
+ *	sched_rt_steal_thread:
+ *
+ *	Take the earliest-deadline realtime thread queued on
+ *	another processor set, for a processor whose own RT
+ *	runq has nothing it can run.
+ *
+ *	The local pset must be locked, and its RT lock not held.
+ *	Candidates are picked from an unlocked peek at each
+ *	runq's earliest deadline and revalidated under its lock.
+ */
+static thread_t
+sched_rt_steal_thread(processor_set_t pset)
+{
+	processor_set_t		nset, target = PROCESSOR_SET_NULL;
+	uint64_t			earliest_deadline = UINT64_MAX;
+	thread_t			thread = THREAD_NULL;
+
+	for (nset = next_pset(pset); nset != pset; nset = next_pset(nset)) {
+		if (nset->rt_runq.count > 0 && nset->rt_runq.earliest_deadline < earliest_deadline) {
+			earliest_deadline = nset->rt_runq.earliest_deadline;
+			target = nset;
+		}
+	}
+
+	if (target == PROCESSOR_SET_NULL)
+		return (THREAD_NULL);
+
+	rt_lock_lock(target);
+
+	if (target->rt_runq.count > 0) {
+		thread_t next_rt = qe_queue_first(&target->rt_runq.queue, struct thread, runq_links);
+
+		if (next_rt->bound_processor == PROCESSOR_NULL)
+			thread = rt_runq_dequeue(target);
+	}
+
+	rt_lock_unlock(target);
+
+	return (thread);
+}
+#endif /* __SMP__ */
 
 /*
  *	realtime_queue_insert:
  *
- *	Enqueue a thread for realtime execution.
+ *	Enqueue a thread for realtime execution on the
+ *	RT runq of the chosen processor's pset.
  */
 static boolean_t
-realtime_queue_insert(thread_t thread)
+realtime_queue_insert(processor_t processor, thread_t thread)
 {
-	queue_t     queue       = &rt_runq.queue;
-	uint64_t    deadline    = thread->realtime.deadline;
-	boolean_t   preempt     = FALSE;
+	processor_set_t	pset        = processor->processor_set;
+	queue_t			queue       = &pset->rt_runq.queue;
+	uint64_t		deadline    = thread->realtime.deadline;
+	boolean_t		preempt     = FALSE;
 
-	rt_lock_lock();
+	rt_lock_lock(pset);
 
 	if (queue_empty(queue)) {
 		enqueue_tail(queue, &thread->runq_links);
@@ -3084,15 +3330,67 @@ realtime_queue_insert(thread_t thread)
 		}
 	}
 
-	thread->runq = THREAD_ON_RT_RUNQ;
-	SCHED_STATS_RUNQ_CHANGE(&rt_runq.runq_stats, rt_runq.count);
-	rt_runq.count++;
+	thread->runq = processor;
+	SCHED_STATS_RUNQ_CHANGE(&pset->rt_runq.runq_stats, pset->rt_runq.count);
+	pset->rt_runq.count++;
+	rt_runq_update_deadline(pset);
 
-	rt_lock_unlock();
+	rt_lock_unlock(pset);
 
 	return (preempt);
 }
 
+/*
+ * Whether a realtime thread made runnable on the processor
+ * should preempt what it is running.
+ */
+static inline boolean_t
+realtime_should_preempt(
+	processor_t			processor,
+	thread_t			thread)
+{
+	return (processor->current_pri < BASEPRI_RTQUEUES ||
+	        thread->realtime.deadline < processor->deadline);
+}
+
+#if __SMP__
+/*
+ *	realtime_remote_processor:
+ *
+ *	Find a processor in another processor set that is
+ *	idle or running below the realtime band, preferring
+ *	an idle one, then the lowest priority one.
+ *
+ *	The scan is an unlocked peek; the caller must
+ *	recheck the result under its pset lock.
+ */
+static processor_t
+realtime_remote_processor(
+	processor_set_t		pset)
+{
+	processor_t		processor, best = PROCESSOR_NULL;
+	integer_t		lowest_priority = BASEPRI_RTQUEUES;
+
+	for (processor = processor_list; processor != PROCESSOR_NULL; processor = processor->processor_list) {
+		if (processor->processor_set == pset || !processor->is_recommended)
+			continue;
+
+		if (processor->state == PROCESSOR_IDLE)
+			return (processor);
+
+		if (processor->state != PROCESSOR_RUNNING && processor->state != PROCESSOR_DISPATCHING)
+			continue;
+
+		if (processor->current_pri < lowest_priority) {
+			lowest_priority = processor->current_pri;
+			best = processor;
+		}
+	}
+
+	return (best);
+}
+#endif /* __SMP__ */
+
 /*
  *	realtime_setrun:
  *
@@ -3111,6 +3409,38 @@ realtime_setrun(
 
 	boolean_t do_signal_idle = FALSE, do_cause_ast = FALSE;
 
+#if __SMP__
+	/*
+	 * Processors only look at their own pset's RT runq when deciding
+	 * whether to preempt or leave the idle loop.  If nothing here can
+	 * run the thread soon, queue it on a pset with a processor that can
+	 * and signal that processor instead.
+	 */
+	if (thread->bound_processor == PROCESSOR_NULL &&
+	    !realtime_should_preempt(processor, thread)) {
+		processor_t remote = realtime_remote_processor(pset);
+
+		if (remote != PROCESSOR_NULL) {
+			processor_set_t rpset = remote->processor_set;
+
+			pset_unlock(pset);
+			pset_lock(rpset);
+
+			if (remote->is_recommended &&
+			    (remote->state == PROCESSOR_IDLE ||
+			     remote->state == PROCESSOR_RUNNING ||
+			     remote->state == PROCESSOR_DISPATCHING) &&
+			    realtime_should_preempt(remote, thread)) {
+				processor = remote;
+				pset = rpset;
+			} else {
+				pset_unlock(rpset);
+				pset_lock(pset);
+			}
+		}
+	}
+#endif /* __SMP__ */
+
 	thread->chosen_processor = processor;
 
 	/* <rdar://problem/15102234> */
@@ -3145,14 +3475,12 @@ realtime_setrun(
 		return;
 	}
 
-	if (processor->current_pri < BASEPRI_RTQUEUES)
-		preempt = (AST_PREEMPT | AST_URGENT);
-	else if (thread->realtime.deadline < processor->deadline)
+	if (realtime_should_preempt(processor, thread))
 		preempt = (AST_PREEMPT | AST_URGENT);
 	else
 		preempt = AST_NONE;
 
-	realtime_queue_insert(thread);
+	realtime_queue_insert(processor, thread);
 
 	if (preempt != AST_NONE) {
 		if (processor->state == PROCESSOR_IDLE) {
@@ -3441,6 +3769,7 @@ choose_processor(
 	thread_t			thread)
 {
 	processor_set_t		nset, cset = pset;
+	boolean_t			cache_hot = FALSE;
 
 	assert(thread->sched_pri <= BASEPRI_RTQUEUES);
 
@@ -3448,6 +3777,17 @@ choose_processor(
 	 * Prefer the hinted processor, when appropriate.
 	 */
 
+	/*
+	 * A timeshare thread that ran on its last processor within the
+	 * cache hot window prefers that processor and its set, whose
+	 * members share a cache.  Fixed priority and realtime threads
+	 * are placed for latency only.
+	 */
+	if (processor != PROCESSOR_NULL && processor == thread->last_processor &&
+	    thread->sched_mode == TH_MODE_TIMESHARE) {
+		cache_hot = sched_thread_cache_hot(thread, mach_approximate_time());
+	}
+
 	/* Fold last processor hint from secondary processor to its primary */
 	if (processor != PROCESSOR_NULL) {
 		processor = processor->processor_primary;
@@ -3459,7 +3799,12 @@ choose_processor(
 	 * is going to sleep.
 	 */
 	if (pset->online_processor_count) {
-		if ((processor == PROCESSOR_NULL) || (processor->processor_set == pset && processor->state == PROCESSOR_IDLE)) {
+		/*
+		 * An idle last processor for a cache-hot thread is better than
+		 * whichever idle processor the platform considers cheapest.
+		 */
+		if ((processor == PROCESSOR_NULL) ||
+		    (!cache_hot && processor->processor_set == pset && processor->state == PROCESSOR_IDLE)) {
 			processor_t mc_processor = machine_choose_processor(pset, processor);
 			if (mc_processor != PROCESSOR_NULL)
 				processor = mc_processor->processor_primary;
@@ -3536,6 +3881,7 @@ choose_processor(
 	processor_t lp_unpaired_secondary_processor = PROCESSOR_NULL;
 	processor_t lc_processor = PROCESSOR_NULL;
 	processor_t fd_processor = PROCESSOR_NULL;
+	processor_t hot_processor = PROCESSOR_NULL;
 
 	if (processor != PROCESSOR_NULL) {
 		/* All other states should be enumerated above. */
@@ -3665,6 +4011,18 @@ choose_processor(
 			 */
 		}
 
+		/*
+		 * A cache-hot thread still preempts a lower priority processor
+		 * in any set, so it never waits behind its own set while such
+		 * a processor runs elsewhere.  Only when it would preempt
+		 * nothing does it queue on the least loaded processor of its
+		 * own set rather than the least loaded one anywhere.
+		 */
+		if (cache_hot && cset == pset) {
+			hot_processor = (lp_unpaired_secondary_processor != PROCESSOR_NULL) ?
+			    lp_unpaired_secondary_processor : lc_processor;
+		}
+
 		/*
 		 * Move onto the next processor set.
 		 */
@@ -3692,7 +4050,10 @@ choose_processor(
 	do {
 
 		/* lowest_priority is evaluated in the main loops above */
-		if (lp_unpaired_secondary_processor != PROCESSOR_NULL) {
+		if (hot_processor != PROCESSOR_NULL) {
+			processor = hot_processor;
+			hot_processor = PROCESSOR_NULL;
+		} else if (lp_unpaired_secondary_processor != PROCESSOR_NULL) {
 			processor = lp_unpaired_secondary_processor;
 			lp_unpaired_secondary_processor = PROCESSOR_NULL;
 		} else if (lc_processor != PROCESSOR_NULL) {
@@ -3887,18 +4248,18 @@ csw_check(
 ast_t
 csw_check_locked(
 	processor_t		processor,
-	processor_set_t	pset __unused,
+	processor_set_t	pset,
 	ast_t			check_reason)
 {
 	ast_t			result;
 	thread_t		thread = processor->active_thread;
 
 	if (processor->first_timeslice) {
-		if (rt_runq.count > 0)
+		if (pset->rt_runq.count > 0)
 			return (check_reason | AST_PREEMPT | AST_URGENT);
 	}
 	else {
-		if (rt_runq.count > 0) {
+		if (pset->rt_runq.count > 0) {
 			if (BASEPRI_RTQUEUES > processor->current_pri)
 				return (check_reason | AST_PREEMPT | AST_URGENT);
 			else
@@ -4117,7 +4478,14 @@ thread_run_queue_remove(
 		return SCHED(processor_queue_remove)(processor, thread);
 	}
 
-	rt_lock_lock();
+	/*
+	 * An RT thread's runq names a processor in the pset whose
+	 * RT runq holds it; the thread lock keeps it from being
+	 * requeued elsewhere, so that RT lock covers the removal.
+	 */
+	processor_set_t pset = processor->processor_set;
+
+	rt_lock_lock(pset);
 
 	if (thread->runq != PROCESSOR_NULL) {
 		/*
@@ -4125,18 +4493,19 @@ thread_run_queue_remove(
 		 *	that run queue.
 		 */
 
-		assert(thread->runq == THREAD_ON_RT_RUNQ);
+		assert(thread->runq->processor_set == pset);
 
 		remqueue(&thread->runq_links);
-		SCHED_STATS_RUNQ_CHANGE(&rt_runq.runq_stats, rt_runq.count);
-		rt_runq.count--;
+		SCHED_STATS_RUNQ_CHANGE(&pset->rt_runq.runq_stats, pset->rt_runq.count);
+		pset->rt_runq.count--;
+		rt_runq_update_deadline(pset);
 
 		thread->runq = PROCESSOR_NULL;
 
 		removed = TRUE;
 	}
 
-	rt_lock_unlock();
+	rt_lock_unlock(pset);
 
 	return (removed);
 }
@@ -4241,7 +4610,7 @@ processor_idle(
 		if (pset->pending_AST_cpu_mask & (1ULL << processor->cpu_id))
 			break;
 		if (processor->is_recommended) {
-			if (rt_runq.count)
+			if (pset->rt_runq.count)
 				break;
 		} else {
 			if (SCHED(processor_bound_count)(processor))
@@ -4257,7 +4626,7 @@ processor_idle(
 #endif
 
 		IDLE_KERNEL_DEBUG_CONSTANT(
-			MACHDBG_CODE(DBG_MACH_SCHED,MACH_IDLE) | DBG_FUNC_NONE, (uintptr_t)thread_tid(thread), rt_runq.count, SCHED(processor_runq_count)(processor), -1, 0);
+			MACHDBG_CODE(DBG_MACH_SCHED,MACH_IDLE) | DBG_FUNC_NONE, (uintptr_t)thread_tid(thread), pset->rt_runq.count, SCHED(processor_runq_count)(processor), -1, 0);
 
 		machine_track_platform_idle(TRUE);
 
@@ -4268,7 +4637,7 @@ processor_idle(
 		(void)splsched();
 
 		IDLE_KERNEL_DEBUG_CONSTANT(
-			MACHDBG_CODE(DBG_MACH_SCHED,MACH_IDLE) | DBG_FUNC_NONE, (uintptr_t)thread_tid(thread), rt_runq.count, SCHED(processor_runq_count)(processor), -2, 0);
+			MACHDBG_CODE(DBG_MACH_SCHED,MACH_IDLE) | DBG_FUNC_NONE, (uintptr_t)thread_tid(thread), pset->rt_runq.count, SCHED(processor_runq_count)(processor), -2, 0);
 
 		if (!SCHED(processor_queue_empty)(processor)) {
 			/* Secondary SMT processors respond to directed wakeups
@@ -4301,7 +4670,7 @@ processor_idle(
 		processor->state = PROCESSOR_RUNNING;
 
 		if ((new_thread != THREAD_NULL) && (SCHED(processor_queue_has_priority)(processor, new_thread->sched_pri, FALSE)					||
-											(rt_runq.count > 0))	) {
+											(pset->rt_runq.count > 0))	) {
    			/* Something higher priority has popped up on the runqueue - redispatch this thread elsewhere */
 			processor->current_pri = IDLEPRI;
 			processor->current_thmode = TH_MODE_FIXED;
@@ -4311,7 +4680,7 @@ processor_idle(
 			pset_unlock(pset);
 
 			thread_lock(new_thread);
-			KERNEL_DEBUG_CONSTANT(MACHDBG_CODE(DBG_MACH_SCHED, MACH_REDISPATCH), (uintptr_t)thread_tid(new_thread), new_thread->sched_pri, rt_runq.count, 0, 0);
+			KERNEL_DEBUG_CONSTANT(MACHDBG_CODE(DBG_MACH_SCHED, MACH_REDISPATCH), (uintptr_t)thread_tid(new_thread), new_thread->sched_pri, pset->rt_runq.count, 0, 0);
 			thread_setrun(new_thread, SCHED_HEADQ);
 			thread_unlock(new_thread);
 
@@ -4689,29 +5058,42 @@ runq_scan(
 	     queue_index >= 0;
 	     queue_index = bitmap_next(runq->bitmap, queue_index)) {
 
-		thread_t thread;
-		queue_t  queue = &runq->queues[queue_index];
+		if (runq_scan_queue(&runq->queues[queue_index], scan_context))
+			return TRUE;
+	}
 
-		qe_foreach_element(thread, queue, runq_links) {
-			assert(count > 0);
-			assert_thread_magic(thread);
+	return FALSE;
+}
 
-			if (thread->sched_stamp != sched_tick &&
-			    thread->sched_mode == TH_MODE_TIMESHARE) {
-				if (thread_update_add_thread(thread) == FALSE)
-					return TRUE;
-			}
+/*
+ *	Scan one priority level of a runq for candidate threads.
+ *
+ *	Returns TRUE if retry is needed.
+ */
+boolean_t
+runq_scan_queue(
+          queue_t                       queue,
+          sched_update_scan_context_t   scan_context)
+{
+	thread_t thread;
 
-			if (cpu_throttle_enabled && ((thread->sched_pri <= MAXPRI_THROTTLE) && (thread->base_pri <= MAXPRI_THROTTLE))) {
-				if (thread->last_made_runnable_time < scan_context->earliest_bg_make_runnable_time) {
-					scan_context->earliest_bg_make_runnable_time = thread->last_made_runnable_time;
-				}
-			} else {
-				if (thread->last_made_runnable_time < scan_context->earliest_normal_make_runnable_time) {
-					scan_context->earliest_normal_make_runnable_time = thread->last_made_runnable_time;
-				}
+	qe_foreach_element(thread, queue, runq_links) {
+		assert_thread_magic(thread);
+
+		if (thread->sched_stamp != sched_tick &&
+		    thread->sched_mode == TH_MODE_TIMESHARE) {
+			if (thread_update_add_thread(thread) == FALSE)
+				return TRUE;
+		}
+
+		if (cpu_throttle_enabled && ((thread->sched_pri <= MAXPRI_THROTTLE) && (thread->base_pri <= MAXPRI_THROTTLE))) {
+			if (thread->last_made_runnable_time < scan_context->earliest_bg_make_runnable_time) {
+				scan_context->earliest_bg_make_runnable_time = thread->last_made_runnable_time;
+			}
+		} else {
+			if (thread->last_made_runnable_time < scan_context->earliest_normal_make_runnable_time) {
+				scan_context->earliest_normal_make_runnable_time = thread->last_made_runnable_time;
 			}
-			count--;
 		}
 	}
 
@@ -4778,10 +5160,11 @@ thread_clear_eager_preempt(thread_t thread)
  * Scheduling statistics
  */
 void
-sched_stats_handle_csw(processor_t processor, int reasons, int selfpri, int otherpri)
+sched_stats_handle_csw(processor_t processor, int reasons, int selfpri, thread_t thread, processor_t last_processor)
 {
 	struct processor_sched_statistics *stats;
 	boolean_t to_realtime = FALSE;
+	int otherpri = thread->sched_pri;
 	
 	stats = &processor->processor_data.sched_stats;
 	stats->csw_count++;
@@ -4791,6 +5174,27 @@ sched_stats_handle_csw(processor_t processor, int reasons, int selfpri, int othe
 		to_realtime = TRUE;
 	}
 
+	/*
+	 * Account where the incoming thread last ran, and whether it was
+	 * still cache hot (as of this dispatch) when placed here.
+	 */
+	if (last_processor != PROCESSOR_NULL) {
+		boolean_t same_pset = (last_processor->processor_set == processor->processor_set);
+
+		if (last_processor != processor) {
+			stats->migration_count++;
+			if (!same_pset)
+				stats->pset_migration_count++;
+		}
+
+		if (sched_thread_cache_hot(thread, processor->last_dispatch)) {
+			if (same_pset)
+				stats->cache_hot_count++;
+			else
+				stats->cache_hot_migration_count++;
+		}
+	}
+
 	if ((reasons & AST_PREEMPT) != 0) {
 		stats->preempt_count++;
 
@@ -4805,13 +5209,99 @@ sched_stats_handle_csw(processor_t processor, int reasons, int selfpri, int othe
 	}
 }
 
+/*
+ * Number of RUNQ_STATS_DECAY_SECS periods a histogram is behind on,
+ * 64 or more meaning all of its contents have decayed away.
+ */
+static uint32_t
+sched_stats_decay_shift(uint64_t decay_deadline, uint64_t timestamp)
+{
+	uint64_t period = RUNQ_STATS_DECAY_SECS * sched_one_second_interval;
+	uint64_t periods;
+
+	if (timestamp < decay_deadline)
+		return 0;
+
+	periods = 1 + (timestamp - decay_deadline) / period;
+	return (periods > 64) ? 64 : (uint32_t)periods;
+}
+
+static void
+sched_stats_decay(uint64_t *hist, int nbuckets, uint64_t *decay_deadline, uint64_t timestamp)
+{
+	uint32_t shift = sched_stats_decay_shift(*decay_deadline, timestamp);
+
+	for (int i = 0; i < nbuckets; i++)
+		hist[i] = (shift >= 64) ? 0 : (hist[i] >> shift);
+
+	*decay_deadline = timestamp + RUNQ_STATS_DECAY_SECS * sched_one_second_interval;
+}
+
+/*
+ * Add a decayed view of hist to out, without writing to hist: the
+ * histograms are only updated by their owner.
+ */
+void
+sched_stats_decayed_hist(uint64_t *hist, int nbuckets, uint64_t decay_deadline, uint64_t *out)
+{
+	uint32_t shift = sched_stats_decay_shift(decay_deadline, mach_absolute_time());
+
+	if (shift >= 64)
+		return;
+
+	for (int i = 0; i < nbuckets; i++)
+		out[i] += hist[i] >> shift;
+}
+
 void
 sched_stats_handle_runq_change(struct runq_stats *stats, int old_count) 
 {
 	uint64_t timestamp = mach_absolute_time();
+	uint64_t delta = 0;
+	int bucket = 0;
+
+	/* nothing is known about the queue before its first change */
+	if (stats->last_change_timestamp != 0)
+		delta = timestamp - stats->last_change_timestamp;
 
-	stats->count_sum += (timestamp - stats->last_change_timestamp) * old_count;
+	if (old_count > 0)
+		bucket = MIN(bit_first((uint64_t)old_count) + 1, RUNQ_STATS_DEPTH_BUCKETS - 1);
+
+	stats->count_sum += delta * old_count;
+	stats->depth_time[bucket] += delta;
 	stats->last_change_timestamp = timestamp;
+
+	/* a change after a long time with sched_stats_active off clears out stale time */
+	if (timestamp >= stats->decay_deadline)
+		sched_stats_decay(stats->depth_time, RUNQ_STATS_DEPTH_BUCKETS, &stats->decay_deadline, timestamp);
+}
+
+void
+sched_stats_runq_depth(struct runq_stats *stats, uint64_t *depth_time)
+{
+	sched_stats_decayed_hist(stats->depth_time, RUNQ_STATS_DEPTH_BUCKETS, stats->decay_deadline, depth_time);
+}
+
+/*
+ * Called at dispatch on the processor itself, so the wait histogram
+ * needs no locking.
+ */
+void
+sched_stats_handle_wait(processor_t processor, uint64_t latency)
+{
+	struct processor_sched_statistics *stats = &processor->processor_data.sched_stats;
+	uint64_t ns, timestamp = processor->last_dispatch;
+	int bucket = 0;
+
+	absolutetime_to_nanoseconds(latency, &ns);
+	ns >>= SCHED_STATS_WAIT_SHIFT;
+	if (ns > 0)
+		bucket = MIN(bit_first(ns) + 1, SCHED_STATS_WAIT_BUCKETS - 1);
+
+	if (timestamp >= stats->wait_decay_deadline)
+		sched_stats_decay(stats->wait_hist, SCHED_STATS_WAIT_BUCKETS, &stats->wait_decay_deadline, timestamp);
+
+	stats->wait_hist[bucket]++;
 }
 
 /*
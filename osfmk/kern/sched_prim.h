@@ -203,9 +203,6 @@ extern void		thread_setrun(
 #define SCHED_HEADQ		2
 #define SCHED_PREEMPT	4
 
-extern uintptr_t sched_thread_on_rt_queue;
-#define THREAD_ON_RT_RUNQ  ((processor_t)(uintptr_t)&sched_thread_on_rt_queue)
-
 extern processor_set_t	task_choose_pset(
 							task_t			task);
 
@@ -252,6 +249,7 @@ typedef struct sched_update_scan_context *sched_update_scan_context_t;
 extern boolean_t        thread_update_add_thread(thread_t thread);
 extern void             thread_update_process_threads(void);
 extern boolean_t        runq_scan(run_queue_t runq, sched_update_scan_context_t scan_context);
+extern boolean_t        runq_scan_queue(queue_t queue, sched_update_scan_context_t scan_context);
 
 extern void sched_timeshare_init(void);
 extern void sched_timeshare_timebase_init(void);
@@ -266,6 +264,8 @@ extern int sched_compute_timeshare_priority(thread_t thread);
 
 extern void        rt_runq_scan(sched_update_scan_context_t scan_context);
 
+extern void        sched_realtime_pset_init(processor_set_t pset);
+
 /* Remove thread from its run queue */
 extern boolean_t	thread_run_queue_remove(thread_t thread);
 thread_t thread_run_queue_remove_for_handoff(thread_t thread);
@@ -299,19 +299,34 @@ extern void sched_stats_handle_csw(
 							processor_t processor, 
 							int reasons, 
 							int selfpri, 
-							int otherpri);
+							thread_t thread,
+							processor_t last_processor);
 
 extern void sched_stats_handle_runq_change(
 									struct runq_stats *stats, 
 									int old_count);
 
+extern void sched_stats_handle_wait(
+									processor_t processor,
+									uint64_t latency);
+
+extern void sched_stats_runq_depth(
+									struct runq_stats *stats,
+									uint64_t *depth_time);
 
+extern void sched_stats_decayed_hist(
+									uint64_t *hist,
+									int nbuckets,
+									uint64_t decay_deadline,
+									uint64_t *out);
 
-#define	SCHED_STATS_CSW(processor, reasons, selfpri, otherpri) 		\
+
+
+#define	SCHED_STATS_CSW(processor, reasons, selfpri, thread, last_processor)	\
 do { 								\
 	if (__builtin_expect(sched_stats_active, 0)) { 	\
-		sched_stats_handle_csw((processor), 		\
-				(reasons), (selfpri), (otherpri)); 	\
+		sched_stats_handle_csw((processor), (reasons),	\
+				(selfpri), (thread), (last_processor));	\
 	}							\
 } while (0) 
 
@@ -404,12 +419,30 @@ extern thread_t port_name_to_thread_for_ulock(mach_port_name_t	thread_name);
 /* Attempt to context switch to a specific runnable thread */
 extern wait_result_t thread_handoff(thread_t thread);
 
+/* Yield to a thread just woken by the caller, which stays runnable */
+extern void thread_handoff_woken(thread_t thread);
+
+/* Wake-one paths of ulocks and semaphores hand off to the woken thread */
+extern uint32_t sched_wake_handoff;
+
 extern struct waitq	*assert_wait_queue(event_t event);
 
 extern kern_return_t thread_wakeup_one_with_pri(event_t event, int priority);
 
 extern thread_t thread_wakeup_identify(event_t event, int priority);
 
+/* Window after a thread last ran during which its cache state is assumed hot */
+extern uint32_t	sched_cache_hot_us;
+extern void	sched_cache_hot_window_init(void);
+
+/* Admission control for THREAD_TIME_CONSTRAINT_POLICY */
+extern uint32_t	sched_rt_edf_admission;
+extern boolean_t	sched_rt_admit(
+					thread_t	thread,
+					uint32_t	period,
+					uint32_t	computation,
+					uint32_t	constraint);
+
 #endif	/* XNU_KERNEL_PRIVATE */
 
 #ifdef KERNEL_PRIVATE
@@ -614,6 +647,9 @@ struct sched_dispatch_table {
 	/* Aggregate runcount statistics for per-processor runqueue */
 	uint64_t    (*processor_runq_stats_count_sum)(processor_t   processor);
 
+	/* Add the decayed depth histogram of the per-processor runqueue to depth_time */
+	void        (*processor_runq_stats_depth)(processor_t processor, uint64_t *depth_time);
+
 	boolean_t	(*processor_bound_count)(processor_t processor);
 
 	void		(*thread_update_scan)(sched_update_scan_context_t scan_context);
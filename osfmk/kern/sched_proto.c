@@ -146,6 +146,9 @@ sched_proto_processor_runq_count(processor_t   processor);
 static uint64_t
 sched_proto_processor_runq_stats_count_sum(processor_t   processor);
 
+static void
+sched_proto_processor_runq_stats_depth(processor_t   processor, uint64_t *depth_time);
+
 static int
 sched_proto_processor_bound_count(processor_t   processor);
 
@@ -180,6 +183,7 @@ const struct sched_dispatch_table sched_proto_dispatch = {
 	.quantum_expire                                 = sched_proto_quantum_expire,
 	.processor_runq_count                           = sched_proto_processor_runq_count,
 	.processor_runq_stats_count_sum                 = sched_proto_processor_runq_stats_count_sum,
+	.processor_runq_stats_depth                     = sched_proto_processor_runq_stats_depth,
 	.processor_bound_count                          = sched_proto_processor_bound_count,
 	.thread_update_scan                             = sched_proto_thread_update_scan,
 	.direct_dispatch_to_idle_processors             = TRUE,
@@ -583,6 +587,14 @@ sched_proto_processor_runq_stats_count_sum(processor_t   processor)
 	}
 }
 
+static void
+sched_proto_processor_runq_stats_depth(processor_t   processor, uint64_t *depth_time)
+{
+	if (master_processor == processor) {
+		sched_stats_runq_depth(&global_runq->runq_stats, depth_time);
+	}
+}
+
 static int
 sched_proto_processor_bound_count(__unused processor_t   processor)
 {
@@ -104,6 +104,12 @@ sched_traditional_processor_runq_stats_count_sum(processor_t processor);
 static uint64_t
 sched_traditional_with_pset_runqueue_processor_runq_stats_count_sum(processor_t processor);
 
+static void
+sched_traditional_processor_runq_stats_depth(processor_t processor, uint64_t *depth_time);
+
+static void
+sched_traditional_with_pset_runqueue_processor_runq_stats_depth(processor_t processor, uint64_t *depth_time);
+
 static int
 sched_traditional_processor_bound_count(processor_t processor);
 
@@ -155,6 +161,7 @@ const struct sched_dispatch_table sched_traditional_dispatch = {
 	.quantum_expire                                 = sched_default_quantum_expire,
 	.processor_runq_count                           = sched_traditional_processor_runq_count,
 	.processor_runq_stats_count_sum                 = sched_traditional_processor_runq_stats_count_sum,
+	.processor_runq_stats_depth                     = sched_traditional_processor_runq_stats_depth,
 	.processor_bound_count                          = sched_traditional_processor_bound_count,
 	.thread_update_scan                             = sched_traditional_thread_update_scan,
 	.direct_dispatch_to_idle_processors             = TRUE,
@@ -189,6 +196,7 @@ const struct sched_dispatch_table sched_traditional_with_pset_runqueue_dispatch
 	.quantum_expire                                 = sched_default_quantum_expire,
 	.processor_runq_count                           = sched_traditional_processor_runq_count,
 	.processor_runq_stats_count_sum                 = sched_traditional_with_pset_runqueue_processor_runq_stats_count_sum,
+	.processor_runq_stats_depth                     = sched_traditional_with_pset_runqueue_processor_runq_stats_depth,
 	.processor_bound_count                          = sched_traditional_processor_bound_count,
 	.thread_update_scan                             = sched_traditional_thread_update_scan,
 	.direct_dispatch_to_idle_processors             = FALSE,
@@ -462,6 +470,19 @@ sched_traditional_with_pset_runqueue_processor_runq_stats_count_sum(processor_t
 		return 0ULL;
 }
 
+static void
+sched_traditional_processor_runq_stats_depth(processor_t processor, uint64_t *depth_time)
+{
+	sched_stats_runq_depth(&runq_for_processor(processor)->runq_stats, depth_time);
+}
+
+static void
+sched_traditional_with_pset_runqueue_processor_runq_stats_depth(processor_t processor, uint64_t *depth_time)
+{
+	if (processor->cpu_id == processor->processor_set->cpu_set_low)
+		sched_stats_runq_depth(&runq_for_processor(processor)->runq_stats, depth_time);
+}
+
 static int
 sched_traditional_processor_bound_count(processor_t processor)
 {
@@ -426,6 +426,12 @@ kernel_bootstrap_thread(void)
 	kernel_bootstrap_thread_log("thread_daemon_init");
 	thread_daemon_init();
 
+	/*
+	 * Background return of free zone pages
+	 */
+	kernel_bootstrap_thread_log("zone_reclaim_init");
+	zone_reclaim_init();
+
 	/* Create kernel map entry reserve */
 	vm_kernel_reserved_entry_init();
 
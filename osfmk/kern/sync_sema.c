@@ -63,6 +63,12 @@
 static unsigned int semaphore_event;
 #define SEMAPHORE_EVENT CAST_EVENT64_T(&semaphore_event)
 
+/*
+ * Kernel-internal signal option: switch to the woken thread
+ * (see sched_wake_handoff).  Only for callers that may block.
+ */
+#define SEMAPHORE_SIGNAL_HANDOFF	0x00010000
+
 zone_t semaphore_zone;
 unsigned int semaphore_max;
 
@@ -406,6 +412,33 @@ semaphore_signal_internal(
 		return kr;
 	}
 	
+	if (semaphore->count < 0 && (options & SEMAPHORE_SIGNAL_HANDOFF)) {
+		thread_t woken;
+		spl_t th_spl;
+
+		woken = waitq_wakeup64_identify_locked(
+					&semaphore->waitq,
+					SEMAPHORE_EVENT,
+					THREAD_AWAKENED,
+					&th_spl, NULL,
+					WAITQ_ALL_PRIORITIES,
+					WAITQ_KEEP_LOCKED);
+		if (woken != THREAD_NULL) {
+			/* thread is locked, and runnable */
+			thread_reference(woken);
+			thread_unlock(woken);
+			splx(th_spl);
+
+			semaphore_unlock(semaphore);
+			splx(spl_level);
+
+			thread_handoff_woken(woken);
+			return KERN_SUCCESS;
+		} else {
+			semaphore->count = 0;  /* all waiters gone */
+		}
+	}
+
 	if (semaphore->count < 0) {
 		kr = waitq_wakeup64_one_locked(
 					&semaphore->waitq,
@@ -549,7 +582,8 @@ semaphore_signal_internal_trap(mach_port_name_t sema_name)
 	if (kr == KERN_SUCCESS) {
 		kr = semaphore_signal_internal(semaphore, 
 				THREAD_NULL, 
-				SEMAPHORE_SIGNAL_PREPOST);
+				SEMAPHORE_SIGNAL_PREPOST |
+				(sched_wake_handoff ? SEMAPHORE_SIGNAL_HANDOFF : 0));
 		semaphore_dereference(semaphore);
 		if (kr == KERN_NOT_WAITING)
 			kr = KERN_SUCCESS;
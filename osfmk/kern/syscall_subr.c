@@ -113,7 +113,7 @@ swtch_continue(void)
 
     disable_preemption();
 	myprocessor = current_processor();
-	result = !SCHED(processor_queue_empty)(myprocessor) || rt_runq.count > 0;
+	result = !SCHED(processor_queue_empty)(myprocessor) || myprocessor->processor_set->rt_runq.count > 0;
 	enable_preemption();
 
 	thread_syscall_return(result);
@@ -129,7 +129,7 @@ swtch(
 
 	disable_preemption();
 	myprocessor = current_processor();
-	if (SCHED(processor_queue_empty)(myprocessor) &&	rt_runq.count == 0) {
+	if (SCHED(processor_queue_empty)(myprocessor) &&	myprocessor->processor_set->rt_runq.count == 0) {
 		mp_enable_preemption();
 
 		return (FALSE);
@@ -142,7 +142,7 @@ swtch(
 
 	disable_preemption();
 	myprocessor = current_processor();
-	result = !SCHED(processor_queue_empty)(myprocessor) || rt_runq.count > 0;
+	result = !SCHED(processor_queue_empty)(myprocessor) || myprocessor->processor_set->rt_runq.count > 0;
 	enable_preemption();
 
 	return (result);
@@ -158,7 +158,7 @@ swtch_pri_continue(void)
 
     disable_preemption();
 	myprocessor = current_processor();
-	result = !SCHED(processor_queue_empty)(myprocessor) || rt_runq.count > 0;
+	result = !SCHED(processor_queue_empty)(myprocessor) || myprocessor->processor_set->rt_runq.count > 0;
 	mp_enable_preemption();
 
 	thread_syscall_return(result);
@@ -174,7 +174,7 @@ __unused	struct swtch_pri_args *args)
 
 	disable_preemption();
 	myprocessor = current_processor();
-	if (SCHED(processor_queue_empty)(myprocessor) && rt_runq.count == 0) {
+	if (SCHED(processor_queue_empty)(myprocessor) && myprocessor->processor_set->rt_runq.count == 0) {
 		mp_enable_preemption();
 
 		return (FALSE);
@@ -191,7 +191,7 @@ __unused	struct swtch_pri_args *args)
 
 	disable_preemption();
 	myprocessor = current_processor();
-	result = !SCHED(processor_queue_empty)(myprocessor) || rt_runq.count > 0;
+	result = !SCHED(processor_queue_empty)(myprocessor) || myprocessor->processor_set->rt_runq.count > 0;
 	enable_preemption();
 
 	return (result);
@@ -469,6 +469,42 @@ thread_handoff(thread_t thread)
 	return result;
 }
 
+/*
+ * Switch directly to a thread the caller has just woken, leaving the
+ * caller runnable, so the woken thread runs at once on this processor
+ * instead of waiting for a remote dispatch.  If the thread can't be
+ * pulled off its run queue (e.g. realtime, or bound elsewhere) it is
+ * left to the scheduler.
+ *
+ * Consumes a ref on thread
+ */
+void
+thread_handoff_woken(thread_t thread)
+{
+	thread_t self = current_thread();
+	spl_t s = splsched();
+
+	thread_t pulled_thread = thread_run_queue_remove_for_handoff(thread);
+
+	KERNEL_DEBUG_CONSTANT(MACHDBG_CODE(DBG_MACH_SCHED,MACH_SCHED_THREAD_SWITCH)|DBG_FUNC_NONE,
+			      thread_tid(thread), thread->state,
+			      pulled_thread ? TRUE : FALSE, 0, 0);
+
+	if (pulled_thread != THREAD_NULL) {
+		/* We can't be dropping the last ref here */
+		thread_deallocate_safe(thread);
+
+		thread_run(self, THREAD_CONTINUE_NULL, NULL, pulled_thread);
+
+		splx(s);
+		return;
+	}
+
+	splx(s);
+
+	thread_deallocate(thread);
+}
+
 /*
  * Depress thread's priority to lowest possible for the specified interval,
  * with a value of zero resulting in no timeout being scheduled.
@@ -626,7 +662,7 @@ thread_yield_internal(
 
 	disable_preemption();
 	myprocessor = current_processor();
-	if (SCHED(processor_queue_empty)(myprocessor) && rt_runq.count == 0) {
+	if (SCHED(processor_queue_empty)(myprocessor) && myprocessor->processor_set->rt_runq.count == 0) {
 		mp_enable_preemption();
 
 		return;
@@ -906,6 +906,12 @@ init_task_ledgers(void)
 	ledger_track_credit_only(t, task_ledgers.purgeable_volatile_compressed);
 	ledger_track_credit_only(t, task_ledgers.purgeable_nonvolatile_compressed);
 
+	/* Updated from every thread of the task on faults and context switches */
+	ledger_track_percpu(t, task_ledgers.cpu_time);
+	ledger_track_percpu(t, task_ledgers.phys_mem);
+	ledger_track_percpu(t, task_ledgers.internal);
+	ledger_track_percpu(t, task_ledgers.internal_compressed);
+
 	ledger_track_maximum(t, task_ledgers.phys_footprint, 60);
 #if MACH_ASSERT
 	if (pmap_ledgers_panic) {
@@ -1263,6 +1269,7 @@ task_create_internal(
 	lck_mtx_lock(&tasks_threads_lock);
 	queue_enter(&tasks, new_task, task_t, tasks);
 	tasks_count++;
+	tasks_generation++;
         if (tasks_suspend_state) {
             task_suspend_internal(new_task);
         }
@@ -2189,6 +2196,7 @@ task_terminate_internal(
 	queue_enter(&terminated_tasks, task, task_t, tasks);
 	tasks_count--;
 	terminated_tasks_count++;
+	tasks_generation++;
 	lck_mtx_unlock(&tasks_threads_lock);
 
 	/*
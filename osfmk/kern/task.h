@@ -385,6 +385,8 @@ struct task {
 	 */
 	coalition_t	coalition[COALITION_NUM_TYPES];
 	queue_chain_t   task_coalition[COALITION_NUM_TYPES];
+	/* usage already folded into the resource coalition's totals */
+	struct coalition_resource_usage coalition_folded_usage;
 	uint64_t        dispatchqueue_offset;
 
 #if DEVELOPMENT || DEBUG
@@ -53,12 +53,17 @@
 #endif
 #include <machine/machine_routines.h>
 
+#if defined(__x86_64__)
+#include <i386/mp.h>
+#endif
+
 static zone_t			thread_call_zone;
 static struct waitq		daemon_waitq;
 
 struct thread_call_group {
-	queue_head_t		pending_queue;
-	uint32_t		pending_count;
+	lck_mtx_t		lock;		/* protects the delayed queue and the threads */
+
+	volatile uint32_t	pending_count;	/* on all processors' pending queues */
 
 	queue_head_t		delayed_queue;
 	uint32_t		delayed_count;
@@ -96,10 +101,26 @@ typedef struct thread_call_group	*thread_call_group_t;
 #define IS_CONT_GROUP(group) \
 	(((group)->flags & TCG_CONTINUOUS) ? TRUE : FALSE)
 
+#define THREAD_CALL_GROUP_INDEX(group) \
+	((uint32_t)((group) - thread_call_groups))
+
 // groups [0..4]: thread calls in mach_absolute_time
 // groups [4..8]: thread calls in mach_continuous_time 
 static struct thread_call_group thread_call_groups[THREAD_CALL_GROUP_COUNT];
 
+/*
+ * Each processor has a pending queue for every group.
+ */
+struct thread_call_cpu {
+	lck_mtx_t		lock;		/* protects the queues and the calls bound here */
+	queue_head_t		pending_queue[THREAD_CALL_GROUP_COUNT];
+} __attribute__((aligned(64)));
+
+typedef struct thread_call_cpu	*thread_call_cpu_t;
+
+static thread_call_cpu_t	thread_call_cpus;
+static uint32_t			thread_call_ncpus;
+
 static struct thread_call_group *abstime_thread_call_groups;
 static struct thread_call_group *conttime_thread_call_groups;
 
@@ -111,10 +132,11 @@ static uint64_t 		thread_call_dealloc_interval_abs;
 
 static __inline__ thread_call_t	_internal_call_allocate(thread_call_func_t func, thread_call_param_t param0);
 static __inline__ void		_internal_call_release(thread_call_t call);
-static __inline__ boolean_t	_pending_call_enqueue(thread_call_t call, thread_call_group_t group);
-static __inline__ boolean_t 	_delayed_call_enqueue(thread_call_t call, thread_call_group_t group, uint64_t deadline);
-static __inline__ boolean_t 	_call_dequeue(thread_call_t call, thread_call_group_t group);
+static __inline__ boolean_t	_pending_call_enqueue(thread_call_t call, thread_call_group_t group, thread_call_cpu_t tcc);
+static __inline__ boolean_t 	_delayed_call_enqueue(thread_call_t call, thread_call_group_t group, thread_call_cpu_t tcc, uint64_t deadline);
+static __inline__ boolean_t 	_call_dequeue(thread_call_t call, thread_call_group_t group, thread_call_cpu_t tcc);
 static __inline__ void		thread_call_wake(thread_call_group_t group);
+static void			thread_call_signal(thread_call_group_t group);
 static __inline__ void		_set_delayed_call_timer(thread_call_t call, thread_call_group_t	group);
 static boolean_t		_remove_from_pending_queue(thread_call_func_t func, thread_call_param_t	param0, boolean_t remove_all);
 static boolean_t 		_remove_from_delayed_queue(thread_call_func_t func, thread_call_param_t	param0, boolean_t remove_all);
@@ -125,7 +147,7 @@ static void			thread_call_dealloc_timer(timer_call_param_t p0, timer_call_param_
 static void			thread_call_group_setup(thread_call_group_t group, thread_call_priority_t pri, uint32_t target_thread_count, boolean_t parallel, boolean_t continuous);
 static void			sched_call_thread(int type, thread_t thread);
 static void			thread_call_start_deallocate_timer(thread_call_group_t group);
-static void			thread_call_wait_locked(thread_call_t call);
+static thread_call_cpu_t	thread_call_wait_locked(thread_call_t call, thread_call_cpu_t tcc);
 static boolean_t		thread_call_enter_delayed_internal(thread_call_t call,
 						thread_call_func_t alt_func, thread_call_param_t alt_param0,
 						thread_call_param_t param1, uint64_t deadline,
@@ -140,32 +162,64 @@ lck_grp_t               thread_call_lck_grp;
 lck_attr_t              thread_call_lck_attr;
 lck_grp_attr_t          thread_call_lck_grp_attr;
 
+/*
+ * Pending calls are kept on per-processor queues, so that entering a
+ * call and picking it up usually only take one processor's lock. A call
+ * is bound to a processor: that processor's lock protects the call's
+ * state (its queue linkage, submit and finish counts, flags and refcount)
+ * and the call is only ever put on that processor's pending queues. A
+ * call that is neither queued nor running is rebound to the processor
+ * entering it, with both processors' locks held, so the binding is
+ * stable while the bound processor's lock is held. A group's threads
+ * take calls from the queue of the processor they run on first, and
+ * steal them from the other processors' queues after that.
+ *
+ * Each group has its own lock, which protects its delayed queue and
+ * timers, its thread counts and its idle threads. Putting a call on or
+ * taking it off the delayed queue takes the group lock as well as the
+ * processor lock, and so does moving a call from an absolute to the
+ * continuous time group. Group locks (absolute time groups first) are
+ * taken before processor locks, and processor locks in processor order.
+ * The global lock only covers the internal call storage and the daemon,
+ * and is always taken last.
+ */
 lck_mtx_t		thread_call_lock_data;
 
+#define thread_call_lock_spin(group)		\
+	lck_mtx_lock_spin_always(&(group)->lock)
+
+#define thread_call_unlock(group)		\
+	lck_mtx_unlock_always(&(group)->lock)
+
+#define thread_call_cpu_lock_spin(tcc)		\
+	lck_mtx_lock_spin_always(&(tcc)->lock)
 
-#define thread_call_lock_spin()			\
+#define thread_call_cpu_unlock(tcc)		\
+	lck_mtx_unlock_always(&(tcc)->lock)
+
+#define thread_call_global_lock_spin()		\
 	lck_mtx_lock_spin_always(&thread_call_lock_data)
 
-#define thread_call_unlock()			\
+#define thread_call_global_unlock()		\
 	lck_mtx_unlock_always(&thread_call_lock_data)
 
 extern boolean_t	mach_timer_coalescing_enabled;
 
 static inline spl_t
-disable_ints_and_lock(void)
+disable_ints_and_lock(thread_call_group_t group)
 {
 	spl_t s;
 
 	s = splsched();
-	thread_call_lock_spin();
+	thread_call_lock_spin(group);
 
 	return s;
 }
 
 static inline void 
-enable_ints_and_unlock(spl_t s)
+enable_ints_and_unlock(thread_call_group_t group, spl_t s)
 {
-	thread_call_unlock();
+	thread_call_unlock(group);
 	splx(s);
 }
 
@@ -234,30 +288,179 @@ thread_call_priority_to_sched_pri(thread_call_priority_t pri)
 	return 0;
 }
 
-/* Lock held */
 static inline thread_call_group_t
-thread_call_get_group(
-		thread_call_t call)
+thread_call_group_for(
+		thread_call_priority_t	pri,
+		boolean_t		continuous)
 {
-	thread_call_priority_t 	pri = call->tc_pri;
-
 	assert(pri == THREAD_CALL_PRIORITY_LOW ||
 			pri == THREAD_CALL_PRIORITY_USER ||
 			pri == THREAD_CALL_PRIORITY_KERNEL ||
 			pri == THREAD_CALL_PRIORITY_HIGH);
 
-	thread_call_group_t group;
-
-	if(call->tc_flags & THREAD_CALL_CONTINUOUS) {
-		group = &conttime_thread_call_groups[pri];
+	if (continuous) {
+		return &conttime_thread_call_groups[pri];
 	} else {
-		group = &abstime_thread_call_groups[pri];
+		return &abstime_thread_call_groups[pri];
 	}
+}
+
+/*
+ * The group of a call.  A call only changes groups, when first entered
+ * with THREAD_CALL_CONTINUOUS, with the lock of its processor held.
+ */
+static inline thread_call_group_t
+thread_call_get_group(
+		thread_call_t call)
+{
+	thread_call_group_t group;
+
+	group = thread_call_group_for(call->tc_pri,
+			(call->tc_flags & THREAD_CALL_CONTINUOUS) ? TRUE : FALSE);
 
 	assert(IS_CONT_GROUP(group) == ((call->tc_flags & THREAD_CALL_CONTINUOUS) ? TRUE : FALSE));
 	return group;
 }
 
+static inline queue_head_t *
+thread_call_pending_queue(
+		thread_call_cpu_t	tcc,
+		thread_call_group_t	group)
+{
+	return &tcc->pending_queue[THREAD_CALL_GROUP_INDEX(group)];
+}
+
+/*
+ * Lock the processor a call is bound to, which keeps the binding
+ * and the call's group stable until it is unlocked.
+ *
+ * Called at splsched.
+ */
+static thread_call_cpu_t
+thread_call_lock_call(
+		thread_call_t		call)
+{
+	thread_call_cpu_t tcc;
+
+	for (;;) {
+		tcc = &thread_call_cpus[call->tc_cpu];
+		thread_call_cpu_lock_spin(tcc);
+		if (tcc == &thread_call_cpus[call->tc_cpu])
+			return (tcc);
+		thread_call_cpu_unlock(tcc);
+	}
+}
+
+/*
+ * Lock a call's group and then the processor it is bound to.
+ *
+ * Called at splsched.
+ */
+static thread_call_cpu_t
+thread_call_lock_call_and_group(
+		thread_call_t		call,
+		thread_call_group_t	*groupp)
+{
+	thread_call_group_t group;
+	thread_call_cpu_t tcc;
+
+	for (;;) {
+		group = thread_call_get_group(call);
+		thread_call_lock_spin(group);
+		tcc = thread_call_lock_call(call);
+		if (group == thread_call_get_group(call)) {
+			*groupp = group;
+			return (tcc);
+		}
+		thread_call_cpu_unlock(tcc);
+		thread_call_unlock(group);
+	}
+}
+
+/*
+ * Given a call whose processor is locked, also lock its group if the
+ * call is on the group's delayed queue, so that it can be taken off.
+ * Returns the (possibly relocked) processor.
+ *
+ * Called at splsched.
+ */
+static thread_call_cpu_t
+thread_call_lock_delayed(
+		thread_call_t		call,
+		thread_call_cpu_t	tcc,
+		thread_call_group_t	*groupp,
+		boolean_t		*group_locked)
+{
+	*groupp = thread_call_get_group(call);
+	*group_locked = FALSE;
+
+	if (call->tc_call.queue == &(*groupp)->delayed_queue) {
+		thread_call_cpu_unlock(tcc);
+		tcc = thread_call_lock_call_and_group(call, groupp);
+		*group_locked = TRUE;
+	}
+
+	return (tcc);
+}
+
+/*
+ * Whether a call may be bound to another processor: it must be off
+ * the queues, and not running unless its storage is not ours (such
+ * calls are not touched once they start).
+ */
+static inline boolean_t
+thread_call_can_rebind(
+		thread_call_t		call)
+{
+	return (call->tc_call.queue == NULL &&
+	    ((call->tc_flags & THREAD_CALL_ALLOC) == 0 ||
+	     call->tc_submit_count == call->tc_finish_count));
+}
+
+/*
+ * Lock the processor a call is bound to, after binding the call to
+ * the current processor if it can be.
+ *
+ * Called at splsched.
+ */
+static thread_call_cpu_t
+thread_call_lock_call_local(
+		thread_call_t		call)
+{
+	thread_call_cpu_t local = &thread_call_cpus[cpu_number()];
+	thread_call_cpu_t tcc;
+
+	for (;;) {
+		tcc = thread_call_lock_call(call);
+		if (tcc == local || !thread_call_can_rebind(call))
+			return (tcc);
+
+		/* Both locks, in processor order, to move the binding */
+		if (tcc < local) {
+			thread_call_cpu_lock_spin(local);
+		} else {
+			thread_call_cpu_unlock(tcc);
+			thread_call_cpu_lock_spin(local);
+			thread_call_cpu_lock_spin(tcc);
+
+			if (tcc != &thread_call_cpus[call->tc_cpu]) {
+				thread_call_cpu_unlock(tcc);
+				thread_call_cpu_unlock(local);
+				continue;
+			}
+			if (!thread_call_can_rebind(call)) {
+				thread_call_cpu_unlock(local);
+				return (tcc);
+			}
+		}
+
+		call->tc_cpu = (uint32_t)(local - thread_call_cpus);
+		thread_call_cpu_unlock(tcc);
+
+		return (local);
+	}
+}
+
 static void
 thread_call_group_setup(
 		thread_call_group_t 		group, 
@@ -266,7 +469,8 @@ thread_call_group_setup(
 		boolean_t			parallel,
 		boolean_t			continuous)
 {
-	queue_init(&group->pending_queue);
+	lck_mtx_init(&group->lock, &thread_call_queues_lck_grp, &thread_call_lck_attr);
+
 	queue_init(&group->delayed_queue);
 
 	timer_call_setup(&group->delayed_timer, thread_call_delayed_timer, group);
@@ -327,6 +531,7 @@ void
 thread_call_initialize(void)
 {
 	thread_call_t			call;
+	thread_call_cpu_t		tcc;
 	kern_return_t			result;
 	thread_t			thread;
 	int				i;
@@ -348,6 +553,18 @@ thread_call_initialize(void)
 	nanotime_to_absolutetime(0, THREAD_CALL_DEALLOC_INTERVAL_NS, &thread_call_dealloc_interval_abs);
 	waitq_init(&daemon_waitq, SYNC_POLICY_DISABLE_IRQ | SYNC_POLICY_FIFO);
 
+	/* IOKit hasn't published the CPU count yet; ml_get_max_cpus() would block */
+	thread_call_ncpus = MAX_CPUS;
+	thread_call_cpus = (thread_call_cpu_t)kalloc(thread_call_ncpus * sizeof(struct thread_call_cpu));
+	if (thread_call_cpus == NULL)
+		panic("thread_call_initialize");
+
+	for (tcc = thread_call_cpus; tcc < &thread_call_cpus[thread_call_ncpus]; tcc++) {
+		lck_mtx_init(&tcc->lock, &thread_call_queues_lck_grp, &thread_call_lck_attr);
+		for (i = 0; i < THREAD_CALL_GROUP_COUNT; i++)
+			queue_init(&tcc->pending_queue[i]);
+	}
+
 	thread_call_group_setup(&abstime_thread_call_groups[THREAD_CALL_PRIORITY_LOW],      THREAD_CALL_PRIORITY_LOW,                       0, TRUE,  FALSE);
 	thread_call_group_setup(&abstime_thread_call_groups[THREAD_CALL_PRIORITY_USER],     THREAD_CALL_PRIORITY_USER,                      0, TRUE,  FALSE);
 	thread_call_group_setup(&abstime_thread_call_groups[THREAD_CALL_PRIORITY_KERNEL],   THREAD_CALL_PRIORITY_KERNEL,                    1, TRUE,  FALSE);
@@ -357,7 +574,8 @@ thread_call_initialize(void)
 	thread_call_group_setup(&conttime_thread_call_groups[THREAD_CALL_PRIORITY_KERNEL],  THREAD_CALL_PRIORITY_KERNEL,                    0, TRUE,  TRUE);
 	thread_call_group_setup(&conttime_thread_call_groups[THREAD_CALL_PRIORITY_HIGH],    THREAD_CALL_PRIORITY_HIGH,                      1, FALSE, TRUE);
 
-	s = disable_ints_and_lock();
+	s = splsched();
+	thread_call_global_lock_spin();
 
 	queue_init(&thread_call_internal_queue);
 	for (
@@ -371,7 +589,8 @@ thread_call_initialize(void)
 
 	thread_call_daemon_awake = TRUE;
 
-	enable_ints_and_unlock(s);
+	thread_call_global_unlock();
+	splx(s);
 
 	result = kernel_thread_start_priority((thread_continue_t)thread_call_daemon, NULL, BASEPRI_PREEMPT + 1, &thread);
 	if (result != KERN_SUCCESS)
@@ -396,22 +615,25 @@ thread_call_setup(
  *
  *	Allocate an internal callout entry.
  *
- *	Called with thread_call_lock held.
+ *	Called with the high priority group's lock held.
  */
 static __inline__ thread_call_t
 _internal_call_allocate(thread_call_func_t func, thread_call_param_t param0)
 {
     thread_call_t		call;
     
+    thread_call_global_lock_spin();
     if (queue_empty(&thread_call_internal_queue))
     	panic("_internal_call_allocate");
 	
     call = TC(dequeue_head(&thread_call_internal_queue));
     thread_call_internal_queue_count--;
+    thread_call_global_unlock();
 
     thread_call_setup(call, func, param0);
     call->tc_refs = 0;
     call->tc_flags = 0; /* THREAD_CALL_ALLOC not set, do not free back to zone */
+    call->tc_cpu = cpu_number();
 
     return (call);
 }
@@ -424,7 +646,7 @@ _internal_call_allocate(thread_call_func_t func, thread_call_param_t param0)
  *	safe to call on a non-internal entry, in which
  *	case nothing happens.
  *
- * 	Called with thread_call_lock held.
+ * 	Called with the call's processor locked.
  */
 static __inline__ void
 _internal_call_release(
@@ -433,41 +655,45 @@ _internal_call_release(
     if (    call >= internal_call_storage						&&
 	   	    call < &internal_call_storage[INTERNAL_CALL_COUNT]		) {
 		assert((call->tc_flags & THREAD_CALL_ALLOC) == 0);
+		thread_call_global_lock_spin();
 		enqueue_head(&thread_call_internal_queue, qe(call));
 		thread_call_internal_queue_count++;
+		thread_call_global_unlock();
 	}
 }
 
 /*
  *	_pending_call_enqueue:
  *
- *	Place an entry at the end of the
- *	pending queue, to be executed soon.
+ *	Place an entry at the end of the pending
+ *	queue of its processor, to be executed soon.
+ *	The caller then wakes a thread for it.
  *
  *	Returns TRUE if the entry was already
  *	on a queue.
  *
- *	Called with thread_call_lock held.
+ *	Called with the call's processor locked, and
+ *	the group lock held if the call may be delayed.
  */
 static __inline__ boolean_t
 _pending_call_enqueue(
     thread_call_t		call,
-	thread_call_group_t	group)
+	thread_call_group_t	group,
+	thread_call_cpu_t	tcc)
 {
 	queue_head_t		*old_queue;
+	queue_head_t		*pending_queue = thread_call_pending_queue(tcc, group);
 
-	old_queue = call_entry_enqueue_tail(CE(call), &group->pending_queue);
+	old_queue = call_entry_enqueue_tail(CE(call), pending_queue);
 
 	if (old_queue == NULL) {
 		call->tc_submit_count++;
-	} else if (old_queue != &group->pending_queue &&
+	} else if (old_queue != pending_queue &&
 			   old_queue != &group->delayed_queue){
 		panic("tried to move a thread call (%p) between groups (old_queue: %p)", call, old_queue);
 	}
 
-	group->pending_count++;
-
-	thread_call_wake(group);
+	(void)OSAddAtomic(1, &group->pending_count);
 
 	return (old_queue != NULL);
 }
@@ -482,20 +708,22 @@ _pending_call_enqueue(
  *	Returns TRUE if the entry was already
  *	on a queue.
  *
- *	Called with thread_call_lock held.
+ *	Called with the group lock held and
+ *	the call's processor locked.
  */
 static __inline__ boolean_t
 _delayed_call_enqueue(
     	thread_call_t		call,
 	thread_call_group_t	group,
+	thread_call_cpu_t	tcc,
 	uint64_t		deadline)
 {
 	queue_head_t		*old_queue;
 
 	old_queue = call_entry_enqueue_deadline(CE(call), &group->delayed_queue, deadline);
 
-	if (old_queue == &group->pending_queue) {
-		group->pending_count--;
+	if (old_queue == thread_call_pending_queue(tcc, group)) {
+		(void)OSAddAtomic(-1, &group->pending_count);
 	} else if (old_queue == NULL) {
 		call->tc_submit_count++;
 	} else if (old_queue == &group->delayed_queue) {
@@ -514,12 +742,14 @@ _delayed_call_enqueue(
  *
  *	Returns TRUE if the entry was on a queue.
  *
- *	Called with thread_call_lock held.
+ *	Called with the call's processor locked, and
+ *	the group lock held if the call may be delayed.
  */
 static __inline__ boolean_t
 _call_dequeue(
 	thread_call_t		call,
-	thread_call_group_t	group)
+	thread_call_group_t	group,
+	thread_call_cpu_t	tcc)
 {
 	queue_head_t		*old_queue;
 
@@ -527,8 +757,8 @@ _call_dequeue(
 
 	if (old_queue != NULL) {
 		call->tc_finish_count++;
-		if (old_queue == &group->pending_queue)
-			group->pending_count--;
+		if (old_queue == thread_call_pending_queue(tcc, group))
+			(void)OSAddAtomic(-1, &group->pending_count);
 	}
 
 	return (old_queue != NULL);
@@ -540,7 +770,8 @@ _call_dequeue(
  *	Reset the timer so that it
  *	next expires when the entry is due.
  *
- *	Called with thread_call_lock held.
+ *	Called with the group lock held, which
+ *	keeps the deadlines of delayed calls stable.
  */
 static __inline__ void
 _set_delayed_call_timer(
@@ -569,12 +800,13 @@ _set_delayed_call_timer(
  *	_remove_from_pending_queue:
  *
  *	Remove the first (or all) matching
- *	entries	from the pending queue.
+ *	entries	from the processors' pending
+ *	queues.
  *
  *	Returns	TRUE if any matching entries
  *	were found.
  *
- *	Called with thread_call_lock held.
+ *	Called with the group lock held.
  */
 static boolean_t
 _remove_from_pending_queue(
@@ -585,26 +817,39 @@ _remove_from_pending_queue(
 	boolean_t				call_removed = FALSE;
 	thread_call_t			call;
 	thread_call_group_t		group = &abstime_thread_call_groups[THREAD_CALL_PRIORITY_HIGH];
+	thread_call_cpu_t		tcc;
+	queue_head_t			*pending_queue;
 
-	call = TC(queue_first(&group->pending_queue));
+	for (tcc = thread_call_cpus; tcc < &thread_call_cpus[thread_call_ncpus]; tcc++) {
+		pending_queue = thread_call_pending_queue(tcc, group);
 
-	while (!queue_end(&group->pending_queue, qe(call))) {
-		if (call->tc_call.func == func &&
-				call->tc_call.param0 == param0) {
-			thread_call_t	next = TC(queue_next(qe(call)));
+		thread_call_cpu_lock_spin(tcc);
 
-			_call_dequeue(call, group);
+		call = TC(queue_first(pending_queue));
 
-			_internal_call_release(call);
+		while (!queue_end(pending_queue, qe(call))) {
+			if (call->tc_call.func == func &&
+					call->tc_call.param0 == param0) {
+				thread_call_t	next = TC(queue_next(qe(call)));
 
-			call_removed = TRUE;
-			if (!remove_all)
-				break;
+				_call_dequeue(call, group, tcc);
 
-			call = next;
+				_internal_call_release(call);
+
+				call_removed = TRUE;
+				if (!remove_all)
+					break;
+
+				call = next;
+			}
+			else	
+				call = TC(queue_next(qe(call)));
 		}
-		else	
-			call = TC(queue_next(qe(call)));
+
+		thread_call_cpu_unlock(tcc);
+
+		if (call_removed && !remove_all)
+			break;
 	}
 
 	return (call_removed);
@@ -619,7 +864,7 @@ _remove_from_pending_queue(
  *	Returns	TRUE if any matching entries
  *	were found.
  *
- *	Called with thread_call_lock held.
+ *	Called with the group lock held.
  */
 static boolean_t
 _remove_from_delayed_queue(
@@ -630,6 +875,7 @@ _remove_from_delayed_queue(
 	boolean_t			call_removed = FALSE;
 	thread_call_t			call;
 	thread_call_group_t		group = &abstime_thread_call_groups[THREAD_CALL_PRIORITY_HIGH];
+	thread_call_cpu_t		tcc;
 
 	call = TC(queue_first(&group->delayed_queue));
 
@@ -638,10 +884,14 @@ _remove_from_delayed_queue(
 				call->tc_call.param0 == param0) {
 			thread_call_t	next = TC(queue_next(qe(call)));
 
-			_call_dequeue(call, group);
+			tcc = thread_call_lock_call(call);
+
+			_call_dequeue(call, group, tcc);
 
 			_internal_call_release(call);
 
+			thread_call_cpu_unlock(tcc);
+
 			call_removed = TRUE;
 			if (!remove_all)
 				break;
@@ -707,12 +957,12 @@ thread_call_func_cancel(
 		boolean_t			cancel_all)
 {
 	boolean_t	result;
+	thread_call_group_t	group = &abstime_thread_call_groups[THREAD_CALL_PRIORITY_HIGH];
 	spl_t		s;
 
 	assert(func != NULL);
 
-	s = splsched();
-	thread_call_lock_spin();
+	s = disable_ints_and_lock(group);
 
 	if (cancel_all)
 		result = _remove_from_pending_queue(func, param, cancel_all) |
@@ -721,8 +971,7 @@ thread_call_func_cancel(
 		result = _remove_from_pending_queue(func, param, cancel_all) ||
 			_remove_from_delayed_queue(func, param, cancel_all);
 
-	thread_call_unlock();
-	splx(s);
+	enable_ints_and_unlock(group, s);
 
 	return (result);
 }
@@ -781,14 +1030,15 @@ boolean_t
 thread_call_free(
 		thread_call_t		call)
 {
+	thread_call_cpu_t	tcc;
 	spl_t	s;
 	int32_t refs;
 
 	s = splsched();
-	thread_call_lock_spin();
+	tcc = thread_call_lock_call(call);
 
 	if (call->tc_call.queue != NULL) {
-		thread_call_unlock();
+		thread_call_cpu_unlock(tcc);
 		splx(s);
 
 		return (FALSE);
@@ -799,7 +1049,7 @@ thread_call_free(
 		panic("Refcount negative: %d\n", refs);
 	}	
 
-	thread_call_unlock();
+	thread_call_cpu_unlock(tcc);
 	splx(s);
 
 	if (refs == 0) {
@@ -830,23 +1080,36 @@ thread_call_enter1(
 		thread_call_param_t		param1)
 {
 	boolean_t		result = TRUE;
+	boolean_t		queued = FALSE;
+	boolean_t		group_locked;
 	thread_call_group_t	group;
+	thread_call_cpu_t	tcc;
 	spl_t			s;
 
 	assert(call->tc_call.func != NULL);
 
-	group = thread_call_get_group(call);
-
 	s = splsched();
-	thread_call_lock_spin();
 
-	if (call->tc_call.queue != &group->pending_queue) {
-		result = _pending_call_enqueue(call, group);
+	tcc = thread_call_lock_call_local(call);
+	tcc = thread_call_lock_delayed(call, tcc, &group, &group_locked);
+
+	if (call->tc_call.queue != thread_call_pending_queue(tcc, group)) {
+		result = _pending_call_enqueue(call, group, tcc);
+		queued = TRUE;
 	}
 
 	call->tc_call.param1 = param1;
 
-	thread_call_unlock();
+	thread_call_cpu_unlock(tcc);
+
+	if (group_locked) {
+		if (queued)
+			thread_call_wake(group);
+		thread_call_unlock(group);
+	} else if (queued) {
+		thread_call_signal(group);
+	}
+
 	splx(s);
 
 	return (result);
@@ -919,7 +1182,9 @@ thread_call_enter_delayed_internal(
 		unsigned int 		flags)
 {
 	boolean_t		result = TRUE;
-	thread_call_group_t	group;
+	thread_call_group_t	group, old_group;
+	thread_call_cpu_t	tcc;
+	queue_head_t		*old_queue = NULL;
 	spl_t			s;
 	uint64_t		abstime, conttime, sdeadline, slop;
 	uint32_t		urgency;
@@ -929,11 +1194,60 @@ thread_call_enter_delayed_internal(
 	urgency = (flags & TIMEOUT_URGENCY_MASK);
 
 	s = splsched();
-	thread_call_lock_spin();
 
 	if (call == NULL) {
+		/* internal calls have the default (high) priority */
+		group = old_group = thread_call_group_for(THREAD_CALL_PRIORITY_HIGH, is_cont_time);
+		thread_call_lock_spin(group);
+
 		/* allocate a structure out of internal storage, as a convenience for BSD callers */
 		call = _internal_call_allocate(alt_func, alt_param0);
+		tcc = thread_call_lock_call(call);
+	} else {
+		/*
+		 * Entering a call with THREAD_CALL_CONTINUOUS moves it to
+		 * the continuous time group for good.  Lock the group it is
+		 * in, the group it goes to and its processor, and retry if
+		 * it was moved before the processor was locked.
+		 */
+		for (;;) {
+			old_group = thread_call_get_group(call);
+			group = thread_call_group_for(call->tc_pri, is_cont_time || IS_CONT_GROUP(old_group));
+
+			thread_call_lock_spin(old_group);
+			if (group != old_group)
+				thread_call_lock_spin(group);
+
+			tcc = thread_call_lock_call(call);
+			if (old_group == thread_call_get_group(call))
+				break;
+
+			thread_call_cpu_unlock(tcc);
+			if (group != old_group)
+				thread_call_unlock(group);
+			thread_call_unlock(old_group);
+		}
+	}
+
+	if (group != old_group) {
+		/*
+		 * Take the call off the absolute time group's queues.  Any
+		 * outstanding request is carried over to the delayed queue
+		 * below, which counts it again.
+		 */
+		old_queue = call_entry_dequeue(CE(call));
+
+		if (old_queue == thread_call_pending_queue(tcc, old_group)) {
+			(void)OSAddAtomic(-1, &old_group->pending_count);
+		} else if (old_queue == &old_group->delayed_queue) {
+			timer_call_cancel(&old_group->delayed_timer);
+			if (!queue_empty(&old_group->delayed_queue)) {
+				_set_delayed_call_timer(TC(queue_first(&old_group->delayed_queue)), old_group);
+			}
+		}
+
+		if (old_queue != NULL)
+			call->tc_submit_count--;
 	}
 
 	if (is_cont_time) {
@@ -941,7 +1255,7 @@ thread_call_enter_delayed_internal(
 	}
 
 	assert(call->tc_call.func != NULL);
-	group = thread_call_get_group(call);
+	assert(group == thread_call_get_group(call));
 	abstime =  mach_absolute_time();
 	conttime =  absolutetime_to_continuoustime(abstime);
 	
@@ -976,7 +1290,7 @@ thread_call_enter_delayed_internal(
 		call->ttd = (sdeadline > abstime) ? (sdeadline - abstime) : 0;
 	}
 
-	result = _delayed_call_enqueue(call, group, deadline);
+	result = _delayed_call_enqueue(call, group, tcc, deadline) || (old_queue != NULL);
 
 	if (queue_first(&group->delayed_queue) == qe(call)) {
 		_set_delayed_call_timer(call, group);
@@ -986,7 +1300,10 @@ thread_call_enter_delayed_internal(
 	DTRACE_TMR5(thread_callout__create, thread_call_func_t, call->tc_call.func, uint64_t, (deadline - sdeadline), uint64_t, (call->ttd >> 32), (unsigned) (call->ttd & 0xFFFFFFFF), call);
 #endif
 
-	thread_call_unlock();
+	thread_call_cpu_unlock(tcc);
+	if (group != old_group)
+		thread_call_unlock(group);
+	thread_call_unlock(old_group);
 	splx(s);
 
 	return (result);
@@ -1005,21 +1322,23 @@ thread_call_cancel(
 		thread_call_t		call)
 {
 	boolean_t		result, do_cancel_callout = FALSE;
+	boolean_t		group_locked;
 	thread_call_group_t	group;
+	thread_call_cpu_t	tcc;
 	spl_t			s;
 
-	group = thread_call_get_group(call);
-
 	s = splsched();
-	thread_call_lock_spin();
 
-	if ((call->tc_call.deadline != 0) &&
+	tcc = thread_call_lock_call(call);
+	tcc = thread_call_lock_delayed(call, tcc, &group, &group_locked);
+
+	if (group_locked && (call->tc_call.deadline != 0) &&
 	    (queue_first(&group->delayed_queue) == qe(call))) {
 		assert (call->tc_call.queue == &group->delayed_queue);
 		do_cancel_callout = TRUE;
 	}
 
-	result = _call_dequeue(call, group);
+	result = _call_dequeue(call, group, tcc);
 
 	if (do_cancel_callout) {
 		timer_call_cancel(&group->delayed_timer);
@@ -1028,7 +1347,9 @@ thread_call_cancel(
 		}
 	}
 
-	thread_call_unlock();
+	thread_call_cpu_unlock(tcc);
+	if (group_locked)
+		thread_call_unlock(group);
 	splx(s);
 #if CONFIG_DTRACE
 	DTRACE_TMR4(thread_callout__cancel, thread_call_func_t, call->tc_call.func, 0, (call->ttd >> 32), (unsigned) (call->ttd & 0xFFFFFFFF));
@@ -1050,23 +1371,29 @@ thread_call_cancel_wait(
 		thread_call_t		call)
 {
 	boolean_t		result;
+	boolean_t		group_locked;
 	thread_call_group_t	group;
+	thread_call_cpu_t	tcc;
 
 	if ((call->tc_flags & THREAD_CALL_ALLOC) == 0) {
 		panic("%s: Can't wait on thread call whose storage I don't own.", __FUNCTION__);
 	}
 
-	group = thread_call_get_group(call);
-
 	(void) splsched();
-	thread_call_lock_spin();
 
-	result = _call_dequeue(call, group);
+	tcc = thread_call_lock_call(call);
+	tcc = thread_call_lock_delayed(call, tcc, &group, &group_locked);
+
+	result = _call_dequeue(call, group, tcc);
+
+	if (group_locked)
+		thread_call_unlock(group);
+
 	if (result == FALSE) {
-		thread_call_wait_locked(call);
+		tcc = thread_call_wait_locked(call, tcc);
 	}
 
-	thread_call_unlock();
+	thread_call_cpu_unlock(tcc);
 	(void) spllo();
 
 	return result;
@@ -1081,7 +1408,7 @@ thread_call_cancel_wait(
  *	the daemon thread in order to
  *	create additional call threads.
  *
- *	Called with thread_call_lock held.
+ *	Called with the group lock held.
  *
  *	For high-priority group, only does wakeup/creation if there are no threads
  *	running.
@@ -1103,16 +1430,65 @@ thread_call_wake(
 				timer_call_cancel(&group->dealloc_timer);
 				group->flags &= ~TCG_DEALLOC_ACTIVE;
 			}
-		} else {
-			if (!thread_call_daemon_awake && thread_call_group_should_add_thread(group)) {
+		} else if (thread_call_group_should_add_thread(group)) {
+			thread_call_global_lock_spin();
+			if (!thread_call_daemon_awake) {
 				thread_call_daemon_awake = TRUE;
 				waitq_wakeup64_one(&daemon_waitq, NO_EVENT64,
 						   THREAD_AWAKENED, WAITQ_ALL_PRIORITIES);
 			}
+			thread_call_global_unlock();
 		}
 	}
 }
 
+/*
+ *	thread_call_signal:
+ *
+ *	Wake a call thread for calls just put on
+ *	a pending queue, taking the group lock
+ *	only when a thread is idle or another one
+ *	is wanted.  A thread that runs out of
+ *	calls re-checks the group's pending count
+ *	after saying so, which pairs with the
+ *	barrier here.
+ *
+ *	Called at splsched, without the group lock.
+ */
+static void
+thread_call_signal(
+	thread_call_group_t		group)
+{
+	OSMemoryBarrier();
+
+	if ((group_isparallel(group) || group->active_count == 0) &&
+	    (group->idle_count > 0 || thread_call_group_should_add_thread(group))) {
+		thread_call_lock_spin(group);
+		thread_call_wake(group);
+		thread_call_unlock(group);
+	}
+}
+
+/*
+ *	thread_call_wake_pending:
+ *
+ *	Called by a thread that ran out of calls,
+ *	once it is counted as idle or gone, to wake
+ *	a thread for calls entered since then that
+ *	thread_call_signal() did not.
+ *
+ *	Called with the group lock held.
+ */
+static void
+thread_call_wake_pending(
+	thread_call_group_t		group)
+{
+	OSMemoryBarrier();
+
+	if (group->pending_count > 0)
+		thread_call_wake(group);
+}
+
 /*
  *	sched_call_thread:
  *
@@ -1128,7 +1504,7 @@ sched_call_thread(
 
 	group = &thread_call_groups[THREAD_CALL_PRIORITY_HIGH]; /* XXX */
 
-	thread_call_lock_spin();
+	thread_call_lock_spin(group);
 
 	switch (type) {
 
@@ -1143,11 +1519,11 @@ sched_call_thread(
 			break;
 	}
 
-	thread_call_unlock();
+	thread_call_unlock(group);
 }
 
 /* 
- * Interrupts disabled, lock held; returns the same way. 
+ * Interrupts disabled, no locks held; returns the same way. 
  * Only called on thread calls whose storage we own.  Wakes up
  * anyone who might be waiting on this work item and frees it
  * if the client has so requested.
@@ -1155,39 +1531,88 @@ sched_call_thread(
 static void
 thread_call_finish(thread_call_t call, spl_t *s)
 {
+	thread_call_cpu_t tcc;
 	boolean_t dowake = FALSE;
+	int32_t refs;
+
+	tcc = thread_call_lock_call(call);
 
 	call->tc_finish_count++;
-	call->tc_refs--;
+	refs = --call->tc_refs;
 
 	if ((call->tc_flags & THREAD_CALL_WAIT) != 0) {
 		dowake = TRUE;
 		call->tc_flags &= ~THREAD_CALL_WAIT;
+	}
 
-		/* 
-		 * Dropping lock here because the sched call for the 
-		 * high-pri group can take the big lock from under
-		 * a thread lock.
-		 */
-		thread_call_unlock();
+	/* 
+	 * Wake after dropping the lock, because the sched call
+	 * for the high-pri group takes the group lock from under
+	 * a thread lock.
+	 */
+	thread_call_cpu_unlock(tcc);
+
+	if (dowake) {
 		thread_wakeup((event_t)call);
-		thread_call_lock_spin();
 	}
 
-	if (call->tc_refs == 0) {
+	if (refs == 0) {
 		if (dowake) {
 			panic("Someone waiting on a thread call that is scheduled for free: %p\n", call->tc_call.func);
 		}
 
-		enable_ints_and_unlock(*s);
+		splx(*s);
 
 		zfree(thread_call_zone, call);
 
-		*s = disable_ints_and_lock();
+		*s = splsched();
 	}
 
 }
 
+/*
+ *	thread_call_dequeue:
+ *
+ *	Take the first pending call of a group,
+ *	from the current processor's queue if it
+ *	has one, otherwise stolen from the queue
+ *	of another processor, which is returned
+ *	locked.
+ *
+ *	Called at splsched.
+ */
+static thread_call_t
+thread_call_dequeue(
+		thread_call_group_t		group,
+		thread_call_cpu_t		*tccp)
+{
+	uint32_t		cpu = cpu_number();
+	uint32_t		i;
+	thread_call_cpu_t	tcc;
+	queue_head_t		*pending_queue;
+
+	for (i = 0; i < thread_call_ncpus && group->pending_count > 0; i++) {
+		tcc = &thread_call_cpus[(cpu + i) % thread_call_ncpus];
+		pending_queue = thread_call_pending_queue(tcc, group);
+
+		if (queue_empty(pending_queue))
+			continue;
+
+		thread_call_cpu_lock_spin(tcc);
+
+		if (!queue_empty(pending_queue)) {
+			(void)OSAddAtomic(-1, &group->pending_count);
+			*tccp = tcc;
+
+			return (TC(dequeue_head(pending_queue)));
+		}
+
+		thread_call_cpu_unlock(tcc);
+	}
+
+	return (NULL);
+}
+
 /*
  *	thread_call_thread:
  */
@@ -1198,6 +1623,8 @@ thread_call_thread(
 {
 	thread_t	self = current_thread();
 	boolean_t	canwait;
+	thread_call_t	call;
+	thread_call_cpu_t tcc;
 	spl_t		s;
 
 	if ((thread_get_tag_internal(self) & THREAD_TAG_CALLOUT) == 0)
@@ -1214,27 +1641,20 @@ thread_call_thread(
 		panic("thread_terminate() returned?");
 	}
 
-	s = disable_ints_and_lock();
+	s = splsched();
 
 	thread_sched_call(self, group->sched_call);
 
-	while (group->pending_count > 0) {
-		thread_call_t			call;
+	while ((call = thread_call_dequeue(group, &tcc)) != NULL) {
 		thread_call_func_t		func;
 		thread_call_param_t		param0, param1;
 
-		call = TC(dequeue_head(&group->pending_queue));
-		assert(call != NULL);
-		group->pending_count--;
-
 		func = call->tc_call.func;
 		param0 = call->tc_call.param0;
 		param1 = call->tc_call.param1;
 
 		call->tc_call.queue = NULL;
 
-		_internal_call_release(call);
-
 		/*
 		 * Can only do wakeups for thread calls whose storage
 		 * we control.
@@ -1245,7 +1665,10 @@ thread_call_thread(
 		} else
 			canwait = FALSE;
 
-		enable_ints_and_unlock(s);
+		_internal_call_release(call);
+
+		thread_call_cpu_unlock(tcc);
+		splx(s);
 
 #if DEVELOPMENT || DEBUG
 		KERNEL_DEBUG_CONSTANT(
@@ -1269,7 +1692,7 @@ thread_call_thread(
 					pl, (void *)VM_KERNEL_UNSLIDE(func), param0, param1);
 		}
 
-		s = disable_ints_and_lock();
+		s = splsched();
 		
 		if (canwait) {
 			/* Frees if so desired */
@@ -1277,6 +1700,8 @@ thread_call_thread(
 		}
 	}
 
+	thread_call_lock_spin(group);
+
 	thread_sched_call(self, NULL);
 	group->active_count--;
 	
@@ -1316,7 +1741,9 @@ thread_call_thread(
 			panic("kcall worker unable to assert wait?");
 		}   
 
-		enable_ints_and_unlock(s);
+		thread_call_wake_pending(group);
+
+		enable_ints_and_unlock(group, s);
 
 		thread_block_parameter((thread_continue_t)thread_call_thread, group);
 	} else {
@@ -1325,14 +1752,18 @@ thread_call_thread(
 
 			waitq_assert_wait64(&group->idle_waitq, NO_EVENT64, THREAD_UNINT, 0); /* Interrupted means to exit */
 
-			enable_ints_and_unlock(s);
+			thread_call_wake_pending(group);
+
+			enable_ints_and_unlock(group, s);
 
 			thread_block_parameter((thread_continue_t)thread_call_thread, group);
 			/* NOTREACHED */
 		}
 	}
 
-	enable_ints_and_unlock(s);
+	thread_call_wake_pending(group);
+
+	enable_ints_and_unlock(group, s);
 
 	thread_terminate(self);
 	/* NOTREACHED */
@@ -1342,6 +1773,10 @@ thread_call_thread(
  *	thread_call_daemon: walk list of groups, allocating
  *	threads if appropriate (as determined by 
  *	thread_call_group_should_add_thread()).  
+ *
+ *	Groups are examined under their own locks, so a group may
+ *	ask for a thread after the daemon has passed it: the walk
+ *	is repeated until no group has asked since it started.
  */
 static void
 thread_call_daemon_continue(__unused void *arg)
@@ -1351,15 +1786,20 @@ thread_call_daemon_continue(__unused void *arg)
 	thread_call_group_t group;
 	spl_t	s;
 
-	s = disable_ints_and_lock();
+again:
+	s = splsched();
+	thread_call_global_lock_spin();
+	thread_call_daemon_awake = FALSE;
+	thread_call_global_unlock();
 
 	/* Starting at zero happens to be high-priority first. */
 	for (i = 0; i < THREAD_CALL_GROUP_COUNT; i++) {
 		group = &thread_call_groups[i];
+		thread_call_lock_spin(group);
 		while (thread_call_group_should_add_thread(group)) {
 			group->active_count++;
 
-			enable_ints_and_unlock(s);
+			enable_ints_and_unlock(group, s);
 
 			kr = thread_call_thread_create(group);
 			if (kr != KERN_SUCCESS) {
@@ -1368,19 +1808,29 @@ thread_call_daemon_continue(__unused void *arg)
 				 * We can try again later.
 				 */
 				delay(10000); /* 10 ms */
-				s = disable_ints_and_lock();
+				s = splsched();
+				thread_call_global_lock_spin();
+				thread_call_daemon_awake = FALSE;
 				goto out;
 			}
 
-			s = disable_ints_and_lock();
+			s = disable_ints_and_lock(group);
 		}
+		thread_call_unlock(group);
+	}
+
+	thread_call_global_lock_spin();
+	if (thread_call_daemon_awake) {
+		thread_call_global_unlock();
+		splx(s);
+		goto again;
 	}
 
 out:
-	thread_call_daemon_awake = FALSE;
 	waitq_assert_wait64(&daemon_waitq, NO_EVENT64, THREAD_UNINT, 0);
 
-	enable_ints_and_unlock(s);
+	thread_call_global_unlock();
+	splx(s);
 
 	thread_block_parameter((thread_continue_t)thread_call_daemon_continue, NULL);
 	/* NOTREACHED */
@@ -1430,9 +1880,10 @@ thread_call_delayed_timer(
 {
 	thread_call_t			call;
 	thread_call_group_t		group = p0;
+	thread_call_cpu_t		tcc;
 	uint64_t			timestamp;
 
-	thread_call_lock_spin();
+	thread_call_lock_spin(group);
 
 	const boolean_t is_cont_time = IS_CONT_GROUP(group) ? TRUE : FALSE;
 
@@ -1454,7 +1905,10 @@ thread_call_delayed_timer(
 			    (ml_timer_forced_evaluation() == FALSE)) {
 				break;
 			}
-			_pending_call_enqueue(call, group);
+			tcc = thread_call_lock_call(call);
+			_pending_call_enqueue(call, group, tcc);
+			thread_call_cpu_unlock(tcc);
+			thread_call_wake(group);
 		} /* TODO, identify differentially coalesced timers */
 		else
 			break;
@@ -1466,18 +1920,19 @@ thread_call_delayed_timer(
 		_set_delayed_call_timer(call, group);
 	}
 
-	thread_call_unlock();
+	thread_call_unlock(group);
 }
 
 static void
 thread_call_delayed_timer_rescan(thread_call_group_t group)
 {
 	thread_call_t			call;
+	thread_call_cpu_t		tcc;
 	uint64_t				timestamp;
 	boolean_t		istate;
 
 	istate = ml_set_interrupts_enabled(FALSE);
-	thread_call_lock_spin();
+	thread_call_lock_spin(group);
 
 	assert(ml_timer_forced_evaluation() == TRUE);
 
@@ -1491,7 +1946,10 @@ thread_call_delayed_timer_rescan(thread_call_group_t group)
 
 	while (!queue_end(&group->delayed_queue, qe(call))) {
 		if (call->tc_soft_deadline <= timestamp) {
-			_pending_call_enqueue(call, group);
+			tcc = thread_call_lock_call(call);
+			_pending_call_enqueue(call, group, tcc);
+			thread_call_cpu_unlock(tcc);
+			thread_call_wake(group);
 			call = TC(queue_first(&group->delayed_queue));
 		}
 		else {
@@ -1502,8 +1960,10 @@ thread_call_delayed_timer_rescan(thread_call_group_t group)
 			 * layer determines which timers require this.
 			 */
 			if (timer_resort_threshold(skew)) {
-				_call_dequeue(call, group);
-				_delayed_call_enqueue(call, group, call->tc_soft_deadline);
+				tcc = thread_call_lock_call(call);
+				_call_dequeue(call, group, tcc);
+				_delayed_call_enqueue(call, group, tcc, call->tc_soft_deadline);
+				thread_call_cpu_unlock(tcc);
 			}
 			call = TC(queue_next(qe(call)));
 		}
@@ -1511,7 +1971,7 @@ thread_call_delayed_timer_rescan(thread_call_group_t group)
 
 	if (!queue_empty(&group->delayed_queue))
  		_set_delayed_call_timer(TC(queue_first(&group->delayed_queue)), group);
-	thread_call_unlock();
+	thread_call_unlock(group);
 	ml_set_interrupts_enabled(istate);
 }
 
@@ -1538,7 +1998,7 @@ thread_call_dealloc_timer(
 	kern_return_t res;
 	boolean_t terminated = FALSE;
 	
-	thread_call_lock_spin();
+	thread_call_lock_spin(group);
 
 	now = mach_absolute_time();
 	if (group->idle_count > 0) {
@@ -1572,17 +2032,18 @@ thread_call_dealloc_timer(
 		group->flags &= ~TCG_DEALLOC_ACTIVE;
 	}
 
-	thread_call_unlock();
+	thread_call_unlock(group);
 }
 
 /*
  * Wait for all requested invocations of a thread call prior to now
  * to finish.  Can only be invoked on thread calls whose storage we manage.  
  * Just waits for the finish count to catch up to the submit count we find
- * at the beginning of our wait.
+ * at the beginning of our wait.  Called and returns with the call's
+ * processor locked, which may be another one on return.
  */
-static void
-thread_call_wait_locked(thread_call_t call)
+static thread_call_cpu_t
+thread_call_wait_locked(thread_call_t call, thread_call_cpu_t tcc)
 {
 	uint64_t submit_count;
 	wait_result_t res;
@@ -1599,7 +2060,7 @@ thread_call_wait_locked(thread_call_t call)
 			panic("Unable to assert wait?");
 		}
 
-		thread_call_unlock();
+		thread_call_cpu_unlock(tcc);
 		(void) spllo();
 
 		res = thread_block(NULL);
@@ -1608,8 +2069,10 @@ thread_call_wait_locked(thread_call_t call)
 		}
 	
 		(void) splsched();
-		thread_call_lock_spin();
+		tcc = thread_call_lock_call(call);
 	}
+
+	return (tcc);
 }
 
 /*
@@ -1619,12 +2082,15 @@ thread_call_wait_locked(thread_call_t call)
 boolean_t
 thread_call_isactive(thread_call_t call) 
 {
+	thread_call_cpu_t tcc;
 	boolean_t active;
 	spl_t	s;
 
-	s = disable_ints_and_lock();
+	s = splsched();
+	tcc = thread_call_lock_call(call);
 	active = (call->tc_submit_count > call->tc_finish_count);
-	enable_ints_and_unlock(s);
+	thread_call_cpu_unlock(tcc);
+	splx(s);
 
 	return active;
 }
@@ -1640,17 +2106,16 @@ adjust_cont_time_thread_calls(void)
 
 	spl_t s;
 	int i;
-	s = disable_ints_and_lock();
 	
 	for (i = 0; i < THREAD_CALL_CONTTIME_COUNT; i++) {	
 		// only the continuous thread call groups
 		group = &conttime_thread_call_groups[i];
 		assert(IS_CONT_GROUP(group));
 
+		s = disable_ints_and_lock(group);
 		if (!queue_empty(&group->delayed_queue)) {
 			_set_delayed_call_timer(TC(queue_first(&group->delayed_queue)), group);
 		}
+		enable_ints_and_unlock(group, s);
 	} 
-
-	enable_ints_and_unlock(s);
 }
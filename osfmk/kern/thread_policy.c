@@ -368,6 +368,11 @@ thread_policy_set_internal(
 			break;
 		}
 
+		if (!sched_rt_admit(thread, info->period, info->computation, info->constraint)) {
+			result = KERN_RESOURCE_SHORTAGE;
+			break;
+		}
+
 		spl_t s = splsched();
 		thread_lock(thread);
 
@@ -120,8 +120,41 @@ typedef struct {
 	uint64_t	latency_max;	/*   maximum threshold latency */
 } threshold_t;
 
+/*
+ * Longterm timers are not kept on a single list but hashed by soft deadline
+ * into a hierarchical timing wheel, so that enqueue and dequeue are O(1) and
+ * a threshold scan only visits the timers it escalates. Level 0 slots are one
+ * 'tick' wide; each slot at level n spans a whole rotation of level n-1, and
+ * its timers are redistributed (cascaded) to lower levels when the wheel
+ * reaches that range. Timers beyond the top level wait on an overflow list.
+ *
+ * The wheel lives under the longterm queue's lock, and every timer on it
+ * still has the longterm queue as its call_entry queue and in its count:
+ * only the list a timer is linked on changes.
+ *
+ * A tick is TIMER_WHEEL_TICK_NS rounded down to a power of 2 in absolute
+ * time, or less when the threshold's margin is smaller: timers are escalated
+ * a whole tick at a time, so a tick wider than the margin would let them
+ * escalate late.  Changing the threshold relinks the wheel at the new tick.
+ */
+#define TIMER_WHEEL_LEVELS	4
+#define TIMER_WHEEL_SLOT_BITS	6
+#define TIMER_WHEEL_SLOTS	(1 << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_SLOT_MASK	(TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_TICK_NS	(NSEC_PER_SEC / 8)
+
+typedef struct {
+	uint64_t	tick;		/* next level 0 tick to be scanned */
+	uint32_t	tick_shift;	/* log2 of a tick, in absolute time */
+	uint64_t	occupied[TIMER_WHEEL_LEVELS]; /* slots that may be in use */
+	queue_head_t	slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+	queue_head_t	overflow;	/* beyond the top level */
+	uint64_t	cascades;	/* num timers moved down a level */
+} timer_wheel_t;
+
 typedef struct {
-	mpqueue_head_t	queue;		/* longterm timer list */
+	mpqueue_head_t	queue;		/* longterm timer lock and count */
+	timer_wheel_t	wheel;		/* longterm timers, by soft deadline */
 	uint64_t	enqueues;	/* num timers queued */
 	uint64_t	dequeues;	/* num timers dequeued */
 	uint64_t	escalates;	/* num timers becoming shortterm */
@@ -358,16 +391,6 @@ timer_call_entry_enqueue_deadline(
 
 #endif
 
-static __inline__ void
-timer_call_entry_enqueue_tail(
-	timer_call_t			entry,
-	mpqueue_head_t			*queue)
-{
-	call_entry_enqueue_tail(TCE(entry), QUEUE(queue));
-	queue->count++;
-	return;
-}
-
 /*
  * Remove timer entry from its queue but don't change the queue pointer
  * and set the async_dequeue flag. This is locking case 2b.
@@ -1093,6 +1116,209 @@ timer_queue_trace(
 	splx(s);
 }
 
+/*
+ * Link 'call' on the wheel slot that covers its soft deadline, relative to
+ * the wheel's current tick. Deadlines already behind the wheel go in the
+ * current tick's slot.
+ */
+static void
+timer_wheel_link(timer_wheel_t *tw, timer_call_t call)
+{
+	uint64_t	t = call->soft_deadline >> tw->tick_shift;
+	queue_t		slot = &tw->overflow;
+	int		level;
+
+	if (t < tw->tick)
+		t = tw->tick;
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		uint32_t	shift = level * TIMER_WHEEL_SLOT_BITS;
+
+		if ((t - tw->tick) < (1ULL << (shift + TIMER_WHEEL_SLOT_BITS))) {
+			uint32_t	idx = (t >> shift) & TIMER_WHEEL_SLOT_MASK;
+
+			slot = &tw->slots[level][idx];
+			tw->occupied[level] |= (1ULL << idx);
+			break;
+		}
+	}
+	enqueue_tail(slot, qe(call));
+}
+
+/*
+ * Enqueue a timer on the longterm wheel.
+ * Call and longterm queue locked, timer not on any queue.
+ */
+static void
+timer_wheel_enqueue(timer_wheel_t *tw, timer_call_t call)
+{
+	assert(TCE(call)->queue == NULL);
+
+	timer_wheel_link(tw, call);
+	TCE(call)->queue = QUEUE(timer_longterm_queue);
+	timer_longterm_queue->count++;
+}
+
+/*
+ * Redistribute the timers of a slot relative to the current tick.
+ */
+static void
+timer_wheel_cascade(timer_wheel_t *tw, queue_t slot)
+{
+	queue_head_t	pending;
+	queue_entry_t	qe;
+
+	if (queue_empty(slot))
+		return;
+
+	movqueue(slot, &pending);
+	while (!queue_empty(&pending)) {
+		qe = dequeue_head(&pending);
+		timer_wheel_link(tw, TIMER_CALL(qe));
+		tw->cascades++;
+	}
+}
+
+/*
+ * Return the first tick at or after the wheel's current tick at which a
+ * slot that may hold timers is cascaded or escalated, or EndOfAllTime
+ * if the wheel is empty. This is a lower bound on the soonest tick of any
+ * timer on the wheel.
+ */
+static uint64_t
+timer_wheel_next_tick(timer_wheel_t *tw)
+{
+	uint64_t	next = EndOfAllTime;
+	uint64_t	tick = tw->tick;
+	int		level;
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		uint32_t	shift = level * TIMER_WHEEL_SLOT_BITS;
+		uint64_t	block, bits = tw->occupied[level];
+
+		/* the next range of this level that the wheel will reach */
+		block = tick >> shift;
+		if ((tick & ((1ULL << shift) - 1)) != 0)
+			block++;
+
+		while (bits != 0) {
+			uint32_t	idx = __builtin_ctzll(bits);
+			uint64_t	event;
+
+			bits &= ~(1ULL << idx);
+			if (queue_empty(&tw->slots[level][idx])) {
+				tw->occupied[level] &= ~(1ULL << idx);
+				continue;
+			}
+			event = (block + ((idx - block) & TIMER_WHEEL_SLOT_MASK)) << shift;
+			if (event < next)
+				next = event;
+		}
+	}
+
+	if (!queue_empty(&tw->overflow)) {
+		uint32_t	shift = TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOT_BITS;
+		uint64_t	event = (tick + (1ULL << shift) - 1) & ~((1ULL << shift) - 1);
+
+		if (event < next)
+			next = event;
+	}
+
+	return next;
+}
+
+/*
+ * Move the wheel to 'tick': cascade every higher level range that starts
+ * there and return the level 0 slot whose timers are now due.
+ */
+static queue_t
+timer_wheel_advance(timer_wheel_t *tw, uint64_t tick)
+{
+	int		level;
+
+	tw->tick = tick;
+	for (level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+		uint32_t	shift = level * TIMER_WHEEL_SLOT_BITS;
+
+		if ((tick & ((1ULL << shift) - 1)) != 0)
+			break;
+		timer_wheel_cascade(tw, &tw->slots[level][(tick >> shift) & TIMER_WHEEL_SLOT_MASK]);
+	}
+	if (level == TIMER_WHEEL_LEVELS &&
+	    (tick & ((1ULL << (level * TIMER_WHEEL_SLOT_BITS)) - 1)) == 0)
+		timer_wheel_cascade(tw, &tw->overflow);
+
+	return &tw->slots[0][tick & TIMER_WHEEL_SLOT_MASK];
+}
+
+/*
+ * log2 of the tick to use for a threshold margin, in absolute time.
+ */
+static uint32_t
+timer_wheel_tick_shift(uint64_t margin)
+{
+	uint64_t	tick_abs;
+
+	nanoseconds_to_absolutetime(TIMER_WHEEL_TICK_NS, &tick_abs);
+	if (margin != 0 && margin < tick_abs)
+		tick_abs = margin;
+
+	return 63 - __builtin_clzll(tick_abs | 1);
+}
+
+/*
+ * Change the wheel's tick, relinking every timer on it.
+ * Longterm queue locked.
+ */
+static void
+timer_wheel_set_tick_shift(timer_wheel_t *tw, uint32_t tick_shift)
+{
+	queue_head_t	pending;
+	int		level, idx;
+
+	if (tick_shift == tw->tick_shift)
+		return;
+
+	queue_init(&pending);
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		for (idx = 0; idx < TIMER_WHEEL_SLOTS; idx++) {
+			while (!queue_empty(&tw->slots[level][idx]))
+				enqueue_tail(&pending, dequeue_head(&tw->slots[level][idx]));
+		}
+		tw->occupied[level] = 0;
+	}
+	while (!queue_empty(&tw->overflow))
+		enqueue_tail(&pending, dequeue_head(&tw->overflow));
+
+	/* the same point in time, at the new resolution */
+	if (tick_shift < tw->tick_shift)
+		tw->tick <<= (tw->tick_shift - tick_shift);
+	else
+		tw->tick >>= (tick_shift - tw->tick_shift);
+	tw->tick_shift = tick_shift;
+
+	while (!queue_empty(&pending))
+		timer_wheel_link(tw, TIMER_CALL(dequeue_head(&pending)));
+}
+
+static void
+timer_wheel_init(timer_wheel_t *tw, uint64_t margin)
+{
+	int		level, idx;
+
+	/* absolute time starts near zero at boot, as does the wheel */
+	tw->tick_shift = timer_wheel_tick_shift(margin);
+	tw->tick = 0;
+	tw->cascades = 0;
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		for (idx = 0; idx < TIMER_WHEEL_SLOTS; idx++)
+			queue_init(&tw->slots[level][idx]);
+		tw->occupied[level] = 0;
+	}
+	queue_init(&tw->overflow);
+}
+
 void
 timer_longterm_dequeued_locked(timer_call_t call)
 {
@@ -1151,7 +1377,7 @@ timer_longterm_enqueue_unlocked(timer_call_t	call,
 	call->ttd = ttd;
 	call->soft_deadline = soft_deadline;
 	call->flags = callout_flags;
-	timer_call_entry_enqueue_tail(call, timer_longterm_queue);
+	timer_wheel_enqueue(&tlp->wheel, call);
 	
 	tlp->enqueues++;
 
@@ -1187,21 +1413,27 @@ timer_longterm_enqueue_unlocked(timer_call_t	call,
  * Move these to the local timer queue (of the boot processor on which the
  * calling thread is running).
  * Both the local (boot) queue and the longterm queue are locked.
- * The scan is similar to the timer migrate sequence but is performed by
- * successively examining each timer on the longterm queue:
- *  - if within the short-term threshold
- *    - enter on the local queue (unless being deleted), 
- *  - otherwise:
- *    - if sooner, deadline becomes the next threshold deadline.
+ * The scan is similar to the timer migrate sequence but only examines the
+ * wheel slots up to the threshold:
+ *  - the wheel is advanced to the tick containing the threshold, cascading
+ *    higher levels as their ranges come within it,
+ *  - every timer in a level 0 slot passed over is entered on the local queue
+ *    (unless being deleted),
+ *  - the next tick at which the wheel holds anything becomes the next
+ *    threshold deadline.
  */
 void
 timer_longterm_scan(timer_longterm_t	*tlp,
 		    uint64_t		now)
 {
+	timer_wheel_t	*tw = &tlp->wheel;
+	queue_t		slot;
 	queue_entry_t	qe;
 	timer_call_t	call;
 	uint64_t	threshold;
+	uint64_t	threshold_tick;
 	uint64_t	deadline;
+	uint64_t	tick;
 	mpqueue_head_t	*timer_master_queue;
 
 	assert(!ml_get_interrupts_enabled());
@@ -1211,38 +1443,45 @@ timer_longterm_scan(timer_longterm_t	*tlp,
 		threshold = now + tlp->threshold.interval;
 	else
 		threshold = TIMER_LONGTERM_NONE;
+	threshold_tick = threshold >> tw->tick_shift;
 
 	tlp->threshold.deadline = TIMER_LONGTERM_NONE;
 	tlp->threshold.call = NULL;
 
-	if (queue_empty(&timer_longterm_queue->head))
+	if (timer_longterm_queue->count == 0) {
+		/* nothing to preserve: restart the wheel at the present */
+		tw->tick = MAX(tw->tick, now >> tw->tick_shift);
 		return;
+	}
 
 	timer_master_queue = timer_queue_cpu(master_cpu);
 	timer_queue_lock_spin(timer_master_queue);
 
-	qe = queue_first(&timer_longterm_queue->head);
-	while (!queue_end(&timer_longterm_queue->head, qe)) {
-		call = TIMER_CALL(qe);
-		deadline = call->soft_deadline;
-		qe = queue_next(qe);
-		if (!simple_lock_try(&call->lock)) {
-			/* case (2c) lock order inversion, dequeue only */
+	while ((tick = timer_wheel_next_tick(tw)) <= threshold_tick) {
+		slot = timer_wheel_advance(tw, tick);
+
+		while (!queue_empty(slot)) {
+			qe = queue_first(slot);
+			call = TIMER_CALL(qe);
+			deadline = call->soft_deadline;
+			if (!simple_lock_try(&call->lock)) {
+				/* case (2c) lock order inversion, dequeue only */
 #ifdef TIMER_ASSERT
-			TIMER_KDEBUG_TRACE(KDEBUG_TRACE,
-				DECR_TIMER_ASYNC_DEQ | DBG_FUNC_NONE,
-				VM_KERNEL_UNSLIDE_OR_PERM(call),
-				VM_KERNEL_UNSLIDE_OR_PERM(TCE(call)->queue),
-				VM_KERNEL_UNSLIDE_OR_PERM(call->lock.interlock.lock_data),
-				0x2c, 0);
+				TIMER_KDEBUG_TRACE(KDEBUG_TRACE,
+					DECR_TIMER_ASYNC_DEQ | DBG_FUNC_NONE,
+					VM_KERNEL_UNSLIDE_OR_PERM(call),
+					VM_KERNEL_UNSLIDE_OR_PERM(TCE(call)->queue),
+					VM_KERNEL_UNSLIDE_OR_PERM(call->lock.interlock.lock_data),
+					0x2c, 0);
 #endif
-			timer_call_entry_dequeue_async(call);
-			continue;
-		}
-		if (deadline < threshold) {
+				timer_call_entry_dequeue_async(call);
+				continue;
+			}
 			/*
 			 * This timer needs moving (escalating)
 			 * to the local (boot) processor's queue.
+			 * Timers sharing the threshold's tick go
+			 * slightly early rather than waiting a scan.
 			 */
 #ifdef TIMER_ASSERT
 			if (deadline < now)
@@ -1270,13 +1509,17 @@ timer_longterm_scan(timer_longterm_t	*tlp,
 			 * the actual hardware deadline if required.
 			 */
 			(void) timer_queue_assign(deadline);
-		} else {
-			if (deadline < tlp->threshold.deadline) {
-				tlp->threshold.deadline = deadline;
-				tlp->threshold.call = call;
-			}
+			simple_unlock(&call->lock);
 		}
-		simple_unlock(&call->lock);
+		tw->tick = tick + 1;
+	}
+
+	if (tick != EndOfAllTime) {
+		/* ticks up to the threshold's are done with */
+		tw->tick = MAX(tw->tick, threshold_tick + 1);
+		tlp->threshold.deadline = tick << tw->tick_shift;
+	} else {
+		tw->tick = MAX(tw->tick, now >> tw->tick_shift);
 	}
 
 	timer_queue_unlock(timer_master_queue);
@@ -1413,6 +1656,7 @@ timer_longterm_init(void)
 		     "timer_longterm", &timer_longterm_lck_grp_attr);
 	mpqueue_init(&tlp->queue,
 		     &timer_longterm_lck_grp, &timer_longterm_lck_attr);
+	timer_wheel_init(&tlp->wheel, tlp->threshold.margin);
 
 	timer_call_setup(&tlp->threshold.timer,
 			 timer_longterm_callout, (timer_call_param_t) tlp);
@@ -1423,7 +1667,7 @@ timer_longterm_init(void)
 enum {
 	THRESHOLD, QCOUNT,
 	ENQUEUES, DEQUEUES, ESCALATES, SCANS, PREEMPTS,
-	LATENCY, LATENCY_MIN, LATENCY_MAX
+	LATENCY, LATENCY_MIN, LATENCY_MAX, CASCADES
 };
 uint64_t
 timer_sysctl_get(int oid)
@@ -1452,6 +1696,8 @@ timer_sysctl_get(int oid)
 		return tlp->threshold.latency_min;
 	case LATENCY_MAX:
 		return tlp->threshold.latency_max;
+	case CASCADES:
+		return tlp->wheel.cascades;
 	default:
 		return 0;
 	}
@@ -1494,7 +1740,7 @@ timer_master_scan(timer_longterm_t	*tlp,
 		if (deadline > threshold) {
 			/* move from master to longterm */
 			timer_call_entry_dequeue(call);
-			timer_call_entry_enqueue_tail(call, timer_longterm_queue);
+			timer_wheel_enqueue(&tlp->wheel, call);
 			if (deadline < tlp->threshold.deadline) {
 				tlp->threshold.deadline = deadline;
 				tlp->threshold.call = call;
@@ -1529,6 +1775,7 @@ timer_sysctl_set_threshold(uint64_t value)
 		nanoseconds_to_absolutetime(tlp->threshold.interval,
 					    &tlp->threshold.interval);
 		tlp->threshold.margin = tlp->threshold.interval / 10;
+		timer_wheel_set_tick_shift(&tlp->wheel, timer_wheel_tick_shift(tlp->threshold.margin));
 		if  (old_interval == TIMER_LONGTERM_NONE)
 			threshold_increase = FALSE;
 		else
@@ -58,6 +58,7 @@
 #include <kern/kern_types.h>
 #include <kern/ltable.h>
 #include <kern/mach_param.h>
+#include <kern/misc_protos.h>
 #include <kern/queue.h>
 #include <kern/sched_prim.h>
 #include <kern/simple_lock.h>
@@ -66,6 +67,11 @@
 #include <kern/zalloc.h>
 #include <kern/policy_internal.h>
 
+#if defined(__x86_64__)
+#include <i386/cpuid.h>
+#include <i386/mp.h>
+#endif
+
 #include <libkern/OSAtomic.h>
 #include <mach/sync_policy.h>
 #include <vm/vm_kern.h>
@@ -1560,8 +1566,23 @@ void waitq_prepost_stats(struct wq_table_stats *stats)
  *
  * ---------------------------------------------------------------------- */
 
-static struct waitq g_boot_waitq;
-static struct waitq *global_waitqs = &g_boot_waitq;
+/*
+ * Each global wait queue gets a cache line to itself, so wakeups on
+ * neighbouring buckets don't bounce a shared line.  The rest of the line
+ * holds collision counters, updated under the bucket's lock.
+ */
+struct waitq_global_bucket {
+	struct waitq	wqb_waitq;
+	uint64_t	wqb_scans;	/* wakeups that scanned this bucket */
+	uint64_t	wqb_collisions;	/* waiters passed over because they wait on something else */
+} __attribute__((aligned(64)));
+
+static_assert(sizeof(struct waitq_global_bucket) == 64, "waitq_global_bucket should fill one cache line");
+
+#define WAITQ_GLOBAL_BUCKET(wq) ((struct waitq_global_bucket *)(void *)(wq))
+
+static struct waitq_global_bucket g_boot_waitq;
+static struct waitq_global_bucket *global_waitqs = &g_boot_waitq;
 static uint32_t g_num_waitqs = 1;
 
 /*
@@ -1580,13 +1601,41 @@ static __inline__ uint32_t waitq_hash(char *key, size_t length)
 /* return a global waitq pointer corresponding to the given event */
 struct waitq *_global_eventq(char *event, size_t event_length)
 {
-	return &global_waitqs[waitq_hash(event, event_length)];
+	return &global_waitqs[waitq_hash(event, event_length)].wqb_waitq;
 }
 
 /* return an indexed global waitq pointer */
 struct waitq *global_waitq(int index)
 {
-	return &global_waitqs[index % g_num_waitqs];
+	return &global_waitqs[index % g_num_waitqs].wqb_waitq;
+}
+
+void waitq_global_table_stats(struct wq_global_table_stats *stats)
+{
+	stats->buckets = g_num_waitqs;
+	stats->busy_buckets = 0;
+	stats->scans = 0;
+	stats->collisions = 0;
+
+	/* unlocked: the counters are only ever added to */
+	for (uint32_t i = 0; i < g_num_waitqs; i++) {
+		struct waitq_global_bucket *wqb = &global_waitqs[i];
+
+		if (!queue_empty(&wqb->wqb_waitq.waitq_queue))
+			stats->busy_buckets++;
+		stats->scans += wqb->wqb_scans;
+		stats->collisions += wqb->wqb_collisions;
+	}
+}
+
+void waitq_link_table_counters(struct ltable_counters *counters)
+{
+	ltable_get_counters(&g_wqlinktable, counters);
+}
+
+void waitq_prepost_table_counters(struct ltable_counters *counters)
+{
+	ltable_get_counters(&g_prepost_table, counters);
 }
 
 
@@ -1619,7 +1668,7 @@ static __inline__ struct wq_stats *waitq_global_stats(struct waitq *waitq) {
 	if (!waitq_is_global(waitq))
 		return NULL;
 
-	idx = (uint32_t)(((uintptr_t)waitq - (uintptr_t)global_waitqs) / sizeof(*waitq));
+	idx = (uint32_t)(((uintptr_t)waitq - (uintptr_t)global_waitqs) / sizeof(*global_waitqs));
 	assert(idx < g_num_waitqs);
 	wqs = &g_waitq_stats[idx];
 	return wqs;
@@ -1680,7 +1729,8 @@ int waitq_set_is_valid(struct waitq_set *wqset)
 
 int waitq_is_global(struct waitq *waitq)
 {
-	if (waitq >= global_waitqs && waitq < global_waitqs + g_num_waitqs)
+	if ((uintptr_t)waitq >= (uintptr_t)global_waitqs &&
+	    (uintptr_t)waitq < (uintptr_t)(global_waitqs + g_num_waitqs))
 		return 1;
 	return 0;
 }
@@ -1691,6 +1741,23 @@ int waitq_irq_safe(struct waitq *waitq)
 	return waitq->waitq_irq;
 }
 
+/*
+ * Global wait queue buckets per CPU.  Wakeup traffic grows with the number
+ * of CPUs, so the table does too, rather than only with thread_max.
+ */
+#define WAITQ_BUCKETS_PER_CPU	256
+#define WAITQ_MAX_BUCKETS	(1 << 16)
+
+/* CPUs we expect to run on; they haven't all been brought up yet */
+static uint32_t waitq_expected_cpus(void)
+{
+#if defined(__x86_64__)
+	return MAX(1, MIN(cpuid_info()->thread_count, max_ncpus));
+#else
+	return 1;
+#endif
+}
+
 static uint32_t waitq_hash_size(void)
 {
 	uint32_t hsize, queues;
@@ -1698,8 +1765,9 @@ static uint32_t waitq_hash_size(void)
 	if (PE_parse_boot_argn("wqsize", &hsize, sizeof(hsize)))
 		return (hsize);
 
-	queues = thread_max / 5;
-	hsize = P2ROUNDUP(queues * sizeof(struct waitq), PAGE_SIZE);
+	queues = MAX(thread_max / 5, waitq_expected_cpus() * WAITQ_BUCKETS_PER_CPU);
+	queues = MIN(queues, WAITQ_MAX_BUCKETS);
+	hsize = P2ROUNDUP(queues * sizeof(struct waitq_global_bucket), PAGE_SIZE);
 
 	return hsize;
 }
@@ -1721,20 +1789,18 @@ void waitq_bootstrap(void)
 	whsize = waitq_hash_size();
 
 	/* Determine the number of waitqueues we can fit. */
-	qsz = sizeof(struct waitq);
+	qsz = sizeof(struct waitq_global_bucket);
 	whsize = ROUNDDOWN(whsize, qsz);
 	g_num_waitqs = whsize / qsz;
 
 	/*
-	 * The hash algorithm requires that this be a power of 2, so we
-	 * just mask off all the low-order bits.
+	 * The hash algorithm requires that this be a power of 2, so round
+	 * up: fewer collisions are worth the extra page or two.
 	 */
-	for (uint32_t i = 0; i < 31; i++) {
-		uint32_t bit = (1 << i);
-		if ((g_num_waitqs & bit) == g_num_waitqs)
-			break;
-		g_num_waitqs &= ~bit;
-	}
+	if (g_num_waitqs == 0)
+		g_num_waitqs = 1;
+	else if (g_num_waitqs & (g_num_waitqs - 1))
+		g_num_waitqs = 1U << (32 - __builtin_clz(g_num_waitqs));
 	assert(g_num_waitqs > 0);
 
 	/* Now determine how much memory we really need. */
@@ -1758,7 +1824,9 @@ void waitq_bootstrap(void)
 #endif
 
 	for (uint32_t i = 0; i < g_num_waitqs; i++) {
-		waitq_init(&global_waitqs[i], SYNC_POLICY_FIFO|SYNC_POLICY_DISABLE_IRQ);
+		waitq_init(&global_waitqs[i].wqb_waitq, SYNC_POLICY_FIFO|SYNC_POLICY_DISABLE_IRQ);
+		global_waitqs[i].wqb_scans = 0;
+		global_waitqs[i].wqb_collisions = 0;
 	}
 
 	waitq_set_zone = zinit(sizeof(struct waitq_set),
@@ -1992,12 +2060,18 @@ static void do_waitq_select_n_locked(struct waitq_select_args *args)
 	if (!waitq_is_global(safeq) ||
 	    (safeq->waitq_eventmask & eventmask) == eventmask) {
 
+		if (waitq_is_global(safeq))
+			WAITQ_GLOBAL_BUCKET(safeq)->wqb_scans++;
+
 		/* look through each thread waiting directly on the safeq */
 		qe_foreach_element_safe(thread, &safeq->waitq_queue, wait_links) {
 			thread_t t = THREAD_NULL;
 			assert_thread_magic(thread);
 
-			if (thread->waitq == waitq && thread->wait_event == args->event) {
+			if (thread->waitq != waitq || thread->wait_event != args->event) {
+				if (waitq_is_global(safeq))
+					WAITQ_GLOBAL_BUCKET(safeq)->wqb_collisions++;
+			} else {
 				t = thread;
 				if (first_thread == THREAD_NULL)
 					first_thread = thread;
@@ -363,6 +363,20 @@ extern struct waitq *_global_eventq(char *event, size_t event_length);
 
 extern struct waitq *global_waitq(int index);
 
+struct wq_global_table_stats {
+	uint64_t buckets;
+	uint64_t busy_buckets;	/* buckets with at least one waiter */
+	uint64_t scans;		/* wakeups that had to scan a bucket */
+	uint64_t collisions;	/* waiters scanned past that wait on another event */
+};
+
+extern void waitq_global_table_stats(struct wq_global_table_stats *stats);
+
+/* allocation counters for the link and prepost tables (see kern/ltable.h) */
+struct ltable_counters;
+extern void waitq_link_table_counters(struct ltable_counters *counters);
+extern void waitq_prepost_table_counters(struct ltable_counters *counters);
+
 /*
  * set alloc/init/free
  */
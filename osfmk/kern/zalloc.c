@@ -76,6 +76,7 @@
 #include <kern/kern_types.h>
 #include <kern/assert.h>
 #include <kern/backtrace.h>
+#include <kern/clock.h>
 #include <kern/host.h>
 #include <kern/macro_help.h>
 #include <kern/sched.h>
@@ -84,6 +85,8 @@
 #include <kern/misc_protos.h>
 #include <kern/thread_call.h>
 #include <kern/zalloc.h>
+#include <kern/zcache.h>
+#include <kern/zsample.h>
 #include <kern/kalloc.h>
 
 #include <vm/pmap.h>
@@ -710,17 +713,28 @@ backup_ptr_mismatch_panic(zone_t        zone,
 	zone_element_was_modified_panic(zone, element, primary, likely_backup, 0);
 }
 
+/*
+ * Fully-free pages a zone may hold before the zone_reclaim thread starts
+ * handing them back to the VM.
+ */
+#define ZONE_RECLAIM_KEEP_DEFAULT	8
+uint32_t zone_reclaim_keep_pages = ZONE_RECLAIM_KEEP_DEFAULT;
+
 /*
  * Adds the element to the head of the zone's free list
  * Keeps a backup next-pointer at the end of the element
+ * Returns TRUE if this queued the zone for the zone_reclaim thread, which
+ * the caller must then wake with zone_reclaim_wakeup() once it has
+ * unlocked the zone.
  */
-static inline void
+static inline boolean_t
 free_to_zone(zone_t      zone,
              vm_offset_t element,
              boolean_t   poison)
 {
 	vm_offset_t old_head;
 	struct zone_page_metadata *page_meta;
+	boolean_t reclaim = FALSE;
 
 	vm_offset_t *primary  = (vm_offset_t *) element;
 	vm_offset_t *backup   = get_backup_ptr(zone->elem_size, primary);
@@ -767,12 +781,19 @@ free_to_zone(zone_t      zone,
 		/* whether the page was on the intermediate or all_used, queue, move it to free */
 		re_queue_tail(&zone->pages.all_free, &(page_meta->pages));
 		zone->count_all_free_pages += page_meta->page_count;
+		if (__improbable(zone->count_all_free_pages > (int)zone_reclaim_keep_pages &&
+		    zone->collectable && !zone->reclaim_pending)) {
+			zone->reclaim_pending = TRUE;
+			reclaim = TRUE;
+		}
 	} else if (page_meta->free_count == 1) {
 		/* first free element on page, move from all_used */
 		re_queue_tail(&zone->pages.intermediate, &(page_meta->pages));
 	}
 	zone->count--;
 	zone->countfree++;
+
+	return reclaim;
 }
 
 
@@ -879,6 +900,63 @@ try_alloc_from_zone(zone_t zone,
 	return element;
 }
 
+/*
+ * Elements held in a per-CPU cache store their own address in the primary
+ * and backup slots, xored with the cookies the same way the freelist does.
+ * That catches an element being freed to a cache twice, and lets an element
+ * leaving a cache be checked like one leaving the freelist.
+ */
+static inline boolean_t
+free_to_cpu_cache(zone_t      zone,
+                  vm_offset_t element,
+                  boolean_t   poison)
+{
+	vm_offset_t *primary = (vm_offset_t *) element;
+	vm_offset_t *backup  = get_backup_ptr(zone->elem_size, primary);
+
+	if (__improbable(*primary == (element ^ zp_nopoison_cookie)))
+		panic("zfree: double free of %p to zone %s\n",
+		      (void *) element, zone->zone_name);
+
+	*backup  = element ^ (poison ? zp_poisoned_cookie : zp_nopoison_cookie);
+	*primary = element ^ zp_nopoison_cookie;
+
+	return zcache_free_to_cpu_cache(zone, (void *) element);
+}
+
+static inline vm_offset_t
+alloc_from_cpu_cache(zone_t zone)
+{
+	vm_offset_t element = (vm_offset_t) zcache_alloc_from_cpu_cache(zone);
+	vm_offset_t *primary, *backup, *element_cursor;
+
+	if (element == 0)
+		return 0;
+
+	primary = (vm_offset_t *) element;
+	backup  = get_backup_ptr(zone->elem_size, primary);
+
+	if (__improbable(*primary != (element ^ zp_nopoison_cookie)))
+		zone_element_was_modified_panic(zone, element, *primary,
+		                                element ^ zp_nopoison_cookie, 0);
+
+	if (*backup == (element ^ zp_poisoned_cookie)) {
+		for (element_cursor = primary + 1; element_cursor < backup; element_cursor++)
+			if (__improbable(*element_cursor != ZP_POISON))
+				zone_element_was_modified_panic(zone, element, *element_cursor, ZP_POISON,
+				                                ((vm_offset_t)element_cursor) - element);
+	} else if (__improbable(*backup != (element ^ zp_nopoison_cookie))) {
+		zone_element_was_modified_panic(zone, element, *backup, element ^ zp_nopoison_cookie,
+		                                zone->elem_size - sizeof(vm_offset_t));
+	}
+
+	/* as in zalloc, so that only free elements carry a valid cookie */
+	*primary = ZP_POISON;
+	*backup  = ZP_POISON;
+
+	return element;
+}
+
 /*
  * End of zone poisoning
  */
@@ -999,6 +1077,7 @@ static int  num_zones_logged = 0;
 #define MAX_ZONE_NAME	32	/* max length of a zone name we can take from the boot-args */
 
 static char zone_name_to_log[MAX_ZONE_NAME] = "";	/* the zone name we're logging, if any */
+static char zcc_zone_name[MAX_ZONE_NAME] = "";		/* the zone given a per-CPU cache by boot-arg, if any */
 
 /* Log allocations and frees to help debug a zone element corruption */
 boolean_t       corruption_debug_flag    = FALSE;    /* enabled by "-zc" boot-arg */
@@ -1086,6 +1165,16 @@ log_this_zone(const char *zonename, const char *logname)
 
 #define DO_LOGGING(z)		(z->zone_logging == TRUE && z->zlog_btlog)
 
+/*
+ * Zones being sampled for leaks bypass their per-CPU cache so that every
+ * allocation and free is seen by zleaks.
+ */
+#if CONFIG_ZLEAKS
+#define DO_CPU_CACHE(z)		((z)->cpu_cache_enabled && !(z)->zleak_on)
+#else
+#define DO_CPU_CACHE(z)		((z)->cpu_cache_enabled)
+#endif /* CONFIG_ZLEAKS */
+
 extern boolean_t kmem_alloc_ready;
 
 #if CONFIG_ZLEAKS
@@ -1632,6 +1721,10 @@ zinit(
 	z->prio_refill_watermark = 0;
 	z->zone_replenish_thread = NULL;
 	z->zp_count = 0;
+	z->cpu_cache_enabled = FALSE;
+	z->cpu_cache_enable_when_ready = FALSE;
+	z->reclaim_pending = FALSE;
+	z->zcache = NULL;
 
 #if CONFIG_ZLEAKS
 	z->zleak_capture = 0;
@@ -1756,6 +1849,17 @@ zinit(
 		}
 	}
 
+	/*
+	 * Per-CPU caches are opt-in.  Besides zone_change(Z_CACHING_ENABLED),
+	 * a zone can be given one with zcc_enable_for_zone_name=<zone>, where
+	 * a period in the name matches a space as it does for zlog.
+	 */
+	if (zcc_zone_name[0] != '\0' ||
+	    PE_parse_boot_argn("zcc_enable_for_zone_name", zcc_zone_name, sizeof(zcc_zone_name))) {
+		if (log_this_zone(z->zone_name, zcc_zone_name))
+			zcache_init(z);
+	}
+
 #if	CONFIG_GZALLOC	
 	gzalloc_zone_init(z);
 #endif
@@ -1908,7 +2012,8 @@ static boolean_t random_bool_gen(
 	return (boolean_t)(buffer[valindex] & (1 << bitpos));
 } 
 
-static void 
+/* Returns TRUE if the zone_reclaim thread needs a wakeup, see free_to_zone() */
+static boolean_t
 random_free_to_zone(
 			zone_t 		zone,
 			vm_offset_t 	newmem,
@@ -1920,6 +2025,7 @@ random_free_to_zone(
 	vm_offset_t 	element_addr;
 	vm_size_t       elem_size;
 	int 		index;	
+	boolean_t	reclaim = FALSE;
 
 	elem_size = zone->elem_size;
 	last_element_offset = first_element_offset + ((element_count * elem_size) - elem_size);
@@ -1938,10 +2044,12 @@ random_free_to_zone(
 		}
 		if (element_addr != (vm_offset_t)zone) {
 			zone->count++;  /* compensate for free_to_zone */
-			free_to_zone(zone, element_addr, FALSE);
+			reclaim |= free_to_zone(zone, element_addr, FALSE);
 		}
 		zone->cur_size += elem_size;
 	}
+
+	return reclaim;
 }
 
 /*
@@ -1955,6 +2063,7 @@ zcram(
 {
 	vm_size_t	elem_size;
 	boolean_t   from_zm = FALSE;
+	boolean_t   reclaim = FALSE;
 	int element_count;
 	int entropy_buffer[MAX_ENTROPY_PER_ZCRAM];
 
@@ -2024,13 +2133,16 @@ zcram(
 				first_element_offset = zone_page_metadata_size + (ZONE_ELEMENT_ALIGNMENT - (zone_page_metadata_size % ZONE_ELEMENT_ALIGNMENT));
 			}
 			element_count = (int)((PAGE_SIZE - first_element_offset) / elem_size);
-			random_free_to_zone(zone, newmem, first_element_offset, element_count, entropy_buffer);				
+			reclaim |= random_free_to_zone(zone, newmem, first_element_offset, element_count, entropy_buffer);
 		}
 	} else {
 		element_count = (int)(size / elem_size);
-		random_free_to_zone(zone, newmem, 0, element_count, entropy_buffer);	
+		reclaim = random_free_to_zone(zone, newmem, 0, element_count, entropy_buffer);
 	}
 	unlock_zone(zone);
+
+	if (__improbable(reclaim))
+		zone_reclaim_wakeup(FALSE);
 	
 	KERNEL_DEBUG_CONSTANT(MACHDBG_CODE(DBG_MACH_ZALLOC, ZALLOC_ZCRAM) | DBG_FUNC_END, VM_KERNEL_ADDRPERM(zone), 0, 0, 0, 0);
 
@@ -2213,6 +2325,16 @@ zalloc_internal(
 
 	assert(zone != ZONE_NULL);
 
+	if (DO_CPU_CACHE(zone)) {
+		addr = alloc_from_cpu_cache(zone);
+		if (addr) {
+			if (__improbable(zsample_active))
+				zsample_alloc(zone->index, addr, zone->elem_size);
+			TRACE_MACHLEAKS(ZALLOC_CODE, ZALLOC_CODE_2, zone->elem_size, addr);
+			return((void *)addr);
+		}
+	}
+
 #if	CONFIG_GZALLOC
 	addr = gzalloc_alloc(zone, canblock);
 	did_gzalloc = (addr != 0);
@@ -2504,6 +2626,9 @@ zalloc_internal(
 #endif /* DEBUG || DEVELOPMENT */
 	}
 
+	if (__improbable(zsample_active) && addr)
+		zsample_alloc(zone->index, addr, zone->elem_size);
+
 	TRACE_MACHLEAKS(ZALLOC_CODE, ZALLOC_CODE_2, zone->elem_size, addr);
 	return((void *)addr);
 }
@@ -2628,6 +2753,7 @@ zfree(
 	int		numsaved = 0;
 	boolean_t	gzfreed = FALSE;
 	boolean_t       poison = FALSE;
+	boolean_t	reclaim = FALSE;
 
 	assert(zone != ZONE_NULL);
 
@@ -2657,6 +2783,9 @@ zfree(
 
 	TRACE_MACHLEAKS(ZFREE_CODE, ZFREE_CODE_2, zone->elem_size, (uintptr_t)addr);
 
+	if (__improbable(zsample_active))
+		zsample_free(elem);
+
 	if (__improbable(!gzfreed && zone->collectable && !zone->allows_foreign &&
 		!from_zone_map(elem, zone->elem_size))) {
 		panic("zfree: non-allocated memory in collectable zone!");
@@ -2692,6 +2821,12 @@ zfree(
 		}
 	}
 
+	/* logged zones never get a per-CPU cache, so nothing is skipped below */
+	if (DO_CPU_CACHE(zone) && !zone_check && !gzfreed) {
+		if (free_to_cpu_cache(zone, elem, poison))
+			return;
+	}
+
 	/*
 	 * See if we're doing logging on this zone.  There are two styles of logging used depending on
 	 * whether we're trying to catch a leak or corruption.  See comments above in zalloc for details.
@@ -2722,7 +2857,7 @@ zfree(
 	}
 
 	if (__probable(!gzfreed))
-		free_to_zone(zone, elem, poison);
+		reclaim = free_to_zone(zone, elem, poison);
 
 #if MACH_ASSERT
 	if (zone->count < 0)
@@ -2741,6 +2876,33 @@ zfree(
 #endif /* CONFIG_ZLEAKS */
 	
 	unlock_zone(zone);
+
+	if (__improbable(reclaim))
+		zone_reclaim_wakeup(FALSE);
+}
+
+void
+zfree_cached_elements(
+	zone_t		zone,
+	void		**elements,
+	uint32_t	count)
+{
+	uint32_t	i;
+	boolean_t	reclaim = FALSE;
+
+	vm_offset_t	element;
+
+	lock_zone(zone);
+	for (i = 0; i < count; i++) {
+		element = (vm_offset_t)elements[i];
+		/* keep the poisoned marking free_to_cpu_cache() left in the backup slot */
+		reclaim |= free_to_zone(zone, element,
+		             *get_backup_ptr(zone->elem_size, (vm_offset_t *)element) == (element ^ zp_poisoned_cookie));
+	}
+	unlock_zone(zone);
+
+	if (__improbable(reclaim))
+		zone_reclaim_wakeup(FALSE);
 }
 
 
@@ -2790,6 +2952,13 @@ zone_change(
 			gzalloc_reconfigure(zone);
 #endif
 			break;
+		case Z_CACHING_ENABLED:
+			/* caches can't be taken away once elements are in them */
+			if (value == TRUE)
+				zcache_init(zone);
+			else
+				zone->cpu_cache_enable_when_ready = FALSE;
+			break;
 		default:
 			panic("Zone_change: Wrong Item Type!");
 			/* break; */
@@ -2853,6 +3022,9 @@ zone_gc(void)
 
 		assert(z != ZONE_NULL);
 
+		if (z->cpu_cache_enabled)
+			zcache_reap(z, TRUE);
+
 		if (!z->collectable)
 			continue;
 		
@@ -2954,8 +3126,8 @@ extern unsigned int kmapoff_pgcnt;
  *	Called by the pageout daemon when the system needs more free pages.
  */
 
-void
-consider_zone_gc(void)
+static void
+consider_kmapoff_reclaim(void)
 {
 	if (kmapoff_kaddr != 0) {
 		/*
@@ -2966,11 +3138,230 @@ consider_zone_gc(void)
 		    kmapoff_kaddr, kmapoff_pgcnt * PAGE_SIZE_64);
 		kmapoff_kaddr = 0;
 	}
+}
+
+void
+consider_zone_gc(void)
+{
+	consider_kmapoff_reclaim();
 
 	if (zone_gc_allowed)
 		zone_gc();
 }
 
+/*
+ *	consider_zone_reclaim:
+ *
+ *	Like consider_zone_gc, but hands the work to the zone_reclaim
+ *	thread instead of sweeping every zone before returning.
+ */
+void
+consider_zone_reclaim(void)
+{
+	consider_kmapoff_reclaim();
+
+	if (zone_gc_allowed)
+		zone_reclaim_wakeup(TRUE);
+}
+
+/*
+ *	Incremental zone reclamation
+ *
+ *	free_to_zone() queues a zone for the zone_reclaim thread once it
+ *	holds more than zone_reclaim_keep_pages fully-free pages.  The
+ *	thread gives the excess back to the VM ZONE_RECLAIM_BATCH pages at a
+ *	time, dropping the zone lock between batches, so no allocation ever
+ *	waits behind a sweep.  Under memory pressure every collectable zone
+ *	is drained down to nothing the same way, after all the full
+ *	magazines in the per-CPU cache depots are returned to it.  Zones
+ *	are only woken for once they are unlocked, see free_to_zone().
+ */
+#define ZONE_RECLAIM_BATCH	16	/* pages per zone lock hold */
+
+static thread_t	zone_reclaim_thread_ptr = THREAD_NULL;
+static boolean_t	zone_reclaim_pressure = FALSE;
+static volatile UInt32	zone_reclaim_wakeup_pending = 0;
+
+/* Statistics, exported as vm.zone_reclaim_* */
+uint64_t	zone_reclaim_wakeups;
+uint64_t	zone_reclaim_batches;
+uint64_t	zone_reclaim_pages;
+uint64_t	zone_reclaim_time_ns;
+uint64_t	zone_reclaim_max_batch_ns;
+
+/*
+ * Full magazines sitting in the depots of all cached zones, exported as
+ * vm.zone_cache_depot_full.  Unlocked reads; only a statistic.
+ */
+uint64_t
+zone_cache_depot_full_count(void)
+{
+	unsigned int	max_zones, i;
+	uint64_t	count = 0;
+	zone_t		z;
+
+	simple_lock(&all_zones_lock);
+	max_zones = num_zones;
+	simple_unlock(&all_zones_lock);
+
+	for (i = 0; i < max_zones; i++) {
+		z = &(zone_array[i]);
+		if (z->cpu_cache_enabled)
+			count += z->zcache->zcc_depot_full;
+	}
+	return count;
+}
+
+void
+zone_reclaim_wakeup(boolean_t pressure)
+{
+	if (zone_reclaim_thread_ptr == THREAD_NULL) {
+		/* too early for the thread; pending zones are picked up once it starts */
+		if (pressure)
+			zone_gc();
+		return;
+	}
+
+	if (pressure)
+		zone_reclaim_pressure = TRUE;
+
+	if (OSCompareAndSwap(0, 1, &zone_reclaim_wakeup_pending))
+		thread_wakeup((event_t)&zone_reclaim_wakeup_pending);
+}
+
+/*
+ * Give up to ZONE_RECLAIM_BATCH fully-free pages of a zone back to the VM,
+ * leaving it keep_pages of them.  Returns the number of pages freed.
+ */
+static unsigned int
+zone_reclaim_batch(zone_t z, unsigned int keep_pages)
+{
+	struct zone_page_metadata	*page_meta;
+	queue_head_t			page_meta_head;
+	unsigned int			npages = 0;
+	uint64_t			start, elapsed_ns;
+
+	/* see zone_gc() */
+	if (vm_map_entry_reserved_zone->zone_replenishing)
+		return 0;
+
+	start = mach_absolute_time();
+	queue_init(&page_meta_head);
+
+	lck_mtx_lock(&zone_gc_lock);
+	lock_zone(z);
+	while (npages < ZONE_RECLAIM_BATCH && !queue_empty(&z->pages.all_free)) {
+		page_meta = (struct zone_page_metadata *)queue_first(&z->pages.all_free);
+		if (z->count_all_free_pages - page_meta->page_count < (int)keep_pages)
+			break;
+
+		assert(from_zone_map((vm_address_t)page_meta, sizeof(*page_meta)));
+		re_queue_tail(&page_meta_head, &(page_meta->pages));
+		z->count_all_free_pages -= page_meta->page_count;
+		z->cur_size -= z->elem_size * page_meta->free_count;
+		z->countfree -= page_meta->free_count;
+		npages += page_meta->page_count;
+	}
+	unlock_zone(z);
+
+	while ((page_meta = (struct zone_page_metadata *)dequeue_head(&page_meta_head)) != NULL) {
+		vm_address_t free_page_address = get_zone_page(page_meta);
+
+		ZONE_PAGE_COUNT_DECR(z, page_meta->page_count);
+		kmem_free(zone_map, free_page_address, (page_meta->page_count * PAGE_SIZE));
+	}
+	lck_mtx_unlock(&zone_gc_lock);
+
+	if (npages != 0) {
+		absolutetime_to_nanoseconds(mach_absolute_time() - start, &elapsed_ns);
+		zone_reclaim_batches++;
+		zone_reclaim_pages += npages;
+		zone_reclaim_time_ns += elapsed_ns;
+		if (elapsed_ns > zone_reclaim_max_batch_ns)
+			zone_reclaim_max_batch_ns = elapsed_ns;
+	}
+
+	return npages;
+}
+
+__attribute__((noreturn))
+static void
+zone_reclaim_thread(void)
+{
+	unsigned int	max_zones, i;
+	boolean_t	pressure, pending;
+	unsigned int	keep_pages;
+	zone_t		z;
+
+	for (;;) {
+		zone_reclaim_wakeups++;
+
+		/* requests made from here on get another pass */
+		zone_reclaim_wakeup_pending = 0;
+		OSMemoryBarrier();
+		pressure = zone_reclaim_pressure;
+		zone_reclaim_pressure = FALSE;
+
+		simple_lock(&all_zones_lock);
+		max_zones = num_zones;
+		simple_unlock(&all_zones_lock);
+
+		for (i = 0; i < max_zones; i++) {
+			z = &(zone_array[i]);
+
+			/* elements reaped here may leave more pages fully free below */
+			if (pressure && z->cpu_cache_enabled)
+				zcache_reap(z, TRUE);
+
+			if (!z->collectable)
+				continue;
+
+			lock_zone(z);
+			pending = z->reclaim_pending;
+			z->reclaim_pending = FALSE;
+			unlock_zone(z);
+
+			if (!pending && !pressure)
+				continue;
+
+			/* otherwise only the magazines the depot didn't need since the last pass */
+			if (!pressure && z->cpu_cache_enabled)
+				zcache_reap(z, FALSE);
+
+			keep_pages = pressure ? 0 : zone_reclaim_keep_pages;
+			while (zone_reclaim_batch(z, keep_pages) != 0)
+				thread_yield_to_preemption();
+		}
+
+		assert_wait((event_t)&zone_reclaim_wakeup_pending, THREAD_UNINT);
+		if (zone_reclaim_wakeup_pending) {
+			clear_wait(current_thread(), THREAD_AWAKENED);
+			continue;
+		}
+		thread_block(THREAD_CONTINUE_NULL);
+	}
+}
+
+void
+zone_reclaim_init(void)
+{
+	kern_return_t	kr;
+	thread_t	thread;
+
+	if (PE_parse_boot_argn("zreclaim_keep", &zone_reclaim_keep_pages, sizeof(zone_reclaim_keep_pages)) == FALSE)
+		zone_reclaim_keep_pages = ZONE_RECLAIM_KEEP_DEFAULT;
+
+	kr = kernel_thread_start_priority((thread_continue_t)zone_reclaim_thread, NULL, MINPRI_KERNEL, &thread);
+	if (kr != KERN_SUCCESS)
+		panic("zone_reclaim_init: thread create: 0x%x", kr);
+
+	zone_reclaim_thread_ptr = thread;
+	thread_deallocate(thread);
+
+	/* pick up zones that crossed the threshold during boot */
+	zone_reclaim_wakeup(FALSE);
+}
+
 kern_return_t
 task_zone_info(
 	__unused task_t					task,
@@ -96,6 +96,7 @@ typedef struct gzalloc_data {
 
 struct zone_free_element;
 struct zone_page_metadata;
+struct zone_cache;
 
 struct zone {
 	struct zone_free_element *free_elements;	/* free elements directly linked */
@@ -135,7 +136,10 @@ struct zone {
 	/* boolean_t */	alignment_required :1,
 	/* boolean_t */ zone_logging	   :1,	/* Enable zone logging for this zone. */
 	/* boolean_t */ zone_replenishing  :1,
-	/* future    */ _reserved          :15;
+	/* boolean_t */ cpu_cache_enabled  :1,	/* per-CPU magazines in front of the freelists */
+	/* boolean_t */ cpu_cache_enable_when_ready :1,	/* Z_CACHING_ENABLED set before zcache_bootstrap */
+	/* boolean_t */ reclaim_pending    :1,	/* queued for the zone_reclaim thread */
+	/* future    */ _reserved          :12;
 
 	int		index;		/* index into zone_info arrays for this zone */
 	const char	*zone_name;	/* a name for the zone */
@@ -151,6 +155,7 @@ struct zone {
 #endif /* CONFIG_GZALLOC */
 
 	btlog_t		*zlog_btlog;		/* zone logging structure to hold stacks and element references to those stacks. */
+	struct zone_cache *zcache;		/* per-CPU caches, if cpu_cache_enabled */
 };
 
 /*
@@ -166,6 +171,18 @@ typedef struct zinfo_usage_store_t {
 extern void		zone_gc(void);
 extern void		consider_zone_gc(void);
 
+/* Incremental reclamation of fully-free zone pages */
+extern void		zone_reclaim_init(void);
+extern void		zone_reclaim_wakeup(boolean_t pressure);
+extern void		consider_zone_reclaim(void);
+extern uint64_t		zone_cache_depot_full_count(void);
+
+/* Give elements held by a per-CPU cache back to the zone freelists */
+extern void		zfree_cached_elements(
+					zone_t		zone,
+					void		**elements,
+					uint32_t	count);
+
 /* Bootstrap zone module (create zone zone) */
 extern void		zone_bootstrap(void);
 
@@ -217,6 +234,7 @@ __BEGIN_DECLS
 #define Z_NOCALLOUT 	7	/* Don't asynchronously replenish the zone via callouts */
 #define Z_ALIGNMENT_REQUIRED 8
 #define Z_GZALLOC_EXEMPT 9	/* Not tracked in guard allocation mode */
+#define Z_CACHING_ENABLED 10	/* Serve alloc/free from per-CPU magazines */
 
 
 
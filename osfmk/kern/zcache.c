@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2017 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ * 
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#include <kern/assert.h>
+#include <kern/cpu_data.h>
+#include <kern/cpu_number.h>
+#include <kern/kalloc.h>
+#include <kern/misc_protos.h>
+#include <kern/zalloc.h>
+#include <kern/zcache.h>
+#include <pexpert/pexpert.h>
+
+#if defined(__x86_64__)
+#include <i386/mp.h>
+#endif
+
+#define ZCC_MAGAZINE_SIZE_DEFAULT	8	/* elements per magazine */
+#define ZCC_MAGAZINE_SIZE_MAX		32	/* bounds the reap buffer on the stack */
+#define ZCC_DEPOT_SIZE_DEFAULT		16	/* magazines per depot */
+
+static boolean_t	zcache_ready = FALSE;
+static boolean_t	zcache_disabled = FALSE;
+static uint32_t		zcc_magazine_size = ZCC_MAGAZINE_SIZE_DEFAULT;
+static uint32_t		zcc_depot_size = ZCC_DEPOT_SIZE_DEFAULT;
+
+/*
+ *	zcache_bootstrap:
+ *
+ *	Called once kalloc is up.  Caches can't be built before then, so
+ *	zone_change(Z_CACHING_ENABLED) on an earlier zone only marks it and
+ *	the cache is attached here.
+ */
+void
+zcache_bootstrap(void)
+{
+	char temp_buf[16];
+	unsigned int max_zones, i;
+
+	if (PE_parse_boot_argn("-no-zcache", temp_buf, sizeof(temp_buf)))
+		zcache_disabled = TRUE;
+
+	if (PE_parse_boot_argn("zcc_magazine_size", &zcc_magazine_size, sizeof(zcc_magazine_size))) {
+		if (zcc_magazine_size == 0)
+			zcache_disabled = TRUE;
+		zcc_magazine_size = MIN(zcc_magazine_size, ZCC_MAGAZINE_SIZE_MAX);
+	}
+
+	if (PE_parse_boot_argn("zcc_depot_size", &zcc_depot_size, sizeof(zcc_depot_size)))
+		zcc_depot_size = MAX(zcc_depot_size, 1);
+
+	zcache_ready = TRUE;
+
+	max_zones = num_zones;
+	for (i = 0; i < max_zones; i++) {
+		zone_t z = &zone_array[i];
+
+		if (z->cpu_cache_enable_when_ready) {
+			z->cpu_cache_enable_when_ready = FALSE;
+			zcache_init(z);
+		}
+	}
+}
+
+/*
+ *	zcache_init:
+ *
+ *	Build the per-CPU magazines and depot for a zone.  Every magazine is
+ *	allocated up front so the fast paths never have to allocate.  Zones
+ *	that are being logged or guarded keep going through the zone so that
+ *	every operation is still seen.
+ */
+boolean_t
+zcache_init(zone_t zone)
+{
+	struct zone_cache *zcache;
+	struct zcc_magazine *mag;
+	vm_size_t mag_size;
+	uint32_t ncpus = MAX_CPUS;
+	uint32_t nmags, i;
+	vm_offset_t mags;
+
+	if (!zcache_ready) {
+		zone->cpu_cache_enable_when_ready = TRUE;
+		return FALSE;
+	}
+
+	if (zcache_disabled || zone->zone_logging || zone->cpu_cache_enabled)
+		return FALSE;
+#if	CONFIG_GZALLOC
+	if (gzalloc_enabled())
+		return FALSE;
+#endif
+
+	mag_size = sizeof(struct zcc_magazine) + zcc_magazine_size * sizeof(void *);
+	nmags = 2 * ncpus + zcc_depot_size;
+
+	zcache = kalloc(sizeof(*zcache));
+	if (zcache == NULL)
+		return FALSE;
+	bzero(zcache, sizeof(*zcache));
+
+	zcache->zcc_per_cpu_caches = kalloc(ncpus * sizeof(struct zcc_per_cpu_cache));
+	zcache->zcc_depot = kalloc(zcc_depot_size * sizeof(struct zcc_magazine *));
+	mags = (vm_offset_t)kalloc(nmags * mag_size);
+	if (zcache->zcc_per_cpu_caches == NULL || zcache->zcc_depot == NULL || mags == 0) {
+		if (zcache->zcc_per_cpu_caches != NULL)
+			kfree(zcache->zcc_per_cpu_caches, ncpus * sizeof(struct zcc_per_cpu_cache));
+		if (zcache->zcc_depot != NULL)
+			kfree(zcache->zcc_depot, zcc_depot_size * sizeof(struct zcc_magazine *));
+		if (mags != 0)
+			kfree((void *)mags, nmags * mag_size);
+		kfree(zcache, sizeof(*zcache));
+		return FALSE;
+	}
+
+	for (i = 0; i < nmags; i++) {
+		mag = (struct zcc_magazine *)(mags + i * mag_size);
+		mag->zcc_rounds = 0;
+		mag->zcc_capacity = zcc_magazine_size;
+
+		if (i < 2 * ncpus) {
+			if (i & 1)
+				zcache->zcc_per_cpu_caches[i / 2].zcc_previous = mag;
+			else
+				zcache->zcc_per_cpu_caches[i / 2].zcc_current = mag;
+		} else {
+			zcache->zcc_depot[i - 2 * ncpus] = mag;
+		}
+	}
+
+	simple_lock_init(&zcache->zcc_depot_lock, 0);
+	zcache->zcc_depot_size = zcc_depot_size;
+	zcache->zcc_depot_full_min = zcc_depot_size;
+
+	zone->zcache = zcache;
+	zone->cpu_cache_enabled = TRUE;
+	return TRUE;
+}
+
+/*
+ * Trade the CPU's magazine for one from the depot: a full one when
+ * allocating (*magp is empty), an empty one when freeing (*magp is full).
+ * Called with preemption disabled.
+ */
+static boolean_t
+zcache_depot_exchange(struct zone_cache *zcache, struct zcc_magazine **magp, boolean_t want_full)
+{
+	struct zcc_magazine *mag;
+	uint32_t idx;
+
+	simple_lock(&zcache->zcc_depot_lock);
+
+	if (want_full) {
+		if (zcache->zcc_depot_full == 0) {
+			zcache->zcc_alloc_misses++;
+			simple_unlock(&zcache->zcc_depot_lock);
+			return FALSE;
+		}
+		idx = --zcache->zcc_depot_full;
+		if (zcache->zcc_depot_full < zcache->zcc_depot_full_min)
+			zcache->zcc_depot_full_min = zcache->zcc_depot_full;
+	} else {
+		if (zcache->zcc_depot_full == zcache->zcc_depot_size) {
+			zcache->zcc_free_misses++;
+			simple_unlock(&zcache->zcc_depot_lock);
+			return FALSE;
+		}
+		idx = zcache->zcc_depot_full++;
+	}
+
+	mag = zcache->zcc_depot[idx];
+	zcache->zcc_depot[idx] = *magp;
+	*magp = mag;
+
+	simple_unlock(&zcache->zcc_depot_lock);
+	return TRUE;
+}
+
+void *
+zcache_alloc_from_cpu_cache(zone_t zone)
+{
+	struct zone_cache *zcache = zone->zcache;
+	struct zcc_per_cpu_cache *cache;
+	struct zcc_magazine *mag;
+	void *elem;
+
+	disable_preemption();
+	cache = &zcache->zcc_per_cpu_caches[cpu_number()];
+
+	if (cache->zcc_current->zcc_rounds == 0) {
+		if (cache->zcc_previous->zcc_rounds != 0) {
+			mag = cache->zcc_current;
+			cache->zcc_current = cache->zcc_previous;
+			cache->zcc_previous = mag;
+		} else if (!zcache_depot_exchange(zcache, &cache->zcc_current, TRUE)) {
+			enable_preemption();
+			return NULL;
+		}
+	}
+
+	mag = cache->zcc_current;
+	elem = mag->zcc_elements[--mag->zcc_rounds];
+
+	enable_preemption();
+	return elem;
+}
+
+boolean_t
+zcache_free_to_cpu_cache(zone_t zone, void *addr)
+{
+	struct zone_cache *zcache = zone->zcache;
+	struct zcc_per_cpu_cache *cache;
+	struct zcc_magazine *mag;
+
+	disable_preemption();
+	cache = &zcache->zcc_per_cpu_caches[cpu_number()];
+
+	if (cache->zcc_current->zcc_rounds == cache->zcc_current->zcc_capacity) {
+		if (cache->zcc_previous->zcc_rounds != cache->zcc_previous->zcc_capacity) {
+			mag = cache->zcc_current;
+			cache->zcc_current = cache->zcc_previous;
+			cache->zcc_previous = mag;
+		} else if (!zcache_depot_exchange(zcache, &cache->zcc_current, FALSE)) {
+			enable_preemption();
+			return FALSE;
+		}
+	}
+
+	mag = cache->zcc_current;
+	mag->zcc_elements[mag->zcc_rounds++] = addr;
+
+	enable_preemption();
+	return TRUE;
+}
+
+/*
+ *	zcache_reap:
+ *
+ *	Empty the full depot magazines that nobody needed since the last
+ *	reap (the low water mark of the full count) back into the zone, or
+ *	every full depot magazine if drain is set, as under memory pressure.
+ *	The mark restarts at the depot size after each reap, so magazines
+ *	filled since then and never taken are reaped too.  Magazines held by
+ *	CPUs are left alone; they can only be touched from their own CPU.
+ */
+void
+zcache_reap(zone_t zone, boolean_t drain)
+{
+	struct zone_cache *zcache = zone->zcache;
+	struct zcc_magazine *mag;
+	void *elements[ZCC_MAGAZINE_SIZE_MAX];
+	uint32_t reap, count;
+
+	simple_lock(&zcache->zcc_depot_lock);
+	reap = drain ? zcache->zcc_depot_full : zcache->zcc_depot_full_min;
+	simple_unlock(&zcache->zcc_depot_lock);
+
+	while (reap-- > 0) {
+		simple_lock(&zcache->zcc_depot_lock);
+		if (zcache->zcc_depot_full == 0) {
+			simple_unlock(&zcache->zcc_depot_lock);
+			break;
+		}
+		mag = zcache->zcc_depot[--zcache->zcc_depot_full];
+		count = mag->zcc_rounds;
+		bcopy(mag->zcc_elements, elements, count * sizeof(void *));
+		mag->zcc_rounds = 0;
+		zcache->zcc_reaped += count;
+		simple_unlock(&zcache->zcc_depot_lock);
+
+		zfree_cached_elements(zone, elements, count);
+	}
+
+	simple_lock(&zcache->zcc_depot_lock);
+	zcache->zcc_depot_full_min = zcache->zcc_depot_size;
+	simple_unlock(&zcache->zcc_depot_lock);
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2017 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ * 
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#ifndef	_KERN_ZCACHE_H_
+#define _KERN_ZCACHE_H_
+
+#include <kern/kern_types.h>
+#include <kern/simple_lock.h>
+#include <sys/cdefs.h>
+#include <stdint.h>
+
+#ifdef	MACH_KERNEL_PRIVATE
+
+/*
+ * Per-CPU caches for zones (Z_CACHING_ENABLED).
+ *
+ * Each CPU owns two magazines: the one it allocates from and frees to,
+ * and a previous one it swaps with when the current one runs full or
+ * empty.  Behind them sits a per-zone depot of full and empty magazines
+ * protected by a spin lock, so the zone lock is only taken when the
+ * depot can't satisfy a CPU either.  This is the same scheme mcache uses
+ * for mbufs, minus the dynamic resizing.
+ *
+ * Caches are opt-in, either with zone_change() or by naming the zone in
+ * the zcc_enable_for_zone_name boot-arg.  Elements freed to a cache are
+ * poisoned as zfree() would and marked with the freelist cookies, so a
+ * double free or a write after free is caught when the element comes back
+ * out.  Elements held in a cache are still counted as allocated by the zone.
+ * zone_gc() and the zone_reclaim thread, when woken for memory pressure,
+ * reap the depot magazines that went unused since the previous reap and
+ * return their elements to the zone freelists.
+ */
+
+struct zcc_magazine {
+	uint32_t	zcc_rounds;		/* number of elements held */
+	uint32_t	zcc_capacity;		/* number of element slots */
+	void		*zcc_elements[0];
+};
+
+struct zcc_per_cpu_cache {
+	struct zcc_magazine	*zcc_current;
+	struct zcc_magazine	*zcc_previous;
+};
+
+struct zone_cache {
+	decl_simple_lock_data(, zcc_depot_lock)
+	uint32_t		zcc_depot_size;		/* number of magazines in the depot */
+	uint32_t		zcc_depot_full;		/* [0, zcc_depot_full) are full magazines */
+	uint32_t		zcc_depot_full_min;	/* low water mark of zcc_depot_full since the last reap */
+	uint64_t		zcc_alloc_misses;	/* allocations that fell through to the zone */
+	uint64_t		zcc_free_misses;	/* frees that fell through to the zone */
+	uint64_t		zcc_reaped;		/* elements returned to the zone by reaps */
+	struct zcc_magazine	**zcc_depot;
+	struct zcc_per_cpu_cache *zcc_per_cpu_caches;
+};
+
+/* Set up the magazine zones; enables caches that were requested before now */
+extern void		zcache_bootstrap(void);
+
+/* Attach a per-CPU cache to a zone */
+extern boolean_t	zcache_init(zone_t zone);
+
+/* Fast paths; return NULL / FALSE to make the caller use the zone */
+extern void *		zcache_alloc_from_cpu_cache(zone_t zone);
+extern boolean_t	zcache_free_to_cpu_cache(zone_t zone, void *addr);
+
+/* Return the unused depot magazines, or all full ones if drain, to the zone */
+extern void		zcache_reap(zone_t zone, boolean_t drain);
+
+#endif	/* MACH_KERNEL_PRIVATE */
+
+#endif	/* _KERN_ZCACHE_H_ */
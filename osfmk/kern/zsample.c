@@ -0,0 +1,337 @@
+/*
+ * Copyright (c) 2017 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ * 
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#include <mach/vm_param.h>
+#include <mach/vm_statistics.h>
+#include <kern/assert.h>
+#include <kern/backtrace.h>
+#include <kern/locks.h>
+#include <kern/misc_protos.h>
+#include <kern/zsample.h>
+#include <vm/vm_kern.h>
+#include <pexpert/pexpert.h>
+
+#if defined(__x86_64__)
+#include <i386/mp.h>
+#endif
+
+#define ZSAMPLE_RATE_DEFAULT	(512 * 1024)	/* mean bytes between samples */
+#define ZSAMPLE_TRACE_BUCKETS	1024		/* must be a power of 2 */
+#define ZSAMPLE_RECORD_BUCKETS	4096		/* must be a power of 2 */
+#define ZSAMPLE_PROBES		4
+
+/* One allocation site: a zone (or ZSAMPLE_SITE_KALLOC) and a backtrace */
+struct zsample_trace {
+	uint32_t	zt_hash;		/* 0 if the bucket was never used */
+	uint32_t	zt_site;
+	uint32_t	zt_depth;
+	uint32_t	zt_live_samples;
+	uint64_t	zt_live_bytes;		/* estimated bytes still allocated */
+	uint64_t	zt_total_samples;
+	uintptr_t	zt_frames[ZSAMPLE_MAX_DEPTH];
+};
+
+/* One sampled allocation that hasn't been freed yet */
+struct zsample_record {
+	vm_offset_t	zr_addr;		/* 0 if free */
+	uint64_t	zr_weight;
+	uint32_t	zr_trace;
+};
+
+boolean_t		zsample_active = FALSE;
+struct zsample_cpu	zsample_cpus[MAX_CPUS];
+
+uint32_t			zsample_rate = 0;	/* 0 while sampling is off */
+static struct zsample_trace	*zsample_traces;
+static struct zsample_record	*zsample_records;
+static uint32_t			zsample_traces_used;
+
+uint64_t	zsample_samples;	/* samples recorded */
+uint64_t	zsample_dropped;	/* samples lost to lock contention or full tables */
+
+static lck_spin_t		zsample_lock;
+static lck_grp_t		zsample_lock_grp;
+
+/* xorshift64* */
+static uint32_t
+zsample_random(struct zsample_cpu *zc)
+{
+	uint64_t x = zc->zc_rng;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	zc->zc_rng = x;
+	return (uint32_t)((x * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+/* log2(x) in 16.16 fixed point, for x > 0 */
+static uint32_t
+zsample_log2_q16(uint32_t x)
+{
+	uint32_t msb = 31 - __builtin_clz(x);
+	uint32_t result = msb << 16;
+	uint64_t y = ((uint64_t)x << 31) >> msb;	/* x / 2^msb in 1.31 */
+	int i;
+
+	for (i = 15; i >= 0; i--) {
+		y = (y * y) >> 31;
+		if (y >= (1ULL << 32)) {
+			y >>= 1;
+			result |= 1U << i;
+		}
+	}
+	return result;
+}
+
+/*
+ * Bytes until the next sample: -ln(U) * rate for U uniform in (0, 1],
+ * computed as (32 - log2(r)) * ln(2) * rate for a random 32-bit r.
+ */
+static int64_t
+zsample_next_interval(struct zsample_cpu *zc)
+{
+	uint32_t r = zsample_random(zc) | 1;
+	uint64_t neg_ln_u = ((((uint64_t)32 << 16) - zsample_log2_q16(r)) * 45426) >> 16;	/* ln(2) = 45426 / 2^16 */
+
+	return (int64_t)(((uint64_t)zsample_rate * neg_ln_u) >> 16) + 1;
+}
+
+static uint32_t
+zsample_trace_hash(uint32_t site, uintptr_t *frames, uint32_t depth)
+{
+	uint32_t hash = 2166136261U ^ site;
+	uint32_t i;
+
+	for (i = 0; i < depth; i++) {
+		hash ^= (uint32_t)frames[i];
+		hash *= 16777619U;
+		hash ^= (uint32_t)(frames[i] >> 32);
+		hash *= 16777619U;
+	}
+	return hash ? hash : 1;
+}
+
+static inline uint32_t
+zsample_record_hash(vm_offset_t addr)
+{
+	return (uint32_t)((addr >> 4) * 0x9E3779B1U);
+}
+
+void
+zsample_init(void)
+{
+	vm_size_t traces_size = ZSAMPLE_TRACE_BUCKETS * sizeof(struct zsample_trace);
+	vm_size_t records_size = ZSAMPLE_RECORD_BUCKETS * sizeof(struct zsample_record);
+	vm_offset_t traces, records;
+	uint32_t enable = 0, rate = ZSAMPLE_RATE_DEFAULT;
+	unsigned int i;
+
+	if (!PE_parse_boot_argn("zsample", &enable, sizeof(enable)) || enable == 0)
+		return;
+	if (PE_parse_boot_argn("zsample_rate", &rate, sizeof(rate)) && rate == 0)
+		return;
+
+	if (kmem_alloc_kobject(kernel_map, &traces, traces_size, VM_KERN_MEMORY_DIAG) != KERN_SUCCESS) {
+		printf("zsample: couldn't allocate the trace table, sampling disabled\n");
+		return;
+	}
+	if (kmem_alloc_kobject(kernel_map, &records, records_size, VM_KERN_MEMORY_DIAG) != KERN_SUCCESS) {
+		kmem_free(kernel_map, traces, traces_size);
+		printf("zsample: couldn't allocate the record table, sampling disabled\n");
+		return;
+	}
+	bzero((void *)traces, traces_size);
+	bzero((void *)records, records_size);
+	zsample_traces = (struct zsample_trace *)traces;
+	zsample_records = (struct zsample_record *)records;
+
+	lck_grp_init(&zsample_lock_grp, "zsample", LCK_GRP_ATTR_NULL);
+	lck_spin_init(&zsample_lock, &zsample_lock_grp, LCK_ATTR_NULL);
+
+	zsample_rate = rate;
+	for (i = 0; i < MAX_CPUS; i++) {
+		zsample_cpus[i].zc_rng = early_random() | 1;
+		zsample_cpus[i].zc_bytes_until_sample = zsample_next_interval(&zsample_cpus[i]);
+	}
+
+	zsample_active = TRUE;
+}
+
+void
+zsample_take(uint32_t site, vm_offset_t addr, vm_size_t size)
+{
+	struct zsample_cpu *zc = &zsample_cpus[cpu_number()];
+	struct zsample_trace *trace = NULL;
+	struct zsample_record *record = NULL;
+	uintptr_t frames[ZSAMPLE_MAX_DEPTH];
+	uint32_t depth, hash, slot, i;
+	uint32_t trace_index = 0;
+	uint64_t weight;
+
+	zc->zc_bytes_until_sample = zsample_next_interval(zc);
+
+	weight = MAX(size, zsample_rate);
+	depth = backtrace(frames, ZSAMPLE_MAX_DEPTH);
+	hash = zsample_trace_hash(site, frames, depth);
+
+	/* never spin in the allocation path; losing a sample is fine */
+	if (!lck_spin_try_lock(&zsample_lock)) {
+		zsample_dropped++;
+		return;
+	}
+
+	for (i = 0; i < ZSAMPLE_PROBES; i++) {
+		slot = (zsample_record_hash(addr) + i) & (ZSAMPLE_RECORD_BUCKETS - 1);
+		if (zsample_records[slot].zr_addr == 0) {
+			record = &zsample_records[slot];
+			break;
+		}
+	}
+
+	/* an existing trace for this site, else the first bucket with nothing live */
+	for (i = 0; record != NULL && i < ZSAMPLE_PROBES; i++) {
+		struct zsample_trace *t;
+
+		slot = (hash + i) & (ZSAMPLE_TRACE_BUCKETS - 1);
+		t = &zsample_traces[slot];
+		if (t->zt_hash == hash && t->zt_site == site && t->zt_depth == depth &&
+		    bcmp(t->zt_frames, frames, depth * sizeof(frames[0])) == 0) {
+			trace = t;
+			trace_index = slot;
+			break;
+		}
+		if (trace == NULL && (t->zt_hash == 0 || t->zt_live_samples == 0)) {
+			trace = t;
+			trace_index = slot;
+		}
+	}
+
+	if (record == NULL || trace == NULL) {
+		zsample_dropped++;
+		lck_spin_unlock(&zsample_lock);
+		return;
+	}
+
+	if (trace->zt_hash != hash || trace->zt_site != site || trace->zt_depth != depth ||
+	    bcmp(trace->zt_frames, frames, depth * sizeof(frames[0])) != 0) {
+		if (trace->zt_hash == 0)
+			zsample_traces_used++;
+		trace->zt_hash = hash;
+		trace->zt_site = site;
+		trace->zt_depth = depth;
+		trace->zt_live_samples = 0;
+		trace->zt_live_bytes = 0;
+		trace->zt_total_samples = 0;
+		bcopy(frames, trace->zt_frames, depth * sizeof(frames[0]));
+	}
+
+	record->zr_addr = addr;
+	record->zr_weight = weight;
+	record->zr_trace = trace_index;
+
+	trace->zt_live_samples++;
+	trace->zt_live_bytes += weight;
+	trace->zt_total_samples++;
+	zsample_samples++;
+
+	lck_spin_unlock(&zsample_lock);
+}
+
+void
+zsample_free(vm_offset_t addr)
+{
+	struct zsample_record *record;
+	struct zsample_trace *trace;
+	uint32_t slot, i;
+
+	/* almost nothing is sampled, so look before locking */
+	for (i = 0; i < ZSAMPLE_PROBES; i++) {
+		slot = (zsample_record_hash(addr) + i) & (ZSAMPLE_RECORD_BUCKETS - 1);
+		if (zsample_records[slot].zr_addr == addr)
+			break;
+	}
+	if (i == ZSAMPLE_PROBES)
+		return;
+
+	record = &zsample_records[slot];
+
+	lck_spin_lock(&zsample_lock);
+	if (record->zr_addr == addr) {
+		trace = &zsample_traces[record->zr_trace];
+		assert(trace->zt_live_samples > 0);
+		trace->zt_live_samples--;
+		trace->zt_live_bytes -= record->zr_weight;
+		record->zr_addr = 0;
+	}
+	lck_spin_unlock(&zsample_lock);
+}
+
+unsigned int
+zsample_export_count(void)
+{
+	if (!zsample_active)
+		return 0;
+	return zsample_traces_used;
+}
+
+/*
+ * Copy out up to max_sites sites that still have live samples, with
+ * their backtraces unslid.
+ */
+unsigned int
+zsample_export(zsample_site_info_t *sites, unsigned int max_sites)
+{
+	unsigned int count = 0, slot, i;
+
+	if (!zsample_active)
+		return 0;
+
+	lck_spin_lock(&zsample_lock);
+	for (slot = 0; slot < ZSAMPLE_TRACE_BUCKETS && count < max_sites; slot++) {
+		struct zsample_trace *trace = &zsample_traces[slot];
+		zsample_site_info_t *site = &sites[count];
+
+		if (trace->zt_hash == 0 || trace->zt_live_samples == 0)
+			continue;
+
+		bzero(site, sizeof(*site));
+		site->zsi_live_bytes = trace->zt_live_bytes;
+		site->zsi_total_samples = trace->zt_total_samples;
+		site->zsi_live_samples = trace->zt_live_samples;
+		site->zsi_site = trace->zt_site;
+		site->zsi_id = slot;
+		site->zsi_depth = trace->zt_depth;
+		for (i = 0; i < trace->zt_depth; i++)
+			site->zsi_frames[i] = VM_KERNEL_UNSLIDE(trace->zt_frames[i]);
+		count++;
+	}
+	lck_spin_unlock(&zsample_lock);
+
+	return count;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2017 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ * 
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#ifndef	_KERN_ZSAMPLE_H_
+#define _KERN_ZSAMPLE_H_
+
+#include <kern/kern_types.h>
+#include <kern/cpu_number.h>
+#include <mach_debug/zone_info.h>
+#include <sys/cdefs.h>
+#include <stdint.h>
+
+#ifdef	MACH_KERNEL_PRIVATE
+
+/*
+ * Sampled allocation profiling for zones and kalloc.
+ *
+ * Every CPU counts down the bytes it allocates and takes a backtrace when
+ * the count runs out, then rearms with an exponentially distributed
+ * interval whose mean is the sampling rate.  Sampling is off unless the
+ * zsample=1 boot-arg is set; zsample_rate sets the mean interval in bytes
+ * (512KB by default).  Sampling by bytes rather than by calls
+ * makes the chance of catching an allocation proportional to its size,
+ * so each sample stands for max(size, rate) bytes of heap.
+ *
+ * Backtraces are deduplicated per allocation site (zone plus stack) and
+ * sampled addresses are remembered until they are freed, so the table
+ * describes live memory.  The kern.zsample_sites sysctl exports it as
+ * zsample_site_info_t records.
+ */
+
+struct zsample_cpu {
+	int64_t		zc_bytes_until_sample;
+	uint64_t	zc_rng;
+} __attribute__((aligned(64)));
+
+extern boolean_t		zsample_active;
+extern uint32_t			zsample_rate;
+extern struct zsample_cpu	zsample_cpus[];
+
+extern void		zsample_init(void);
+extern void		zsample_take(uint32_t site, vm_offset_t addr, vm_size_t size);
+extern void		zsample_free(vm_offset_t addr);
+
+/* Upper bound on, and copying out of, the live sites */
+extern unsigned int	zsample_export_count(void);
+extern unsigned int	zsample_export(zsample_site_info_t *sites, unsigned int max_sites);
+
+/*
+ * Charge an allocation to this CPU's countdown.  A preemption between the
+ * load and the store only moves the next sample around a little.
+ */
+static inline void
+zsample_alloc(uint32_t site, vm_offset_t addr, vm_size_t size)
+{
+	struct zsample_cpu *zc = &zsample_cpus[cpu_number()];
+
+	zc->zc_bytes_until_sample -= (int64_t)size;
+	if (__improbable(zc->zc_bytes_until_sample <= 0))
+		zsample_take(site, addr, size);
+}
+
+#endif	/* MACH_KERNEL_PRIVATE */
+
+#endif	/* _KERN_ZSAMPLE_H_ */
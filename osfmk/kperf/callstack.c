@@ -32,13 +32,42 @@
 #include <mach/mach_types.h>
 #include <kern/thread.h>
 #include <kern/backtrace.h>
+#include <kern/clock.h>
+#include <kern/cpu_number.h>
+#include <kern/kalloc.h>
+#include <kern/machine.h>
 #include <vm/vm_map.h>
 #include <kperf/buffer.h>
 #include <kperf/context.h>
 #include <kperf/callstack.h>
 #include <kperf/ast.h>
+#include <kperf/kperf.h>
 #include <sys/errno.h>
 
+/*
+ * Each CPU remembers the hashes of the callstacks it logged recently in a
+ * small direct-mapped table.  Entries are only trusted for one epoch, so a
+ * trace that starts late or drops events sees every stack's frames again
+ * within an epoch.
+ */
+#define CALLSTACK_DEDUP_ENTRIES (256) /* must be a power of 2 */
+
+struct callstack_dedup_cache {
+	uint64_t cdc_epoch_start;
+	uint32_t cdc_generation;
+	uint64_t cdc_hashes[CALLSTACK_DEDUP_ENTRIES];
+};
+
+static struct callstack_dedup_cache *callstack_dedupv = NULL;
+static unsigned int callstack_dedupc = 0;
+
+/* 0 when deduplication is disabled */
+static int callstack_dedup_epoch_ms = 0;
+static uint64_t callstack_dedup_epoch_abs = 0;
+
+/* bumped to make every CPU start a new epoch */
+static uint32_t callstack_dedup_generation = 0;
+
 
 static void
 callstack_fixup_user(struct callstack *cs, thread_t thread)
@@ -312,13 +341,81 @@ scrub_frame(uint64_t *bt, int n_frames, int frame)
 	}
 }
 
+static uint64_t
+callstack_hash(struct callstack *cs)
+{
+	/* FNV-1a over the flags, frame count and frames */
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	unsigned int nframes = cs->nframes;
+
+	hash = (hash ^ cs->flags) * 0x100000001b3ULL;
+	hash = (hash ^ nframes) * 0x100000001b3ULL;
+
+	if (cs->flags & CALLSTACK_KERNEL_WORDS) {
+		uintptr_t *frames = (uintptr_t *)cs->frames;
+		for (unsigned int i = 0; i < nframes; i++) {
+			hash = (hash ^ frames[i]) * 0x100000001b3ULL;
+		}
+	} else {
+		for (unsigned int i = 0; i < nframes; i++) {
+			hash = (hash ^ cs->frames[i]) * 0x100000001b3ULL;
+		}
+	}
+
+	/* 0 marks an empty cache entry */
+	return hash ? hash : 1;
+}
+
+/*
+ * Returns TRUE if this CPU already logged the stack with this hash in the
+ * current epoch, and remembers it otherwise.
+ */
+static boolean_t
+callstack_dedup_seen(uint64_t hash)
+{
+	assert(ml_get_interrupts_enabled() == FALSE);
+
+	unsigned int cpu = cpu_number();
+	assert(cpu < callstack_dedupc);
+	struct callstack_dedup_cache *cache = &callstack_dedupv[cpu];
+
+	uint64_t now = mach_absolute_time();
+	if (cache->cdc_generation != callstack_dedup_generation ||
+	    (now - cache->cdc_epoch_start) >= callstack_dedup_epoch_abs) {
+		bzero(cache->cdc_hashes, sizeof(cache->cdc_hashes));
+		cache->cdc_generation = callstack_dedup_generation;
+		cache->cdc_epoch_start = now;
+	}
+
+	uint64_t *entry = &cache->cdc_hashes[(hash ^ (hash >> 32)) & (CALLSTACK_DEDUP_ENTRIES - 1)];
+	if (*entry == hash) {
+		return TRUE;
+	}
+	*entry = hash;
+	return FALSE;
+}
+
 static void
-callstack_log(struct callstack *cs, uint32_t hcode, uint32_t dcode)
+callstack_log(struct callstack *cs, uint32_t hcode, uint32_t dcode,
+              uint32_t rcode)
 {
+	uint64_t hash = 0;
+
 	BUF_VERB(PERF_CS_LOG | DBG_FUNC_START, cs->flags, cs->nframes);
 
+	if (callstack_dedup_epoch_ms != 0 && callstack_dedupv != NULL &&
+	    (cs->flags & CALLSTACK_VALID) && cs->nframes > 0)
+	{
+		hash = callstack_hash(cs);
+		if (callstack_dedup_seen(hash)) {
+			BUF_DATA(rcode, cs->flags, cs->nframes, hash);
+			BUF_VERB(PERF_CS_LOG | DBG_FUNC_END, cs->flags, cs->nframes);
+			return;
+		}
+	}
+
 	/* framing information for the stack */
-	BUF_DATA(hcode, cs->flags, cs->nframes);
+	BUF_DATA(hcode, cs->flags, cs->nframes, hash);
 
 	/* how many batches of 4 */
 	unsigned int n = cs->nframes / 4;
@@ -353,13 +450,13 @@ callstack_log(struct callstack *cs, uint32_t hcode, uint32_t dcode)
 void
 kperf_kcallstack_log( struct callstack *cs )
 {
-	callstack_log(cs, PERF_CS_KHDR, PERF_CS_KDATA);
+	callstack_log(cs, PERF_CS_KHDR, PERF_CS_KDATA, PERF_CS_KREF);
 }
 
 void
 kperf_ucallstack_log( struct callstack *cs )
 {
-	callstack_log(cs, PERF_CS_UHDR, PERF_CS_UDATA);
+	callstack_log(cs, PERF_CS_UHDR, PERF_CS_UDATA, PERF_CS_UREF);
 }
 
 int
@@ -370,3 +467,55 @@ kperf_ucallstack_pend(struct kperf_context * context, uint32_t depth)
 
 	return did_pend;
 }
+
+/* callstack deduplication */
+
+int
+kperf_callstack_init(void)
+{
+	unsigned int ncpus = machine_info.logical_cpu_max;
+
+	if (callstack_dedupv != NULL) {
+		return 0;
+	}
+
+	callstack_dedupv = kalloc_tag(ncpus * sizeof(*callstack_dedupv),
+	                              VM_KERN_MEMORY_DIAG);
+	if (callstack_dedupv == NULL) {
+		return ENOMEM;
+	}
+	bzero(callstack_dedupv, ncpus * sizeof(*callstack_dedupv));
+	callstack_dedupc = ncpus;
+
+	return 0;
+}
+
+void
+kperf_callstack_dedup_flush(void)
+{
+	OSIncrementAtomic(&callstack_dedup_generation);
+}
+
+int
+kperf_get_callstack_dedup(void)
+{
+	return callstack_dedup_epoch_ms;
+}
+
+int
+kperf_set_callstack_dedup(int epoch_ms)
+{
+	if (kperf_sampling_status() == KPERF_SAMPLING_ON) {
+		return EBUSY;
+	}
+	if (epoch_ms < 0) {
+		return EINVAL;
+	}
+
+	nanoseconds_to_absolutetime((uint64_t)epoch_ms * NSEC_PER_MSEC,
+	                            &callstack_dedup_epoch_abs);
+	callstack_dedup_epoch_ms = epoch_ms;
+	kperf_callstack_dedup_flush();
+
+	return 0;
+}
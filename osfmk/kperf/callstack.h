@@ -63,4 +63,17 @@ void kperf_ucallstack_sample(struct callstack *cs, struct kperf_context *);
 int kperf_ucallstack_pend(struct kperf_context *, uint32_t depth);
 void kperf_ucallstack_log(struct callstack *cs);
 
+/*
+ * Callstack deduplication.  When enabled, a callstack that was already logged
+ * on the same CPU in the current epoch is logged as a single PERF_CS_KREF or
+ * PERF_CS_UREF event carrying the stack's hash, instead of its frames.  The
+ * header of a fully logged stack carries the hash as its third argument.
+ */
+int kperf_callstack_init(void);
+void kperf_callstack_dedup_flush(void);
+
+/* get/set the dedup epoch length in milliseconds, 0 disables dedup */
+int kperf_get_callstack_dedup(void);
+int kperf_set_callstack_dedup(int epoch_ms);
+
 #endif /* !defined(KPERF_CALLSTACK_H) */
@@ -35,6 +35,7 @@
 
 #include <kperf/action.h>
 #include <kperf/buffer.h>
+#include <kperf/callstack.h>
 #include <kperf/kdebug_trigger.h>
 #include <kperf/kperf.h>
 #include <kperf/kperf_timer.h>
@@ -114,6 +115,11 @@ kperf_init(void)
 		goto error;
 	}
 
+	/* create the per-CPU callstack deduplication caches */
+	if ((err = kperf_callstack_init())) {
+		goto error;
+	}
+
 	kperf_initted = TRUE;
 	return 0;
 
@@ -143,6 +149,7 @@ kperf_reset(void)
 	/* cleanup miscellaneous configuration first */
 	(void)kperf_kdbg_cswitch_set(0);
 	(void)kperf_set_lightweight_pet(0);
+	(void)kperf_set_callstack_dedup(0);
 	kperf_kdebug_reset();
 
 	/* timers, which require actions, first */
@@ -207,6 +214,9 @@ kperf_sampling_enable(void)
 		return ECANCELED;
 	}
 
+	/* a new trace needs to see every callstack's frames again */
+	kperf_callstack_dedup_flush();
+
 	/* mark as running */
 	sampling_status = KPERF_SAMPLING_ON;
 	kperf_lightweight_pet_active_update();
@@ -38,6 +38,7 @@
 #include <sys/kauth.h>
 
 #include <kperf/action.h>
+#include <kperf/callstack.h>
 #include <kperf/context.h>
 #include <kperf/kdebug_trigger.h>
 #include <kperf/kperf.h>
@@ -70,6 +71,7 @@
 #define REQ_LIGHTWEIGHT_PET         (20)
 #define REQ_KDEBUG_ACTION           (21)
 #define REQ_KDEBUG_FILTER           (22)
+#define REQ_CALLSTACK_DEDUP         (23)
 
 int kperf_debug_level = 0;
 
@@ -397,6 +399,13 @@ sysctl_lightweight_pet(struct sysctl_req *req)
 		kperf_set_lightweight_pet);
 }
 
+static int
+sysctl_callstack_dedup(struct sysctl_req *req)
+{
+	return kperf_sysctl_get_set_int(req, kperf_get_callstack_dedup,
+		kperf_set_callstack_dedup);
+}
+
 static int
 sysctl_kdbg_cswitch(struct sysctl_req *req)
 {
@@ -484,6 +493,9 @@ kperf_sysctl SYSCTL_HANDLER_ARGS
 	case REQ_LIGHTWEIGHT_PET:
 		ret = sysctl_lightweight_pet(req);
         break;
+	case REQ_CALLSTACK_DEDUP:
+		ret = sysctl_callstack_dedup(req);
+		break;
 	default:
 		ret = ENOENT;
 		break;
@@ -669,7 +681,15 @@ SYSCTL_PROC(_kperf, OID_AUTO, lightweight_pet,
             CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_ANYBODY | CTLFLAG_LOCKED,
             (void *)REQ_LIGHTWEIGHT_PET,
             sizeof(int), kperf_sysctl, "I",
-            "Status of lightweight PET mode");
+            "PET mode: 0 samples all threads, 1 is lightweight, 2 samples "
+            "only threads that ran since the last tick");
+
+SYSCTL_PROC(_kperf, OID_AUTO, callstack_dedup,
+            CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_ANYBODY | CTLFLAG_LOCKED,
+            (void *)REQ_CALLSTACK_DEDUP,
+            sizeof(int), kperf_sysctl, "I",
+            "Log repeated callstacks by hash, re-logging frames every N ms "
+            "(0 disables)");
 
 /* debug */
 SYSCTL_INT(_kperf, OID_AUTO, debug_level, CTLFLAG_RW | CTLFLAG_LOCKED,
@@ -40,6 +40,7 @@
 
 #include <kern/task.h>
 #include <kern/kalloc.h>
+#include <kern/processor.h>
 
 /* action ID to call for each sample
  *
@@ -78,7 +79,17 @@ static uint32_t pet_idle_rate = KPERF_PET_DEFAULT_IDLE_RATE;
  *               +--- PET timer fire, sample on-core threads A and B,
  *                    increment kperf_pet_gen
  */
-static boolean_t lightweight_pet = FALSE;
+static int lightweight_pet = KPERF_PET_MODE_FULL;
+
+/*
+ * Ran-only PET mode keeps the PET thread, but only samples threads that have
+ * context switched or been on-core since the previous PET tick.  Threads that
+ * sat blocked the whole time produce no samples at all, rather than the
+ * empty-callstack samples that full PET emits for them, so the cost of a tick
+ * follows the number of threads that are doing something instead of the
+ * number that exist.  Tasks without any such threads are not suspended.
+ */
+static uint64_t pet_last_sample_time = 0;
 
 /*
  * Whether or not lightweight PET and sampling is active.
@@ -103,9 +114,15 @@ static void pet_thread_work_unit(void);
 
 /* listing things to sample */
 
+/*
+ * The task list holds its references across PET ticks and is only rebuilt
+ * when tasks_generation shows that a task was created or terminated.
+ */
 static task_array_t pet_tasks = NULL;
 static vm_size_t pet_tasks_size = 0;
 static vm_size_t pet_tasks_count = 0;
+static uint32_t pet_tasks_generation = 0;
+static boolean_t pet_tasks_valid = FALSE;
 
 static thread_array_t pet_threads = NULL;
 static vm_size_t pet_threads_size = 0;
@@ -113,13 +130,14 @@ static vm_size_t pet_threads_count = 0;
 
 static kern_return_t pet_tasks_prepare(void);
 static kern_return_t pet_tasks_prepare_internal(void);
+static void pet_tasks_release(void);
 
-static kern_return_t pet_threads_prepare(task_t task);
+static kern_return_t pet_threads_prepare(task_t task, uint64_t ran_since);
 
 /* sampling */
 
 static void pet_sample_all_tasks(uint32_t idle_rate);
-static void pet_sample_task(task_t task, uint32_t idle_rate);
+static void pet_sample_task(task_t task, uint32_t idle_rate, uint64_t ran_since);
 static void pet_sample_thread(int pid, thread_t thread, uint32_t idle_rate);
 
 /* functions called by other areas of kperf */
@@ -131,7 +149,7 @@ kperf_pet_fire_before(void)
 		return;
 	}
 
-	if (lightweight_pet) {
+	if (lightweight_pet == KPERF_PET_MODE_LIGHTWEIGHT) {
 		BUF_INFO(PERF_PET_SAMPLE);
 		OSIncrementAtomic(&kperf_pet_gen);
 	}
@@ -144,7 +162,7 @@ kperf_pet_fire_after(void)
 		return;
 	}
 
-	if (lightweight_pet) {
+	if (lightweight_pet == KPERF_PET_MODE_LIGHTWEIGHT) {
 		kperf_timer_pet_rearm(0);
 	} else {
 		thread_wakeup(&pet_action_id);
@@ -239,6 +257,8 @@ pet_stop(void)
 		return;
 	}
 
+	pet_tasks_release();
+
 	if (pet_tasks != NULL) {
 		assert(pet_tasks_size != 0);
 		kfree(pet_tasks, pet_tasks_size);
@@ -262,6 +282,7 @@ pet_stop(void)
 		pet_sample = NULL;
 	}
 
+	pet_last_sample_time = 0;
 	pet_running = FALSE;
 }
 
@@ -377,8 +398,12 @@ pet_sample_thread(int pid, thread_t thread, uint32_t idle_rate)
 	BUF_VERB(PERF_PET_SAMPLE_THREAD | DBG_FUNC_END);
 }
 
+/*
+ * Reference the threads of a task that should be sampled.  If ran_since is
+ * non-zero, only threads that have run since that time are included.
+ */
 static kern_return_t
-pet_threads_prepare(task_t task)
+pet_threads_prepare(task_t task, uint64_t ran_since)
 {
 	lck_mtx_assert(pet_lock, LCK_MTX_ASSERT_OWNED);
 
@@ -424,6 +449,10 @@ pet_threads_prepare(task_t task)
 	thread_t thread;
 	pet_threads_count = 0;
 	queue_iterate(&(task->threads), thread, thread_t, task_threads) {
+		if (ran_since != 0 && !kperf_thread_get_dirty(thread) &&
+		    thread->last_run_time < ran_since) {
+			continue;
+		}
 		thread_reference_internal(thread);
 		pet_threads[pet_threads_count++] = thread;
 	}
@@ -435,19 +464,25 @@ pet_threads_prepare(task_t task)
 }
 
 static void
-pet_sample_task(task_t task, uint32_t idle_rate)
+pet_sample_task(task_t task, uint32_t idle_rate, uint64_t ran_since)
 {
 	lck_mtx_assert(pet_lock, LCK_MTX_ASSERT_OWNED);
 
 	BUF_VERB(PERF_PET_SAMPLE_TASK | DBG_FUNC_START);
 
-	kern_return_t kr = pet_threads_prepare(task);
+	kern_return_t kr = pet_threads_prepare(task, ran_since);
 	if (kr != KERN_SUCCESS) {
-		BUF_INFO(PERF_PET_ERROR, ERR_THREAD, kr);
+		/* an idle task in ran-only mode is expected, not an error */
+		if (ran_since == 0) {
+			BUF_INFO(PERF_PET_ERROR, ERR_THREAD, kr);
+		}
 		BUF_VERB(PERF_PET_SAMPLE_TASK | DBG_FUNC_END, 1);
 		return;
 	}
 
+	/* only suspend once there's something to sample */
+	boolean_t suspended = (task_suspend_internal(task) == KERN_SUCCESS);
+
 	int pid = task_pid(task);
 
 	for (unsigned int i = 0; i < pet_threads_count; i++) {
@@ -464,13 +499,17 @@ pet_sample_task(task_t task, uint32_t idle_rate)
 		}
 
 		/* the thread was not on a CPU */
-		if (cpu == machine_info.logical_cpu_max) {
+		if (suspended && cpu == machine_info.logical_cpu_max) {
 			pet_sample_thread(pid, thread, idle_rate);
 		}
 
 		thread_deallocate(pet_threads[i]);
 	}
 
+	if (suspended) {
+		task_resume_internal(task);
+	}
+
 	BUF_VERB(PERF_PET_SAMPLE_TASK | DBG_FUNC_END, pet_threads_count);
 }
 
@@ -513,11 +552,29 @@ pet_tasks_prepare_internal(void)
 	return KERN_SUCCESS;
 }
 
+static void
+pet_tasks_release(void)
+{
+	for (unsigned int i = 0; i < pet_tasks_count; i++) {
+		task_deallocate(pet_tasks[i]);
+	}
+	pet_tasks_count = 0;
+	pet_tasks_valid = FALSE;
+}
+
 static kern_return_t
 pet_tasks_prepare(void)
 {
 	lck_mtx_assert(pet_lock, LCK_MTX_ASSERT_OWNED);
 
+	/* the list from the last tick is still good if no task came or went */
+	if (pet_tasks_valid && pet_tasks_generation == tasks_generation) {
+		return KERN_SUCCESS;
+	}
+
+	/* drop the stale references before the array can be reallocated */
+	pet_tasks_release();
+
 	/* allocate space and take the tasks_threads_lock */
 	kern_return_t kr = pet_tasks_prepare_internal();
 	if (KERN_SUCCESS != kr) {
@@ -527,7 +584,6 @@ pet_tasks_prepare(void)
 
 	/* make sure the tasks are not deallocated after dropping the lock */
 	task_t task;
-	pet_tasks_count = 0;
 	queue_iterate(&tasks, task, task_t, tasks) {
 		if (task != kernel_task) {
 			task_reference_internal(task);
@@ -535,6 +591,9 @@ pet_tasks_prepare(void)
 		}
 	}
 
+	pet_tasks_generation = tasks_generation;
+	pet_tasks_valid = TRUE;
+
 	lck_mtx_unlock(&tasks_threads_lock);
 
 	return KERN_SUCCESS;
@@ -547,6 +606,14 @@ pet_sample_all_tasks(uint32_t idle_rate)
 
 	BUF_INFO(PERF_PET_SAMPLE | DBG_FUNC_START);
 
+	uint64_t now = mach_absolute_time();
+	uint64_t ran_since = 0;
+	if (lightweight_pet == KPERF_PET_MODE_RAN_ONLY) {
+		/* the first tick has nothing to compare against, so sample everyone */
+		ran_since = pet_last_sample_time;
+	}
+	pet_last_sample_time = now;
+
 	kern_return_t kr = pet_tasks_prepare();
 	if (kr != KERN_SUCCESS) {
 		BUF_INFO(PERF_PET_ERROR, ERR_TASK, kr);
@@ -555,24 +622,7 @@ pet_sample_all_tasks(uint32_t idle_rate)
 	}
 
 	for (unsigned int i = 0; i < pet_tasks_count; i++) {
-		task_t task = pet_tasks[i];
-
-		if (task != kernel_task) {
-			kr = task_suspend_internal(task);
-			if (kr != KERN_SUCCESS) {
-				continue;
-			}
-		}
-
-		pet_sample_task(task, idle_rate);
-
-		if (task != kernel_task) {
-			task_resume_internal(task);
-		}
-	}
-
-	for(unsigned int i = 0; i < pet_tasks_count; i++) {
-		task_deallocate(pet_tasks[i]);
+		pet_sample_task(pet_tasks[i], idle_rate, ran_since);
 	}
 
 	BUF_INFO(PERF_PET_SAMPLE | DBG_FUNC_END, pet_tasks_count);
@@ -607,7 +657,16 @@ kperf_set_lightweight_pet(int val)
 		return EBUSY;
 	}
 
-	lightweight_pet = (val == 1);
+	switch (val) {
+	case KPERF_PET_MODE_LIGHTWEIGHT:
+	case KPERF_PET_MODE_RAN_ONLY:
+		lightweight_pet = val;
+		break;
+	default:
+		lightweight_pet = KPERF_PET_MODE_FULL;
+		break;
+	}
+	pet_last_sample_time = 0;
 	kperf_lightweight_pet_active_update();
 
 	return 0;
@@ -616,6 +675,7 @@ kperf_set_lightweight_pet(int val)
 void
 kperf_lightweight_pet_active_update(void)
 {
-	kperf_lightweight_pet_active = (kperf_sampling_status() && lightweight_pet);
+	kperf_lightweight_pet_active = (kperf_sampling_status() &&
+	                                (lightweight_pet == KPERF_PET_MODE_LIGHTWEIGHT));
 	kperf_on_cpu_update();
 }
@@ -30,6 +30,11 @@
 
 #define KPERF_PET_DEFAULT_IDLE_RATE (15)
 
+/* values for the lightweight_pet sysctl */
+#define KPERF_PET_MODE_FULL        (0) /* PET thread samples every thread */
+#define KPERF_PET_MODE_LIGHTWEIGHT (1) /* threads sample themselves on-core */
+#define KPERF_PET_MODE_RAN_ONLY    (2) /* PET thread samples threads that ran */
+
 extern boolean_t kperf_lightweight_pet_active;
 extern uint32_t kperf_pet_gen;
 
@@ -48,7 +53,7 @@ void kperf_pet_on_cpu(thread_t thread, thread_continue_t continuation,
 int kperf_get_pet_idle_rate(void);
 int kperf_set_pet_idle_rate(int val);
 
-/* get/set whether lightweight PET is enabled */
+/* get/set the PET mode, one of KPERF_PET_MODE_* */
 int kperf_get_lightweight_pet(void);
 int kperf_set_lightweight_pet(int val);
 
@@ -113,6 +113,12 @@ struct procinfo_coalinfo {
 	uint32_t coalition_tasks;
 };
 
+/* structure returned by the kern.coalition_resource_usage sysctl */
+struct procinfo_coalusage {
+	uint64_t coalition_id;
+	struct coalition_resource_usage coalition_usage;
+};
+
 #endif /* PRIVATE */
 
 #ifdef XNU_KERNEL_PRIVATE
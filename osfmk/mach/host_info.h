@@ -281,6 +281,47 @@ struct _processor_statistics_np  {
 	uint32_t		ps_quantum_timer_expirations;
 };
 
+/*
+ * Thread placement statistics, maintained while sched stats are enabled.
+ * One entry per processor, counting the threads dispatched on it.
+ */
+struct _processor_cache_stats_np {
+	int32_t			pcs_cpuid;
+	int32_t			pcs_pset_cpu;		/* lowest cpu id of the processor set */
+
+	uint32_t		pcs_migration_count;		/* thread last ran on another processor */
+	uint32_t		pcs_pset_migration_count;	/* ... in another processor set */
+	uint32_t		pcs_cache_hot_count;		/* cache-hot thread from this processor set */
+	uint32_t		pcs_cache_hot_migration_count;	/* cache-hot thread from another processor set */
+};
+
+#define _PROCESSOR_RUNQ_DEPTH_BUCKETS	8
+#define _PROCESSOR_WAIT_BUCKETS		16
+
+/*
+ * Run queue depth and wait time statistics, maintained while sched stats
+ * are enabled.  One entry per processor, then one per processor set for its
+ * realtime queue with prs_cpuid -1.  Histograms are halved every 5 seconds.
+ */
+struct _processor_runq_stats_np {
+	int32_t			prs_cpuid;
+	int32_t			prs_pset_cpu;		/* lowest cpu id of the processor set */
+
+	uint32_t		prs_runq_count;		/* current depth */
+	uint32_t		prs_load_average[3];	/* 5s, 30s and 1m depth averages, scaled by LOAD_SCALE */
+
+	/* time spent at depth 0, 1, 2-3, 4-7, ... 64 and up */
+	uint64_t		prs_depth_ns[_PROCESSOR_RUNQ_DEPTH_BUCKETS];
+
+	/* dispatches by time spent runnable: under 1024 ns, then doubling */
+	uint64_t		prs_wait_count[_PROCESSOR_WAIT_BUCKETS];
+
+	/* percentiles of the wait histogram, as bucket upper bounds */
+	uint64_t		prs_wait_p50_ns;
+	uint64_t		prs_wait_p90_ns;
+	uint64_t		prs_wait_p99_ns;
+};
+
 struct host_debug_info_internal {
 	uint64_t config_bank:1,   /* built configurations */
 		 config_atm:1,
@@ -304,6 +345,14 @@ extern kern_return_t	set_sched_stats_active(
 extern kern_return_t	get_sched_statistics(
 					struct _processor_statistics_np *out,
 					uint32_t *count);
+
+extern kern_return_t	get_sched_runq_statistics(
+					struct _processor_runq_stats_np *out,
+					uint32_t *count);
+
+extern kern_return_t	get_sched_cache_statistics(
+					struct _processor_cache_stats_np *out,
+					uint32_t *count);
 #endif  /* KERNEL_PRIVATE */
 
 
@@ -146,4 +146,26 @@ typedef struct mach_memory_info {
 
 typedef mach_memory_info_t *mach_memory_info_array_t;
 
+#ifdef	PRIVATE
+
+/*
+ *	A live allocation site seen by the sampling allocation profiler,
+ *	as returned by the kern.zsample_sites sysctl.
+ */
+
+#define ZSAMPLE_MAX_DEPTH	14
+#define ZSAMPLE_SITE_KALLOC	0xffffffffU	/* kalloc allocations too large for a zone */
+
+typedef struct zsample_site_info {
+	uint64_t	zsi_live_bytes;		/* estimated bytes still allocated */
+	uint64_t	zsi_total_samples;	/* samples ever taken at this site */
+	uint32_t	zsi_live_samples;	/* samples not freed yet */
+	uint32_t	zsi_site;		/* zone index, or ZSAMPLE_SITE_KALLOC */
+	uint32_t	zsi_id;			/* stable while the site has live samples */
+	uint32_t	zsi_depth;		/* valid entries in zsi_frames */
+	uint64_t	zsi_frames[ZSAMPLE_MAX_DEPTH];	/* unslid return addresses */
+} zsample_site_info_t;
+
+#endif	/* PRIVATE */
+
 #endif	/* _MACH_DEBUG_ZONE_INFO_H_ */
@@ -4513,10 +4513,10 @@ vm_pageout_garbage_collect(int collect)
 			}
 			if (first_try == TRUE || buf_large_zfree == TRUE) {
 				/*
-				 * consider_zone_gc should be last, because the other operations
+				 * consider_zone_reclaim should be last, because the other operations
 				 * might return memory to zones.
 				 */
-				consider_zone_gc();
+				consider_zone_reclaim();
 			}
 			first_try = FALSE;
 
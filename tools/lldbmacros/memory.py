@@ -437,6 +437,22 @@ def ShowZfreeList(cmd_args=None):
 
 # EndMacro: showzfreelist
 
+def GetBtlogShards(btlog_ptr):
+    """ Helper routine returning the shards of a btlog
+        params:
+            btlog_ptr:btlog_t * - A BTLog
+        returns:
+            list of btlog_shard_t *
+    """
+    shard_size = unsigned(sizeof('btlog_shard_t'))
+    shards_addr = unsigned(btlog_ptr) + unsigned(sizeof('struct btlog'))
+    return [kern.GetValueFromAddress(shards_addr + i * shard_size, 'btlog_shard_t *') for i in range(unsigned(btlog_ptr.shard_count))]
+
+def GetBtlogActiveElementCount(btlog_ptr):
+    """ Helper routine returning the number of elements logged in all shards of a btlog
+    """
+    return sum(unsigned(shard.active_element_count) for shard in GetBtlogShards(btlog_ptr))
+
 # Macro: zstack_showzonesbeinglogged
 
 @lldb_command('zstack_showzonesbeinglogged')
@@ -468,17 +484,16 @@ def Zstack(cmd_args=None):
         return
 
     btlog_ptr = kern.GetValueFromAddress(cmd_args[0], 'btlog_t *')
-    btrecords_total_size = unsigned(btlog_ptr.btlog_buffersize)
     btrecord_size = unsigned(btlog_ptr.btrecord_size)
     btrecords = unsigned(btlog_ptr.btrecords)
-    btlog_size = unsigned(sizeof('struct btlog'))
     depth = unsigned(btlog_ptr.btrecord_btdepth)
+    elements_count = GetBtlogActiveElementCount(btlog_ptr)
     zstack_index = ArgumentStringToInt(cmd_args[1])
     count = 1
     if len(cmd_args) >= 3:
         count = ArgumentStringToInt(cmd_args[2])
 
-    max_count = ((btrecords_total_size - btlog_size)/btrecord_size)
+    max_count = unsigned(btlog_ptr.btrecord_count)
 
     if (zstack_index + count) > max_count:
        count = max_count - zstack_index
@@ -487,7 +502,7 @@ def Zstack(cmd_args=None):
         zstack_record_offset = zstack_index * btrecord_size
         zstack_record = kern.GetValueFromAddress(btrecords + zstack_record_offset, 'btlog_record_t *')
         if int(zstack_record.ref_count)!=0:
-           ShowZStackRecord(zstack_record, zstack_index, depth, unsigned(btlog_ptr.active_element_count))
+           ShowZStackRecord(zstack_record, zstack_index, depth, elements_count)
         zstack_index += 1
         count -= 1
 
@@ -508,22 +523,22 @@ def ZstackInOrder(cmd_args=None):
         return
 
     btlog_ptr = kern.GetValueFromAddress(cmd_args[0], 'btlog_t *')
-    btrecords_total_size = unsigned(btlog_ptr.btlog_buffersize)
     btrecord_size = unsigned(btlog_ptr.btrecord_size)
     btrecords = unsigned(btlog_ptr.btrecords)
-    btlog_size = unsigned(sizeof('struct btlog'))
     depth = unsigned(btlog_ptr.btrecord_btdepth)
-    zstack_head = unsigned(btlog_ptr.head)
-    zstack_index = zstack_head
-    zstack_tail = unsigned(btlog_ptr.tail)
-    count = ((btrecords_total_size - btlog_size)/btrecord_size)
+    elements_count = GetBtlogActiveElementCount(btlog_ptr)
 
-    while count and (zstack_index != 0xffffff):
-        zstack_record_offset = zstack_index * btrecord_size
-        zstack_record = kern.GetValueFromAddress(btrecords + zstack_record_offset, 'btlog_record_t *')
-        ShowZStackRecord(zstack_record, zstack_index, depth, unsigned(btlog_ptr.active_element_count))
-        zstack_index = zstack_record.next
-        count -= 1
+    # records are kept in order per shard
+    for shard in GetBtlogShards(btlog_ptr):
+        zstack_index = unsigned(shard.head)
+        count = unsigned(shard.record_count)
+
+        while count and (zstack_index != 0xffffff):
+            zstack_record_offset = zstack_index * btrecord_size
+            zstack_record = kern.GetValueFromAddress(btrecords + zstack_record_offset, 'btlog_record_t *')
+            ShowZStackRecord(zstack_record, zstack_index, depth, elements_count)
+            zstack_index = zstack_record.next
+            count -= 1
 
 # EndMacro : zstack_inorder
 
@@ -552,21 +567,22 @@ def zstack_findleak(cmd_args=None):
     btrecord_size = unsigned(btlog_ptr.btrecord_size)
     btrecords = unsigned(btlog_ptr.btrecords)
 
-    cpcs_index = unsigned(btlog_ptr.head)
     depth = unsigned(btlog_ptr.btrecord_btdepth)
     highref = 0
     highref_index = 0
     highref_record = 0
 
-    while cpcs_index != 0xffffff:
-        cpcs_record_offset = cpcs_index * btrecord_size
-        cpcs_record = kern.GetValueFromAddress(btrecords + cpcs_record_offset, 'btlog_record_t *')
-        if cpcs_record.ref_count > highref:
-                highref_record = cpcs_record
-                highref = cpcs_record.ref_count
-                highref_index = cpcs_index
-        cpcs_index = cpcs_record.next
-    ShowZStackRecord(highref_record, highref_index, depth, unsigned(btlog_ptr.active_element_count))
+    for shard in GetBtlogShards(btlog_ptr):
+        cpcs_index = unsigned(shard.head)
+        while cpcs_index != 0xffffff:
+            cpcs_record_offset = cpcs_index * btrecord_size
+            cpcs_record = kern.GetValueFromAddress(btrecords + cpcs_record_offset, 'btlog_record_t *')
+            if cpcs_record.ref_count > highref:
+                    highref_record = cpcs_record
+                    highref = cpcs_record.ref_count
+                    highref_index = cpcs_index
+            cpcs_index = cpcs_record.next
+    ShowZStackRecord(highref_record, highref_index, depth, GetBtlogActiveElementCount(btlog_ptr))
 
 # EndMacro: zstack_findleak
 
@@ -607,34 +623,36 @@ def ZStackFindElem(cmd_args=None):
 
     prev_op = -1
     scan_items = 0
-    hashelem = cast(btlog_ptr.elem_linkage_un.element_hash_queue.tqh_first, 'btlog_element_t *')
     if (target_element >> 32) != 0:
         target_element = target_element ^ 0xFFFFFFFFFFFFFFFF
     else:
         target_element = target_element ^ 0xFFFFFFFF
-    while hashelem != 0:
-        if unsigned(hashelem.elem) == target_element:
-            recindex = hashelem.recindex
-            recoffset = recindex * btrecord_size
-            record = kern.GetValueFromAddress(btrecords + recoffset, 'btlog_record_t *')
-            out_str = ('-' * 8)
-            if record.operation == 1:
-               out_str += "OP: ALLOC. "
-            else:
-               out_str += "OP: FREE.  "
-            out_str += "Stack Index {0: <d} {1: <s}\n".format(recindex, ('-' * 8))
-            print out_str
-            print GetBtlogBacktrace(depth, record)
-            print " \n"
-            if int(record.operation) == prev_op:
-                print "{0: <s} DOUBLE OP! {1: <s}".format(('*' * 8), ('*' * 8))
-                return
-            prev_op = int(record.operation)
-            scan_items = 0
-        hashelem = cast(hashelem.element_hash_link.tqe_next, 'btlog_element_t *')
-        scan_items += 1
-        if scan_items % 100 == 0:
-           print "Scanning is ongoing. {0: <d} items scanned since last check." .format(scan_items)
+    # all entries for an element are logged in the same shard
+    for shard in GetBtlogShards(btlog_ptr):
+        hashelem = cast(shard.elem_linkage_un.element_hash_queue.tqh_first, 'btlog_element_t *')
+        while hashelem != 0:
+            if unsigned(hashelem.elem) == target_element:
+                recindex = hashelem.recindex
+                recoffset = recindex * btrecord_size
+                record = kern.GetValueFromAddress(btrecords + recoffset, 'btlog_record_t *')
+                out_str = ('-' * 8)
+                if record.operation == 1:
+                   out_str += "OP: ALLOC. "
+                else:
+                   out_str += "OP: FREE.  "
+                out_str += "Stack Index {0: <d} {1: <s}\n".format(recindex, ('-' * 8))
+                print out_str
+                print GetBtlogBacktrace(depth, record)
+                print " \n"
+                if int(record.operation) == prev_op:
+                    print "{0: <s} DOUBLE OP! {1: <s}".format(('*' * 8), ('*' * 8))
+                    return
+                prev_op = int(record.operation)
+                scan_items = 0
+            hashelem = cast(hashelem.element_hash_link.tqe_next, 'btlog_element_t *')
+            scan_items += 1
+            if scan_items % 100 == 0:
+               print "Scanning is ongoing. {0: <d} items scanned since last check." .format(scan_items)
 
 # EndMacro: zstack_findelem
 
@@ -52,14 +52,39 @@ def dumpTimerList(anchor):
     """
     Utility function to dump the timer entries in list (anchor).
     """
-    entry = Cast(anchor.head, 'queue_t')
-    if entry == addressof(anchor):
+    dumpTimerEntries([anchor.head])
+
+def dumpTimerWheel(wheel):
+    """
+    Utility function to dump the timer entries on a longterm timer wheel,
+    level by level and then the overflow list.
+    """
+    levels = sizeof(wheel.slots) / sizeof(wheel.slots[0])
+    nslots = sizeof(wheel.slots[0]) / sizeof(wheel.slots[0][0])
+    slots = []
+    for level in range(levels):
+        for idx in range(nslots):
+            slots.append(wheel.slots[level][idx])
+    slots.append(wheel.overflow)
+    dumpTimerEntries(slots)
+
+def dumpTimerEntries(heads):
+    """
+    Utility function to dump the timer entries on a list of queue heads.
+    """
+    heads = [head for head in heads if Cast(head.next, 'queue_t') != addressof(head)]
+    if len(heads) == 0:
         print '(empty)'
         return
 
     thdr = ' {:<22s}{:<17s}{:<16s} {:<14s} {:<18s}'
     print thdr.format('entry:','deadline','soft_deadline','to go','(*func)(param0,param1')
-    while entry != addressof(anchor):
+    for head in heads:
+        dumpTimerQueue(head)
+
+def dumpTimerQueue(head):
+    entry = Cast(head.next, 'queue_t')
+    while entry != addressof(head):
         timer_call = Cast(entry, 'timer_call_t')
         call_entry = Cast(entry, 'struct call_entry *')
         debugger_entry = kern.globals.debugger_entry_time
@@ -125,7 +150,9 @@ def longtermTimers(cmd_args=None):
     print     ' threshold.latency   : {:d}'    .format(ltt.latency)
     print     '               - min : {:d}'    .format(ltt.latency_min)
     print     '               - max : {:d}'    .format(ltt.latency_max)
-    dumpTimerList(lt.queue)
+    print     ' wheel.tick          : {:d}'    .format(lt.wheel.tick)
+    print     ' wheel.cascades      : {:d}'    .format(lt.wheel.cascades)
+    dumpTimerWheel(lt.wheel)
 
 
 @lldb_command('processortimers')
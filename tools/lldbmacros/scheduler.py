@@ -15,7 +15,10 @@ def ShowAllProcRunQCount(cmd_args=None):
     while processor_itr:
         out_str += "{:d}\t\t{:d}\n".format(processor_itr.cpu_id, processor_itr.runq.count)
         processor_itr = processor_itr.processor_list
-    out_str += "RT:\t\t{:d}\n".format(kern.globals.rt_runq.count)
+    pset = addressof(kern.globals.pset0)
+    while unsigned(pset) != 0:
+        out_str += "RT {: <#012x}:\t{:d}\n".format(pset, pset.rt_runq.count)
+        pset = pset.pset_list
     print out_str
 
 # EndMacro: showallprocrunqcount
@@ -561,13 +564,14 @@ def ShowScheduler(cmd_args=None):
         print " \n"
 
 
-        pset = pset.pset_list
+        print "Realtime Queue ({:<#012x}) Count {:d}\n".format(addressof(pset.rt_runq.queue), pset.rt_runq.count)
+        if pset.rt_runq.count != 0:
+            print "\t" + GetThreadSummary.header + "\n"
+            for rt_runq_thread in ParanoidIterateLinkageChain(pset.rt_runq.queue, "thread_t", "runq_links"):
+                print "\t" + GetThreadSummary(rt_runq_thread) + "\n"
+        print " \n"
 
-    print "\nRealtime Queue ({:<#012x}) Count {:d}\n".format(addressof(kern.globals.rt_runq.queue), kern.globals.rt_runq.count)
-    if kern.globals.rt_runq.count != 0:
-        print "\t" + GetThreadSummary.header + "\n"
-        for rt_runq_thread in ParanoidIterateLinkageChain(kern.globals.rt_runq.queue, "thread_t", "runq_links"):
-            print "\t" + GetThreadSummary(rt_runq_thread) + "\n"
+        pset = pset.pset_list
 
     print "\nTerminate Queue: ({:<#012x})\n".format(addressof(kern.globals.thread_terminate_queue))
     first = False
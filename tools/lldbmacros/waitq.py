@@ -69,6 +69,14 @@ def WaitqTableGenFromId(id):
         shift += 1
     return (unsigned(id) >> shift) & msk
 
+def GetLtableCachedElemCount(table):
+    """ Count the free elements held in the per-CPU caches of a link table
+    """
+    ncached = 0
+    for i in range(unsigned(table.ncpu_cache)):
+        ncached += unsigned(table.cpu_cache[i].avail)
+    return ncached
+
 def GetWaitqLink(id):
     if int(id) == 0:
         return 0, "NULL link id"
@@ -576,6 +584,8 @@ def ShowAllSetidLinks(cmd_args=None, cmd_options={}):
 
     nused = nwqs + nlink + nrsvd
     nfound = nused + nfree + ninv
+    # free elements parked in per-CPU caches are still counted as used
+    nused += GetLtableCachedElemCount(table)
     print "\n\nFound {:d} objects: {:d} WQS, {:d} LINK, {:d} RSVD, {:d} FREE".format(nfound, nwqs, nlink, nrsvd, nfree)
     if (opt_type_filt == "" and opt_valid_only == 0) and (nused != table.used_elem):
         print"\tWARNING: inconsistent state! Table reports {:d}/{:d} used elem, found {:d}/{:d}".format(table.used_elem, nelem, nused, nfound)
@@ -701,6 +711,8 @@ def ShowAllPreposts(cmd_args=None, cmd_options={}):
         id += 1
     nused = nwq + npost + nrsvd
     nfound = nused + nfree + ninv
+    # free elements parked in per-CPU caches are still counted as used
+    nused += GetLtableCachedElemCount(table)
     print "\nFound {:d} objects: {:d} WQ, {:d} POST, {:d} RSVD, {:d} FREE".format(nfound, nwq, npost, nrsvd, nfree)
     if (opt_type_filt == "" and opt_valid_only == 0) and (nused != table.used_elem):
         print"\tWARNING: inconsistent state! Table reports {:d}/{:d} used elem, found {:d}/{:d}".format(table.used_elem, nelem, nused, nfound)
@@ -993,7 +1005,7 @@ def ShowGlobalWaitqs(cmd_args=None):
     print GetWaitqSummary.header
 
     while q < kern.globals.g_num_waitqs:
-        print GetWaitqSummary(addressof(kern.globals.global_waitqs[q]))
+        print GetWaitqSummary(addressof(kern.globals.global_waitqs[q].wqb_waitq))
         q = q + 1
 # EndMacro: showglobalwaitqs
 
@@ -1026,7 +1038,7 @@ def ShowGlobalQStats(cmd_args=None, cmd_options={}):
 
     fmt_str = "{q: <#18x} {stats.waits: <8d} {stats.wakeups: <8d} {diff: <8d} {stats.failed_wakeups: <8d} {stats.clears: <8d} {bt_str: <s}"
     while q < kern.globals.g_num_waitqs:
-        waitq = kern.globals.global_waitqs[q]
+        waitq = kern.globals.global_waitqs[q].wqb_waitq
         stats = kern.globals.g_waitq_stats[q]
         diff = stats.waits - stats.wakeups
         if diff == 0 and waiters_only:
@@ -0,0 +1,86 @@
+#ifdef T_NAMESPACE
+#undef T_NAMESPACE
+#endif
+#include <darwintest.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/sysctl.h>
+#include <unistd.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.perf.btlog"),
+	T_META_ASROOT(true),
+	T_META_CHECK_LEAKS(false)
+);
+
+#define ENTRIES_PER_THREAD 20000
+
+static pthread_barrier_t start_barrier;
+
+static void
+log_from_kernel(int count)
+{
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("debug.btlog_stress", NULL, NULL, &count, sizeof(count)),
+	                                "sysctl debug.btlog_stress");
+}
+
+static void *
+btlog_thread(__unused void *arg)
+{
+	pthread_barrier_wait(&start_barrier);
+	log_from_kernel(ENTRIES_PER_THREAD);
+	return NULL;
+}
+
+/*
+ * Measure how long it takes nthreads threads to each do ENTRIES_PER_THREAD
+ * btlog add/remove pairs against the same log at the same time.
+ */
+static void
+run_btlog_test(int nthreads)
+{
+	pthread_t *threads = calloc((size_t)nthreads, sizeof(pthread_t));
+	T_QUIET; T_ASSERT_NOTNULL(threads, "calloc");
+
+	dt_stat_time_t s = dt_stat_time_create("%d_threads", nthreads);
+
+	do {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_barrier_init(&start_barrier, NULL, (unsigned)nthreads + 1),
+		                             "pthread_barrier_init");
+		for (int i = 0; i < nthreads; i++) {
+			T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&threads[i], NULL, btlog_thread, NULL), "pthread_create");
+		}
+
+		dt_stat_token start = dt_stat_time_begin(s);
+		pthread_barrier_wait(&start_barrier);
+		for (int i = 0; i < nthreads; i++) {
+			pthread_join(threads[i], NULL);
+		}
+		dt_stat_time_end_batch(s, nthreads * ENTRIES_PER_THREAD, start);
+
+		pthread_barrier_destroy(&start_barrier);
+	} while (!dt_stat_stable(s));
+
+	dt_stat_finalize(s);
+	free(threads);
+}
+
+T_DECL(btlog_scaling,
+       "Measure the cost of logging an allocation to a shared btlog as more CPUs log at once") {
+	int ncpu = 0;
+	size_t ncpu_size = sizeof(ncpu);
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("hw.ncpu", &ncpu, &ncpu_size, NULL, 0), "hw.ncpu");
+
+	int count = 0;
+	if (sysctlbyname("debug.btlog_stress", NULL, NULL, &count, sizeof(count)) != 0) {
+		T_SKIP("debug.btlog_stress is only available on development kernels");
+	}
+
+	for (int nthreads = 1; nthreads < ncpu && nthreads < 64; nthreads *= 2) {
+		run_btlog_test(nthreads);
+	}
+	run_btlog_test(ncpu < 64 ? ncpu : 64);
+}
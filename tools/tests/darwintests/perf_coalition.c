@@ -0,0 +1,70 @@
+#ifdef T_NAMESPACE
+#undef T_NAMESPACE
+#endif
+#include <darwintest.h>
+
+#include <errno.h>
+#include <mach/coalition.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/coalition.h>
+#include <sys/sysctl.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.perf.coalition"),
+	T_META_CHECK_LEAKS(false)
+);
+
+static struct procinfo_coalusage *
+get_all_usage(size_t *count)
+{
+	struct procinfo_coalusage *usage;
+	size_t size = 0;
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.coalition_resource_usage", NULL, &size, NULL, 0),
+	                                "sysctl kern.coalition_resource_usage size");
+	usage = malloc(size);
+	T_QUIET; T_ASSERT_NOTNULL(usage, "malloc");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.coalition_resource_usage", usage, &size, NULL, 0),
+	                                "sysctl kern.coalition_resource_usage");
+	*count = size / sizeof(*usage);
+	return usage;
+}
+
+T_DECL(coalition_resource_usage_all,
+       "Cost of a resource usage snapshot of every resource coalition, one call per coalition and batched") {
+	struct procinfo_coalusage *usage;
+	size_t count = 0, size = 0;
+
+	if (sysctlbyname("kern.coalition_resource_usage", NULL, &size, NULL, 0) != 0) {
+		T_SKIP("kern.coalition_resource_usage is not available");
+	}
+
+	usage = get_all_usage(&count);
+	T_ASSERT_GT(count, (size_t)0, "found %zu resource coalitions", count);
+	T_LOG("%zu resource coalitions", count);
+
+	dt_stat_time_t s = dt_stat_time_create("coalition_info_per_coalition");
+	do {
+		dt_stat_token start = dt_stat_time_begin(s);
+		for (size_t i = 0; i < count; i++) {
+			struct coalition_resource_usage cru;
+			/* coalitions that exited since the listing just fail */
+			(void)coalition_info_resource_usage(usage[i].coalition_id, &cru, sizeof(cru));
+		}
+		dt_stat_time_end(s, start);
+	} while (!dt_stat_stable(s));
+	dt_stat_finalize(s);
+
+	s = dt_stat_time_create("coalition_resource_usage_batch");
+	do {
+		size = count * sizeof(*usage);
+		dt_stat_token start = dt_stat_time_begin(s);
+		int ret = sysctlbyname("kern.coalition_resource_usage", usage, &size, NULL, 0);
+		dt_stat_time_end(s, start);
+		T_QUIET; T_ASSERT_TRUE(ret == 0 || errno == ENOMEM, "sysctl kern.coalition_resource_usage");
+	} while (!dt_stat_stable(s));
+	dt_stat_finalize(s);
+
+	free(usage);
+}
@@ -0,0 +1,109 @@
+#ifdef T_NAMESPACE
+#undef T_NAMESPACE
+#endif
+#include <darwintest.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/sysctl.h>
+#include <unistd.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.perf.lck_mtx"),
+	T_META_ASROOT(true),
+	T_META_CHECK_LEAKS(false)
+);
+
+#define ACQUISITIONS_PER_THREAD 20000
+
+struct spin_stats {
+	uint64_t spins;
+	uint64_t acquired;
+	uint64_t timeouts;
+	uint64_t owner_offcore;
+};
+
+static uint64_t
+spin_stat(const char *name)
+{
+	char oid[64];
+	uint64_t value = 0;
+	size_t size = sizeof(value);
+
+	snprintf(oid, sizeof(oid), "kern.lck_mtx_spin.%s", name);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(oid, &value, &size, NULL, 0), "%s", oid);
+	return value;
+}
+
+static void
+read_spin_stats(struct spin_stats *stats)
+{
+	stats->spins = spin_stat("spins");
+	stats->acquired = spin_stat("acquired");
+	stats->timeouts = spin_stat("timeouts");
+	stats->owner_offcore = spin_stat("owner_offcore");
+}
+
+static void *
+contend_thread(__unused void *arg)
+{
+	int count = ACQUISITIONS_PER_THREAD;
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("debug.lck_mtx_contend", NULL, NULL, &count, sizeof(count)),
+	                                "sysctl debug.lck_mtx_contend");
+	return NULL;
+}
+
+/*
+ * Measure the cost of a contended mutex acquisition with nthreads
+ * contenders, each holding the mutex for hold_ns.
+ */
+static void
+run_contend_test(int nthreads, int hold_ns)
+{
+	struct spin_stats before, after;
+	pthread_t *threads = calloc((size_t)nthreads, sizeof(pthread_t));
+	T_QUIET; T_ASSERT_NOTNULL(threads, "calloc");
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("debug.lck_mtx_contend_hold_ns", NULL, NULL, &hold_ns, sizeof(hold_ns)),
+	                                "sysctl debug.lck_mtx_contend_hold_ns");
+
+	dt_stat_time_t s = dt_stat_time_create("lck_mtx_%d_threads_%dns_hold", nthreads, hold_ns);
+	read_spin_stats(&before);
+
+	do {
+		dt_stat_token start = dt_stat_time_begin(s);
+		for (int i = 0; i < nthreads; i++) {
+			T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&threads[i], NULL, contend_thread, NULL), "pthread_create");
+		}
+		for (int i = 0; i < nthreads; i++) {
+			pthread_join(threads[i], NULL);
+		}
+		dt_stat_time_end_batch(s, nthreads * ACQUISITIONS_PER_THREAD, start);
+	} while (!dt_stat_stable(s));
+
+	dt_stat_finalize(s);
+	read_spin_stats(&after);
+
+	uint64_t spins = after.spins - before.spins;
+	uint64_t acquired = after.acquired - before.acquired;
+	T_LOG("%d threads, %dns hold: %llu spins, %llu%% acquired, %llu timeouts, %llu owner off-core",
+	      nthreads, hold_ns, spins, spins ? acquired * 100 / spins : 0,
+	      after.timeouts - before.timeouts, after.owner_offcore - before.owner_offcore);
+	free(threads);
+}
+
+T_DECL(lck_mtx_contention,
+       "Contended lck_mtx acquisition cost and spin success rate from 2 to 64 threads") {
+	int count = 0;
+	if (sysctlbyname("debug.lck_mtx_contend", NULL, NULL, &count, sizeof(count)) != 0) {
+		T_SKIP("debug.lck_mtx_contend is only available on development kernels");
+	}
+
+	for (int nthreads = 2; nthreads <= 64; nthreads *= 2) {
+		run_contend_test(nthreads, 100);
+		run_contend_test(nthreads, 5000);
+	}
+}
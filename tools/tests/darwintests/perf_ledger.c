@@ -0,0 +1,70 @@
+#ifdef T_NAMESPACE
+#undef T_NAMESPACE
+#endif
+#include <darwintest.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/sysctl.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.perf.ledger"),
+	T_META_CHECK_LEAKS(false)
+);
+
+#define UPDATES_PER_THREAD	100000
+#define MAX_THREADS		64
+
+/*
+ * Every thread credits and debits the same entry of this task's ledger,
+ * through the sysctl named by arg.
+ */
+static void *
+hammer_thread(void *arg)
+{
+	const char *oid = arg;
+	int count = UPDATES_PER_THREAD;
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(oid, NULL, NULL, &count, sizeof(count)), "%s", oid);
+	return NULL;
+}
+
+static void
+run_hammer_test(const char *name, int nthreads)
+{
+	char oid[64];
+	pthread_t *threads = calloc((size_t)nthreads, sizeof(pthread_t));
+	T_QUIET; T_ASSERT_NOTNULL(threads, "calloc");
+
+	snprintf(oid, sizeof(oid), "debug.ledger_hammer_%s", name);
+	dt_stat_time_t s = dt_stat_time_create("ledger_%s_%d_threads", name, nthreads);
+
+	do {
+		dt_stat_token start = dt_stat_time_begin(s);
+		for (int i = 0; i < nthreads; i++) {
+			T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&threads[i], NULL, hammer_thread, oid), "pthread_create");
+		}
+		for (int i = 0; i < nthreads; i++) {
+			pthread_join(threads[i], NULL);
+		}
+		dt_stat_time_end_batch(s, nthreads * UPDATES_PER_THREAD, start);
+	} while (!dt_stat_stable(s));
+
+	dt_stat_finalize(s);
+	free(threads);
+}
+
+T_DECL(ledger_contention,
+       "Cost of a credit/debit pair on one task ledger entry from 1 to 64 threads, per-CPU and direct") {
+	int count = 0;
+	if (sysctlbyname("debug.ledger_hammer_percpu", NULL, NULL, &count, sizeof(count)) != 0) {
+		T_SKIP("debug.ledger_hammer_percpu is only available on development kernels");
+	}
+
+	for (int nthreads = 1; nthreads <= MAX_THREADS; nthreads *= 2) {
+		run_hammer_test("percpu", nthreads);
+		run_hammer_test("direct", nthreads);
+	}
+}
@@ -0,0 +1,134 @@
+#ifdef T_NAMESPACE
+#undef T_NAMESPACE
+#endif
+#include <darwintest.h>
+
+#include <kern/kcdata.h>
+#include <libproc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/proc_info.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.perf.proc_bulkinfo"),
+	T_META_ASROOT(true),
+	T_META_CHECK_LEAKS(false)
+);
+
+/* From bsd/sys/proc_info.h */
+extern int __proc_info(int callnum, int pid, int flavor, uint64_t arg, void *buffer, int buffersize);
+
+#ifndef PROC_INFO_CALL_BULKINFO
+#define PROC_INFO_CALL_BULKINFO	0xd
+#endif
+#ifndef PROC_BULKINFO_THREADS
+#define PROC_BULKINFO_THREADS	0x1
+#endif
+
+static void *
+bulkinfo(uint32_t flags, int *size)
+{
+	void *buffer;
+	int needed;
+
+	needed = __proc_info(PROC_INFO_CALL_BULKINFO, PROC_ALL_PIDS, 0, flags, NULL, 0);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(needed, "proc_info bulkinfo size");
+	buffer = malloc((size_t)needed);
+	T_QUIET; T_ASSERT_NOTNULL(buffer, "malloc");
+	*size = __proc_info(PROC_INFO_CALL_BULKINFO, PROC_ALL_PIDS, 0, flags, buffer, needed);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(*size, "proc_info bulkinfo");
+	return buffer;
+}
+
+/* Count the task containers and check that this process is among them */
+static int
+count_tasks(void *buffer, int size)
+{
+	kcdata_iter_t iter = kcdata_iter(buffer, (unsigned long)size);
+	struct proc_bulkinfo_header *header = NULL;
+	int ntasks = 0;
+	int found_self = 0;
+
+	T_QUIET; T_ASSERT_EQ(kcdata_iter_type(iter), KCDATA_BUFFER_BEGIN_PROC_BULKINFO, "kcdata magic");
+
+	KCDATA_ITER_FOREACH(iter) {
+		switch (kcdata_iter_type(iter)) {
+		case PROC_BULKINFO_KCTYPE_HEADER:
+			header = kcdata_iter_payload(iter);
+			break;
+		case PROC_BULKINFO_KCTYPE_TASK: {
+			struct proc_bulkinfo_task *pbt = kcdata_iter_payload(iter);
+			ntasks++;
+			if (pbt->pbt_pid == getpid()) {
+				found_self = 1;
+				T_QUIET; T_ASSERT_GT(pbt->pbt_phys_footprint, 0ULL, "own footprint");
+				T_QUIET; T_ASSERT_GT(pbt->pbt_user_time + pbt->pbt_system_time, 0ULL, "own CPU time");
+			}
+			break;
+		}
+		}
+	}
+
+	T_QUIET; T_ASSERT_NOTNULL(header, "bulkinfo header");
+	T_QUIET; T_ASSERT_EQ((int)header->pbh_task_count, ntasks, "header task count");
+	T_QUIET; T_ASSERT_TRUE(found_self, "own process reported");
+	return ntasks;
+}
+
+T_DECL(proc_bulkinfo_all,
+       "Cost of sampling CPU, memory and I/O counters of every process, one pid at a time and batched") {
+	int size, npids, ntasks;
+	void *buffer;
+	int *pids;
+
+	if (__proc_info(PROC_INFO_CALL_BULKINFO, PROC_ALL_PIDS, 0, 0, NULL, 0) < 0) {
+		T_SKIP("PROC_INFO_CALL_BULKINFO is not available");
+	}
+
+	buffer = bulkinfo(0, &size);
+	ntasks = count_tasks(buffer, size);
+	free(buffer);
+	T_LOG("%d processes", ntasks);
+
+	npids = proc_listallpids(NULL, 0);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(npids, "proc_listallpids size");
+	pids = calloc((size_t)npids, sizeof(int));
+	T_QUIET; T_ASSERT_NOTNULL(pids, "calloc");
+
+	dt_stat_time_t s = dt_stat_time_create("proc_pidinfo_per_pid");
+	do {
+		dt_stat_token start = dt_stat_time_begin(s);
+		int n = proc_listallpids(pids, npids * (int)sizeof(int));
+		for (int i = 0; i < n; i++) {
+			struct proc_taskinfo pti;
+			struct rusage_info_v2 ri;
+			/* processes that exited since the listing just fail */
+			(void)proc_pidinfo(pids[i], PROC_PIDTASKINFO, 0, &pti, sizeof(pti));
+			(void)proc_pid_rusage(pids[i], RUSAGE_INFO_V2, (rusage_info_t *)&ri);
+		}
+		dt_stat_time_end(s, start);
+	} while (!dt_stat_stable(s));
+	dt_stat_finalize(s);
+
+	s = dt_stat_time_create("proc_bulkinfo_batch");
+	do {
+		dt_stat_token start = dt_stat_time_begin(s);
+		buffer = bulkinfo(0, &size);
+		dt_stat_time_end(s, start);
+		free(buffer);
+	} while (!dt_stat_stable(s));
+	dt_stat_finalize(s);
+
+	s = dt_stat_time_create("proc_bulkinfo_batch_threads");
+	do {
+		dt_stat_token start = dt_stat_time_begin(s);
+		buffer = bulkinfo(PROC_BULKINFO_THREADS, &size);
+		dt_stat_time_end(s, start);
+		free(buffer);
+	} while (!dt_stat_stable(s));
+	dt_stat_finalize(s);
+
+	free(pids);
+}
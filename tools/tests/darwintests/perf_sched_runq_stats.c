@@ -0,0 +1,132 @@
+#ifdef T_NAMESPACE
+#undef T_NAMESPACE
+#endif
+#include <darwintest.h>
+
+#include <mach/mach.h>
+#include <mach/semaphore.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/sysctl.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.perf.sched_runq_stats"),
+	T_META_ASROOT(true),
+	T_META_CHECK_LEAKS(false)
+);
+
+#define ROUND_TRIPS		10000
+
+static void
+set_sched_stats(int enable)
+{
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.sched_stats_enable", NULL, NULL, &enable, sizeof(enable)),
+	                                "sysctl kern.sched_stats_enable");
+}
+
+static void
+disable_sched_stats(void)
+{
+	set_sched_stats(0);
+}
+
+/* Semaphore ping-pong: every round trip is two wakeups through the run queues */
+
+static semaphore_t ping_sema, pong_sema;
+
+static void *
+pong_thread(__unused void *arg)
+{
+	for (int i = 0; i < ROUND_TRIPS; i++) {
+		T_QUIET; T_ASSERT_MACH_SUCCESS(semaphore_wait(ping_sema), "semaphore_wait");
+		T_QUIET; T_ASSERT_MACH_SUCCESS(semaphore_signal(pong_sema), "semaphore_signal");
+	}
+	return NULL;
+}
+
+static void
+run_pingpong_test(int enable)
+{
+	pthread_t pong;
+
+	set_sched_stats(enable);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(semaphore_create(mach_task_self(), &ping_sema, SYNC_POLICY_FIFO, 0), "semaphore_create");
+	T_QUIET; T_ASSERT_MACH_SUCCESS(semaphore_create(mach_task_self(), &pong_sema, SYNC_POLICY_FIFO, 0), "semaphore_create");
+
+	dt_stat_time_t s = dt_stat_time_create("wakeup_round_trip_sched_stats_%d", enable);
+
+	do {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&pong, NULL, pong_thread, NULL), "pthread_create");
+
+		dt_stat_token start = dt_stat_time_begin(s);
+		for (int i = 0; i < ROUND_TRIPS; i++) {
+			T_QUIET; T_ASSERT_MACH_SUCCESS(semaphore_signal(ping_sema), "semaphore_signal");
+			T_QUIET; T_ASSERT_MACH_SUCCESS(semaphore_wait(pong_sema), "semaphore_wait");
+		}
+		dt_stat_time_end_batch(s, ROUND_TRIPS, start);
+
+		pthread_join(pong, NULL);
+	} while (!dt_stat_stable(s));
+
+	dt_stat_finalize(s);
+	semaphore_destroy(mach_task_self(), ping_sema);
+	semaphore_destroy(mach_task_self(), pong_sema);
+}
+
+T_DECL(sched_runq_stats_overhead,
+       "Wakeup round trip latency with and without run queue statistics") {
+	int enable = 0;
+
+	if (sysctlbyname("kern.sched_stats_enable", NULL, NULL, &enable, sizeof(enable)) != 0) {
+		T_SKIP("kern.sched_stats_enable is not available");
+	}
+	T_ATEND(disable_sched_stats);
+
+	run_pingpong_test(0);
+	run_pingpong_test(1);
+}
+
+T_DECL(sched_runq_stats_read,
+       "Cost of reading the per-processor run queue statistics") {
+	struct _processor_runq_stats_np *stats;
+	size_t size = 0, len;
+	uint64_t dispatches = 0;
+
+	if (sysctlbyname("kern.sched_runq_stats", NULL, &size, NULL, 0) != 0) {
+		T_SKIP("kern.sched_runq_stats is not available");
+	}
+	T_ATEND(disable_sched_stats);
+
+	/* enable the statistics and give the scheduler some dispatches to record */
+	run_pingpong_test(1);
+
+	stats = malloc(size);
+	T_QUIET; T_ASSERT_NOTNULL(stats, "malloc");
+
+	len = size;
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.sched_runq_stats", stats, &len, NULL, 0), "sysctl kern.sched_runq_stats");
+	for (size_t i = 0; i < len / sizeof(*stats); i++) {
+		for (int b = 0; b < _PROCESSOR_WAIT_BUCKETS; b++) {
+			dispatches += stats[i].prs_wait_count[b];
+		}
+		if (stats[i].prs_cpuid >= 0) {
+			T_LOG("cpu %d: load %u.%03u, wait p50 %llu ns p90 %llu ns p99 %llu ns", stats[i].prs_cpuid,
+			      stats[i].prs_load_average[0] / LOAD_SCALE, stats[i].prs_load_average[0] % LOAD_SCALE,
+			      stats[i].prs_wait_p50_ns, stats[i].prs_wait_p90_ns, stats[i].prs_wait_p99_ns);
+		}
+	}
+	T_ASSERT_GT(dispatches, 0ULL, "dispatches recorded in the wait histograms");
+
+	dt_stat_time_t s = dt_stat_time_create("sched_runq_stats_read");
+	do {
+		len = size;
+		dt_stat_token start = dt_stat_time_begin(s);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.sched_runq_stats", stats, &len, NULL, 0),
+		                                "sysctl kern.sched_runq_stats");
+		dt_stat_time_end(s, start);
+	} while (!dt_stat_stable(s));
+	dt_stat_finalize(s);
+
+	free(stats);
+}
@@ -0,0 +1,207 @@
+#ifdef T_NAMESPACE
+#undef T_NAMESPACE
+#endif
+#include <darwintest.h>
+
+#include <kern/debug.h>
+#include <kern/kcdata.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stackshot.h>
+#include <sys/sysctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.perf.stackshot"),
+	T_META_ASROOT(true),
+	T_META_CHECK_LEAKS(false)
+);
+
+#define THREADS_PER_CHILD 500
+
+static pthread_mutex_t park_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t park_cond = PTHREAD_COND_INITIALIZER;
+
+static void *
+park_thread(__unused void *arg)
+{
+	pthread_mutex_lock(&park_lock);
+	for (;;) {
+		pthread_cond_wait(&park_cond, &park_lock);
+	}
+	return NULL;
+}
+
+/*
+ * Spawn enough children to add nthreads parked threads to the system; a
+ * single process can't hold all of them.
+ */
+static int
+spawn_parked_threads(int nthreads, pid_t *children)
+{
+	int nchildren = 0;
+	int fds[2];
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(pipe(fds), "pipe");
+
+	while (nthreads > 0) {
+		int count = (nthreads > THREADS_PER_CHILD) ? THREADS_PER_CHILD : nthreads;
+		pid_t pid = fork();
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(pid, "fork");
+
+		if (pid == 0) {
+			close(fds[0]);
+			for (int i = 0; i < count; i++) {
+				pthread_t thread;
+				if (pthread_create(&thread, NULL, park_thread, NULL) != 0) {
+					exit(1);
+				}
+			}
+			char c = 0;
+			write(fds[1], &c, 1);
+			for (;;) {
+				pause();
+			}
+		}
+
+		children[nchildren++] = pid;
+		nthreads -= count;
+	}
+
+	close(fds[1]);
+	for (int i = 0; i < nchildren; i++) {
+		char c;
+		T_QUIET; T_ASSERT_EQ(read(fds[0], &c, 1), (ssize_t)1, "child %d parked its threads", i);
+	}
+	close(fds[0]);
+
+	return nchildren;
+}
+
+static void
+reap_children(pid_t *children, int nchildren)
+{
+	for (int i = 0; i < nchildren; i++) {
+		kill(children[i], SIGKILL);
+		waitpid(children[i], NULL, 0);
+	}
+}
+
+/*
+ * Returns the time interrupts were held off for, as recorded by the kernel
+ * (development kernels only), or 0.
+ */
+static uint64_t
+stackshot_pause_time(void *buf, size_t buflen)
+{
+	kcdata_iter_t iter = kcdata_iter_find_type(kcdata_iter(buf, buflen), STACKSHOT_KCTYPE_STACKSHOT_DURATION);
+	if (!kcdata_iter_valid(iter)) {
+		return 0;
+	}
+	struct stackshot_duration *duration = kcdata_iter_payload(iter);
+	return duration->stackshot_duration_outer;
+}
+
+/*
+ * Returns the number of CPUs that walked the task list, or 0 if the
+ * stackshot was taken serially.
+ */
+static uint32_t
+stackshot_parallel_cpus(void *buf, size_t buflen)
+{
+	kcdata_iter_t iter = kcdata_iter(buf, buflen);
+
+	KCDATA_ITER_FOREACH(iter) {
+		char *desc;
+		void *data;
+		uint32_t size;
+
+		if (kcdata_iter_type(iter) != KCDATA_TYPE_UINT32_DESC || !kcdata_iter_data_with_desc_valid(iter, sizeof(uint32_t))) {
+			continue;
+		}
+		kcdata_iter_get_data_with_desc(iter, &desc, &data, &size);
+		if (strcmp(desc, "stackshot_parallel_cpus") == 0) {
+			return *(uint32_t *)data;
+		}
+	}
+	return 0;
+}
+
+static void
+run_stackshot_test(const char *name, int nthreads, uint32_t extra_flags)
+{
+	int ncpu = 0;
+	size_t ncpu_size = sizeof(ncpu);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("hw.ncpu", &ncpu, &ncpu_size, NULL, 0), "hw.ncpu");
+	bool expect_parallel = !(extra_flags & STACKSHOT_NO_PARALLEL) && ncpu > 1;
+
+	pid_t *children = calloc((size_t)(nthreads / THREADS_PER_CHILD + 1), sizeof(pid_t));
+	T_QUIET; T_ASSERT_NOTNULL(children, "calloc");
+
+	int nchildren = spawn_parked_threads(nthreads, children);
+
+	dt_stat_time_t wall = dt_stat_time_create("%s_%d_threads_wall", name, nthreads);
+	dt_stat_time_t pause = dt_stat_time_create("%s_%d_threads_pause", name, nthreads);
+
+	do {
+		/* a config can't be reused until its buffer is deallocated */
+		void *config = stackshot_config_create();
+		T_QUIET; T_ASSERT_NOTNULL(config, "stackshot_config_create");
+		T_QUIET; T_ASSERT_POSIX_ZERO(stackshot_config_set_flags(config,
+		                             STACKSHOT_KCDATA_FORMAT | STACKSHOT_SAVE_LOADINFO |
+		                             STACKSHOT_GET_GLOBAL_MEM_STATS | extra_flags), "stackshot_config_set_flags");
+
+		dt_stat_token start = dt_stat_time_begin(wall);
+		int ret = stackshot_capture_with_config(config);
+		dt_stat_time_end(wall, start);
+
+		if (ret == 0) {
+			void *buf = stackshot_config_get_stackshot_buffer(config);
+			size_t buflen = stackshot_config_get_stackshot_size(config);
+			uint32_t parallel_cpus = stackshot_parallel_cpus(buf, buflen);
+
+			if (expect_parallel) {
+				T_QUIET; T_ASSERT_GT(parallel_cpus, 0U, "tasks were walked in parallel");
+			} else {
+				T_QUIET; T_ASSERT_EQ(parallel_cpus, 0U, "tasks were walked serially");
+			}
+
+			uint64_t pause_time = stackshot_pause_time(buf, buflen);
+			if (pause_time != 0) {
+				dt_stat_mach_time_add(pause, pause_time);
+			}
+		} else {
+			T_QUIET; T_ASSERT_TRUE(ret == EBUSY || ret == ETIMEDOUT, "stackshot_capture_with_config (error %d)", ret);
+		}
+
+		stackshot_config_dealloc(config);
+	} while (!dt_stat_stable(wall));
+
+	dt_stat_finalize(wall);
+	dt_stat_finalize(pause);
+
+	reap_children(children, nchildren);
+	free(children);
+}
+
+T_DECL(stackshot_pause_serial,
+       "Measure stackshot pause time against thread count, walking tasks on one CPU") {
+	int counts[] = { 0, 1000, 5000, 20000 };
+	for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		run_stackshot_test("serial", counts[i], STACKSHOT_NO_PARALLEL);
+	}
+}
+
+T_DECL(stackshot_pause_parallel,
+       "Measure stackshot pause time against thread count, walking tasks on all CPUs") {
+	int counts[] = { 0, 1000, 5000, 20000 };
+	for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		run_stackshot_test("parallel", counts[i], 0);
+	}
+}
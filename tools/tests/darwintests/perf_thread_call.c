@@ -0,0 +1,91 @@
+#ifdef T_NAMESPACE
+#undef T_NAMESPACE
+#endif
+#include <darwintest.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/sysctl.h>
+#include <unistd.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.perf.thread_call"),
+	T_META_ASROOT(true),
+	T_META_CHECK_LEAKS(false)
+);
+
+#define CALLS_PER_THREAD 100000
+
+static char churn_sysctl[64];
+
+static uint64_t
+fired_count(void)
+{
+	uint64_t value = 0;
+	size_t size = sizeof(value);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("debug.thread_call_churn_fired", &value, &size, NULL, 0),
+	                                "debug.thread_call_churn_fired");
+	return value;
+}
+
+static void *
+enter_thread(__unused void *arg)
+{
+	int count = CALLS_PER_THREAD;
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(churn_sysctl, NULL, NULL, &count, sizeof(count)),
+	                                "sysctl %s", churn_sysctl);
+	return NULL;
+}
+
+/*
+ * Measure the cost of entering a short thread call of the given priority
+ * from nthreads threads at once, including running it.
+ */
+static void
+run_enter_test(int nthreads, const char *pri)
+{
+	pthread_t *threads = calloc((size_t)nthreads, sizeof(pthread_t));
+	T_QUIET; T_ASSERT_NOTNULL(threads, "calloc");
+
+	snprintf(churn_sysctl, sizeof(churn_sysctl), "debug.thread_call_churn_%s", pri);
+	dt_stat_time_t s = dt_stat_time_create("thread_call_%s_%d_threads", pri, nthreads);
+	uint64_t fired = fired_count();
+	uint64_t entered = 0;
+
+	do {
+		dt_stat_token start = dt_stat_time_begin(s);
+		for (int i = 0; i < nthreads; i++) {
+			T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&threads[i], NULL, enter_thread, NULL), "pthread_create");
+		}
+		for (int i = 0; i < nthreads; i++) {
+			pthread_join(threads[i], NULL);
+		}
+		dt_stat_time_end_batch(s, nthreads * CALLS_PER_THREAD, start);
+		entered += (uint64_t)nthreads * CALLS_PER_THREAD;
+	} while (!dt_stat_stable(s));
+
+	dt_stat_finalize(s);
+	T_LOG("%s, %d threads: %llu entered, %llu ran", pri, nthreads, entered, fired_count() - fired);
+	free(threads);
+}
+
+T_DECL(thread_call_throughput,
+       "Thread call enter and run throughput for serial and parallel groups") {
+	int ncpu = 0;
+	size_t ncpu_size = sizeof(ncpu);
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("hw.ncpu", &ncpu, &ncpu_size, NULL, 0), "hw.ncpu");
+
+	int count = 0;
+	if (sysctlbyname("debug.thread_call_churn_kernel", NULL, NULL, &count, sizeof(count)) != 0) {
+		T_SKIP("debug.thread_call_churn_kernel is only available on development kernels");
+	}
+
+	for (int nthreads = 1; nthreads <= ncpu; nthreads *= 2) {
+		run_enter_test(nthreads, "high");
+		run_enter_test(nthreads, "kernel");
+		run_enter_test(nthreads, "user");
+	}
+}
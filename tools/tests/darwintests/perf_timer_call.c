@@ -0,0 +1,73 @@
+#ifdef T_NAMESPACE
+#undef T_NAMESPACE
+#endif
+#include <darwintest.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/sysctl.h>
+#include <unistd.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.perf.timer_call"),
+	T_META_ASROOT(true),
+	T_META_CHECK_LEAKS(false)
+);
+
+#define REARMS_PER_SAMPLE 100000
+
+static uint64_t
+longterm_stat(const char *name)
+{
+	char oid[64];
+	uint64_t value = 0;
+	size_t size = sizeof(value);
+
+	snprintf(oid, sizeof(oid), "kern.timer.longterm.%s", name);
+	if (sysctlbyname(oid, &value, &size, NULL, 0) != 0) {
+		return 0;
+	}
+	return value;
+}
+
+/*
+ * Measure the cost of cancelling and re-arming a timer call while a pool
+ * of others is armed, for deadlines on the per-cpu queues ("short") or
+ * on the longterm queue ("long").
+ */
+static void
+run_churn_test(const char *mode)
+{
+	char churn_sysctl[64];
+	uint64_t escalates, cascades;
+
+	snprintf(churn_sysctl, sizeof(churn_sysctl), "debug.timer_call_churn_%s", mode);
+	dt_stat_time_t s = dt_stat_time_create("timer_call_rearm_%s", mode);
+	escalates = longterm_stat("escalates");
+	cascades = longterm_stat("cascades");
+
+	do {
+		int count = REARMS_PER_SAMPLE;
+		dt_stat_token start = dt_stat_time_begin(s);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(churn_sysctl, NULL, NULL, &count, sizeof(count)),
+		                                "sysctl %s", churn_sysctl);
+		dt_stat_time_end_batch(s, count, start);
+	} while (!dt_stat_stable(s));
+
+	dt_stat_finalize(s);
+	T_LOG("%s: longterm queue length %llu, %llu escalates, %llu cascades", mode,
+	      longterm_stat("qlen"), longterm_stat("escalates") - escalates,
+	      longterm_stat("cascades") - cascades);
+}
+
+T_DECL(timer_call_churn,
+       "Timer call cancel and re-arm throughput for short and long deadlines") {
+	int count = 0;
+	if (sysctlbyname("debug.timer_call_churn_short", NULL, NULL, &count, sizeof(count)) != 0) {
+		T_SKIP("debug.timer_call_churn_short is only available on development kernels");
+	}
+
+	run_churn_test("short");
+	run_churn_test("long");
+}
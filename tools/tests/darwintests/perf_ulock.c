@@ -0,0 +1,145 @@
+#ifdef T_NAMESPACE
+#undef T_NAMESPACE
+#endif
+#include <darwintest.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.perf.ulock"),
+	T_META_CHECK_LEAKS(false)
+);
+
+/* From bsd/sys/ulock.h */
+extern int __ulock_wait(uint32_t operation, void *addr, uint64_t value, uint32_t timeout);
+extern int __ulock_wake(uint32_t operation, void *addr, uint64_t wake_value);
+
+#define UL_COMPARE_AND_WAIT	1
+#define ULF_NO_ERRNO		0x01000000
+
+#define OPS_PER_THREAD		20000
+#define MAX_THREADS		64
+
+/* Each thread's (or pair's) lock word on its own cache line, and so its own ulock */
+struct ulock_word {
+	_Atomic uint32_t value;
+} __attribute__((aligned(64)));
+
+static struct ulock_word words[MAX_THREADS];
+
+/*
+ * Wait with a stale value and wake with no waiters: both look up
+ * the ulock hash and return without blocking.
+ */
+static void *
+uncontended_thread(void *arg)
+{
+	struct ulock_word *word = arg;
+
+	for (int i = 0; i < OPS_PER_THREAD; i++) {
+		int ret = __ulock_wait(UL_COMPARE_AND_WAIT | ULF_NO_ERRNO, &word->value, 1, 0);
+		T_QUIET; T_ASSERT_GE(ret, 0, "__ulock_wait");
+		ret = __ulock_wake(UL_COMPARE_AND_WAIT | ULF_NO_ERRNO, &word->value, 0);
+		T_QUIET; T_ASSERT_EQ(ret, -ENOENT, "__ulock_wake");
+	}
+	return NULL;
+}
+
+struct pingpong_args {
+	struct ulock_word *word;
+	uint32_t side;
+};
+
+/*
+ * Two threads hand a turn back and forth through one word,
+ * each waiting until the word names its side.
+ */
+static void *
+pingpong_thread(void *arg)
+{
+	struct pingpong_args *args = arg;
+	struct ulock_word *word = args->word;
+
+	for (int i = 0; i < OPS_PER_THREAD; i++) {
+		uint32_t value;
+		while ((value = word->value) != args->side) {
+			int ret = __ulock_wait(UL_COMPARE_AND_WAIT | ULF_NO_ERRNO, &word->value, value, 0);
+			T_QUIET; T_ASSERT_TRUE(ret >= 0 || ret == -EINTR, "__ulock_wait");
+		}
+		word->value = !args->side;
+		int ret = __ulock_wake(UL_COMPARE_AND_WAIT | ULF_NO_ERRNO, &word->value, 0);
+		T_QUIET; T_ASSERT_TRUE(ret == 0 || ret == -ENOENT, "__ulock_wake");
+	}
+	return NULL;
+}
+
+static void
+run_uncontended_test(int nthreads)
+{
+	pthread_t *threads = calloc((size_t)nthreads, sizeof(pthread_t));
+	T_QUIET; T_ASSERT_NOTNULL(threads, "calloc");
+
+	dt_stat_time_t s = dt_stat_time_create("ulock_uncontended_%d_threads", nthreads);
+
+	do {
+		dt_stat_token start = dt_stat_time_begin(s);
+		for (int i = 0; i < nthreads; i++) {
+			T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&threads[i], NULL, uncontended_thread, &words[i]), "pthread_create");
+		}
+		for (int i = 0; i < nthreads; i++) {
+			pthread_join(threads[i], NULL);
+		}
+		dt_stat_time_end_batch(s, nthreads * OPS_PER_THREAD, start);
+	} while (!dt_stat_stable(s));
+
+	dt_stat_finalize(s);
+	free(threads);
+}
+
+static void
+run_pingpong_test(int npairs)
+{
+	pthread_t *threads = calloc((size_t)npairs * 2, sizeof(pthread_t));
+	struct pingpong_args *args = calloc((size_t)npairs * 2, sizeof(*args));
+	T_QUIET; T_ASSERT_NOTNULL(threads, "calloc");
+	T_QUIET; T_ASSERT_NOTNULL(args, "calloc");
+
+	dt_stat_time_t s = dt_stat_time_create("ulock_pingpong_%d_pairs", npairs);
+
+	do {
+		dt_stat_token start = dt_stat_time_begin(s);
+		for (int i = 0; i < npairs * 2; i++) {
+			args[i].word = &words[i / 2];
+			args[i].side = (uint32_t)(i % 2);
+			words[i / 2].value = 0;
+		}
+		for (int i = 0; i < npairs * 2; i++) {
+			T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&threads[i], NULL, pingpong_thread, &args[i]), "pthread_create");
+		}
+		for (int i = 0; i < npairs * 2; i++) {
+			pthread_join(threads[i], NULL);
+		}
+		dt_stat_time_end_batch(s, npairs * OPS_PER_THREAD, start);
+	} while (!dt_stat_stable(s));
+
+	dt_stat_finalize(s);
+	free(args);
+	free(threads);
+}
+
+T_DECL(ulock_uncontended,
+       "Uncontended ulock wait/wake throughput on per-thread addresses from 1 to 64 threads") {
+	for (int nthreads = 1; nthreads <= MAX_THREADS; nthreads *= 2) {
+		run_uncontended_test(nthreads);
+	}
+}
+
+T_DECL(ulock_pingpong,
+       "Contended ulock wait/wake round trips between thread pairs, from 1 to 32 pairs") {
+	for (int npairs = 1; npairs <= MAX_THREADS / 2; npairs *= 2) {
+		run_pingpong_test(npairs);
+	}
+}
@@ -0,0 +1,95 @@
+#ifdef T_NAMESPACE
+#undef T_NAMESPACE
+#endif
+#include <darwintest.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/sysctl.h>
+#include <unistd.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.perf.waitq"),
+	T_META_ASROOT(true),
+	T_META_CHECK_LEAKS(false)
+);
+
+#define TOKENS_PER_THREAD 2000
+
+static void *
+herd_thread(__unused void *arg)
+{
+	int count = TOKENS_PER_THREAD;
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("debug.waitq_herd_wait", NULL, NULL, &count, sizeof(count)),
+	                                "sysctl debug.waitq_herd_wait");
+	return NULL;
+}
+
+static uint64_t
+global_waitq_stat(const char *name)
+{
+	uint64_t value = 0;
+	size_t size = sizeof(value);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(name, &value, &size, NULL, 0), "%s", name);
+	return value;
+}
+
+/*
+ * Measure the cost of handing a token to one of nthreads sleepers, when
+ * each token wakes all of them (thread_wakeup) or only one
+ * (thread_wakeup_one).
+ */
+static void
+run_herd_test(int nthreads, const char *mode)
+{
+	char wake_sysctl[64];
+	pthread_t *threads = calloc((size_t)nthreads, sizeof(pthread_t));
+	T_QUIET; T_ASSERT_NOTNULL(threads, "calloc");
+
+	snprintf(wake_sysctl, sizeof(wake_sysctl), "debug.waitq_herd_wake_%s", mode);
+	dt_stat_time_t s = dt_stat_time_create("wake_%s_%d_threads", mode, nthreads);
+	uint64_t collisions = global_waitq_stat("kern.waitq_global.collisions");
+
+	do {
+		for (int i = 0; i < nthreads; i++) {
+			T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&threads[i], NULL, herd_thread, NULL), "pthread_create");
+		}
+
+		int count = nthreads * TOKENS_PER_THREAD;
+		dt_stat_token start = dt_stat_time_begin(s);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(wake_sysctl, NULL, NULL, &count, sizeof(count)),
+		                                "sysctl %s", wake_sysctl);
+		dt_stat_time_end_batch(s, count, start);
+
+		for (int i = 0; i < nthreads; i++) {
+			pthread_join(threads[i], NULL);
+		}
+	} while (!dt_stat_stable(s));
+
+	dt_stat_finalize(s);
+	T_LOG("%s, %d threads: %llu global waitq collisions", mode, nthreads,
+	      global_waitq_stat("kern.waitq_global.collisions") - collisions);
+	free(threads);
+}
+
+T_DECL(waitq_thundering_herd,
+       "Compare thread_wakeup and thread_wakeup_one when many threads sleep on one event") {
+	int ncpu = 0;
+	size_t ncpu_size = sizeof(ncpu);
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("hw.ncpu", &ncpu, &ncpu_size, NULL, 0), "hw.ncpu");
+
+	int count = 0;
+	if (sysctlbyname("debug.waitq_herd_wake_one", NULL, NULL, &count, sizeof(count)) != 0) {
+		T_SKIP("debug.waitq_herd_wake_one is only available on development kernels");
+	}
+
+	T_LOG("global waitq table: %llu buckets", global_waitq_stat("kern.waitq_global.buckets"));
+
+	for (int nthreads = 2; nthreads <= 4 * ncpu && nthreads <= 128; nthreads *= 2) {
+		run_herd_test(nthreads, "one");
+		run_herd_test(nthreads, "all");
+	}
+}
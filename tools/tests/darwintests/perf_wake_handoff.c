@@ -0,0 +1,167 @@
+#ifdef T_NAMESPACE
+#undef T_NAMESPACE
+#endif
+#include <darwintest.h>
+
+#include <errno.h>
+#include <mach/mach.h>
+#include <mach/semaphore.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/sysctl.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.perf.wake_handoff"),
+	T_META_ASROOT(true),
+	T_META_CHECK_LEAKS(false)
+);
+
+/* From bsd/sys/ulock.h */
+extern int __ulock_wait(uint32_t operation, void *addr, uint64_t value, uint32_t timeout);
+extern int __ulock_wake(uint32_t operation, void *addr, uint64_t wake_value);
+
+#define UL_COMPARE_AND_WAIT	1
+#define ULF_NO_ERRNO		0x01000000
+
+#define ROUND_TRIPS		10000
+
+static uint32_t saved_handoff;
+
+static void
+set_handoff(uint32_t handoff)
+{
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.sched_wake_handoff", NULL, NULL, &handoff, sizeof(handoff)),
+	                                "sysctl kern.sched_wake_handoff");
+}
+
+static void
+restore_handoff(void)
+{
+	set_handoff(saved_handoff);
+}
+
+static void
+save_handoff(void)
+{
+	size_t size = sizeof(saved_handoff);
+	if (sysctlbyname("kern.sched_wake_handoff", &saved_handoff, &size, NULL, 0) != 0) {
+		T_SKIP("kern.sched_wake_handoff is not available");
+	}
+	T_ATEND(restore_handoff);
+}
+
+/* Semaphore ping-pong: each side signals the other's semaphore and waits on its own */
+
+static semaphore_t ping_sema, pong_sema;
+
+static void *
+sema_pong_thread(__unused void *arg)
+{
+	for (int i = 0; i < ROUND_TRIPS; i++) {
+		T_QUIET; T_ASSERT_MACH_SUCCESS(semaphore_wait(ping_sema), "semaphore_wait");
+		T_QUIET; T_ASSERT_MACH_SUCCESS(semaphore_signal(pong_sema), "semaphore_signal");
+	}
+	return NULL;
+}
+
+static void
+run_sema_test(uint32_t handoff)
+{
+	pthread_t pong;
+
+	set_handoff(handoff);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(semaphore_create(mach_task_self(), &ping_sema, SYNC_POLICY_FIFO, 0), "semaphore_create");
+	T_QUIET; T_ASSERT_MACH_SUCCESS(semaphore_create(mach_task_self(), &pong_sema, SYNC_POLICY_FIFO, 0), "semaphore_create");
+
+	dt_stat_time_t s = dt_stat_time_create("semaphore_round_trip_handoff_%u", handoff);
+
+	do {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&pong, NULL, sema_pong_thread, NULL), "pthread_create");
+
+		dt_stat_token start = dt_stat_time_begin(s);
+		for (int i = 0; i < ROUND_TRIPS; i++) {
+			T_QUIET; T_ASSERT_MACH_SUCCESS(semaphore_signal(ping_sema), "semaphore_signal");
+			T_QUIET; T_ASSERT_MACH_SUCCESS(semaphore_wait(pong_sema), "semaphore_wait");
+		}
+		dt_stat_time_end_batch(s, ROUND_TRIPS, start);
+
+		pthread_join(pong, NULL);
+	} while (!dt_stat_stable(s));
+
+	dt_stat_finalize(s);
+	semaphore_destroy(mach_task_self(), ping_sema);
+	semaphore_destroy(mach_task_self(), pong_sema);
+}
+
+/* ulock ping-pong: the two sides take turns through one word */
+
+static _Atomic uint32_t turn;
+
+static void
+ulock_take_turn(uint32_t side)
+{
+	uint32_t value;
+
+	while ((value = turn) != side) {
+		int ret = __ulock_wait(UL_COMPARE_AND_WAIT | ULF_NO_ERRNO, &turn, value, 0);
+		T_QUIET; T_ASSERT_TRUE(ret >= 0 || ret == -EINTR, "__ulock_wait");
+	}
+}
+
+static void
+ulock_pass_turn(uint32_t side)
+{
+	turn = !side;
+	int ret = __ulock_wake(UL_COMPARE_AND_WAIT | ULF_NO_ERRNO, &turn, 0);
+	T_QUIET; T_ASSERT_TRUE(ret == 0 || ret == -ENOENT, "__ulock_wake");
+}
+
+static void *
+ulock_pong_thread(__unused void *arg)
+{
+	for (int i = 0; i < ROUND_TRIPS; i++) {
+		ulock_take_turn(1);
+		ulock_pass_turn(1);
+	}
+	return NULL;
+}
+
+static void
+run_ulock_test(uint32_t handoff)
+{
+	pthread_t pong;
+
+	set_handoff(handoff);
+
+	dt_stat_time_t s = dt_stat_time_create("ulock_round_trip_handoff_%u", handoff);
+
+	do {
+		turn = 0;
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&pong, NULL, ulock_pong_thread, NULL), "pthread_create");
+
+		dt_stat_token start = dt_stat_time_begin(s);
+		for (int i = 0; i < ROUND_TRIPS; i++) {
+			ulock_take_turn(0);
+			ulock_pass_turn(0);
+		}
+		dt_stat_time_end_batch(s, ROUND_TRIPS, start);
+
+		pthread_join(pong, NULL);
+	} while (!dt_stat_stable(s));
+
+	dt_stat_finalize(s);
+}
+
+T_DECL(semaphore_handoff,
+       "Semaphore ping-pong round trip latency with and without wake handoff") {
+	save_handoff();
+	run_sema_test(0);
+	run_sema_test(1);
+}
+
+T_DECL(ulock_handoff,
+       "ulock ping-pong round trip latency with and without wake handoff") {
+	save_handoff();
+	run_ulock_test(0);
+	run_ulock_test(1);
+}
@@ -0,0 +1,127 @@
+#ifdef T_NAMESPACE
+#undef T_NAMESPACE
+#endif
+#include <darwintest.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/sysctl.h>
+#include <unistd.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.perf.zalloc"),
+	T_META_ASROOT(true),
+	T_META_CHECK_LEAKS(false)
+);
+
+#define ALLOCS_PER_THREAD 100000
+
+static pthread_barrier_t start_barrier;
+
+static void
+zalloc_from_kernel(int count)
+{
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("debug.zalloc_stress", NULL, NULL, &count, sizeof(count)),
+	                                "sysctl debug.zalloc_stress");
+}
+
+static void *
+zalloc_thread(__unused void *arg)
+{
+	pthread_barrier_wait(&start_barrier);
+	zalloc_from_kernel(ALLOCS_PER_THREAD);
+	return NULL;
+}
+
+/*
+ * Measure how long it takes nthreads threads to each do ALLOCS_PER_THREAD
+ * kalloc/kfree pairs from the same zone at the same time.
+ */
+static void
+run_zalloc_test(int nthreads)
+{
+	pthread_t *threads = calloc((size_t)nthreads, sizeof(pthread_t));
+	T_QUIET; T_ASSERT_NOTNULL(threads, "calloc");
+
+	dt_stat_time_t s = dt_stat_time_create("%d_threads", nthreads);
+
+	do {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_barrier_init(&start_barrier, NULL, (unsigned)nthreads + 1),
+		                             "pthread_barrier_init");
+		for (int i = 0; i < nthreads; i++) {
+			T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&threads[i], NULL, zalloc_thread, NULL), "pthread_create");
+		}
+
+		dt_stat_token start = dt_stat_time_begin(s);
+		pthread_barrier_wait(&start_barrier);
+		for (int i = 0; i < nthreads; i++) {
+			pthread_join(threads[i], NULL);
+		}
+		dt_stat_time_end_batch(s, nthreads * ALLOCS_PER_THREAD, start);
+
+		pthread_barrier_destroy(&start_barrier);
+	} while (!dt_stat_stable(s));
+
+	dt_stat_finalize(s);
+	free(threads);
+}
+
+T_DECL(zalloc_scaling,
+       "Measure the per-allocation cost of a shared zone as more CPUs allocate at once") {
+	int ncpu = 0;
+	size_t ncpu_size = sizeof(ncpu);
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("hw.ncpu", &ncpu, &ncpu_size, NULL, 0), "hw.ncpu");
+
+	int count = 0;
+	if (sysctlbyname("debug.zalloc_stress", NULL, NULL, &count, sizeof(count)) != 0) {
+		T_SKIP("debug.zalloc_stress is only available on development kernels");
+	}
+
+	/* boot with zcc_enable_for_zone_name=kalloc.64 to get the numbers with per-CPU caches */
+	for (int nthreads = 1; nthreads < ncpu && nthreads < 64; nthreads *= 2) {
+		run_zalloc_test(nthreads);
+	}
+	run_zalloc_test(ncpu < 64 ? ncpu : 64);
+}
+
+static uint64_t
+zone_cache_depot_full(void)
+{
+	uint64_t depot_full = 0;
+	size_t size = sizeof(depot_full);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("vm.zone_cache_depot_full", &depot_full, &size, NULL, 0),
+	                                "sysctl vm.zone_cache_depot_full");
+	return depot_full;
+}
+
+T_DECL(zone_cache_reap_on_pressure,
+       "Check that a memory pressure wakeup of the zone_reclaim thread empties the zone cache depots") {
+	uint64_t before, after;
+	int value = 1;
+
+	if (sysctlbyname("vm.zone_reclaim_pressure", NULL, NULL, &value, sizeof(value)) != 0) {
+		T_SKIP("vm.zone_reclaim_pressure is only available on development kernels");
+	}
+
+	zalloc_from_kernel(ALLOCS_PER_THREAD);
+	before = after = zone_cache_depot_full();
+	if (before == 0) {
+		T_SKIP("no full magazines in the zone cache depots");
+	}
+
+	/* a pressure reap drains every full depot magazine; wait for the thread to get to it */
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("vm.zone_reclaim_pressure", NULL, NULL, &value, sizeof(value)),
+	                       "sysctl vm.zone_reclaim_pressure");
+	for (int i = 0; i < 50; i++) {
+		usleep(100 * 1000);
+		after = zone_cache_depot_full();
+		if (after < before) {
+			break;
+		}
+	}
+	T_LOG("full depot magazines: %llu before, %llu after", before, after);
+	T_ASSERT_LT(after, before, "pressure wakeup reaped the zone cache depots");
+}
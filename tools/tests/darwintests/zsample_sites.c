@@ -0,0 +1,121 @@
+#ifdef T_NAMESPACE
+#undef T_NAMESPACE
+#endif
+#include <darwintest.h>
+
+#include <mach/mach.h>
+#include <mach_debug/zone_info.h>
+#include <stdlib.h>
+#include <sys/sysctl.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.vm.zsample"),
+	T_META_ASROOT(true),
+	T_META_CHECK_LEAKS(false)
+);
+
+#define NPORTS 50000
+
+static uint32_t
+zsample_rate(void)
+{
+	uint32_t rate = 0;
+	size_t rate_size = sizeof(rate);
+
+	if (sysctlbyname("kern.zsample_rate", &rate, &rate_size, NULL, 0) != 0 || rate == 0) {
+		T_SKIP("allocation sampling is off; boot with zsample=1");
+	}
+	return rate;
+}
+
+static zsample_site_info_t *
+copy_sites(unsigned int *countp)
+{
+	zsample_site_info_t *sites;
+	size_t size = 0;
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.zsample_sites", NULL, &size, NULL, 0),
+	                                "sysctl kern.zsample_sites size");
+	sites = malloc(size + sizeof(*sites));
+	T_QUIET; T_ASSERT_NOTNULL(sites, "malloc");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.zsample_sites", sites, &size, NULL, 0),
+	                                "sysctl kern.zsample_sites");
+	T_QUIET; T_ASSERT_EQ(size % sizeof(*sites), 0UL, "whole site records");
+
+	*countp = (unsigned int)(size / sizeof(*sites));
+	return sites;
+}
+
+static uint64_t
+live_bytes(zsample_site_info_t *sites, unsigned int count)
+{
+	uint64_t total = 0;
+
+	for (unsigned int i = 0; i < count; i++) {
+		total += sites[i].zsi_live_bytes;
+	}
+	return total;
+}
+
+T_DECL(zsample_sites_valid,
+       "Check the sites exported by the sampling allocation profiler") {
+	uint32_t rate = zsample_rate();
+	unsigned int count;
+	zsample_site_info_t *sites = copy_sites(&count);
+
+	T_ASSERT_GT(count, 0U, "the kernel has sampled live allocations");
+
+	for (unsigned int i = 0; i < count; i++) {
+		zsample_site_info_t *site = &sites[i];
+
+		T_QUIET; T_ASSERT_GT(site->zsi_depth, 0U, "site %u has a backtrace", i);
+		T_QUIET; T_ASSERT_LE(site->zsi_depth, ZSAMPLE_MAX_DEPTH, "site %u backtrace fits", i);
+		T_QUIET; T_ASSERT_GT(site->zsi_live_samples, 0U, "site %u has live samples", i);
+		T_QUIET; T_ASSERT_GE(site->zsi_total_samples, (uint64_t)site->zsi_live_samples,
+		                     "site %u total samples cover the live ones", i);
+		T_QUIET; T_ASSERT_GE(site->zsi_live_bytes, (uint64_t)site->zsi_live_samples * rate,
+		                     "site %u samples weigh at least the rate", i);
+		for (uint32_t f = 0; f < site->zsi_depth; f++) {
+			T_QUIET; T_ASSERT_NE(site->zsi_frames[f], 0ULL, "site %u frame %u", i, f);
+		}
+		for (unsigned int j = 0; j < i; j++) {
+			T_QUIET; T_ASSERT_NE(site->zsi_id, sites[j].zsi_id, "site ids are unique");
+		}
+	}
+	T_PASS("%u sites, %llu bytes estimated live", count, live_bytes(sites, count));
+
+	free(sites);
+}
+
+T_DECL(zsample_sites_track_allocations,
+       "Check that memory the kernel keeps allocated shows up in the samples") {
+	uint32_t rate = zsample_rate();
+	mach_port_t *ports = calloc(NPORTS, sizeof(mach_port_t));
+	zsample_site_info_t *sites;
+	unsigned int count;
+	uint64_t before, after;
+
+	T_QUIET; T_ASSERT_NOTNULL(ports, "calloc");
+
+	sites = copy_sites(&count);
+	before = live_bytes(sites, count);
+	free(sites);
+
+	for (int i = 0; i < NPORTS; i++) {
+		T_QUIET; T_ASSERT_MACH_SUCCESS(mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE, &ports[i]),
+		                               "mach_port_allocate");
+	}
+
+	sites = copy_sites(&count);
+	after = live_bytes(sites, count);
+	free(sites);
+
+	/* each port is well over 64 bytes; expect at least a quarter of that to be sampled */
+	T_EXPECT_GE(after, before + (uint64_t)NPORTS * 64 / 4,
+	            "live bytes grew from %llu to %llu (rate %u)", before, after, rate);
+
+	for (int i = 0; i < NPORTS; i++) {
+		mach_port_mod_refs(mach_task_self(), ports[i], MACH_PORT_RIGHT_RECEIVE, -1);
+	}
+	free(ports);
+}
@@ -57,6 +57,10 @@ typedef enum my_policy_type { MY_POLICY_REALTIME, MY_POLICY_TIMESHARE, MY_POLICY
 
 struct mach_timebase_info g_mti;
 
+/* Realtime parameters; a wakeup later than the constraint misses its deadline */
+uint64_t g_constraint_ns = CONSTRAINT_NANOS;
+uint64_t g_computation_ns = COMPUTATION_NANOS;
+
 #define assert(truth, label) do { if(!(truth)) { printf("Thread %p: failure on line %d\n", pthread_self(), __LINE__); goto label; } } while (0)
 
 struct second_thread_args {
@@ -66,6 +70,7 @@ struct second_thread_args {
 	my_policy_type_t pol;
 	double *wakeup_second_jitter_arr;
 	uint64_t woke_on_same_cpu;
+	uint64_t deadline_misses;
 	uint64_t too_much;
 	volatile uint64_t last_poke_time;
 	volatile int cpuno;
@@ -79,7 +84,7 @@ second_thread(void *args);
 void
 print_usage()
 {
-	printf("Usage: jitter [-w] [-s <random seed>] [-n <min sleep, ns>] [-m <max sleep, ns>] <realtime | timeshare | fixed> <num iterations> <traceworthy jitter, ns>\n");
+	printf("Usage: jitter [-w] [-s <random seed>] [-n <min sleep, ns>] [-m <max sleep, ns>] [-c <computation, ns>] [-d <constraint, ns>] <realtime | timeshare | fixed> <num iterations> <traceworthy jitter, ns>\n");
 }
 
 my_policy_type_t
@@ -113,11 +118,15 @@ thread_setup(my_policy_type_t pol)
 
 			/* Hard-coded realtime parameters (similar to what Digi uses) */
 			pol.period = 100000;
-			pol.constraint =  CONSTRAINT_NANOS * g_mti.denom / g_mti.numer;
-			pol.computation = COMPUTATION_NANOS * g_mti.denom / g_mti.numer;
+			pol.constraint =  g_constraint_ns * g_mti.denom / g_mti.numer;
+			pol.computation = g_computation_ns * g_mti.denom / g_mti.numer;
 			pol.preemptible = 0; /* Ignored by OS */
 
 			res = thread_policy_set(mach_thread_self(), THREAD_TIME_CONSTRAINT_POLICY, (thread_policy_t) &pol, THREAD_TIME_CONSTRAINT_POLICY_COUNT);
+			if (res == KERN_RESOURCE_SHORTAGE) {
+				/* kern.sched_rt_edf_admission is set and the system is full */
+				printf("Realtime admission refused.\n");
+			}
 			assert(res == 0, fail);
 			break;
 		}
@@ -232,6 +241,8 @@ main(int argc, char **argv)
 	double avg, stddev, max, min;
 	double avg_fract, stddev_fract, max_fract, min_fract;
 	uint64_t too_much;
+	uint64_t constraint_abs;
+	uint64_t deadline_misses = 0;
 
 	struct second_thread_args secargs;
 	pthread_t secthread;
@@ -240,7 +251,7 @@ main(int argc, char **argv)
 
 	/* Seed random */
 	opterr = 0;
-	while ((ch = getopt(argc, argv, "m:n:hs:w")) != -1 && ch != '?') {
+	while ((ch = getopt(argc, argv, "c:d:m:n:hs:w")) != -1 && ch != '?') {
 		switch (ch) {
 			case 's':
 				/* Specified seed for random)() */
@@ -256,6 +267,14 @@ main(int argc, char **argv)
 				/* How long per timer? */
 				min_sleep_ns = strtoull(optarg, NULL, 10);	
 				break;
+			case 'c':
+				/* Realtime computation */
+				g_computation_ns = strtoull(optarg, NULL, 10);
+				break;
+			case 'd':
+				/* Realtime constraint, the deadline for each wakeup */
+				g_constraint_ns = strtoull(optarg, NULL, 10);
+				break;
 			case 'w':
 				/* After each timed wait, wakeup another thread */
 				wakeup_second_thread = TRUE;
@@ -284,6 +303,13 @@ main(int argc, char **argv)
 		exit(1);
 	}
 
+	if (g_computation_ns == 0 || g_computation_ns > g_constraint_ns) {
+		print_usage();
+		exit(1);
+	}
+
+	constraint_abs = g_constraint_ns * g_mti.denom / g_mti.numer;
+
 	if (need_seed) {
 		srandom(time(NULL));
 	}
@@ -337,6 +363,7 @@ main(int argc, char **argv)
 		secargs.pol = pol;
 		secargs.wakeup_second_jitter_arr = wakeup_second_jitter_arr;
 		secargs.woke_on_same_cpu = 0;
+		secargs.deadline_misses = 0;
 		secargs.too_much = too_much;
 		secargs.last_poke_time = 0ULL;
 		secargs.cpuno = 0;
@@ -382,6 +409,10 @@ main(int argc, char **argv)
 	
 		jitter_arr[i] = (double)(wake_time - target_time);
 		fraction_arr[i] = jitter_arr[i] / ((double)sleep_length_abs);
+
+		if (wake_time - target_time > constraint_abs) {
+			deadline_misses++;
+		}
 		
 		/* Too much: cut a tracepoint for a debugger */
 		if (jitter_arr[i] >= too_much) {
@@ -415,6 +446,10 @@ main(int argc, char **argv)
 	print_stats_us("jitter", avg, max, min, stddev);
 	print_stats_fract("%", avg_fract, max_fract, min_fract, stddev_fract);
 
+	putchar('\n');
+	printf("%llu/%llu (%.1f%%) wakeups missed the %.1lfus deadline\n", deadline_misses, iterations,
+		   100.0*((double)deadline_misses)/iterations, g_constraint_ns / 1000.0);
+
 	if (wakeup_second_thread) {
 
 		res = pthread_join(secthread, NULL);
@@ -430,6 +465,8 @@ main(int argc, char **argv)
 		putchar('\n');
 		printf("%llu/%llu (%.1f%%) wakeups on same CPU\n", secargs.woke_on_same_cpu, iterations,
 			   100.0*((double)secargs.woke_on_same_cpu)/iterations);
+		printf("%llu/%llu (%.1f%%) second thread wakeups missed the %.1lfus deadline\n", secargs.deadline_misses, iterations,
+			   100.0*((double)secargs.deadline_misses)/iterations, g_constraint_ns / 1000.0);
 	}
 
 	return 0;
@@ -477,6 +514,10 @@ second_thread(void *args)
 		}
 
 		secargs->wakeup_second_jitter_arr[i] = (double)(wake_time - secargs->last_poke_time);
+
+		if (wake_time - secargs->last_poke_time > g_constraint_ns * g_mti.denom / g_mti.numer) {
+			secargs->deadline_misses++;
+		}
 		
 		/* Too much: cut a tracepoint for a debugger */
 		if (secargs->wakeup_second_jitter_arr[i] >= secargs->too_much) {
@@ -0,0 +1,243 @@
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/select.h>
+#include <sys/sysctl.h>
+#include <sys/time.h>
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <mach/mach.h>
+
+/*
+ * Registration churn benchmark for the waitq link and prepost tables.
+ *
+ * Each EVFILT_MACHPORT registration on a port set links the port set's
+ * wait queue into the kqueue's wait queue set, and each select() on a kqueue
+ * or pipe links the descriptor's wait queue into the selecting thread's set.
+ * Both allocate and free link table elements on every operation, so running
+ * them from many threads at once measures table allocation scalability.
+ */
+
+#define PORTSETS_PER_THREAD	64
+#define FDS_PER_THREAD		32
+#define RUN_SECONDS		2
+
+int passed, failed;
+
+static volatile int stop;
+
+struct churn_thread {
+	pthread_t	thread;
+	uint64_t	ops;
+	int		error;
+};
+
+/*
+ * Add and delete EVFILT_MACHPORT knotes on a set of port sets.
+ */
+static void *
+portset_churn(void *arg)
+{
+	struct churn_thread *ct = arg;
+	mach_port_t psets[PORTSETS_PER_THREAD];
+	struct kevent64_s kev[PORTSETS_PER_THREAD];
+	kern_return_t kr;
+	int kq, i;
+
+	kq = kqueue();
+	if (kq < 0) {
+		ct->error = errno;
+		return NULL;
+	}
+
+	for (i = 0; i < PORTSETS_PER_THREAD; i++) {
+		kr = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_PORT_SET, &psets[i]);
+		if (kr != KERN_SUCCESS) {
+			ct->error = kr;
+			return NULL;
+		}
+	}
+
+	while (!stop) {
+		for (i = 0; i < PORTSETS_PER_THREAD; i++)
+			EV_SET64(&kev[i], psets[i], EVFILT_MACHPORT, EV_ADD | EV_ENABLE, 0, 0, 0, 0, 0);
+		if (kevent64(kq, kev, PORTSETS_PER_THREAD, NULL, 0, 0, NULL) < 0) {
+			ct->error = errno;
+			break;
+		}
+
+		for (i = 0; i < PORTSETS_PER_THREAD; i++)
+			EV_SET64(&kev[i], psets[i], EVFILT_MACHPORT, EV_DELETE, 0, 0, 0, 0, 0);
+		if (kevent64(kq, kev, PORTSETS_PER_THREAD, NULL, 0, 0, NULL) < 0) {
+			ct->error = errno;
+			break;
+		}
+
+		ct->ops += 2 * PORTSETS_PER_THREAD;
+	}
+
+	for (i = 0; i < PORTSETS_PER_THREAD; i++)
+		mach_port_mod_refs(mach_task_self(), psets[i], MACH_PORT_RIGHT_PORT_SET, -1);
+	close(kq);
+	return NULL;
+}
+
+/*
+ * Poll a mix of kqueues and pipes with select(), none of which are ready.
+ */
+static void *
+select_churn(void *arg)
+{
+	struct churn_thread *ct = arg;
+	int fds[FDS_PER_THREAD];
+	int pipes[FDS_PER_THREAD / 2][2];
+	struct timeval timeout = { 0, 0 };
+	fd_set readfds;
+	int i, maxfd = 0;
+
+	for (i = 0; i < FDS_PER_THREAD / 2; i++) {
+		if ((fds[i] = kqueue()) < 0 || pipe(pipes[i]) < 0) {
+			ct->error = errno;
+			return NULL;
+		}
+		fds[FDS_PER_THREAD / 2 + i] = pipes[i][0];
+	}
+	for (i = 0; i < FDS_PER_THREAD; i++) {
+		if (fds[i] > maxfd)
+			maxfd = fds[i];
+	}
+	if (maxfd >= FD_SETSIZE) {
+		ct->error = EMFILE;
+		return NULL;
+	}
+
+	while (!stop) {
+		FD_ZERO(&readfds);
+		for (i = 0; i < FDS_PER_THREAD; i++)
+			FD_SET(fds[i], &readfds);
+		if (select(maxfd + 1, &readfds, NULL, NULL, &timeout) < 0) {
+			ct->error = errno;
+			break;
+		}
+		ct->ops += FDS_PER_THREAD;
+	}
+
+	for (i = 0; i < FDS_PER_THREAD / 2; i++) {
+		close(fds[i]);
+		close(pipes[i][0]);
+		close(pipes[i][1]);
+	}
+	return NULL;
+}
+
+static uint64_t
+table_counter(const char *table, const char *name)
+{
+	char oid[128];
+	uint64_t value = 0;
+	size_t size = sizeof(value);
+
+	snprintf(oid, sizeof(oid), "kern.%s.%s", table, name);
+	if (sysctlbyname(oid, &value, &size, NULL, 0) < 0)
+		return 0;
+	return value;
+}
+
+static const char *counter_names[] = {
+	"grows", "alloc_collisions", "free_collisions",
+	"cache_hits", "cache_misses", "cache_flushes",
+};
+#define NCOUNTERS (sizeof(counter_names) / sizeof(counter_names[0]))
+
+static void
+read_counters(const char *table, uint64_t counters[NCOUNTERS])
+{
+	for (unsigned i = 0; i < NCOUNTERS; i++)
+		counters[i] = table_counter(table, counter_names[i]);
+}
+
+void
+test_churn(const char *name, void *(*fn)(void *), int nthreads)
+{
+	struct churn_thread *threads;
+	struct timeval before, after;
+	uint64_t link_before[NCOUNTERS], link_after[NCOUNTERS];
+	uint64_t ops = 0, elapsed_usecs;
+	int error = 0, i;
+
+	printf("%s churn, %d threads\n", name, nthreads);
+
+	threads = calloc(nthreads, sizeof(*threads));
+	assert(threads != NULL);
+
+	read_counters("waitq_link_table", link_before);
+	stop = 0;
+	gettimeofday(&before, NULL);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i].thread, NULL, fn, &threads[i]) != 0) {
+			printf("\tfailure: pthread_create\n");
+			failed++;
+			nthreads = i;
+			stop = 1;
+			break;
+		}
+	}
+
+	sleep(RUN_SECONDS);
+	stop = 1;
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		ops += threads[i].ops;
+		if (threads[i].error)
+			error = threads[i].error;
+	}
+	gettimeofday(&after, NULL);
+	read_counters("waitq_link_table", link_after);
+	free(threads);
+
+	if (error) {
+		printf("\tfailure: error %d\n", error);
+		failed++;
+		return;
+	}
+
+	elapsed_usecs = (after.tv_sec - before.tv_sec) * (1000 * 1000) +
+		(after.tv_usec - before.tv_usec);
+	printf("\t%llu link operations in %llu usecs (%llu ops/sec)\n",
+		ops, elapsed_usecs, ops * 1000 * 1000 / (elapsed_usecs ? elapsed_usecs : 1));
+	for (unsigned c = 0; c < NCOUNTERS; c++)
+		printf("\tlink table %s: %llu\n", counter_names[c], link_after[c] - link_before[c]);
+
+	printf("\tsuccess.\n");
+	passed++;
+}
+
+int
+main(void)
+{
+	int ncpu = 1;
+	size_t ncpu_size = sizeof(ncpu);
+
+	(void)sysctlbyname("hw.ncpu", &ncpu, &ncpu_size, NULL, 0);
+	passed = 0;
+	failed = 0;
+
+	for (int nthreads = 1; nthreads <= ncpu; nthreads *= 2) {
+		test_churn("portset", portset_churn, nthreads);
+		test_churn("select", select_churn, nthreads);
+	}
+	if ((ncpu & (ncpu - 1)) != 0) {
+		test_churn("portset", portset_churn, ncpu);
+		test_churn("select", select_churn, ncpu);
+	}
+
+	printf("\nFinished: %d tests passed, %d failed.\n", passed, failed);
+
+	exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1 @@
+#include <sched_sim_objs.h>
@@ -0,0 +1 @@
+#include <sched_sim_kern.h>
@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2017 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ * 
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * The kernel environment seen by the scheduler policy sources when they are
+ * built into the user space scheduler simulator.
+ *
+ * Every kernel header the policies include that is not self-contained is
+ * replaced, under include/, by a header that includes this file. The
+ * self-contained ones (kern/queue.h, kern/bits.h, kern/sched.h and
+ * kern/sched_prim.h among them) are used as they are, so run queues,
+ * priorities and the dispatch table are the kernel's own.
+ *
+ * Threads, processors and processor sets carry only the fields the
+ * policies touch. There is a single simulated CPU of execution, so locks
+ * and interrupt levels are no-ops.
+ */
+
+#ifndef _SCHED_SIM_KERN_H_
+#define _SCHED_SIM_KERN_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/cdefs.h>
+
+/* Basic mach types */
+
+typedef int			boolean_t;
+typedef int			integer_t;
+typedef unsigned int		natural_t;
+typedef int			kern_return_t;
+typedef int			wait_result_t;
+typedef int			wait_interrupt_t;
+typedef int			spl_t;
+typedef uint32_t		ast_t;
+typedef uint32_t		mach_port_name_t;
+typedef uint64_t		event64_t;
+typedef void			*event_t;
+typedef void			(*thread_continue_t)(void *, wait_result_t);
+typedef int			block_hint_t;
+typedef void			*timer_call_param_t;
+typedef int			policy_t;
+typedef int			wait_timeout_urgency_t;
+typedef uintptr_t		vm_offset_t;
+
+#ifndef TRUE
+#define TRUE			1
+#endif
+#ifndef FALSE
+#define FALSE			0
+#endif
+
+#define KERN_SUCCESS		0
+#define KERN_FAILURE		5
+
+#define THREAD_WAITING		-1
+#define THREAD_AWAKENED		0
+#define THREAD_TIMED_OUT	1
+#define THREAD_INTERRUPTED	2
+#define THREAD_RESTART		3
+
+#define AST_NONE		0x00
+#define AST_PREEMPT		0x01
+#define AST_QUANTUM		0x02
+#define AST_URGENT		0x04
+#define AST_HANDOFF		0x08
+#define AST_YIELD		0x10
+#define AST_PREEMPTION		(AST_PREEMPT | AST_QUANTUM | AST_URGENT)
+#define AST_SCHEDULING		(AST_PREEMPTION | AST_YIELD | AST_HANDOFF)
+
+#define THREAD_UNINT		0
+#define THREAD_INTERRUPTIBLE	1
+#define THREAD_ABORTSAFE	2
+
+#define NSEC_PER_USEC		1000ull
+#define NSEC_PER_MSEC		1000000ull
+#define USEC_PER_SEC		1000000ull
+#define NSEC_PER_SEC		1000000000ull
+
+#define PAGE_SIZE		4096
+#define task_max		1024
+
+#ifndef __private_extern__
+#define __private_extern__	extern
+#endif
+#ifndef __dead2
+#define __dead2			__attribute__((__noreturn__))
+#endif
+#ifndef __offsetof
+#define __offsetof(type, field)	offsetof(type, field)
+#endif
+#ifndef __unused
+#define __unused		__attribute__((__unused__))
+#endif
+#ifndef __BEGIN_DECLS
+#define __BEGIN_DECLS
+#define __END_DECLS
+#endif
+
+#define MIN(a, b)		(((a) < (b)) ? (a) : (b))
+#define MAX(a, b)		(((a) > (b)) ? (a) : (b))
+
+#define MAX_CPUS		64
+
+/* Kernel services */
+
+#define panic(...)		sim_panic(__VA_ARGS__)
+extern void			sim_panic(const char *fmt, ...) __dead2 __attribute__((format(__printf__, 1, 2)));
+
+/*
+ * Policy sources print their configuration at init; that goes to stderr
+ * with -v and is dropped otherwise, keeping the report on stdout clean.
+ */
+#define kprintf			sim_kprintf
+#ifndef SCHED_SIM_HOST
+#define printf			sim_kprintf
+#endif
+extern void			sim_kprintf(const char *fmt, ...) __attribute__((format(__printf__, 1, 2)));
+#define KERNEL_DEBUG_CONSTANT(...) do { } while (0)
+#define KERNEL_DEBUG_CONSTANT_IST(...) do { } while (0)
+#define KDBG(...)		do { } while (0)
+#define DTRACE_SCHED(...)	do { } while (0)
+#define DTRACE_SCHED1(...)	do { } while (0)
+#define DTRACE_SCHED2(...)	do { } while (0)
+
+/* No boot-args: the policies run with their defaults */
+static inline boolean_t
+PE_parse_boot_argn(__unused const char *name, __unused void *ptr, __unused int size)
+{
+	return (FALSE);
+}
+
+#define splsched()		(0)
+#define splx(s)			((void)(s))
+
+#define kalloc(size)		malloc(size)
+#define kfree(ptr, size)	free(ptr)
+
+extern void			clock_interval_to_absolutetime_interval(uint32_t interval,
+				    uint32_t scale_factor, uint64_t *result);
+extern void			clock_deadline_for_periodic_event(uint64_t interval,
+				    uint64_t abstime, uint64_t *deadline);
+
+struct zone;
+typedef struct zone		*zone_t;
+extern zone_t			zinit(size_t size, size_t max, size_t alloc, const char *name);
+extern void			*zalloc(zone_t zone);
+extern void			zfree(zone_t zone, void *elem);
+#define zone_change(zone, item, value) do { } while (0)
+
+/* Locks: the simulation is single threaded */
+
+typedef struct { int unused; } lck_mtx_t, lck_mtx_ext_t, lck_spin_t;
+typedef struct { int unused; } lck_grp_t, lck_grp_attr_t, lck_attr_t;
+typedef int			simple_lock_data_t;
+
+#define decl_simple_lock_data(class, name)	class simple_lock_data_t name
+#define simple_lock_init(l, t)	do { } while (0)
+#define simple_lock(l)		do { } while (0)
+#define simple_unlock(l)	do { } while (0)
+#define lck_attr_setdefault(a)	do { } while (0)
+#define lck_grp_attr_setdefault(a) do { } while (0)
+#define lck_grp_init(g, n, a)	do { } while (0)
+#define lck_mtx_init(m, g, a)	do { } while (0)
+#define lck_mtx_lock(m)		do { } while (0)
+#define lck_mtx_unlock(m)	do { } while (0)
+
+#define thread_lock(t)		do { } while (0)
+#define thread_unlock(t)	do { } while (0)
+#define pset_lock(p)		do { } while (0)
+#define pset_unlock(p)		do { } while (0)
+#define rt_lock_lock()		do { } while (0)
+#define rt_lock_unlock()	do { } while (0)
+
+/* kern/bits.h uses the clang spelling of the C11 atomic builtins */
+#ifndef __clang__
+#define __c11_atomic_fetch_or(p, v, order)	__atomic_fetch_or(p, v, order)
+#define __c11_atomic_fetch_and(p, v, order)	__atomic_fetch_and(p, v, order)
+#endif
+
+#include <kern/queue.h>
+
+/* Scheduler objects */
+
+typedef struct thread		*thread_t;
+typedef struct processor	*processor_t;
+typedef struct processor_set	*processor_set_t;
+typedef struct task		*task_t;
+typedef struct run_queue	*run_queue_t;
+typedef struct sched_group	*sched_group_t;
+typedef struct grrr_run_queue	*grrr_run_queue_t;
+typedef struct grrr_group	*grrr_group_t;
+
+#define THREAD_NULL		((thread_t) 0)
+#define PROCESSOR_NULL		((processor_t) 0)
+#define PROCESSOR_SET_NULL	((processor_set_t) 0)
+#define TASK_NULL		((task_t) 0)
+#define SCHED_GROUP_NULL	((sched_group_t) 0)
+#define GRRR_GROUP_NULL		((grrr_group_t) 0)
+
+#define assert_thread_magic(thread) do { (void)(thread); } while (0)
+
+#endif /* _SCHED_SIM_KERN_H_ */
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2017 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ * 
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Simulated threads, tasks, processors and processor sets: the fields the
+ * scheduler policies use, under their kernel names, plus the simulator's
+ * own bookkeeping in the sim_ fields.
+ */
+
+#ifndef _SCHED_SIM_OBJS_H_
+#define _SCHED_SIM_OBJS_H_
+
+#include <sched_sim_kern.h>
+#include <kern/sched.h>
+
+struct task {
+	sched_group_t		sched_group;
+	const char		*sim_name;
+};
+
+#define TH_WAIT			0x01	/* queued for waiting */
+#define TH_RUN			0x04	/* running or on runq */
+#define TH_TERMINATE		0x10	/* halted at termination */
+#define TH_IDLE			0x80	/* idling processor */
+
+struct thread {
+	queue_chain_t		runq_links;	/* run queue linkage */
+	processor_t		runq;		/* run queue assignment */
+
+	int			state;
+	ast_t			reason;		/* why we blocked */
+	uint32_t		quantum_remaining;
+
+	int			sched_pri;	/* scheduled (current) priority */
+	int			base_pri;	/* base priority */
+	sched_mode_t		sched_mode;
+	sched_bucket_t		th_sched_bucket;
+	unsigned		sched_stamp;
+
+	processor_t		bound_processor;
+	processor_t		last_processor;
+	processor_t		chosen_processor;
+	uint64_t		last_run_time;	/* time thread last switched off */
+
+	task_t			task;
+	sched_group_t		sched_group;
+
+#if defined(CONFIG_SCHED_GRRR)
+	uint32_t		grrr_deficit;
+#endif
+
+	/* simulator state */
+	const char		*sim_name;
+	uint64_t		sim_run_ns;	/* length of each burst */
+	uint64_t		sim_block_ns;	/* sleep between bursts */
+	uint32_t		sim_bursts_left;
+	uint64_t		sim_burst_remaining;
+	uint64_t		sim_made_runnable;
+	boolean_t		sim_woken;	/* made runnable by a wakeup */
+};
+
+#define PROCESSOR_OFF_LINE	0
+#define PROCESSOR_SHUTDOWN	1
+#define PROCESSOR_START		2
+#define PROCESSOR_INACTIVE	3
+#define PROCESSOR_IDLE		4
+#define PROCESSOR_DISPATCHING	5
+#define PROCESSOR_RUNNING	6
+
+struct processor {
+	queue_chain_t		processor_queue;
+	int			state;
+	thread_t		active_thread;
+	thread_t		next_thread;
+	thread_t		idle_thread;
+
+	processor_set_t		processor_set;
+
+	int			current_pri;
+	sched_mode_t		current_thmode;
+	int			cpu_id;
+	boolean_t		first_timeslice;
+
+#if defined(CONFIG_SCHED_TRADITIONAL) || defined(CONFIG_SCHED_MULTIQ)
+	struct run_queue	runq;
+#endif
+#if defined(CONFIG_SCHED_TRADITIONAL)
+	int			runq_bound_count;
+#endif
+#if defined(CONFIG_SCHED_GRRR)
+	struct grrr_run_queue	grrr_runq;
+#endif
+
+	uint64_t		last_dispatch;
+	uint64_t		quantum_end;
+
+	processor_t		processor_list;
+
+	/* simulator state */
+	uint64_t		sim_timer_gen;	/* invalidates stale timer events */
+	uint64_t		sim_busy_ns;
+};
+
+struct processor_set {
+	queue_head_t		active_queue;
+	queue_head_t		idle_queue;
+
+	int			online_processor_count;
+	int			cpu_set_low, cpu_set_hi;
+	int			cpu_set_count;
+
+	uint64_t		pending_AST_cpu_mask;
+
+#if defined(CONFIG_SCHED_TRADITIONAL) || defined(CONFIG_SCHED_MULTIQ)
+	struct run_queue	pset_runq;
+#endif
+#if defined(CONFIG_SCHED_TRADITIONAL)
+	int			pset_runq_bound_count;
+#endif
+
+	processor_set_t		pset_list;
+};
+
+extern struct processor_set	pset0;
+extern processor_t		processor_list;
+extern struct task		*kernel_task;
+extern unsigned			sched_tick;
+extern boolean_t		sched_stats_active;
+
+extern processor_t		sim_current_processor;
+#define current_processor()	(sim_current_processor)
+#define current_thread()	(sim_current_processor->active_thread)
+
+extern uint64_t			sim_now;
+#define mach_absolute_time()	(sim_now)
+#define mach_approximate_time()	(sim_now)
+
+extern processor_set_t		next_pset(processor_set_t pset);
+extern thread_t			thread_select(thread_t thread, processor_t processor, ast_t reason);
+
+/* Provided by the event loop */
+extern void			sim_processor_signal(processor_t processor);
+
+#endif /* _SCHED_SIM_OBJS_H_ */
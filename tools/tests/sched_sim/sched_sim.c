@@ -0,0 +1,898 @@
+/*
+ * Copyright (c) 2017 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * sched_sim: a deterministic discrete event simulator for the scheduler
+ * policies in osfmk/kern/sched_*.c.
+ *
+ * The policy sources are compiled unmodified and driven through their
+ * sched_dispatch_table, so choose_thread, processor_enqueue, steal_thread
+ * and processor_csw_check are the kernel's own.  The event loop stands in
+ * for the processors: each one runs a thread until its burst ends, its
+ * quantum expires or it is signalled, and then calls thread_select() as
+ * the kernel would.
+ *
+ * A workload trace has one thread per line:
+ *
+ *	name task start_us pri run_us block_us bursts [cpu]
+ *
+ * The thread becomes runnable at start_us, runs for run_us, blocks for
+ * block_us, and repeats for the given number of bursts.  Threads in the
+ * same task share a scheduler group under multiq.  A cpu number binds the
+ * thread to that processor.  Blank lines and text after '#' are ignored.
+ *
+ * With -l, the processors are split into processor sets of the given
+ * size, each standing for a shared last level cache as on x86, and -w
+ * sets the scheduler's cache hot window.
+ *
+ * For each policy, sched_sim reports context switches, migrations,
+ * utilization and burst throughput, and per task the wakeup to dispatch
+ * latency percentiles and the total time spent running and waiting on a
+ * run queue.  Each policy runs in its own process, since the
+ * policies keep their state in globals.
+ */
+
+#define SCHED_SIM_HOST
+
+#include <kern/processor.h>
+#include <kern/sched_prim.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdarg.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define SIM_MAX_THREADS		1024
+#define SIM_MAX_TASKS		64
+
+uint64_t		sim_now;
+processor_t		sim_current_processor;
+
+static int		sim_verbose;
+static int		sim_ncpus = 4;
+static int		sim_pset_ncpus;		/* 0: a single processor set */
+static int		sim_npsets;
+static uint64_t		sim_ipi_latency = 2 * NSEC_PER_USEC;
+static uint64_t		sim_time_limit = 60 * NSEC_PER_SEC;
+
+static const struct sched_dispatch_table *sim_policies[] = {
+	&sched_traditional_dispatch,
+	&sched_traditional_with_pset_runqueue_dispatch,
+	&sched_multiq_dispatch,
+	&sched_dualq_dispatch,
+	&sched_grrr_dispatch,
+};
+#define SIM_NPOLICIES	(sizeof(sim_policies) / sizeof(sim_policies[0]))
+
+void
+sim_panic(const char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "sched_sim: panic at %llu ns: ", (unsigned long long)sim_now);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	abort();
+}
+
+void
+sim_kprintf(const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!sim_verbose)
+		return;
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
+
+/*
+ *	Statistics.
+ */
+
+struct sim_samples {
+	uint64_t		*values;
+	size_t			count, size;
+};
+
+struct sim_task {
+	struct task		task;
+	struct sim_samples	latency;
+	uint64_t		bursts;
+	uint64_t		cpu_ns;
+	uint64_t		wait_ns;	/* runnable but not running */
+};
+
+static struct sim_task	sim_tasks[SIM_MAX_TASKS];
+static int		sim_ntasks;
+static struct sim_task	sim_kernel_task;
+
+static struct thread	sim_threads[SIM_MAX_THREADS];
+static int		sim_nthreads;
+static int		sim_threads_done;
+
+static struct processor	sim_processors[MAX_CPUS];
+static struct processor_set sim_psets[MAX_CPUS];
+static struct thread	sim_idle_threads[MAX_CPUS];
+
+static struct sim_task	sim_total;
+static uint64_t		sim_context_switches;
+static uint64_t		sim_involuntary;
+static uint64_t		sim_migrations;
+static uint64_t		sim_pset_migrations;
+static uint64_t		sim_cache_hot_migrations;
+
+extern uint64_t		sched_cache_hot_window;
+
+static void
+sim_sample(struct sim_samples *s, uint64_t value)
+{
+	if (s->count == s->size) {
+		s->size = s->size ? 2 * s->size : 1024;
+		s->values = realloc(s->values, s->size * sizeof(s->values[0]));
+		if (s->values == NULL)
+			panic("out of memory");
+	}
+	s->values[s->count++] = value;
+}
+
+static int
+sim_sample_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double
+sim_percentile(struct sim_samples *s, unsigned pct)
+{
+	if (s->count == 0)
+		return (0.0);
+	return (double)s->values[(s->count - 1) * pct / 100] / NSEC_PER_USEC;
+}
+
+/*
+ *	Events.
+ *
+ * A binary heap ordered by time, then by insertion, so that runs are
+ * reproducible.  Timer events carry the processor's timer generation at
+ * the time they were armed and are dropped if it has moved on.
+ */
+
+enum sim_event_type {
+	SIM_EV_WAKEUP,		/* a thread becomes runnable */
+	SIM_EV_TIMER,		/* the running thread's burst or quantum ends */
+	SIM_EV_AST,		/* a processor was signalled */
+};
+
+struct sim_event {
+	uint64_t		time;
+	uint64_t		seq;
+	enum sim_event_type	type;
+	void			*obj;
+	uint64_t		gen;
+};
+
+static struct sim_event	*sim_events;
+static size_t		sim_nevents, sim_events_size;
+static uint64_t		sim_event_seq;
+
+static boolean_t
+sim_event_before(struct sim_event *a, struct sim_event *b)
+{
+	return (a->time < b->time || (a->time == b->time && a->seq < b->seq));
+}
+
+static void
+sim_event_post(uint64_t time, enum sim_event_type type, void *obj, uint64_t gen)
+{
+	struct sim_event ev = { time, sim_event_seq++, type, obj, gen };
+	size_t i;
+
+	if (sim_nevents == sim_events_size) {
+		sim_events_size = sim_events_size ? 2 * sim_events_size : 256;
+		sim_events = realloc(sim_events, sim_events_size * sizeof(sim_events[0]));
+		if (sim_events == NULL)
+			panic("out of memory");
+	}
+
+	for (i = sim_nevents++; i > 0; i = (i - 1) / 2) {
+		if (!sim_event_before(&ev, &sim_events[(i - 1) / 2]))
+			break;
+		sim_events[i] = sim_events[(i - 1) / 2];
+	}
+	sim_events[i] = ev;
+}
+
+static boolean_t
+sim_event_next(struct sim_event *ev)
+{
+	struct sim_event last;
+	size_t i, child;
+
+	if (sim_nevents == 0)
+		return (FALSE);
+
+	*ev = sim_events[0];
+	last = sim_events[--sim_nevents];
+
+	for (i = 0; (child = 2 * i + 1) < sim_nevents; i = child) {
+		if (child + 1 < sim_nevents && sim_event_before(&sim_events[child + 1], &sim_events[child]))
+			child++;
+		if (!sim_event_before(&sim_events[child], &last))
+			break;
+		sim_events[i] = sim_events[child];
+	}
+	sim_events[i] = last;
+
+	return (TRUE);
+}
+
+/*
+ * Called by processor_setrun() to interrupt or wake a processor.  A
+ * processor signalling itself sees the AST at once; any other pays the
+ * interprocessor interrupt latency.
+ */
+static boolean_t	sim_in_processor;
+
+void
+sim_processor_signal(processor_t processor)
+{
+	uint64_t latency = sim_ipi_latency;
+
+	if (sim_in_processor && processor == sim_current_processor)
+		latency = 0;
+	sim_event_post(sim_now + latency, SIM_EV_AST, processor, 0);
+}
+
+/*
+ *	Processors.
+ */
+
+static struct sim_task *
+sim_task_of(thread_t thread)
+{
+	return (struct sim_task *)thread->task;
+}
+
+/*
+ * Charge the time since the last dispatch or accounting point to the
+ * running thread.
+ */
+static void
+sim_account(processor_t processor)
+{
+	thread_t thread = processor->active_thread;
+	uint64_t elapsed = sim_now - processor->last_dispatch;
+
+	if (thread->state & TH_IDLE)
+		return;
+
+	assert(elapsed <= thread->sim_burst_remaining);
+	thread->sim_burst_remaining -= elapsed;
+	sim_task_of(thread)->cpu_ns += elapsed;
+	processor->sim_busy_ns += elapsed;
+	processor->last_dispatch = sim_now;
+}
+
+static void
+sim_arm_timer(processor_t processor)
+{
+	thread_t thread = processor->active_thread;
+	uint64_t deadline;
+
+	processor->sim_timer_gen++;
+	if (thread->state & TH_IDLE)
+		return;
+
+	deadline = sim_now + thread->sim_burst_remaining;
+	if (processor->quantum_end < deadline)
+		deadline = processor->quantum_end;
+	sim_event_post(deadline, SIM_EV_TIMER, processor, processor->sim_timer_gen);
+}
+
+/*
+ * Put a thread that came off core back on a run queue, as
+ * thread_dispatch() does, keeping what is left of its quantum.
+ */
+static void
+sim_thread_dispatch(processor_t processor, thread_t thread, thread_t self)
+{
+	if (thread->state & TH_IDLE)
+		return;
+
+	if (processor->first_timeslice && processor->quantum_end > sim_now)
+		thread->quantum_remaining = (uint32_t)(processor->quantum_end - sim_now);
+	else
+		thread->quantum_remaining = 0;
+
+	/*
+	 *	For non-realtime threads treat a tiny
+	 *	remaining quantum as an expired quantum
+	 *	but include what's left next time.
+	 */
+	if (thread->quantum_remaining < min_std_quantum) {
+		thread->reason |= AST_QUANTUM;
+		thread->quantum_remaining += SCHED(initial_quantum_size)(thread);
+	}
+
+	if (SCHED(sched_groups_enabled) && !(self->state & TH_IDLE) &&
+	    thread->sched_group == self->sched_group) {
+		self->quantum_remaining = thread->quantum_remaining;
+		thread->quantum_remaining = 0;
+	}
+
+	if (!(thread->state & (TH_WAIT | TH_TERMINATE))) {
+		/*
+		 *	Still runnable.
+		 */
+		sim_involuntary++;
+		thread->sim_made_runnable = sim_now;
+
+		if (thread->reason & AST_QUANTUM)
+			thread_setrun(thread, SCHED_TAILQ);
+		else if (thread->reason & AST_PREEMPT)
+			thread_setrun(thread, SCHED_HEADQ);
+		else
+			thread_setrun(thread, SCHED_PREEMPT | SCHED_TAILQ);
+	}
+}
+
+/*
+ * Switch the processor from its active thread to the given one.
+ */
+static void
+sim_switch(processor_t processor, thread_t thread)
+{
+	thread_t old = processor->active_thread;
+
+	processor->active_thread = thread;
+	processor->last_dispatch = sim_now;
+	old->last_run_time = sim_now;
+
+	if (thread->state & TH_IDLE) {
+		sim_thread_dispatch(processor, old, thread);
+		processor->current_pri = IDLEPRI;
+		processor->first_timeslice = FALSE;
+		sim_arm_timer(processor);
+		return;
+	}
+
+	processor->state = PROCESSOR_RUNNING;
+	processor->current_pri = thread->sched_pri;
+	processor->current_thmode = thread->sched_mode;
+
+	sim_context_switches++;
+	sim_total.wait_ns += sim_now - thread->sim_made_runnable;
+	sim_task_of(thread)->wait_ns += sim_now - thread->sim_made_runnable;
+	if (thread->sim_woken) {
+		uint64_t latency = sim_now - thread->sim_made_runnable;
+
+		sim_sample(&sim_total.latency, latency);
+		sim_sample(&sim_task_of(thread)->latency, latency);
+		thread->sim_woken = FALSE;
+	}
+	if (thread->last_processor != PROCESSOR_NULL && thread->last_processor != processor) {
+		sim_migrations++;
+		if (thread->last_processor->processor_set != processor->processor_set) {
+			sim_pset_migrations++;
+			if (thread->last_run_time + sched_cache_hot_window > sim_now)
+				sim_cache_hot_migrations++;
+		}
+	}
+	thread->last_processor = processor;
+
+	sim_thread_dispatch(processor, old, thread);
+
+	/*
+	 *	Get a new quantum if none remaining.
+	 */
+	if (thread->quantum_remaining == 0)
+		thread->quantum_remaining = SCHED(initial_quantum_size)(thread);
+	processor->quantum_end = sim_now + thread->quantum_remaining;
+	processor->first_timeslice = TRUE;
+	thread->reason = AST_NONE;
+
+	sim_arm_timer(processor);
+}
+
+/*
+ * Reschedule the processor: thread_block() with the given reason.
+ */
+static void
+sim_block(processor_t processor, ast_t reason)
+{
+	thread_t self = processor->active_thread;
+	thread_t thread;
+
+	sim_account(processor);
+	self->reason = reason;
+
+	thread = thread_select(self, processor, reason);
+	if (thread == self) {
+		self->reason = AST_NONE;
+		sim_arm_timer(processor);
+		return;
+	}
+	sim_switch(processor, thread);
+}
+
+static void
+sim_timer_expire(processor_t processor)
+{
+	thread_t thread = processor->active_thread;
+	struct sim_task *task = sim_task_of(thread);
+
+	sim_account(processor);
+
+	if (thread->sim_burst_remaining == 0) {
+		/*
+		 * The burst is done: block, or terminate after the last one.
+		 */
+		sim_total.bursts++;
+		task->bursts++;
+		thread->state &= ~TH_RUN;
+		if (--thread->sim_bursts_left > 0) {
+			thread->state |= TH_WAIT;
+			sim_event_post(sim_now + thread->sim_block_ns, SIM_EV_WAKEUP, thread, 0);
+		} else {
+			thread->state |= TH_TERMINATE;
+			sim_threads_done++;
+		}
+		sim_block(processor, AST_NONE);
+		return;
+	}
+
+	/*
+	 * Quantum expiry, as in thread_quantum_expire().
+	 */
+	SCHED(quantum_expire)(thread);
+	SCHED(lightweight_update_priority)(thread);
+
+	thread->quantum_remaining = SCHED(initial_quantum_size)(thread);
+	processor->quantum_end = sim_now + thread->quantum_remaining;
+	processor->first_timeslice = FALSE;
+
+	ast_t preempt = csw_check(processor, AST_QUANTUM);
+	if (preempt != AST_NONE)
+		sim_block(processor, preempt);
+	else
+		sim_arm_timer(processor);
+}
+
+static void
+sim_ast(processor_t processor)
+{
+	processor_set_t pset = processor->processor_set;
+	thread_t thread;
+
+	if (!(processor->active_thread->state & TH_IDLE)) {
+		ast_t preempt = csw_check(processor, AST_NONE);
+
+		if (preempt != AST_NONE)
+			sim_block(processor, preempt);
+		return;
+	}
+
+	/*
+	 * The processor is idle: leave the idle loop as processor_idle() does.
+	 */
+	pset->pending_AST_cpu_mask &= ~(1ULL << processor->cpu_id);
+
+	if (processor->state == PROCESSOR_DISPATCHING) {
+		thread = processor->next_thread;
+		processor->next_thread = THREAD_NULL;
+		processor->state = PROCESSOR_RUNNING;
+
+		if (thread != THREAD_NULL) {
+			if (SCHED(processor_queue_has_priority)(processor, thread->sched_pri, FALSE) == FALSE) {
+				sim_switch(processor, thread);
+				return;
+			}
+			thread_setrun(thread, SCHED_HEADQ);
+		}
+	} else if (processor->state == PROCESSOR_IDLE) {
+		processor->state = PROCESSOR_RUNNING;
+		re_queue_tail(&pset->active_queue, &processor->processor_queue);
+	}
+
+	sim_block(processor, AST_NONE);
+}
+
+static void
+sim_wakeup(thread_t thread)
+{
+	thread->state = (thread->state & ~TH_WAIT) | TH_RUN;
+	thread->sim_burst_remaining = thread->sim_run_ns;
+	thread->sim_made_runnable = sim_now;
+	thread->sim_woken = TRUE;
+	thread_setrun(thread, SCHED_PREEMPT | SCHED_TAILQ);
+}
+
+/*
+ *	Setup.
+ */
+
+static void
+sim_task_init(struct sim_task *task, const char *name)
+{
+	task->task.sim_name = name;
+	task->task.sched_group = sched_group_create();
+}
+
+static task_t
+sim_task_lookup(const char *name)
+{
+	for (int i = 0; i < sim_ntasks; i++) {
+		if (strcmp(sim_tasks[i].task.sim_name, name) == 0)
+			return (&sim_tasks[i].task);
+	}
+	if (sim_ntasks == SIM_MAX_TASKS)
+		panic("too many tasks (%d)", SIM_MAX_TASKS);
+	sim_tasks[sim_ntasks].task.sim_name = strdup(name);
+	return (&sim_tasks[sim_ntasks++].task);
+}
+
+static void
+sim_thread_init(thread_t thread, task_t task, int pri)
+{
+	thread->task = task;
+	thread->sched_group = task->sched_group;
+	thread->base_pri = thread->sched_pri = pri;
+	thread->sched_mode = SCHED(initial_thread_sched_mode)(task);
+
+	if (thread->sched_mode != TH_MODE_TIMESHARE)
+		thread->th_sched_bucket = TH_BUCKET_FIXPRI;
+	else if (thread->base_pri > BASEPRI_UTILITY)
+		thread->th_sched_bucket = TH_BUCKET_SHARE_FG;
+	else if (thread->base_pri > MAXPRI_THROTTLE)
+		thread->th_sched_bucket = TH_BUCKET_SHARE_UT;
+	else
+		thread->th_sched_bucket = TH_BUCKET_SHARE_BG;
+}
+
+static void
+sim_processors_init(void)
+{
+	int pset_ncpus = sim_ncpus;
+
+	/*
+	 * As in pset_create(), policies without multiple pset
+	 * support put every processor in pset0.
+	 */
+	if (sim_pset_ncpus != 0 && SCHED(multiple_psets_enabled))
+		pset_ncpus = sim_pset_ncpus;
+	sim_npsets = (sim_ncpus + pset_ncpus - 1) / pset_ncpus;
+
+	/*
+	 * pset0 is initialized by sched_init(); link the others after it.
+	 */
+	for (int i = 0; i < sim_npsets; i++) {
+		processor_set_t pset = (i == 0) ? &pset0 : &sim_psets[i];
+
+		if (i > 0) {
+			SCHED(pset_init)(pset);
+			((i == 1) ? &pset0 : &sim_psets[i - 1])->pset_list = pset;
+		}
+		queue_init(&pset->active_queue);
+		queue_init(&pset->idle_queue);
+		pset->cpu_set_low = i * pset_ncpus;
+		pset->cpu_set_hi = MIN(sim_ncpus, (i + 1) * pset_ncpus) - 1;
+		pset->cpu_set_count = pset->cpu_set_hi - pset->cpu_set_low + 1;
+		pset->online_processor_count = pset->cpu_set_count;
+	}
+
+	sim_task_init(&sim_kernel_task, "kernel_task");
+	kernel_task = &sim_kernel_task.task;
+
+	for (int i = sim_ncpus - 1; i >= 0; i--) {
+		processor_t processor = &sim_processors[i];
+		processor_set_t pset = (i < pset_ncpus) ? &pset0 : &sim_psets[i / pset_ncpus];
+		thread_t idle = &sim_idle_threads[i];
+
+		processor->cpu_id = i;
+		processor->processor_set = pset;
+		processor->state = PROCESSOR_IDLE;
+		processor->current_pri = IDLEPRI;
+		processor->processor_list = processor_list;
+		processor_list = processor;
+		enqueue_head(&pset->idle_queue, &processor->processor_queue);
+
+		sim_thread_init(idle, kernel_task, IDLEPRI);
+		idle->state = TH_RUN | TH_IDLE;
+		idle->bound_processor = processor;
+		idle->sim_name = "idle";
+		processor->idle_thread = processor->active_thread = idle;
+
+		SCHED(processor_init)(processor);
+	}
+	sim_current_processor = processor_list;
+}
+
+/*
+ * Workload traces are parsed before the policy is chosen; task groups
+ * are created once the policy is initialized.
+ */
+struct sim_trace_thread {
+	char			name[64];
+	char			task[64];
+	uint64_t		start_us;
+	int			pri;
+	uint64_t		run_us, block_us;
+	uint32_t		bursts;
+	int			cpu;
+};
+
+static struct sim_trace_thread sim_trace[SIM_MAX_THREADS];
+
+static void
+sim_trace_load(const char *path)
+{
+	char line[512];
+	FILE *f;
+	int lineno = 0;
+
+	if ((f = fopen(path, "r")) == NULL) {
+		fprintf(stderr, "sched_sim: %s: %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		struct sim_trace_thread *t = &sim_trace[sim_nthreads];
+		char *p;
+		int n;
+
+		lineno++;
+		if ((p = strchr(line, '#')) != NULL)
+			*p = '\0';
+		for (p = line; isspace((unsigned char)*p); p++)
+			;
+		if (*p == '\0')
+			continue;
+
+		if (sim_nthreads == SIM_MAX_THREADS) {
+			fprintf(stderr, "sched_sim: %s: more than %d threads\n", path, SIM_MAX_THREADS);
+			exit(EXIT_FAILURE);
+		}
+
+		t->cpu = -1;
+		n = sscanf(p, "%63s %63s %llu %d %llu %llu %u %d", t->name, t->task,
+		           (unsigned long long *)&t->start_us, &t->pri,
+		           (unsigned long long *)&t->run_us, (unsigned long long *)&t->block_us,
+		           &t->bursts, &t->cpu);
+		if (n < 7 || t->pri < MINPRI || t->pri > MAXPRI_KERNEL || t->run_us == 0 ||
+		    t->bursts == 0 || t->cpu >= sim_ncpus) {
+			fprintf(stderr, "sched_sim: %s:%d: malformed thread\n", path, lineno);
+			exit(EXIT_FAILURE);
+		}
+		sim_nthreads++;
+	}
+	fclose(f);
+
+	if (sim_nthreads == 0) {
+		fprintf(stderr, "sched_sim: %s: no threads\n", path);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void
+sim_threads_init(void)
+{
+	for (int i = 0; i < sim_nthreads; i++) {
+		struct sim_trace_thread *t = &sim_trace[i];
+		thread_t thread = &sim_threads[i];
+		task_t task = sim_task_lookup(t->task);
+
+		if (task->sched_group == SCHED_GROUP_NULL)
+			task->sched_group = sched_group_create();
+
+		sim_thread_init(thread, task, t->pri);
+		thread->sim_name = t->name;
+		thread->sim_run_ns = t->run_us * NSEC_PER_USEC;
+		thread->sim_block_ns = t->block_us * NSEC_PER_USEC;
+		thread->sim_bursts_left = t->bursts;
+		thread->state = TH_WAIT;
+		if (t->cpu >= 0)
+			thread->bound_processor = &sim_processors[t->cpu];
+
+		sim_event_post(t->start_us * NSEC_PER_USEC, SIM_EV_WAKEUP, thread, 0);
+	}
+}
+
+/*
+ *	Run and report.
+ */
+
+static void
+sim_report_task(const char *name, struct sim_task *task)
+{
+	struct sim_samples *s = &task->latency;
+
+	qsort(s->values, s->count, sizeof(s->values[0]), sim_sample_cmp);
+	printf("    %-16s %8llu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", name,
+	       (unsigned long long)task->bursts,
+	       sim_percentile(s, 50), sim_percentile(s, 90), sim_percentile(s, 99),
+	       sim_percentile(s, 100), (double)task->cpu_ns / NSEC_PER_MSEC,
+	       (double)task->wait_ns / NSEC_PER_MSEC);
+}
+
+static void
+sim_report(void)
+{
+	uint64_t busy = 0;
+	double elapsed = (double)sim_now / NSEC_PER_SEC;
+
+	for (int i = 0; i < sim_ncpus; i++)
+		busy += sim_processors[i].sim_busy_ns;
+	sim_total.cpu_ns = busy;
+
+	printf("%s: %d cpus in %d psets, %d threads, %s after %.6f s\n", SCHED(sched_name), sim_ncpus,
+	       sim_npsets,
+	       sim_nthreads, sim_threads_done == sim_nthreads ? "completed" : "stopped", elapsed);
+	printf("    throughput %.1f bursts/s, utilization %.1f%%\n",
+	       elapsed > 0 ? sim_total.bursts / elapsed : 0.0,
+	       sim_now ? 100.0 * busy / ((double)sim_now * sim_ncpus) : 0.0);
+	printf("    %llu context switches, %llu involuntary, %llu migrations\n",
+	       (unsigned long long)sim_context_switches, (unsigned long long)sim_involuntary,
+	       (unsigned long long)sim_migrations);
+	printf("    %llu cross-pset migrations, %llu of them cache hot (window %u us)\n",
+	       (unsigned long long)sim_pset_migrations, (unsigned long long)sim_cache_hot_migrations,
+	       sched_cache_hot_us);
+	printf("    %-16s %8s %9s %9s %9s %9s %9s %9s\n", "task", "bursts", "p50 us", "p90 us",
+	       "p99 us", "max us", "run ms", "wait ms");
+	sim_report_task("all", &sim_total);
+	for (int i = 0; i < sim_ntasks; i++)
+		sim_report_task(sim_tasks[i].task.sim_name, &sim_tasks[i]);
+}
+
+static void
+sim_run(const struct sched_dispatch_table *policy)
+{
+	struct sim_event ev;
+
+	sched_current_dispatch = policy;
+	sched_init();
+	sched_timebase_init();
+	sim_processors_init();
+	sim_threads_init();
+
+	while (sim_threads_done < sim_nthreads && sim_event_next(&ev)) {
+		if (ev.time > sim_time_limit)
+			break;
+		sim_now = ev.time;
+
+		switch (ev.type) {
+		case SIM_EV_WAKEUP:
+			sim_in_processor = FALSE;
+			sim_current_processor = processor_list;
+			sim_wakeup(ev.obj);
+			break;
+		case SIM_EV_TIMER:
+			if (ev.gen != ((processor_t)ev.obj)->sim_timer_gen)
+				break;
+			sim_in_processor = TRUE;
+			sim_current_processor = ev.obj;
+			sim_timer_expire(ev.obj);
+			break;
+		case SIM_EV_AST:
+			sim_in_processor = TRUE;
+			sim_current_processor = ev.obj;
+			sim_ast(ev.obj);
+			break;
+		}
+	}
+
+	sim_report();
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+	        "usage: sched_sim [-v] [-c ncpus] [-l pset_ncpus] [-i ipi_us] [-w cache_hot_us]\n"
+	        "                 [-t limit_s] [-p policy] trace\n"
+	        "policies:");
+	for (size_t i = 0; i < SIM_NPOLICIES; i++)
+		fprintf(stderr, " %s", sim_policies[i]->sched_name);
+	fprintf(stderr, "\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *policy = NULL;
+	int status = EXIT_SUCCESS;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "c:i:l:p:t:vw:")) != -1) {
+		switch (ch) {
+		case 'c':
+			sim_ncpus = atoi(optarg);
+			if (sim_ncpus < 1 || sim_ncpus > MAX_CPUS)
+				usage();
+			break;
+		case 'i':
+			sim_ipi_latency = strtoull(optarg, NULL, 0) * NSEC_PER_USEC;
+			break;
+		case 'l':
+			sim_pset_ncpus = atoi(optarg);
+			if (sim_pset_ncpus < 1 || sim_pset_ncpus > MAX_CPUS)
+				usage();
+			break;
+		case 'p':
+			policy = optarg;
+			break;
+		case 't':
+			sim_time_limit = strtoull(optarg, NULL, 0) * NSEC_PER_SEC;
+			break;
+		case 'v':
+			sim_verbose = 1;
+			break;
+		case 'w':
+			sched_cache_hot_us = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1)
+		usage();
+
+	sim_trace_load(argv[optind]);
+
+	for (size_t i = 0; i < SIM_NPOLICIES; i++) {
+		pid_t pid;
+
+		if (policy != NULL && strcmp(policy, sim_policies[i]->sched_name) != 0)
+			continue;
+
+		fflush(stdout);
+		if ((pid = fork()) == 0) {
+			sim_run(sim_policies[i]);
+			exit(EXIT_SUCCESS);
+		}
+		if (pid < 0 || waitpid(pid, &ch, 0) < 0 || !WIFEXITED(ch) || WEXITSTATUS(ch) != 0)
+			status = EXIT_FAILURE;
+		if (policy != NULL)
+			return (status);
+		printf("\n");
+	}
+
+	if (policy != NULL) {
+		fprintf(stderr, "sched_sim: unknown policy %s\n", policy);
+		usage();
+	}
+	return (status);
+}
@@ -0,0 +1,897 @@
+/*
+ * Copyright (c) 2017 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * The parts of osfmk/kern/sched_prim.c and priority.c that the scheduler
+ * policies call back into, for the user space scheduler simulator.
+ *
+ * Run queue maintenance, priority_is_urgent(), thread_setrun() and
+ * processor_setrun() follow the kernel line by line, less realtime
+ * threads, SMT, SFI and affinity sets, none of which are simulated.
+ * thread_select() and choose_processor() keep the kernel's structure
+ * with the same omissions.  Keep them in sync when changing the kernel
+ * versions.
+ *
+ * Timeshare priority decay is not modelled: a thread always runs at its
+ * base priority.
+ */
+
+#include <kern/processor.h>
+#include <kern/sched_prim.h>
+
+#include <limits.h>
+#include <stdarg.h>
+
+struct processor_set	pset0;
+processor_t		processor_list;
+struct task		*kernel_task;
+
+const struct sched_dispatch_table *sched_current_dispatch;
+
+#define		DEFAULT_PREEMPTION_RATE		100		/* (1/s) */
+int			default_preemption_rate = DEFAULT_PREEMPTION_RATE;
+
+#define		DEFAULT_BG_PREEMPTION_RATE	400		/* (1/s) */
+int			default_bg_preemption_rate = DEFAULT_BG_PREEMPTION_RATE;
+
+#define		MAX_UNSAFE_QUANTA			800
+int			max_unsafe_quanta = MAX_UNSAFE_QUANTA;
+
+uint64_t	max_unsafe_computation;
+uint64_t	sched_safe_duration;
+
+uint32_t	std_quantum;
+uint32_t	min_std_quantum;
+uint32_t	bg_quantum;
+
+uint32_t	std_quantum_us;
+uint32_t	bg_quantum_us;
+
+uint32_t	thread_depress_time;
+uint32_t	default_timeshare_computation;
+uint32_t	default_timeshare_constraint;
+
+unsigned	sched_tick;
+uint64_t	sched_one_second_interval;
+
+#define SCHED_CACHE_HOT_US_DEFAULT	500
+uint32_t	sched_cache_hot_us = SCHED_CACHE_HOT_US_DEFAULT;
+uint64_t	sched_cache_hot_window;
+
+boolean_t	sched_stats_active;
+
+bitmap_t	sched_preempt_pri[BITMAP_LEN(NRQS)];
+
+/*
+ *	Kernel services used by the policies.
+ */
+
+void
+clock_interval_to_absolutetime_interval(
+	uint32_t		interval,
+	uint32_t		scale_factor,
+	uint64_t		*result)
+{
+	/* The simulated timebase is 1ns */
+	*result = (uint64_t)interval * scale_factor;
+}
+
+struct zone {
+	size_t			elem_size;
+	const char		*name;
+};
+
+zone_t
+zinit(size_t size, __unused size_t max, __unused size_t alloc, const char *name)
+{
+	zone_t zone = malloc(sizeof(*zone));
+
+	if (zone == NULL)
+		panic("zinit: %s", name);
+	zone->elem_size = size;
+	zone->name = name;
+	return (zone);
+}
+
+void *
+zalloc(zone_t zone)
+{
+	void *elem = calloc(1, zone->elem_size);
+
+	if (elem == NULL)
+		panic("zalloc: %s", zone->name);
+	return (elem);
+}
+
+void
+zfree(__unused zone_t zone, void *elem)
+{
+	free(elem);
+}
+
+/*
+ * The maintenance continuations block on a deadline and never return,
+ * so the simulator never calls them.
+ */
+
+void
+clock_deadline_for_periodic_event(
+	__unused uint64_t	interval,
+	__unused uint64_t	abstime,
+	__unused uint64_t	*deadline)
+{
+	panic("clock_deadline_for_periodic_event: not simulated");
+}
+
+wait_result_t
+assert_wait_deadline(
+	__unused event_t	event,
+	__unused wait_interrupt_t interruptible,
+	__unused uint64_t	deadline)
+{
+	panic("assert_wait_deadline: not simulated");
+}
+
+wait_result_t
+thread_block(__unused thread_continue_t continuation)
+{
+	panic("thread_block: not simulated");
+}
+
+void
+compute_averages(__unused uint64_t stdelta)
+{
+}
+
+void
+sched_timeshare_maintenance_continue(void)
+{
+	panic("sched_timeshare_maintenance_continue: not simulated");
+}
+
+/*
+ *	Timeshare core.
+ */
+
+static void
+preempt_pri_init(void)
+{
+	bitmap_t *p = sched_preempt_pri;
+
+	for (int i = BASEPRI_FOREGROUND; i < MINPRI_KERNEL; ++i)
+		bitmap_set(p, i);
+
+	for (int i = BASEPRI_PREEMPT; i <= MAXPRI; ++i)
+		bitmap_set(p, i);
+}
+
+void
+sched_timeshare_init(void)
+{
+	/*
+	 * Calculate the timeslicing quantum
+	 * in us.
+	 */
+	if (default_preemption_rate < 1)
+		default_preemption_rate = DEFAULT_PREEMPTION_RATE;
+	std_quantum_us = (1000 * 1000) / default_preemption_rate;
+
+	printf("standard timeslicing quantum is %d us\n", std_quantum_us);
+
+	if (default_bg_preemption_rate < 1)
+		default_bg_preemption_rate = DEFAULT_BG_PREEMPTION_RATE;
+	bg_quantum_us = (1000 * 1000) / default_bg_preemption_rate;
+
+	printf("standard background quantum is %d us\n", bg_quantum_us);
+
+	preempt_pri_init();
+	sched_tick = 0;
+}
+
+void
+sched_timeshare_timebase_init(void)
+{
+	uint64_t	abstime;
+
+	/* standard timeslicing quantum */
+	clock_interval_to_absolutetime_interval(
+							std_quantum_us, NSEC_PER_USEC, &abstime);
+	std_quantum = (uint32_t)abstime;
+
+	/* smallest remaining quantum (250 us) */
+	clock_interval_to_absolutetime_interval(250, NSEC_PER_USEC, &abstime);
+	min_std_quantum = (uint32_t)abstime;
+
+	/* quantum for background tasks */
+	clock_interval_to_absolutetime_interval(
+							bg_quantum_us, NSEC_PER_USEC, &abstime);
+	bg_quantum = (uint32_t)abstime;
+
+	max_unsafe_computation = ((uint64_t)max_unsafe_quanta) * std_quantum;
+	sched_safe_duration = 2 * ((uint64_t)max_unsafe_quanta) * std_quantum;
+
+	thread_depress_time = 1 * std_quantum;
+	default_timeshare_computation = std_quantum / 2;
+	default_timeshare_constraint = std_quantum;
+}
+
+uint32_t
+sched_timeshare_initial_quantum_size(thread_t thread)
+{
+	if ((thread != THREAD_NULL) && thread->th_sched_bucket == TH_BUCKET_SHARE_BG)
+		return bg_quantum;
+	else
+		return std_quantum;
+}
+
+int
+sched_compute_timeshare_priority(thread_t thread)
+{
+	return (thread->base_pri);
+}
+
+boolean_t
+can_update_priority(thread_t thread)
+{
+	return (sched_tick != thread->sched_stamp);
+}
+
+void
+update_priority(thread_t thread)
+{
+	thread->sched_stamp = sched_tick;
+}
+
+void
+lightweight_update_priority(__unused thread_t thread)
+{
+}
+
+void
+sched_default_quantum_expire(__unused thread_t thread)
+{
+}
+
+boolean_t
+priority_is_urgent(int priority)
+{
+	return bitmap_test(sched_preempt_pri, priority) ? TRUE : FALSE;
+}
+
+/*
+ * The thread update scan only matters for decay, which is not modelled.
+ */
+
+boolean_t
+thread_update_add_thread(__unused thread_t thread)
+{
+	return (FALSE);
+}
+
+void
+thread_update_process_threads(void)
+{
+}
+
+boolean_t
+runq_scan(
+	__unused run_queue_t			runq,
+	__unused sched_update_scan_context_t	scan_context)
+{
+	return (FALSE);
+}
+
+boolean_t
+runq_scan_queue(
+	__unused queue_t			queue,
+	__unused sched_update_scan_context_t	scan_context)
+{
+	return (FALSE);
+}
+
+static uint32_t
+sched_stats_decay_shift(uint64_t decay_deadline, uint64_t timestamp)
+{
+	uint64_t period = RUNQ_STATS_DECAY_SECS * sched_one_second_interval;
+	uint64_t periods;
+
+	if (timestamp < decay_deadline)
+		return 0;
+
+	periods = 1 + (timestamp - decay_deadline) / period;
+	return (periods > 64) ? 64 : (uint32_t)periods;
+}
+
+void
+sched_stats_decayed_hist(uint64_t *hist, int nbuckets, uint64_t decay_deadline, uint64_t *out)
+{
+	uint32_t shift = sched_stats_decay_shift(decay_deadline, mach_absolute_time());
+
+	if (shift >= 64)
+		return;
+
+	for (int i = 0; i < nbuckets; i++)
+		out[i] += hist[i] >> shift;
+}
+
+void
+sched_stats_handle_runq_change(struct runq_stats *stats, int old_count)
+{
+	uint64_t timestamp = mach_absolute_time();
+	uint64_t delta = 0;
+	int bucket = 0;
+
+	/* nothing is known about the queue before its first change */
+	if (stats->last_change_timestamp != 0)
+		delta = timestamp - stats->last_change_timestamp;
+
+	if (old_count > 0)
+		bucket = MIN(bit_first((uint64_t)old_count) + 1, RUNQ_STATS_DEPTH_BUCKETS - 1);
+
+	stats->count_sum += delta * old_count;
+	stats->depth_time[bucket] += delta;
+	stats->last_change_timestamp = timestamp;
+
+	if (timestamp >= stats->decay_deadline) {
+		uint32_t shift = sched_stats_decay_shift(stats->decay_deadline, timestamp);
+
+		for (int i = 0; i < RUNQ_STATS_DEPTH_BUCKETS; i++)
+			stats->depth_time[i] = (shift >= 64) ? 0 : (stats->depth_time[i] >> shift);
+		stats->decay_deadline = timestamp + RUNQ_STATS_DECAY_SECS * sched_one_second_interval;
+	}
+}
+
+void
+sched_stats_runq_depth(struct runq_stats *stats, uint64_t *depth_time)
+{
+	sched_stats_decayed_hist(stats->depth_time, RUNQ_STATS_DEPTH_BUCKETS, stats->decay_deadline, depth_time);
+}
+
+/*
+ *	Run queues.
+ */
+
+void
+run_queue_init(
+	run_queue_t		rq)
+{
+	rq->highq = NOPRI;
+	for (u_int i = 0; i < BITMAP_LEN(NRQS); i++)
+		rq->bitmap[i] = 0;
+	rq->urgency = rq->count = 0;
+	for (int i = 0; i < NRQS; i++)
+		queue_init(&rq->queues[i]);
+}
+
+thread_t
+run_queue_dequeue(
+                  run_queue_t   rq,
+                  integer_t     options)
+{
+	thread_t    thread;
+	queue_t     queue = &rq->queues[rq->highq];
+
+	if (options & SCHED_HEADQ) {
+		thread = qe_dequeue_head(queue, struct thread, runq_links);
+	} else {
+		thread = qe_dequeue_tail(queue, struct thread, runq_links);
+	}
+
+	assert(thread != THREAD_NULL);
+
+	thread->runq = PROCESSOR_NULL;
+	SCHED_STATS_RUNQ_CHANGE(&rq->runq_stats, rq->count);
+	rq->count--;
+	if (SCHED(priority_is_urgent)(rq->highq)) {
+		rq->urgency--; assert(rq->urgency >= 0);
+	}
+	if (queue_empty(queue)) {
+		bitmap_clear(rq->bitmap, rq->highq);
+		rq->highq = bitmap_first(rq->bitmap, NRQS);
+	}
+
+	return thread;
+}
+
+boolean_t
+run_queue_enqueue(
+                  run_queue_t   rq,
+                  thread_t      thread,
+                  integer_t     options)
+{
+	queue_t     queue = &rq->queues[thread->sched_pri];
+	boolean_t   result = FALSE;
+
+	if (queue_empty(queue)) {
+		enqueue_tail(queue, &thread->runq_links);
+
+		rq_bitmap_set(rq->bitmap, thread->sched_pri);
+		if (thread->sched_pri > rq->highq) {
+			rq->highq = thread->sched_pri;
+			result = TRUE;
+		}
+	} else {
+		if (options & SCHED_TAILQ)
+			enqueue_tail(queue, &thread->runq_links);
+		else
+			enqueue_head(queue, &thread->runq_links);
+	}
+	if (SCHED(priority_is_urgent)(thread->sched_pri))
+		rq->urgency++;
+	SCHED_STATS_RUNQ_CHANGE(&rq->runq_stats, rq->count);
+	rq->count++;
+
+	return (result);
+}
+
+void
+run_queue_remove(
+                 run_queue_t    rq,
+                 thread_t       thread)
+{
+	assert(thread->runq != PROCESSOR_NULL);
+
+	remqueue(&thread->runq_links);
+	SCHED_STATS_RUNQ_CHANGE(&rq->runq_stats, rq->count);
+	rq->count--;
+	if (SCHED(priority_is_urgent)(thread->sched_pri)) {
+		rq->urgency--; assert(rq->urgency >= 0);
+	}
+
+	if (queue_empty(&rq->queues[thread->sched_pri])) {
+		/* update run queue status */
+		bitmap_clear(rq->bitmap, thread->sched_pri);
+		rq->highq = bitmap_first(rq->bitmap, NRQS);
+	}
+
+	thread->runq = PROCESSOR_NULL;
+}
+
+/*
+ *	Initialization.
+ */
+
+void
+sched_init(void)
+{
+	SCHED(init)();
+	SCHED(pset_init)(&pset0);
+}
+
+void
+sched_timebase_init(void)
+{
+	uint64_t	abstime;
+
+	clock_interval_to_absolutetime_interval(1, NSEC_PER_SEC, &abstime);
+	sched_one_second_interval = abstime;
+
+	sched_cache_hot_window_init();
+
+	SCHED(timebase_init)();
+}
+
+void
+sched_cache_hot_window_init(void)
+{
+	uint64_t	abstime;
+
+	clock_interval_to_absolutetime_interval(sched_cache_hot_us, NSEC_PER_USEC, &abstime);
+	sched_cache_hot_window = abstime;
+}
+
+static inline boolean_t
+sched_thread_cache_hot(
+	thread_t	thread,
+	uint64_t	now)
+{
+	return (thread->last_run_time + sched_cache_hot_window > now);
+}
+
+processor_set_t
+next_pset(processor_set_t pset)
+{
+	return (pset->pset_list != PROCESSOR_SET_NULL) ? pset->pset_list : &pset0;
+}
+
+/*
+ *	Dispatch.
+ */
+
+/*
+ *	processor_setrun:
+ *
+ *	Dispatch a thread for execution on a
+ *	processor.
+ */
+static void
+processor_setrun(
+	processor_t			processor,
+	thread_t			thread,
+	integer_t			options)
+{
+	processor_set_t		pset = processor->processor_set;
+	ast_t				preempt;
+	enum { eExitIdle, eInterruptRunning, eDoNothing } ipi_action = eDoNothing;
+
+	thread->chosen_processor = processor;
+
+	/*
+	 *	Dispatch directly onto idle processor.
+	 */
+	if ( (SCHED(direct_dispatch_to_idle_processors) ||
+		  thread->bound_processor == processor)
+		&& processor->state == PROCESSOR_IDLE) {
+
+		re_queue_tail(&pset->active_queue, &processor->processor_queue);
+
+		processor->next_thread = thread;
+		processor->current_pri = thread->sched_pri;
+		processor->current_thmode = thread->sched_mode;
+		processor->state = PROCESSOR_DISPATCHING;
+
+		if (!(pset->pending_AST_cpu_mask & (1ULL << processor->cpu_id))) {
+			pset->pending_AST_cpu_mask |= (1ULL << processor->cpu_id);
+			sim_processor_signal(processor);
+		}
+		return;
+	}
+
+	/*
+	 *	Set preemption mode.
+	 */
+	if (SCHED(priority_is_urgent)(thread->sched_pri) && thread->sched_pri > processor->current_pri)
+		preempt = (AST_PREEMPT | AST_URGENT);
+	else if ((thread->sched_mode == TH_MODE_TIMESHARE) && (thread->sched_pri < thread->base_pri)) {
+		if(SCHED(priority_is_urgent)(thread->base_pri) && thread->sched_pri > processor->current_pri) {
+			preempt = (options & SCHED_PREEMPT)? AST_PREEMPT: AST_NONE;
+		} else {
+			preempt = AST_NONE;
+		}
+	} else
+		preempt = (options & SCHED_PREEMPT)? AST_PREEMPT: AST_NONE;
+
+	SCHED(processor_enqueue)(processor, thread, options);
+
+	if (preempt != AST_NONE) {
+		if (processor->state == PROCESSOR_IDLE) {
+			re_queue_tail(&pset->active_queue, &processor->processor_queue);
+
+			processor->next_thread = THREAD_NULL;
+			processor->current_pri = thread->sched_pri;
+			processor->current_thmode = thread->sched_mode;
+			processor->state = PROCESSOR_DISPATCHING;
+
+			ipi_action = eExitIdle;
+		} else if ( processor->state == PROCESSOR_DISPATCHING) {
+			if ((processor->next_thread == THREAD_NULL) && (processor->current_pri < thread->sched_pri)) {
+				processor->current_pri = thread->sched_pri;
+				processor->current_thmode = thread->sched_mode;
+			}
+		} else if (processor->state == PROCESSOR_RUNNING &&
+				(thread->sched_pri >= processor->current_pri)) {
+			ipi_action = eInterruptRunning;
+		}
+	} else {
+		/*
+		 * New thread is not important enough to preempt what is running, but
+		 * special processor states may need special handling
+		 */
+		if (processor->state == PROCESSOR_IDLE) {
+			re_queue_tail(&pset->active_queue, &processor->processor_queue);
+
+			processor->next_thread = THREAD_NULL;
+			processor->current_pri = thread->sched_pri;
+			processor->current_thmode = thread->sched_mode;
+			processor->state = PROCESSOR_DISPATCHING;
+
+			ipi_action = eExitIdle;
+		}
+	}
+
+	/*
+	 * The kernel checks the current processor in place and signals any
+	 * other; the event loop delivers both, the local one without the
+	 * interprocessor interrupt latency.
+	 */
+	if (ipi_action != eDoNothing &&
+	    !(pset->pending_AST_cpu_mask & (1ULL << processor->cpu_id))) {
+		pset->pending_AST_cpu_mask |= (1ULL << processor->cpu_id);
+		sim_processor_signal(processor);
+	}
+}
+
+/*
+ *	choose_processor:
+ *
+ *	Choose a processor for the thread, beginning at
+ *	the pset.  Accepts an optional processor hint in
+ *	the pset.
+ *
+ *	Returns a processor, possibly from a different pset.
+ */
+processor_t
+choose_processor(
+	processor_set_t		pset,
+	processor_t			processor,
+	thread_t			thread)
+{
+	processor_set_t		nset, cset = pset;
+	boolean_t			cache_hot = FALSE;
+
+	/*
+	 * A timeshare thread that ran on its last processor within
+	 * the cache hot window prefers that processor and its set.
+	 */
+	if (processor != PROCESSOR_NULL && processor == thread->last_processor &&
+	    thread->sched_mode == TH_MODE_TIMESHARE)
+		cache_hot = sched_thread_cache_hot(thread, mach_approximate_time());
+
+	/*
+	 * Discard a hint for a processor that cannot
+	 * run new threads.
+	 */
+	if (processor != PROCESSOR_NULL) {
+		if (processor->processor_set != pset) {
+			processor = PROCESSOR_NULL;
+		} else {
+			switch (processor->state) {
+				case PROCESSOR_START:
+				case PROCESSOR_SHUTDOWN:
+				case PROCESSOR_OFF_LINE:
+					processor = PROCESSOR_NULL;
+					break;
+				case PROCESSOR_IDLE:
+					return (processor);
+				case PROCESSOR_RUNNING:
+				case PROCESSOR_DISPATCHING:
+					break;
+				default:
+					processor = PROCESSOR_NULL;
+					break;
+			}
+		}
+	}
+
+	integer_t lowest_priority = MAXPRI + 1;
+	integer_t lowest_count = INT_MAX;
+	processor_t lp_processor = PROCESSOR_NULL;
+	processor_t lc_processor = PROCESSOR_NULL;
+	processor_t hot_processor = PROCESSOR_NULL;
+
+	if (processor != PROCESSOR_NULL) {
+		lowest_priority = processor->current_pri;
+		lp_processor = processor;
+
+		lowest_count = SCHED(processor_runq_count)(processor);
+		lc_processor = processor;
+	}
+
+	do {
+		/*
+		 * Choose an idle processor, in pset traversal order
+		 */
+		qe_foreach_element(processor, &cset->idle_queue, processor_queue) {
+			return processor;
+		}
+
+		/*
+		 * Otherwise, enumerate active processors to find candidates
+		 * with lower priority/etc.
+		 */
+		qe_foreach_element(processor, &cset->active_queue, processor_queue) {
+			integer_t cpri = processor->current_pri;
+			if (cpri < lowest_priority) {
+				lowest_priority = cpri;
+				lp_processor = processor;
+			}
+
+			integer_t ccount = SCHED(processor_runq_count)(processor);
+			if (ccount < lowest_count) {
+				lowest_count = ccount;
+				lc_processor = processor;
+			}
+		}
+
+		if (thread->sched_pri > lowest_priority) {
+			/* Move to end of active queue so that the next thread doesn't also pick it */
+			re_queue_tail(&cset->active_queue, &lp_processor->processor_queue);
+			return lp_processor;
+		}
+
+		/*
+		 * A cache-hot thread that would preempt nothing queues
+		 * within its last processor set.
+		 */
+		if (cache_hot && cset == pset)
+			hot_processor = lc_processor;
+
+		/*
+		 * Move onto the next processor set.
+		 */
+		nset = next_pset(cset);
+		if (nset != pset)
+			cset = nset;
+	} while (nset != pset);
+
+	/*
+	 * All processors are running a higher priority
+	 * thread; enqueue on the least busy one.
+	 */
+	if (hot_processor != PROCESSOR_NULL)
+		return hot_processor;
+	return (lc_processor != PROCESSOR_NULL) ? lc_processor : processor_list;
+}
+
+/*
+ *	thread_setrun:
+ *
+ *	Dispatch thread for execution, onto an idle
+ *	processor or run queue, and signal a preemption
+ *	as appropriate.
+ */
+void
+thread_setrun(
+	thread_t			thread,
+	integer_t			options)
+{
+	processor_t			processor;
+	processor_set_t		pset;
+
+	assert((thread->state & (TH_RUN|TH_WAIT|TH_TERMINATE)) == TH_RUN);
+	assert(thread->runq == PROCESSOR_NULL);
+
+	/*
+	 *	Update priority if needed.
+	 */
+	if (SCHED(can_update_priority)(thread))
+		SCHED(update_priority)(thread);
+
+	if (thread->bound_processor == PROCESSOR_NULL) {
+		if (thread->last_processor != PROCESSOR_NULL) {
+			/*
+			 *	Simple (last processor) affinity case.
+			 */
+			processor = thread->last_processor;
+			pset = processor->processor_set;
+			processor = SCHED(choose_processor)(pset, processor, thread);
+		} else {
+			/*
+			 *	No Affinity case.
+			 */
+			pset = current_processor()->processor_set;
+			processor = SCHED(choose_processor)(pset, PROCESSOR_NULL, thread);
+		}
+	} else {
+		/*
+		 *	Bound case:
+		 *
+		 *	Unconditionally dispatch on the processor.
+		 */
+		processor = thread->bound_processor;
+	}
+
+	processor_setrun(processor, thread, options);
+}
+
+/*
+ *	thread_select:
+ *
+ *	Select a new thread for the current processor to execute.
+ */
+thread_t
+thread_select(
+	thread_t			thread,
+	processor_t			processor,
+	ast_t				reason)
+{
+	processor_set_t		pset = processor->processor_set;
+	thread_t			new_thread = THREAD_NULL;
+
+	assert(processor == current_processor());
+
+	do {
+		/*
+		 *	Update the priority.
+		 */
+		if (!(thread->state & TH_IDLE)) {
+			if (SCHED(can_update_priority)(thread))
+				SCHED(update_priority)(thread);
+
+			processor->current_pri = thread->sched_pri;
+			processor->current_thmode = thread->sched_mode;
+		}
+
+		/*
+		 *	Test to see if the current thread should continue
+		 *	to run on this processor.  Must not be attempting to wait, and not
+		 *	bound to a different processor.
+		 */
+		if (((thread->state & (TH_TERMINATE|TH_IDLE|TH_WAIT|TH_RUN)) == TH_RUN) &&
+		    (thread->bound_processor == PROCESSOR_NULL || thread->bound_processor == processor)) {
+			if (SCHED(processor_queue_has_priority)(processor, thread->sched_pri, TRUE) == FALSE) {
+				/* This thread is still the highest priority runnable (non-idle) thread */
+				return (thread);
+			}
+		}
+
+		if ((new_thread = SCHED(choose_thread)(processor, MINPRI, reason)) != THREAD_NULL)
+			return (new_thread);
+
+		if (SCHED(steal_thread_enabled)) {
+			/*
+			 * No runnable threads, attempt to steal
+			 * from other processors.
+			 */
+			if ((new_thread = SCHED(steal_thread)(pset)) != THREAD_NULL)
+				return (new_thread);
+
+			/*
+			 * If other threads have appeared, shortcut
+			 * around again.
+			 */
+			if (!SCHED(processor_queue_empty)(processor))
+				continue;
+		}
+
+		/*
+		 *	Nothing is runnable, so set this processor idle if it
+		 *	was running.
+		 */
+		if (processor->state == PROCESSOR_RUNNING) {
+			processor->state = PROCESSOR_IDLE;
+			re_queue_head(&pset->idle_queue, &processor->processor_queue);
+		}
+
+		new_thread = processor->idle_thread;
+	} while (new_thread == THREAD_NULL);
+
+	return (new_thread);
+}
+
+/*
+ *	Check for a preemption point in
+ *	the current context.
+ */
+ast_t
+csw_check(
+	processor_t		processor,
+	ast_t			check_reason)
+{
+	processor_set_t	pset = processor->processor_set;
+	ast_t			result;
+
+	/* If we were sent a remote AST and interrupted a running processor, acknowledge it here */
+	pset->pending_AST_cpu_mask &= ~(1ULL << processor->cpu_id);
+
+	result = SCHED(processor_csw_check)(processor);
+	if (result != AST_NONE)
+		return (check_reason | result);
+
+	return (AST_NONE);
+}
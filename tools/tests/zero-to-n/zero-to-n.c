@@ -37,6 +37,8 @@
 #include <assert.h>
 #include <sysexits.h>
 #include <sys/sysctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include <getopt.h>
 
 #include <spawn.h>
@@ -102,6 +104,20 @@ static boolean_t                g_churn_stop = FALSE;
 
 static pthread_t*               g_churn_threads = NULL;
 
+/*
+ * Churn threads spread over this many child tasks, each with its own
+ * scheduler group, to load the run queue with many groups' entries.
+ */
+static uint32_t                 g_churn_tasks = 0;
+static pid_t*                   g_churn_pids = NULL;
+
+/* Start time and stop flag, shared with the churn tasks */
+struct churn_task_state {
+	volatile uint64_t       starttime_abs;
+	volatile boolean_t      stop;
+};
+static struct churn_task_state *g_churn_task_state = NULL;
+
 /* Threshold for dropping a 'bad run' tracepoint */
 static uint64_t                 g_traceworthy_latency_ns = TRACEWORTHY_NANOS;
 
@@ -181,8 +197,20 @@ churn_thread(__unused void *arg)
 	return NULL;
 }
 
+static void *
+churn_task_thread(__unused void *arg)
+{
+	/* Same safety measure as churn_thread, against the shared start time */
+	while (g_churn_task_state->stop == FALSE &&
+	       mach_absolute_time() < (g_churn_task_state->starttime_abs + NSEC_PER_SEC)) {
+		yield();
+	}
+
+	return NULL;
+}
+
 static void
-create_churn_threads()
+create_churn_threads(void *(*start_routine)(void *))
 {
 	if (g_churn_count == 0)
 		g_churn_count = g_numcpus - 1;
@@ -208,7 +236,7 @@ create_churn_threads()
 	for (uint32_t i = 0 ; i < g_churn_count ; i++) {
 		pthread_t new_thread;
 
-		if ((err = pthread_create(&new_thread, &attr, churn_thread, NULL)))
+		if ((err = pthread_create(&new_thread, &attr, start_routine, NULL)))
 			errc(EX_OSERR, err, "pthread_create");
 		g_churn_threads[i] = new_thread;
 	}
@@ -217,6 +245,63 @@ create_churn_threads()
 		errc(EX_OSERR, err, "pthread_attr_destroy");
 }
 
+/*
+ * Fork the churn tasks, splitting g_churn_count threads between them.
+ */
+static void
+create_churn_tasks(void)
+{
+	if (g_churn_count == 0)
+		g_churn_count = g_numcpus - 1;
+
+	uint32_t threads_per_task = g_churn_count / g_churn_tasks;
+	if (threads_per_task == 0)
+		threads_per_task = 1;
+
+	g_churn_task_state = mmap(NULL, sizeof(*g_churn_task_state), PROT_READ | PROT_WRITE,
+	                          MAP_ANON | MAP_SHARED, -1, 0);
+	if (g_churn_task_state == MAP_FAILED)
+		err(EX_OSERR, "mmap churn task state");
+	g_churn_task_state->starttime_abs = g_starttime_abs;
+	g_churn_task_state->stop = FALSE;
+
+	g_churn_pids = (pid_t*) valloc(sizeof(pid_t) * g_churn_tasks);
+	assert(g_churn_pids);
+
+	for (uint32_t i = 0; i < g_churn_tasks; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0)
+			err(EX_OSERR, "fork churn task %d", i);
+
+		if (pid == 0) {
+			g_churn_count = threads_per_task;
+			create_churn_threads(churn_task_thread);
+			for (uint32_t j = 0; j < g_churn_count; j++)
+				pthread_join(g_churn_threads[j], NULL);
+			_exit(0);
+		}
+
+		g_churn_pids[i] = pid;
+	}
+}
+
+static void
+join_churn_tasks(void)
+{
+	g_churn_task_state->stop = TRUE;
+
+	for (uint32_t i = 0; i < g_churn_tasks; i++) {
+		int status;
+
+		if (waitpid(g_churn_pids[i], &status, 0) < 0)
+			err(EX_OSERR, "waitpid churn task %d", i);
+	}
+
+	free(g_churn_pids);
+	munmap((void *)g_churn_task_state, sizeof(*g_churn_task_state));
+}
+
 static void
 join_churn_threads(void)
 {
@@ -687,8 +772,10 @@ main(int argc, char **argv)
 
 	g_starttime_abs = mach_absolute_time();
 
-	if (g_churn_pri)
-		create_churn_threads();
+	if (g_churn_pri && g_churn_tasks)
+		create_churn_tasks();
+	else if (g_churn_pri)
+		create_churn_threads(churn_thread);
 
 	/* Let everyone get settled */
 	kr = semaphore_wait(g_main_sem);
@@ -712,6 +799,8 @@ main(int argc, char **argv)
 		OSMemoryBarrier();
 
 		g_starttime_abs = mach_absolute_time();
+		if (g_churn_task_state)
+			g_churn_task_state->starttime_abs = g_starttime_abs;
 
 		/* Fire them off and wait for worker threads to finish */
 		kr = semaphore_wait_signal(g_main_sem, g_leadersem);
@@ -765,7 +854,9 @@ main(int argc, char **argv)
 		if (ret) errc(EX_OSERR, ret, "pthread_join %d", i);
 	}
 
-	if (g_churn_pri)
+	if (g_churn_pri && g_churn_tasks)
+		join_churn_tasks();
+	else if (g_churn_pri)
 		join_churn_threads();
 
 	compute_stats(worst_latencies_ns, g_iterations, &avg, &max, &min, &stddev);
@@ -847,7 +938,7 @@ usage()
 	     "<realtime | timeshare | fixed> <iterations>\n\t\t"
 	     "[--trace <traceworthy latency in ns>] "
 	     "[--verbose] [--spin-one] [--spin-all] [--spin-time <nanos>] [--affinity]\n\t\t"
-	     "[--no-sleep] [--drop-priority] [--churn-pri <pri>] [--churn-count <n>]",
+	     "[--no-sleep] [--drop-priority] [--churn-pri <pri>] [--churn-count <n>] [--churn-tasks <n>]",
 	     getprogname());
 }
 
@@ -879,6 +970,7 @@ parse_args(int argc, char *argv[])
 		OPT_PRIORITY,
 		OPT_CHURN_PRI,
 		OPT_CHURN_COUNT,
+		OPT_CHURN_TASKS,
 	};
 
 	static struct option longopts[] = {
@@ -887,6 +979,7 @@ parse_args(int argc, char *argv[])
 		{ "priority",           required_argument,      NULL,                           OPT_PRIORITY  },
 		{ "churn-pri",          required_argument,      NULL,                           OPT_CHURN_PRI },
 		{ "churn-count",        required_argument,      NULL,                           OPT_CHURN_COUNT },
+		{ "churn-tasks",        required_argument,      NULL,                           OPT_CHURN_TASKS },
 		{ "switched_apptype",   no_argument,            (int*)&g_seen_apptype,          TRUE },
 		{ "spin-one",           no_argument,            (int*)&g_do_one_long_spin,      TRUE },
 		{ "spin-all",           no_argument,            (int*)&g_do_all_spin,           TRUE },
@@ -922,6 +1015,9 @@ parse_args(int argc, char *argv[])
 		case OPT_CHURN_COUNT:
 			g_churn_count = read_dec_arg();
 			break;
+		case OPT_CHURN_TASKS:
+			g_churn_tasks = read_dec_arg();
+			break;
 		case '?':
 		case 'h':
 		default: